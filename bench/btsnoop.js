@@ -0,0 +1,121 @@
+// btsnoop.js
+
+const fs = require("node:fs");
+
+// btsnoop file format (RFC 1761 style, big endian)
+// uint8_t identification[8] = "btsnoop\0"
+// uint32_t version = 1
+// uint32_t datalink: 1001 (HCI un-encapsulated), 1002 (HCI UART / H4) or
+//  2001 (Linux monitor, btmon -w)
+// Records:
+//  uint32_t original_length
+//  uint32_t included_length
+//  uint32_t flags: bit 0 received (controller to host), bit 1 command / event
+//   (monitor: controller index << 16 | opcode)
+//  uint32_t cumulative_drops
+//  int64_t timestamp (usec since 0000-01-01)
+//  uint8_t data[included_length]
+const BTSNOOP_MAGIC = Buffer.from("btsnoop\0", "latin1");
+const BTSNOOP_VERSION = 1;
+const BTSNOOP_HCI_UNENCAP = 1001;
+const BTSNOOP_HCI_UART = 1002;
+const BTSNOOP_MONITOR = 2001;
+const BTSNOOP_FLAG_RECEIVED = 0x01;
+const BTSNOOP_FLAG_COMMAND_EVENT = 0x02;
+const BTSNOOP_EPOCH_DELTA = 0x00dcddb30f2f8000n; // usec from 0000-01-01 to 1970-01-01
+
+const HCI_COMMAND_PKT = 0x01;
+const HCI_ACLDATA_PKT = 0x02;
+const HCI_EVENT_PKT = 0x04;
+
+// Monitor opcodes: [packet type, received]
+const monitorOpcodes = {
+  2: [HCI_COMMAND_PKT, false],
+  3: [HCI_EVENT_PKT, true],
+  4: [HCI_ACLDATA_PKT, false],
+  5: [HCI_ACLDATA_PKT, true],
+};
+
+// Returns [{ received, timestamp (usec since epoch), packet (H4 framed) }]
+function readBtsnoop(path) {
+  const file = fs.readFileSync(path);
+  if (file.length < 16 || !file.subarray(0, 8).equals(BTSNOOP_MAGIC)) {
+    throw new Error(`${path}: not a btsnoop file`);
+  }
+  const datalink = file.readUInt32BE(12);
+  if (
+    datalink !== BTSNOOP_HCI_UNENCAP &&
+    datalink !== BTSNOOP_HCI_UART &&
+    datalink !== BTSNOOP_MONITOR
+  ) {
+    throw new Error(`${path}: unsupported datalink ${datalink}`);
+  }
+
+  const records = [];
+  for (let offset = 16; offset + 24 <= file.length; ) {
+    const length = file.readUInt32BE(offset + 4);
+    const flags = file.readUInt32BE(offset + 8);
+    const timestamp = file.readBigInt64BE(offset + 16) - BTSNOOP_EPOCH_DELTA;
+    offset += 24;
+    if (offset + length > file.length) break; // Truncated capture
+    let packet = file.subarray(offset, offset + length);
+    offset += length;
+    let received = !!(flags & BTSNOOP_FLAG_RECEIVED);
+    if (datalink === BTSNOOP_MONITOR) {
+      // Skip index / system notes, SCO and ISO
+      const opcode = monitorOpcodes[flags & 0xffff];
+      if (!opcode) continue;
+      packet = Buffer.concat([Buffer.from([opcode[0]]), packet]);
+      received = opcode[1];
+    } else if (datalink === BTSNOOP_HCI_UNENCAP) {
+      // Packet type is implied by the flags
+      const type =
+        flags & BTSNOOP_FLAG_COMMAND_EVENT
+          ? received
+            ? HCI_EVENT_PKT
+            : HCI_COMMAND_PKT
+          : HCI_ACLDATA_PKT;
+      packet = Buffer.concat([Buffer.from([type]), packet]);
+    }
+    records.push({
+      received,
+      timestamp: Number(timestamp),
+      packet,
+    });
+  }
+  return records;
+}
+
+// Writes [{ received, timestamp, packet (H4 framed) }] as an H4 capture
+function writeBtsnoop(path, records) {
+  const header = Buffer.alloc(16);
+  BTSNOOP_MAGIC.copy(header, 0);
+  header.writeUInt32BE(BTSNOOP_VERSION, 8);
+  header.writeUInt32BE(BTSNOOP_HCI_UART, 12);
+
+  const chunks = [header];
+  for (const record of records) {
+    const type = record.packet[0];
+    const recordHeader = Buffer.alloc(24);
+    recordHeader.writeUInt32BE(record.packet.length, 0);
+    recordHeader.writeUInt32BE(record.packet.length, 4);
+    recordHeader.writeUInt32BE(
+      (record.received ? BTSNOOP_FLAG_RECEIVED : 0) |
+        (type === HCI_COMMAND_PKT || type === HCI_EVENT_PKT
+          ? BTSNOOP_FLAG_COMMAND_EVENT
+          : 0),
+      8
+    );
+    recordHeader.writeBigInt64BE(
+      BigInt(Math.round(record.timestamp || 0)) + BTSNOOP_EPOCH_DELTA,
+      16
+    );
+    chunks.push(recordHeader, record.packet);
+  }
+  fs.writeFileSync(path, Buffer.concat(chunks));
+}
+
+module.exports = {
+  readBtsnoop,
+  writeBtsnoop,
+};
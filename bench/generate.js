@@ -0,0 +1,21 @@
+// generate.js
+
+// Writes the built-in synthetic traces as btsnoop files, for inspection with
+// btmon / Wireshark or for replay.js.
+//
+// Usage: node bench/generate.js [directory]  (current directory by default)
+
+const fs = require("node:fs");
+const path = require("node:path");
+
+const { writeBtsnoop } = require("./btsnoop.js");
+const { traces } = require("./traces.js");
+
+const directory = process.argv[2] || ".";
+fs.mkdirSync(directory, { recursive: true });
+for (const name in traces) {
+  const file = path.join(directory, `${name}.btsnoop`);
+  const records = traces[name]();
+  writeBtsnoop(file, records);
+  console.log(`${file}: ${records.length} packets`);
+}
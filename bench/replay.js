@@ -0,0 +1,209 @@
+// replay.js
+
+// Replays a controller to host trace through the whole receive pipeline
+// (HciSocket::poll -> Hci.onSocketData -> Central) using the fake transport.
+//
+// Usage: node bench/replay.js <trace> [options]
+//  trace: btsnoop file or built-in trace name (see traces.js)
+//  --mode <name>: receive mode, see modes below (default)
+//  --repeat <n>: replay the trace n times (1)
+//  --chunk <n>: frames injected per event loop turn (256)
+//  --json: print the result as JSON
+
+const { monitorEventLoopDelay, PerformanceObserver } = require("node:perf_hooks");
+const v8 = require("node:v8");
+
+const Central = require("../central.js");
+const { readBtsnoop } = require("./btsnoop.js");
+const { traces } = require("./traces.js");
+
+// Central options by mode
+const modes = {
+  default: {},
+  batch: { batchSize: 64 },
+  advReports: { advReports: 256 },
+  recvPool: { recvPool: 256 },
+  readerThread: { readerThread: 4096 },
+  aclReassembly: { aclReassembly: 1024 },
+  all: {
+    batchSize: 64,
+    advReports: 256,
+    recvPool: 256,
+    aclReassembly: 1024,
+  },
+};
+
+function parseArgs(argv) {
+  const args = { mode: "default", repeat: 1, chunk: 256, json: false };
+  for (let i = 0; i < argv.length; i++) {
+    switch (argv[i]) {
+      case "--mode":
+        args.mode = argv[++i];
+        break;
+      case "--repeat":
+        args.repeat = parseInt(argv[++i], 10);
+        break;
+      case "--chunk":
+        args.chunk = parseInt(argv[++i], 10);
+        break;
+      case "--json":
+        args.json = true;
+        break;
+      default:
+        args.trace = argv[i];
+        break;
+    }
+  }
+  return args;
+}
+
+function loadTrace(name) {
+  const records = traces[name] ? traces[name]() : readBtsnoop(name);
+  // Only what the controller sent is replayed
+  return records.filter((record) => record.received).map((r) => r.packet);
+}
+
+// Bytes allocated on the JS heap between GCs, from the GC profiler samples
+function allocatedBytes(samples, startUsed, endUsed) {
+  let total = 0;
+  let used = startUsed;
+  for (const sample of samples) {
+    total += Math.max(0, sample.beforeGC.heapStatistics.usedHeapSize - used);
+    used = sample.afterGC.heapStatistics.usedHeapSize;
+  }
+  return total + Math.max(0, endUsed - used);
+}
+
+function percentile(histogram, p) {
+  return histogram.percentile(p) / 1e6;
+}
+
+async function replay(central, packets, args) {
+  // Sentinel: a Read BD ADDR completion, answered in order after a chunk
+  const sentinel = Buffer.from([
+    0x04, 0x0e, 0x0a, 0x01, 0x09, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0xc0,
+  ]);
+  const drained = () =>
+    new Promise((resolve) => {
+      central.once("address", resolve);
+      central.inject(sentinel);
+    });
+
+  const counts = { events: 0 };
+  const count = () => counts.events++;
+  if (modes[args.mode].advReports) {
+    // Columnar reports, not expanded into per-report events
+    central.on("advertisements", (n) => (counts.events += n));
+  } else {
+    central.on("advertisement", count);
+    central.on("extendedAdvertisement", count);
+  }
+  central.on("notification", count);
+
+  const gcs = { count: 0, duration: 0 };
+  const observer = new PerformanceObserver((list) => {
+    for (const entry of list.getEntries()) {
+      gcs.count++;
+      gcs.duration += entry.duration;
+    }
+  });
+  observer.observe({ entryTypes: ["gc"] });
+  const profiler = v8.GCProfiler ? new v8.GCProfiler() : null;
+  const histogram = monitorEventLoopDelay({ resolution: 1 });
+
+  const startUsed = v8.getHeapStatistics().used_heap_size;
+  profiler?.start();
+  histogram.enable();
+  const startCpu = process.cpuUsage();
+  const start = process.hrtime.bigint();
+
+  let frames = 0;
+  for (let r = 0; r < args.repeat; r++) {
+    for (let i = 0; i < packets.length; i += args.chunk) {
+      const end = Math.min(i + args.chunk, packets.length);
+      for (let j = i; j < end; j++) central.inject(packets[j]);
+      frames += end - i;
+      await drained();
+    }
+  }
+
+  const elapsed = Number(process.hrtime.bigint() - start);
+  const cpu = process.cpuUsage(startCpu);
+  histogram.disable();
+  const samples = profiler ? profiler.stop().statistics : [];
+  const endUsed = v8.getHeapStatistics().used_heap_size;
+  // Let the observer see the last GC entries
+  await new Promise((resolve) => setImmediate(resolve));
+  observer.disconnect();
+
+  return {
+    frames,
+    events: counts.events,
+    seconds: elapsed / 1e9,
+    framesPerSecond: Math.round(frames / (elapsed / 1e9)),
+    cpuNsPerFrame: Math.round(((cpu.user + cpu.system) * 1000) / frames),
+    allocatedBytesPerFrame: profiler
+      ? Math.round(allocatedBytes(samples, startUsed, endUsed) / frames)
+      : undefined,
+    gcCount: gcs.count,
+    gcMs: Math.round(gcs.duration * 100) / 100,
+    loopDelayMs: {
+      p50: percentile(histogram, 50),
+      p99: percentile(histogram, 99),
+      max: histogram.max / 1e6,
+    },
+  };
+}
+
+async function main() {
+  const args = parseArgs(process.argv.slice(2));
+  if (!args.trace || !modes[args.mode]) {
+    console.error(
+      `usage: replay.js <${Object.keys(traces).join("|")}|file.btsnoop> ` +
+        `[--mode ${Object.keys(modes).join("|")}] [--repeat n] [--chunk n] [--json]`
+    );
+    process.exit(2);
+  }
+  const packets = loadTrace(args.trace);
+
+  // No synthetic advertisers: the trace is the only traffic
+  const central = new Central(
+    Object.assign(
+      { transport: "fake", fake: { advertisers: 0, maxConnections: 255 } },
+      modes[args.mode]
+    )
+  );
+  const ready = new Promise((resolve) => central.once("address", resolve));
+  central.start();
+  await ready;
+
+  const result = await replay(central, packets, args);
+  result.trace = args.trace;
+  result.mode = args.mode;
+
+  if (args.json) {
+    console.log(JSON.stringify(result));
+  } else {
+    console.log(`${result.trace} (${result.mode})`);
+    console.log(`  frames        ${result.frames} (${result.events} events)`);
+    console.log(`  frames/sec    ${result.framesPerSecond}`);
+    console.log(`  cpu ns/frame  ${result.cpuNsPerFrame}`);
+    if (result.allocatedBytesPerFrame !== undefined) {
+      console.log(`  alloc B/frame ${result.allocatedBytesPerFrame}`);
+    }
+    console.log(`  gc            ${result.gcCount} (${result.gcMs} ms)`);
+    console.log(
+      `  loop delay ms p50 ${result.loopDelayMs.p50.toFixed(3)}, ` +
+        `p99 ${result.loopDelayMs.p99.toFixed(3)}, ` +
+        `max ${result.loopDelayMs.max.toFixed(3)}`
+    );
+  }
+  central.stop();
+  process.exit(0);
+}
+
+main().catch((error) => {
+  console.error(error);
+  process.exit(1);
+});
@@ -0,0 +1,102 @@
+// run.js
+
+// Runs every built-in trace in every receive mode, one process per run so
+// that runs don't share heap or native state, and prints a summary table.
+//
+// Usage: node bench/run.js [--traces a,b] [--modes a,b] [--repeat n] [--json]
+
+const { execFileSync } = require("node:child_process");
+const path = require("node:path");
+
+const { traces } = require("./traces.js");
+
+const defaultModes = [
+  "default",
+  "batch",
+  "advReports",
+  "recvPool",
+  "readerThread",
+  "aclReassembly",
+  "all",
+];
+
+function parseArgs(argv) {
+  const args = {
+    traces: Object.keys(traces),
+    modes: defaultModes,
+    repeat: 1,
+    json: false,
+  };
+  for (let i = 0; i < argv.length; i++) {
+    switch (argv[i]) {
+      case "--traces":
+        args.traces = argv[++i].split(",");
+        break;
+      case "--modes":
+        args.modes = argv[++i].split(",");
+        break;
+      case "--repeat":
+        args.repeat = parseInt(argv[++i], 10);
+        break;
+      case "--json":
+        args.json = true;
+        break;
+    }
+  }
+  return args;
+}
+
+function main() {
+  const args = parseArgs(process.argv.slice(2));
+  const results = [];
+  if (!args.json) {
+    console.log(
+      [
+        "trace".padEnd(22),
+        "mode".padEnd(14),
+        "frames/s".padStart(9),
+        "ns/frame".padStart(8),
+        "B/frame".padStart(8),
+        "gcs".padStart(5),
+        "p99 ms".padStart(8),
+        "max ms".padStart(8),
+      ].join(" ")
+    );
+  }
+  for (const trace of args.traces) {
+    for (const mode of args.modes) {
+      const output = execFileSync(
+        process.execPath,
+        [
+          path.join(__dirname, "replay.js"),
+          trace,
+          "--mode",
+          mode,
+          "--repeat",
+          `${args.repeat}`,
+          "--json",
+        ],
+        { encoding: "utf8" }
+      );
+      const result = JSON.parse(output.trim().split("\n").pop());
+      results.push(result);
+      if (!args.json) {
+        console.log(
+          [
+            trace.padEnd(22),
+            mode.padEnd(14),
+            `${result.framesPerSecond}`.padStart(9),
+            `${result.cpuNsPerFrame}`.padStart(8),
+            `${result.allocatedBytesPerFrame ?? "-"}`.padStart(8),
+            `${result.gcCount}`.padStart(5),
+            result.loopDelayMs.p99.toFixed(2).padStart(8),
+            result.loopDelayMs.max.toFixed(2).padStart(8),
+          ].join(" ")
+        );
+      }
+    }
+  }
+  if (args.json) console.log(JSON.stringify(results, null, 2));
+}
+
+main();
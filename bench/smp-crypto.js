@@ -0,0 +1,124 @@
+// smp-crypto.js
+
+// Compares the Security Manager cryptography of crypto.js (node:crypto) with
+// the addon's (smp-crypto.js), per pairing step and per whole pairing.
+//
+// Usage: node bench/smp-crypto.js [--ms n] [--json]
+
+const { performance } = require("node:perf_hooks");
+
+const js = require("../crypto.js");
+const native = require("../smp-crypto.js");
+
+// Inputs of one pairing, in SMP PDU order
+const tk = Buffer.alloc(16);
+const r1 = js.r();
+const r2 = js.r();
+const pres = Buffer.from("02030001100101", "hex");
+const preq = Buffer.from("01030001100001", "hex");
+const iat = Buffer.of(0);
+const ia = Buffer.from("010000c0ffee", "hex");
+const rat = Buffer.of(1);
+const ra = Buffer.from("e6d5c4b3a1f2", "hex");
+const a1 = Buffer.concat([ia, iat]);
+const a2 = Buffer.concat([ra, rat]);
+const peer = js.generateKeyPair();
+const dhKey = js.dhKey(js.generateKeyPair().privateKey, peer.publicKey);
+const pkx = peer.publicKey.subarray(0, 32);
+const z = Buffer.of(0);
+const zero = Buffer.alloc(16);
+
+const steps = {
+  e: (c) => c.e(tk, r1),
+  c1: (c) => c.c1(tk, r1, pres, preq, iat, ia, rat, ra),
+  s1: (c) => c.s1(tk, r1, r2),
+  aesCmac: (c) => c.aesCmac(r1, dhKey),
+  f4: (c) => c.f4(pkx, pkx, r1, z),
+  f5: (c) => c.f5(dhKey, r1, r2, a1, a2),
+  f6: (c) => c.f6(r1, r1, r2, zero, preq.subarray(1, 4), a1, a2),
+  g2: (c) => c.g2(pkx, pkx, r1, r2),
+  generateKeyPair: (c) => c.generateKeyPair(),
+  dhKey: (c) => c.dhKey(peer.privateKey, peer.publicKey),
+  // Initiator side computations of a whole pairing
+  legacyPairing: (c) => {
+    c.c1(tk, r1, pres, preq, iat, ia, rat, ra);
+    c.c1(tk, r2, pres, preq, iat, ia, rat, ra);
+    c.s1(tk, r2, r1);
+  },
+  scPairing: (c) => {
+    const { privateKey } = c.generateKeyPair();
+    const w = c.dhKey(privateKey, peer.publicKey);
+    c.f4(pkx, pkx, r2, z);
+    const { macKey } = c.f5(w, r1, r2, a1, a2);
+    c.f6(macKey, r1, r2, zero, preq.subarray(1, 4), a1, a2);
+    c.f6(macKey, r2, r1, zero, pres.subarray(1, 4), a2, a1);
+  },
+};
+
+function parseArgs(argv) {
+  const args = { ms: 500, json: false };
+  for (let i = 0; i < argv.length; i++) {
+    switch (argv[i]) {
+      case "--ms":
+        args.ms = parseInt(argv[++i], 10);
+        break;
+      case "--json":
+        args.json = true;
+        break;
+    }
+  }
+  return args;
+}
+
+// Calls per second, run for about ms msec after a warm up
+function measure(fn, ms) {
+  for (let i = 0; i < 100; i++) fn();
+  let calls = 0;
+  const start = performance.now();
+  let elapsed = 0;
+  while (elapsed < ms) {
+    for (let i = 0; i < 100; i++) fn();
+    calls += 100;
+    elapsed = performance.now() - start;
+  }
+  return (calls * 1000) / elapsed;
+}
+
+function main() {
+  const args = parseArgs(process.argv.slice(2));
+  const results = [];
+  if (!args.json) {
+    console.log(
+      [
+        "step".padEnd(16),
+        "js ops/s".padStart(10),
+        "native ops/s".padStart(13),
+        "speedup".padStart(8),
+      ].join(" ")
+    );
+  }
+  for (const [step, fn] of Object.entries(steps)) {
+    const jsOps = measure(() => fn(js), args.ms);
+    const nativeOps = measure(() => fn(native), args.ms);
+    const result = {
+      step,
+      jsOps: Math.round(jsOps),
+      nativeOps: Math.round(nativeOps),
+      speedup: Number((nativeOps / jsOps).toFixed(2)),
+    };
+    results.push(result);
+    if (!args.json) {
+      console.log(
+        [
+          step.padEnd(16),
+          `${result.jsOps}`.padStart(10),
+          `${result.nativeOps}`.padStart(13),
+          `${result.speedup}x`.padStart(8),
+        ].join(" ")
+      );
+    }
+  }
+  if (args.json) console.log(JSON.stringify(results, null, 2));
+}
+
+main();
@@ -0,0 +1,189 @@
+// traces.js
+
+// Synthetic controller to host traces, one record per HCI packet (H4 framed)
+
+const HCI_ACLDATA_PKT = 0x02;
+const HCI_EVENT_PKT = 0x04;
+const EVT_LE_META_EVENT = 0x3e;
+const EVT_LE_CONN_COMPLETE = 0x01;
+const EVT_LE_ADVERTISING_REPORT = 0x02;
+const EVT_LE_EXTENDED_ADVERTISING_REPORT = 0x0d;
+const ACL_START = 0x02;
+const ACL_CONT = 0x01;
+const ATT_CID = 0x0004;
+const ATT_OP_READ_BLOB_RESP = 0x0d;
+const ATT_OP_HANDLE_NOTIFY = 0x1b;
+const HANDLE_FIRST = 0x0040;
+
+function leConnComplete(handle) {
+  // uint8_t status, uint16_t handle, uint8_t role, uint8_t peer_bdaddr_type,
+  // bdaddr_t peer_bdaddr, uint16_t interval, uint16_t latency,
+  // uint16_t supervision_timeout, uint8_t master_clock_accuracy
+  const packet = Buffer.alloc(3 + 19);
+  packet.writeUInt8(HCI_EVENT_PKT, 0);
+  packet.writeUInt8(EVT_LE_META_EVENT, 1);
+  packet.writeUInt8(19, 2);
+  packet.writeUInt8(EVT_LE_CONN_COMPLETE, 3);
+  packet.writeUInt16LE(handle, 5);
+  packet.writeUInt8(0x01, 8); // Random
+  packet.writeUInt16LE(handle, 9);
+  packet.writeUInt8(0xd0, 14); // Random static D0:00:00:00:hh:hh
+  packet.writeUInt16LE(24, 15);
+  packet.writeUInt16LE(72, 19);
+  return packet;
+}
+
+// ACL packets carrying one L2CAP PDU, fragmented to pktLen
+function aclFragments(handle, cid, pdu, pktLen) {
+  const l2cap = Buffer.alloc(4 + pdu.length);
+  l2cap.writeUInt16LE(pdu.length, 0);
+  l2cap.writeUInt16LE(cid, 2);
+  pdu.copy(l2cap, 4);
+
+  const packets = [];
+  for (let offset = 0; offset < l2cap.length; offset += pktLen) {
+    const fragment = l2cap.subarray(offset, offset + pktLen);
+    const packet = Buffer.alloc(5 + fragment.length);
+    packet.writeUInt8(HCI_ACLDATA_PKT, 0);
+    packet.writeUInt16LE(
+      handle | ((offset === 0 ? ACL_START : ACL_CONT) << 12),
+      1
+    );
+    packet.writeUInt16LE(fragment.length, 3);
+    fragment.copy(packet, 5);
+    packets.push(packet);
+  }
+  return packets;
+}
+
+function toRecords(packets, interval) {
+  return packets.map((packet, i) => ({
+    received: true,
+    timestamp: i * interval,
+    packet,
+  }));
+}
+
+// Dense advertising: reportsPerEvent legacy reports per LE Meta event (or one
+// extended report per event) from a rotating advertiser population
+function advertising(options = {}) {
+  const events = options.events || 100000;
+  const advertisers = options.advertisers || 1000;
+  const reportsPerEvent = options.extended ? 1 : options.reportsPerEvent || 1;
+  const advLength = options.advLength || 26;
+  const packets = [];
+  let counter = 0;
+  for (let i = 0; i < events; i++) {
+    const reports = [];
+    for (let j = 0; j < reportsPerEvent; j++, counter++) {
+      const index = counter % advertisers;
+      const address = Buffer.from([
+        index & 0xff,
+        (index >> 8) & 0xff,
+        (index >> 16) & 0xff,
+        0x00,
+        0x00,
+        0xc0,
+      ]);
+      // Flags + manufacturer specific data (0xffff) with a running counter
+      const adv = Buffer.alloc(advLength);
+      adv.set([0x02, 0x01, 0x06, advLength - 4, 0xff, 0xff, 0xff], 0);
+      adv.writeUInt32LE(counter >>> 0, 7);
+      const rssi = -40 - (index % 50);
+      if (options.extended) {
+        const report = Buffer.alloc(24 + advLength);
+        report.writeUInt16LE(0x0013, 0); // Legacy ADV_IND
+        report.writeUInt8(0x01, 2);
+        address.copy(report, 3);
+        report.writeUInt8(0x01, 9); // LE 1M
+        report.writeUInt8(0xff, 11);
+        report.writeInt8(0x7f, 12);
+        report.writeInt8(rssi, 13);
+        report.writeUInt8(advLength, 23);
+        adv.copy(report, 24);
+        reports.push(report);
+      } else {
+        const report = Buffer.alloc(10 + advLength);
+        report.writeUInt8(0x00, 0); // ADV_IND
+        report.writeUInt8(0x01, 1);
+        address.copy(report, 2);
+        report.writeUInt8(advLength, 8);
+        adv.copy(report, 9);
+        report.writeInt8(rssi, 9 + advLength);
+        reports.push(report);
+      }
+    }
+    const body = Buffer.concat(reports);
+    const packet = Buffer.alloc(5 + body.length);
+    packet.writeUInt8(HCI_EVENT_PKT, 0);
+    packet.writeUInt8(EVT_LE_META_EVENT, 1);
+    packet.writeUInt8(2 + body.length, 2);
+    packet.writeUInt8(
+      options.extended
+        ? EVT_LE_EXTENDED_ADVERTISING_REPORT
+        : EVT_LE_ADVERTISING_REPORT,
+      3
+    );
+    packet.writeUInt8(reportsPerEvent, 4);
+    body.copy(packet, 5);
+    packets.push(packet);
+  }
+  return toRecords(packets, 100);
+}
+
+// Multi-link notification flood: links connections, then notifications
+// round-robin across them
+function notifications(options = {}) {
+  const links = options.links || 8;
+  const count = options.count || 100000;
+  const valueLength = options.valueLength || 20;
+  const pktLen = options.pktLen || 27;
+  const packets = [];
+  for (let i = 0; i < links; i++) packets.push(leConnComplete(HANDLE_FIRST + i));
+  for (let i = 0; i < count; i++) {
+    const pdu = Buffer.alloc(3 + valueLength);
+    pdu.writeUInt8(ATT_OP_HANDLE_NOTIFY, 0);
+    pdu.writeUInt16LE(0x0010 + (i % 4), 1);
+    pdu.writeUInt32LE(i >>> 0, 3);
+    packets.push(
+      ...aclFragments(HANDLE_FIRST + (i % links), ATT_CID, pdu, pktLen)
+    );
+  }
+  return toRecords(packets, 50);
+}
+
+// Long ATT reads: Read Blob Responses of mtu - 1 bytes fragmented into
+// pktLen ACL packets, round-robin across links
+function longReads(options = {}) {
+  const links = options.links || 4;
+  const reads = options.reads || 20000;
+  const mtu = options.mtu || 517;
+  const pktLen = options.pktLen || 27;
+  const packets = [];
+  for (let i = 0; i < links; i++) packets.push(leConnComplete(HANDLE_FIRST + i));
+  for (let i = 0; i < reads; i++) {
+    const pdu = Buffer.alloc(mtu);
+    pdu.writeUInt8(ATT_OP_READ_BLOB_RESP, 0);
+    for (let j = 1; j < mtu; j++) pdu[j] = (i + j) & 0xff;
+    packets.push(
+      ...aclFragments(HANDLE_FIRST + (i % links), ATT_CID, pdu, pktLen)
+    );
+  }
+  return toRecords(packets, 20);
+}
+
+const traces = {
+  advertising: () => advertising({ reportsPerEvent: 1 }),
+  "advertising-batched": () => advertising({ reportsPerEvent: 6 }),
+  "advertising-extended": () => advertising({ extended: true }),
+  notifications: () => notifications({ links: 8 }),
+  "notifications-251": () => notifications({ links: 32, pktLen: 251 }),
+  "long-reads": () => longReads({ links: 4, reads: 5000 }),
+};
+
+module.exports = {
+  advertising,
+  notifications,
+  longReads,
+  traces,
+};
@@ -6,7 +6,20 @@
         ["OS=='linux'", {
           "sources": [
             "src/Index.cpp",
-            "src/HciSocket.cpp"
+            "src/AclReassembly.cpp",
+            "src/AclScheduler.cpp",
+            "src/AdvFilter.cpp",
+            "src/BtSnoop.cpp",
+            "src/CommandQueue.cpp",
+            "src/FakeHciTransport.cpp",
+            "src/HciSocket.cpp",
+            "src/HciStats.cpp",
+            "src/HciTransport.cpp",
+            "src/NotifyTable.cpp",
+            "src/RecvPool.cpp",
+            "src/RecvRing.cpp",
+            "src/SmpCrypto.cpp",
+            "src/SmpCryptoBinding.cpp"
           ]
         }]
       ],
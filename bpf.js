@@ -0,0 +1,235 @@
+// bpf.js
+
+// Classic BPF (SO_ATTACH_FILTER) programs for the HCI socket: frames the
+// program rejects are dropped by the kernel, before being queued to the socket
+// and copied to user space.
+
+const os = require("node:os");
+
+const { addressToBuffer } = require("./common.js");
+const {
+  HCI_EVENT_PKT,
+  EVT_LE_META_EVENT,
+  EVT_LE_ADVERTISING_REPORT,
+  EVT_LE_EXTENDED_ADVERTISING_REPORT,
+} = require("./hci-defs.js");
+
+// Constants borrowed from <linux/filter.h>
+const BPF_LD = 0x00;
+const BPF_LDX = 0x01;
+const BPF_ST = 0x02;
+const BPF_ALU = 0x04;
+const BPF_JMP = 0x05;
+const BPF_RET = 0x06;
+const BPF_MISC = 0x07;
+const BPF_W = 0x00;
+const BPF_H = 0x08;
+const BPF_B = 0x10;
+const BPF_IMM = 0x00;
+const BPF_ABS = 0x20;
+const BPF_IND = 0x40;
+const BPF_MEM = 0x60;
+const BPF_ADD = 0x00;
+const BPF_XOR = 0xa0;
+const BPF_JA = 0x00;
+const BPF_JEQ = 0x10;
+const BPF_JGE = 0x30;
+const BPF_K = 0x00;
+const BPF_X = 0x08;
+const BPF_TAX = 0x00;
+const BPF_MAXINSNS = 4096;
+
+const ACCEPT = 0xffffffff; // Whole frame
+const REJECT = 0;
+
+// Scratch memory
+const M_END = 0; // End of advertising data
+const M_OFFSET = 1; // Current AD structure
+
+// Frame offsets of a single report event (packet type included)
+// uint8_t evt_type; uint8_t sub_evt_type; uint8_t plen; uint8_t sub_evt;
+// uint8_t num_reports; ...
+const NUM_REPORTS_OFFSET = 4;
+const reportLayouts = {
+  [EVT_LE_ADVERTISING_REPORT]: {
+    address: 7,
+    dataLength: 13,
+    data: 14,
+    rssi: undefined, // Follows the data
+    adStructures: 15, // 31 bytes of data
+  },
+  [EVT_LE_EXTENDED_ADVERTISING_REPORT]: {
+    address: 8,
+    dataLength: 28,
+    data: 29,
+    rssi: 18,
+    adStructures: 32, // Beyond that reports are left to user space
+  },
+};
+
+// Jump offsets are relative and forward only: instructions jump to labels
+// resolved once the program is complete, conditional jumps always skip over
+// an unconditional one so that targets are not limited to 255 instructions
+class Program {
+  constructor() {
+    this._insns = [];
+    this._labels = new Map();
+  }
+
+  emit(code, k = 0, jt = 0, jf = 0) {
+    this._insns.push({ code, jt, jf, k });
+  }
+
+  label(name) {
+    this._labels.set(name, this._insns.length);
+  }
+
+  goto(name) {
+    this._insns.push({ code: BPF_JMP | BPF_JA, jt: 0, jf: 0, k: 0, name });
+  }
+
+  // Jumps to name when A <op> k (X when k is undefined) holds
+  jumpIf(op, k, name) {
+    this.emit(BPF_JMP | op | (k === undefined ? BPF_X : BPF_K), k, 0, 1);
+    this.goto(name);
+  }
+
+  jumpUnless(op, k, name) {
+    this.emit(BPF_JMP | op | (k === undefined ? BPF_X : BPF_K), k, 1, 0);
+    this.goto(name);
+  }
+
+  toBuffer() {
+    if (this._insns.length > BPF_MAXINSNS) {
+      throw new RangeError(`BPF program too long (${this._insns.length})`);
+    }
+    const buffer = Buffer.alloc(this._insns.length * 8);
+    const le = os.endianness() === "LE";
+    this._insns.forEach((insn, i) => {
+      let k = insn.k || 0;
+      if (insn.name !== undefined) {
+        const target = this._labels.get(insn.name);
+        if (target === undefined || target <= i) {
+          throw new Error(`Bad BPF label ${insn.name}`);
+        }
+        k = target - i - 1;
+      }
+      // struct sock_filter { __u16 code; __u8 jt; __u8 jf; __u32 k; }
+      const offset = i * 8;
+      if (le) buffer.writeUInt16LE(insn.code, offset);
+      else buffer.writeUInt16BE(insn.code, offset);
+      buffer.writeUInt8(insn.jt, offset + 2);
+      buffer.writeUInt8(insn.jf, offset + 3);
+      if (le) buffer.writeUInt32LE(k >>> 0, offset + 4);
+      else buffer.writeUInt32BE(k >>> 0, offset + 4);
+    });
+    return buffer;
+  }
+}
+
+function compileReport(program, name, layout, filter) {
+  const { addresses = [], rssi, adTypes = [] } = filter;
+  program.label(name);
+  // Several reports in one event are left to user space
+  program.emit(BPF_LD | BPF_B | BPF_ABS, NUM_REPORTS_OFFSET);
+  program.jumpUnless(BPF_JEQ, 1, "accept");
+
+  if (rssi !== undefined) {
+    if (layout.rssi !== undefined) {
+      program.emit(BPF_LD | BPF_B | BPF_ABS, layout.rssi);
+    } else {
+      program.emit(BPF_LD | BPF_B | BPF_ABS, layout.dataLength);
+      program.emit(BPF_MISC | BPF_TAX);
+      program.emit(BPF_LD | BPF_B | BPF_IND, layout.data);
+    }
+    // Signed comparison: flipping the sign bit orders int8 values as unsigned
+    // (127, RSSI not available, is always accepted)
+    const minimum = Math.max(-128, Math.min(127, rssi | 0));
+    program.emit(BPF_ALU | BPF_XOR | BPF_K, 0x80);
+    program.jumpUnless(BPF_JGE, minimum + 128, "reject");
+  }
+
+  if (addresses.length > 0) {
+    // Loaded in network order from the little endian address
+    for (const address of addresses) {
+      const buffer = addressToBuffer(address);
+      program.emit(BPF_LD | BPF_W | BPF_ABS, layout.address);
+      program.emit(BPF_JMP | BPF_JEQ | BPF_K, buffer.readUInt32BE(0), 0, 3);
+      program.emit(BPF_LD | BPF_H | BPF_ABS, layout.address + 4);
+      program.jumpIf(BPF_JEQ, buffer.readUInt16BE(4), `${name}.address`);
+    }
+    program.goto("reject");
+    program.label(`${name}.address`);
+  }
+
+  if (adTypes.length > 0) {
+    // No loops in classic BPF: AD structures are walked unrolled
+    program.emit(BPF_LD | BPF_B | BPF_ABS, layout.dataLength);
+    program.emit(BPF_ALU | BPF_ADD | BPF_K, layout.data);
+    program.emit(BPF_ST, M_END);
+    program.emit(BPF_LD | BPF_IMM, layout.data);
+    program.emit(BPF_ST, M_OFFSET);
+    for (let i = 0; i < layout.adStructures; i++) {
+      // uint8_t length; uint8_t type; uint8_t data[length - 1];
+      program.emit(BPF_LD | BPF_MEM, M_OFFSET);
+      program.emit(BPF_ALU | BPF_ADD | BPF_K, 1);
+      program.emit(BPF_LDX | BPF_MEM, M_END);
+      program.jumpIf(BPF_JGE, undefined, "reject");
+      program.emit(BPF_LDX | BPF_MEM, M_OFFSET);
+      program.emit(BPF_LD | BPF_B | BPF_IND, 1);
+      for (const adType of adTypes) {
+        program.jumpIf(BPF_JEQ, adType, `${name}.adType`);
+      }
+      program.emit(BPF_LD | BPF_B | BPF_IND, 0);
+      program.jumpIf(BPF_JEQ, 0, "reject"); // Zero padding
+      program.emit(BPF_ALU | BPF_ADD | BPF_X);
+      program.emit(BPF_ALU | BPF_ADD | BPF_K, 1);
+      program.emit(BPF_ST, M_OFFSET);
+    }
+    program.goto("accept");
+    program.label(`${name}.adType`);
+  }
+  program.goto("accept");
+}
+
+// filter: {
+//   leSubevents, // LE meta subevents delivered, all when undefined (connections need theirs)
+//   addresses, // Accepted advertiser addresses
+//   rssi, // Minimum RSSI
+//   adTypes, // At least one of these AD types must be present
+// }
+// Other packets and events are always delivered. The address, RSSI and AD type
+// conditions apply to advertising reports carrying a single report, events
+// batching several reports are delivered (see setAdvFilter()).
+function compileBpfFilter(filter) {
+  const { leSubevents, addresses = [], rssi, adTypes = [] } = filter;
+  const program = new Program();
+  program.emit(BPF_LD | BPF_B | BPF_ABS, 0);
+  program.jumpUnless(BPF_JEQ, HCI_EVENT_PKT, "accept");
+  program.emit(BPF_LD | BPF_B | BPF_ABS, 1);
+  program.jumpUnless(BPF_JEQ, EVT_LE_META_EVENT, "accept");
+  program.emit(BPF_LD | BPF_B | BPF_ABS, 3);
+  if (leSubevents) {
+    for (const subevent of leSubevents) {
+      program.jumpIf(BPF_JEQ, subevent, "subevent");
+    }
+    program.goto("reject");
+    program.label("subevent");
+  }
+  if (addresses.length > 0 || rssi !== undefined || adTypes.length > 0) {
+    for (const subevent of Object.keys(reportLayouts)) {
+      program.jumpIf(BPF_JEQ, Number(subevent), `report.${subevent}`);
+    }
+    program.goto("accept");
+    for (const [subevent, layout] of Object.entries(reportLayouts)) {
+      compileReport(program, `report.${subevent}`, layout, filter);
+    }
+  }
+  program.label("accept");
+  program.emit(BPF_RET | BPF_K, ACCEPT);
+  program.label("reject");
+  program.emit(BPF_RET | BPF_K, REJECT);
+  return program.toBuffer();
+}
+
+module.exports = { compileBpfFilter };
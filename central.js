@@ -6,9 +6,14 @@ const { EventEmitter } = require("node:events");
 
 const Acl = require("./acl.js");
 const Gatt = require("./gatt.js");
+const GattCache = require("./gatt-cache.js");
 const Hci = require("./hci.js");
 const { HCI_SUCCESS, LE_ROLE_CENTRAL } = require("./hci-defs.js");
 const Signaling = require("./signaling.js");
+const { numberToAddress } = require("./common.js");
+
+const SMP_MTU = 65; // LE Secure Connections SMP MTU
+const BULK_CONNECT_TIMEOUT = 10000; // Before bulk targets fall back to connect()
 
 // BLE Central
 class Central extends EventEmitter {
@@ -19,10 +24,12 @@ class Central extends EventEmitter {
     this._addressTypes = {}; // Device address types (by address)
     this._connectionInProgress = null; // currently connecting device address
     this._connectionQueue = []; // Pending connections queue
+    this._bulkTargets = new Map(); // Bulk connection targets (by address)
     this._handles = {}; // Device addresses by connection handle & vice versa
     this._gatts = {}; // Gatt interfaces by connection handle and by address
     this._acls = {}; // ACL transports by connection handle only
     this._signalings = {}; // Signaling channels by connection handle only
+    this._gattCache = null; // Attribute tables of known peers
     this._hci = new Hci(options);
     this._hci.on("start", this.onStart.bind(this));
     this._hci.on("stop", this.onStop.bind(this));
@@ -32,11 +39,17 @@ class Central extends EventEmitter {
     this._hci.on("leSetScanParameters", this.onLeSetScanParameters.bind(this));
     this._hci.on("leSetScanEnable", this.onLeSetScanEnable.bind(this));
     this._hci.on("leAdvertisingReport", this.onLeAdvertisingReport.bind(this));
+    this._hci.on(
+      "leAdvertisingReports",
+      this.onLeAdvertisingReports.bind(this)
+    );
     this._hci.on(
       "leExtendedAdvertisingReport",
       this.onLeExtendedAdvertisingReport.bind(this)
     );
     this._hci.on("leConnComplete", this.onLeConnComplete.bind(this));
+    this._hci.on("l2SocketConnect", this.onL2SocketConnect.bind(this));
+    this._hci.on("drain", this.onDrain.bind(this));
     this._hci.on("disconnComplete", this.onDisconnComplete.bind(this));
     this._hci.on("encryptChange", this.onEncryptChange.bind(this));
     this._hci.on(
@@ -44,7 +57,9 @@ class Central extends EventEmitter {
       this.onLeConnUpdateComplete.bind(this)
     );
     this._hci.on("aclDataPkt", this.onAclDataPkt.bind(this));
+    this._hci.on("notifyReports", this.onNotifyReports.bind(this));
     process.on("exit", this.onExit.bind(this));
+    if (options.gattCache) this.setGattCache(options.gattCache);
   }
 
   AttDefs = require("./att-defs.js");
@@ -61,18 +76,136 @@ class Central extends EventEmitter {
     }
   }
 
+  getDeviceList() {
+    return Hci.getDeviceList();
+  }
+
+  get deviceId() {
+    return this._hci.deviceId;
+  }
+
   availableL2Sockets() {
     return this._hci.availableL2Sockets();
   }
 
+  connectionCount() {
+    // Established links plus connections in progress or queued
+    return (
+      Object.keys(this._acls).length +
+      this._connectionQueue.length +
+      this._bulkTargets.size +
+      (this._connectionInProgress && !this._connectionInProgress.bulk ? 1 : 0)
+    );
+  }
+
   setAuth(enabled) {
     this._hci.setAuth(!!enabled);
   }
 
+  setGattCache(directory) {
+    // discoverAsync() skips discovery of peers whose attribute table is cached
+    // in directory for their current Database Hash (null disables)
+    this._gattCache = directory ? new GattCache(directory) : null;
+  }
+
+  setConnectionParameters(
+    minInterval,
+    maxInterval,
+    latency,
+    supervisionTimeout
+  ) {
+    this._hci.setConnectionParameters(
+      minInterval,
+      maxInterval,
+      latency,
+      supervisionTimeout
+    );
+  }
+
   setEncrypt(enabled) {
     this._hci.setEncrypt(!!enabled);
   }
 
+  setBatchSize(batchSize) {
+    this._hci.setBatchSize(batchSize);
+  }
+
+  setRecvPool(slots) {
+    this._hci.setRecvPool(slots);
+  }
+
+  setReaderThread(slots) {
+    this._hci.setReaderThread(slots);
+  }
+
+  getReaderStats() {
+    return this._hci.getReaderStats();
+  }
+
+  setAclReassembly(maxPdu, timeout) {
+    this._hci.setAclReassembly(maxPdu, timeout);
+  }
+
+  setAclScheduler(enabled) {
+    this._hci.setAclScheduler(enabled);
+  }
+
+  setWriteQueue(maxBytes) {
+    this._hci.setWriteQueue(maxBytes);
+  }
+
+  setCommandQueue(maxQueued) {
+    this._hci.setCommandQueue(maxQueued);
+  }
+
+  inject(packet) {
+    this._hci.inject(packet);
+  }
+
+  setCapture(bytes) {
+    this._hci.setCapture(bytes);
+  }
+
+  dumpCapture(path) {
+    this._hci.dumpCapture(path);
+  }
+
+  streamCapture(path) {
+    this._hci.streamCapture(path);
+  }
+
+  getSocketDelayStats() {
+    return this._hci.getSocketDelayStats();
+  }
+
+  setAdvReports(capacity) {
+    return this._hci.setAdvReports(capacity);
+  }
+
+  setAdvFilter(filter) {
+    this._hci.setAdvFilter(filter);
+  }
+
+  setNotificationReports(capacity) {
+    return this._hci.setNotifyReports(capacity);
+  }
+
+  setBpfFilter(filter) {
+    this._hci.setBpfFilter(filter);
+  }
+
+  getAdvFilterStats() {
+    return this._hci.getAdvFilterStats();
+  }
+
+  getStats() {
+    return this._hci.getStats();
+  }
+
+  getMetrics(labels) {
+    return this._hci.getMetrics(labels);
+  }
+
   start() {
     this._hci.start();
   }
@@ -106,7 +239,7 @@ class Central extends EventEmitter {
   }
 
   setScanParameters(type, interval, window, ownAddressType, filter) {
-    this._hci.leSetScanParameters(
+    return this._hci.leSetScanParameters(
       type,
       interval,
       window,
@@ -118,7 +251,18 @@ class Central extends EventEmitter {
   setScanParametersAsync(type, interval, window, ownAddressType, filter) {
     return new Promise((resolve, reject) => {
       this.once("scanParametersSet", resolve);
-      this.setScanParameters(type, interval, window, ownAddressType, filter);
+      this.setScanParameters(
+        type,
+        interval,
+        window,
+        ownAddressType,
+        filter
+      ).catch((error) => {
+        // A failure status still resolves through "scanParametersSet"
+        if (error.status !== undefined) return;
+        this.removeListener("scanParametersSet", resolve);
+        reject(error);
+      });
     });
   }
 
@@ -176,7 +320,9 @@ class Central extends EventEmitter {
     advLength,
     advData,
     rssi,
-    numReports
+    numReports,
+    timestamp,
+    delay
   ) {
     this.emit(
       "advertisement",
@@ -186,10 +332,68 @@ class Central extends EventEmitter {
       advLength,
       advData,
       rssi,
-      numReports
+      numReports,
+      timestamp,
+      delay
     );
   }
 
+  onLeAdvertisingReports(count, reports) {
+    this.emit("advertisements", count, reports);
+
+    // Expand into per-report events only when someone listens for them
+    const legacy = this.listenerCount("advertisement") > 0;
+    const extended = this.listenerCount("extendedAdvertisement") > 0;
+    if (!legacy && !extended) return;
+    // Kernel timestamps are wall clock time, so is the delay reference
+    const now = Date.now();
+    for (let i = 0; i < count; i++) {
+      const advOffset = reports.advOffset[i];
+      const advLength = reports.advLength[i];
+      const timestamp = reports.timestamp[i];
+      const delay = timestamp ? Math.max(0, now - timestamp) : 0;
+      if (reports.extended[i]) {
+        if (!extended) continue;
+        this.emit(
+          "extendedAdvertisement",
+          reports.type[i],
+          reports.addressType[i],
+          numberToAddress(reports.address[i]),
+          reports.primaryPhy[i],
+          reports.secondaryPhy[i],
+          reports.sid[i],
+          reports.txPower[i] & 0xff,
+          reports.rssi[i],
+          reports.periodicAdvInterval[i],
+          reports.directAddressType[i],
+          numberToAddress(reports.directAddress[i]),
+          Buffer.from(
+            reports.payload.subarray(advOffset, advOffset + advLength)
+          ),
+          reports.numReports[i],
+          timestamp,
+          delay
+        );
+      } else {
+        if (!legacy) continue;
+        this.emit(
+          "advertisement",
+          reports.type[i],
+          reports.addressType[i],
+          numberToAddress(reports.address[i]),
+          advLength,
+          Buffer.from(
+            reports.payload.subarray(advOffset, advOffset + advLength)
+          ),
+          reports.rssi[i],
+          reports.numReports[i],
+          timestamp,
+          delay
+        );
+      }
+    }
+  }
+
   onLeExtendedAdvertisingReport(
     type,
     addressType,
@@ -203,7 +407,9 @@ class Central extends EventEmitter {
     directAddressType,
     directAddress,
     advData,
-    numReports
+    numReports,
+    timestamp,
+    delay
   ) {
     this.emit(
       "extendedAdvertisement",
@@ -219,7 +425,9 @@ class Central extends EventEmitter {
       directAddressType,
       directAddress,
       advData,
-      numReports
+      numReports,
+      timestamp,
+      delay
     );
   }
 
@@ -249,6 +457,7 @@ class Central extends EventEmitter {
       ) => {
         if (address === address_) {
           this.off("connect", listener);
+          this.off("l2SocketConnect", errorListener);
           resolve({
             status,
             handle,
@@ -264,11 +473,162 @@ class Central extends EventEmitter {
           });
         }
       };
+      const errorListener = (address_, errno) => {
+        if (address === address_ && errno !== 0) {
+          this.off("connect", listener);
+          this.off("l2SocketConnect", errorListener);
+          reject(new Error(`L2CAP socket connection failed (errno ${errno})`));
+        }
+      };
       this.on("connect", listener);
+      this.on("l2SocketConnect", errorListener);
       this.connect(addressType, address, parameters);
     });
   }
 
+  bulkConnect(devices, parameters = {}) {
+    // devices: [{ addressType, address }, ...]
+    // Connects to whichever targets advertise first: targets are loaded into
+    // the controller's filter accept list and a single LE Create Connection
+    // initiates to all of them, re-armed after each connection. Targets still
+    // pending after parameters.bulkTimeout msec fall back to connect().
+    for (const { addressType, address } of devices) {
+      if (this._handles[address] !== undefined) continue;
+      this._bulkTargets.set(address, { addressType, address, parameters });
+    }
+    if (this._bulkTargets.size === 0) return;
+    if (!this._connectionInProgress) {
+      this.startBulkConnect(parameters);
+    } else if (this._connectionInProgress.bulk) {
+      this.armBulkConnect();
+    } else if (!this._connectionQueue.some((connection) => connection.bulk)) {
+      this._connectionQueue.push({ bulk: true, parameters });
+    }
+  }
+
+  bulkConnectAsync(devices, parameters) {
+    // Resolves with the addresses connected and those that failed
+    return new Promise((resolve) => {
+      const pending = new Set(devices.map(({ address }) => address));
+      const connected = [];
+      const failed = [];
+      const settle = (address, success) => {
+        if (!pending.delete(address)) return;
+        (success ? connected : failed).push(address);
+        if (pending.size > 0) return;
+        this.off("connect", listener);
+        this.off("l2SocketConnect", errorListener);
+        resolve({ connected, failed });
+      };
+      const listener = (status, handle, role, addressType, address) => {
+        // Failures of the shared initiator concern no target in particular
+        if (status === HCI_SUCCESS || !this._bulkTargets.has(address)) {
+          settle(address, status === HCI_SUCCESS);
+        }
+      };
+      const errorListener = (address, errno) => {
+        if (errno !== 0) settle(address, false);
+      };
+      this.on("connect", listener);
+      this.on("l2SocketConnect", errorListener);
+      for (const address of pending) {
+        if (this._handles[address] !== undefined) settle(address, true);
+      }
+      if (pending.size > 0) this.bulkConnect(devices, parameters);
+    });
+  }
+
+  startBulkConnect(parameters) {
+    const { bulkTimeout = BULK_CONNECT_TIMEOUT } = parameters;
+    const bulk = { bulk: true, parameters, listed: new Map(), expired: false };
+    this._connectionInProgress = bulk;
+    bulk.timer = setTimeout(() => {
+      debug("Central.startBulkConnect: timeout");
+      bulk.expired = true;
+      // Completes with Unknown Connection Identifier, unless a connection
+      // just completed
+      this._hci
+        .leCreateConnCancel()
+        .catch(() => this.finishBulkConnect(bulk));
+    }, bulkTimeout);
+    this._hci
+      .leClearWhiteList()
+      .then(() => this.armBulkConnect())
+      .catch((error) => {
+        debug("Central.startBulkConnect: %o", error);
+        this.finishBulkConnect(bulk);
+      });
+  }
+
+  async armBulkConnect() {
+    const bulk = this._connectionInProgress;
+    if (bulk.initiating || bulk.arming) return;
+    bulk.arming = true;
+    // The accept list can't change while initiating, targets added or
+    // cancelled since are updated before the next LE Create Connection
+    for (const [address, addressType] of bulk.listed) {
+      if (this._bulkTargets.has(address)) continue;
+      bulk.listed.delete(address);
+      this._hci.leRemoveDeviceFromWhiteList(addressType, address);
+    }
+    for (const { addressType, address } of this._bulkTargets.values()) {
+      if (bulk.listed.has(address)) continue;
+      try {
+        await this._hci.leAddDeviceToWhiteList(addressType, address);
+        bulk.listed.set(address, addressType);
+      } catch (error) {
+        // Accept list full, left to the next rounds or the fallback
+        debug("Central.armBulkConnect: %s %o", address, error);
+        break;
+      }
+    }
+    bulk.arming = false;
+    if (bulk !== this._connectionInProgress || bulk.expired) return;
+    if (bulk.listed.size === 0) {
+      this.finishBulkConnect(bulk);
+      return;
+    }
+    debug("Central.armBulkConnect: %d targets", bulk.listed.size);
+    bulk.initiating = true;
+    this._hci
+      .leCreateConn(0, "000000000000", {
+        ...bulk.parameters,
+        filter: 0x01, // initiator filter policy: filter accept list
+      })
+      .catch((error) => {
+        debug("Central.armBulkConnect: %o", error);
+        this.finishBulkConnect(bulk);
+      });
+  }
+
+  onBulkConnComplete(status, address) {
+    const bulk = this._connectionInProgress;
+    bulk.initiating = false;
+    // Failed attempts keep their target
+    if (status === HCI_SUCCESS && bulk.listed.has(address)) {
+      this._hci.leRemoveDeviceFromWhiteList(bulk.listed.get(address), address);
+      bulk.listed.delete(address);
+      this._bulkTargets.delete(address);
+    }
+    if (bulk.expired || this._bulkTargets.size === 0) {
+      this.finishBulkConnect(bulk);
+    } else {
+      this.armBulkConnect();
+    }
+  }
+
+  finishBulkConnect(bulk) {
+    if (bulk !== this._connectionInProgress) return;
+    clearTimeout(bulk.timer);
+    debug("Central.finishBulkConnect: %d left", this._bulkTargets.size);
+    // Stragglers are connected one by one
+    for (const target of this._bulkTargets.values()) {
+      this._connectionQueue.push(target);
+    }
+    this._bulkTargets.clear();
+    this.connectNext();
+  }
+
   disconnect(address) {
     this._hci.disconnect(this._handles[address]);
   }
@@ -290,6 +650,11 @@ class Central extends EventEmitter {
     this._connectionQueue = this._connectionQueue.filter(
       (connection) => connection.address !== address
     );
+    this._bulkTargets.delete(address);
+    if (this._connectionInProgress?.bulk && this._bulkTargets.size > 0) {
+      // Other targets keep initiating, the accept list is updated next round
+      return;
+    }
     this._hci.leCreateConnCancel();
   }
 
@@ -346,6 +711,7 @@ class Central extends EventEmitter {
       gatt.on("notification", this.onNotification.bind(this));
       gatt.on("readDescriptor", this.onReadDescriptor.bind(this));
       gatt.on("writeDescriptor", this.onWriteDescriptor.bind(this));
+      gatt.on("serviceChanged", this.onServiceChanged.bind(this));
 
       signaling.on(
         "connectionParameterUpdateRequest",
@@ -370,8 +736,49 @@ class Central extends EventEmitter {
       peerResolvablePrivateAddress
     );
 
+    if (this._connectionInProgress?.bulk) {
+      this.onBulkConnComplete(status, address);
+    } else {
+      this.connectNext();
+    }
+  }
+
+  onDrain() {
+    this.emit("drain");
+  }
+
+  onL2SocketConnect(address, errno, sent) {
+    debug(
+      "Central.onL2SocketConnect: address %s, errno %d, sent %s",
+      address,
+      errno,
+      sent
+    );
+
+    this.emit("l2SocketConnect", address, errno, sent);
+
+    // Once LE Create Connection was sent, its failure also ends in LE Connection
+    // Complete, which moves on: only failures before reaching the controller do
+    if (
+      !sent &&
+      errno !== 0 &&
+      this._connectionInProgress?.address === address
+    ) {
+      this.connectNext();
+    }
+  }
+
+  connectNext() {
     if (this._connectionQueue.length > 0) {
       const connection = this._connectionQueue.shift();
+      if (connection.bulk) {
+        if (this._bulkTargets.size > 0) {
+          this.startBulkConnect(connection.parameters);
+        } else {
+          this.connectNext();
+        }
+        return;
+      }
       this._connectionInProgress = connection;
       this._hci.leCreateConn(
         connection.addressType,
@@ -434,7 +841,21 @@ class Central extends EventEmitter {
     });
   }
 
+  onServiceChanged(address, startHandle, endHandle) {
+    if (this._gattCache) {
+      this._gattCache
+        .delete(address)
+        .catch((error) => debug("Central.onServiceChanged: %o", error));
+    }
+    this.emit("serviceChanged", address, startHandle, endHandle);
+  }
+
   onMtu(address, mtu) {
+    // Largest PDU expected on the link: ATT MTU, at least the SMP MTU
+    const handle = this._handles[address];
+    if (handle !== undefined) {
+      this._hci.setAclMaxPdu(handle, Math.max(mtu, SMP_MTU));
+    }
     this.emit("mtu", address, mtu);
   }
 
@@ -625,6 +1046,7 @@ class Central extends EventEmitter {
       let characteristics;
       let characteristic;
       let rejected;
+      let hash;
 
       if (timeout) {
         timeout = setTimeout(() => {
@@ -695,16 +1117,54 @@ class Central extends EventEmitter {
         }
         if (timeout) clearTimeout(timeout);
         if (rejected) return;
+        if (hash) {
+          this._gattCache
+            .save(address, hash, gatt.getServices())
+            .catch((error) => debug("Central.discoverAsync: %o", error));
+        }
         resolve(gatt.getServices());
       };
 
-      gatt.on("servicesDiscover", onServicesDiscover);
-      gatt.on("characteristicsDiscover", onCharacteristicsDiscover);
-      if (includeDescriptors) {
-        gatt.on("descriptorsDiscover", onDescriptorsDiscover);
-      }
+      const discover = () => {
+        gatt.on("servicesDiscover", onServicesDiscover);
+        gatt.on("characteristicsDiscover", onCharacteristicsDiscover);
+        if (includeDescriptors) {
+          gatt.on("descriptorsDiscover", onDescriptorsDiscover);
+        }
+        gatt.discoverServices();
+      };
 
-      gatt.discoverServices();
+      const onDatabaseHash = (address_, hash_) => {
+        if (address_ !== address) return;
+        gatt.off("databaseHash", onDatabaseHash);
+        // Without a Database Hash a cached table can't be validated
+        if (!hash_ || rejected) {
+          if (!rejected) discover();
+          return;
+        }
+        hash = hash_;
+        this._gattCache
+          .load(address, hash)
+          .catch((error) => debug("Central.discoverAsync: %o", error))
+          .then((services) => {
+            if (rejected) return;
+            if (!GattCache.isComplete(services, includeDescriptors)) {
+              discover();
+              return;
+            }
+            debug("Central.discoverAsync: cached %s", address);
+            gatt.restore(services);
+            if (timeout) clearTimeout(timeout);
+            resolve(gatt.getServices());
+          });
+      };
+
+      if (this._gattCache) {
+        gatt.on("databaseHash", onDatabaseHash);
+        gatt.readDatabaseHash();
+      } else {
+        discover();
+      }
     });
   }
 
@@ -842,8 +1302,58 @@ class Central extends EventEmitter {
     this.emit("notify", address, handle, descriptorHandle, notify, error);
   }
 
+  subscribeNotifications(address, handle) {
+    // Routes notifications of handle natively, see setNotificationReports()
+    const connectionHandle = this._handles[address];
+    if (connectionHandle === undefined) return;
+    this._hci.setNotifySubscription(connectionHandle, handle, true);
+  }
+
+  unsubscribeNotifications(address, handle) {
+    const connectionHandle = this._handles[address];
+    if (connectionHandle === undefined) return;
+    this._hci.setNotifySubscription(connectionHandle, handle, false);
+  }
+
+  addressOf(connectionHandle) {
+    return this._handles[connectionHandle];
+  }
+
+  onNotifyReports(count, reports) {
+    this.emit("notifications", count, reports);
+
+    // Expand into per-value events only when someone listens for them
+    if (this.listenerCount("notification") === 0) return;
+    const now = Date.now();
+    for (let i = 0; i < count; i++) {
+      const valueOffset = reports.valueOffset[i];
+      const timestamp = reports.timestamp[i];
+      this.emit(
+        "notification",
+        this._handles[reports.connectionHandle[i]],
+        reports.handle[i],
+        Buffer.from(
+          reports.payload.subarray(
+            valueOffset,
+            valueOffset + reports.valueLength[i]
+          )
+        ),
+        timestamp,
+        timestamp ? Math.max(0, now - timestamp) : 0
+      );
+    }
+  }
+
   onNotification(address, handle, value) {
-    this.emit("notification", address, handle, value);
+    // Dispatched synchronously from the frame that carried it
+    this.emit(
+      "notification",
+      address,
+      handle,
+      value,
+      this._hci.rxTimestamp,
+      this._hci.socketDelay
+    );
   }
 
   readDescriptor(address, handle) {
@@ -7,3 +7,9 @@ module.exports.bufferToAddress = bufferToAddress = (data, startIndex) =>
 
 module.exports.addressToBuffer = addressToBuffer = (address) =>
   Buffer.from(address, "hex").reverse();
+
+module.exports.numberToAddress = numberToAddress = (value) =>
+  value.toString(16).padStart(12, "0");
+
+module.exports.addressToNumber = addressToNumber = (address) =>
+  parseInt(address, 16);
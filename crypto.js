@@ -2,6 +2,9 @@
 
 const crypto = require("node:crypto");
 
+const F5_SALT = Buffer.from("6c888391aaf5a53860370bdb5a6083be", "hex");
+const F5_KEY_ID = Buffer.from("btle");
+
 function r() {
   return crypto.randomBytes(16);
 }
@@ -28,6 +31,125 @@ function e(key, data) {
   return swap(Buffer.concat([cipher.update(data), cipher.final()]));
 }
 
+// AES-CMAC (RFC 4493), key and message most significant octet first
+function aesCmac(key, message) {
+  const cipher = crypto.createCipheriv("aes-128-ecb", key, "");
+  cipher.setAutoPadding(false);
+  const k1 = cmacSubkey(cipher.update(Buffer.alloc(16)));
+  const k2 = cmacSubkey(k1);
+  const n = Math.max(1, Math.ceil(message.length / 16));
+  const last = Buffer.alloc(16);
+  message.copy(last, 0, (n - 1) * 16);
+  if (message.length === n * 16) {
+    xorInto(last, k1);
+  } else {
+    last[message.length - (n - 1) * 16] = 0x80;
+    xorInto(last, k2);
+  }
+  let x = Buffer.alloc(16);
+  for (let i = 0; i < n - 1; i++) {
+    x = cipher.update(xor(x, message.subarray(i * 16, i * 16 + 16)));
+  }
+  return cipher.update(xor(x, last));
+}
+
+function cmacSubkey(l) {
+  const k = Buffer.alloc(16);
+  for (let i = 0; i < 16; i++) {
+    k[i] = (l[i] << 1) | (i < 15 ? l[i + 1] >> 7 : 0);
+  }
+  if (l[0] & 0x80) k[15] ^= 0x87;
+  return k;
+}
+
+// LE Secure Connections confirm value generation function f4
+// Like e() arguments and results are in SMP PDU order (least significant
+// octet first): u, v 32 octets, x 16 octets, z 1 octet
+function f4(u, v, x, z) {
+  return swap(aesCmac(swap(x), Buffer.concat([swap(u), swap(v), z])));
+}
+
+// LE Secure Connections key generation function f5
+// w 32 octets, n1, n2 16 octets, a1, a2 7 octets (address, address type)
+// Returns { macKey, ltk }
+function f5(w, n1, n2, a1, a2) {
+  const t = aesCmac(F5_SALT, swap(w));
+  const message = Buffer.concat([
+    Buffer.of(0), // counter
+    F5_KEY_ID,
+    swap(n1),
+    swap(n2),
+    swap(a1),
+    swap(a2),
+    Buffer.of(0x01, 0x00), // length: 256 bits
+  ]);
+  const macKey = swap(aesCmac(t, message));
+  message[0] = 1;
+  const ltk = swap(aesCmac(t, message));
+  return { macKey, ltk };
+}
+
+// LE Secure Connections check value generation function f6
+// w, n1, n2, r 16 octets, ioCap 3 octets (IO capability, OOB data flag,
+// AuthReq), a1, a2 7 octets
+function f6(w, n1, n2, r, ioCap, a1, a2) {
+  return swap(
+    aesCmac(
+      swap(w),
+      Buffer.concat([
+        swap(n1),
+        swap(n2),
+        swap(r),
+        swap(ioCap),
+        swap(a1),
+        swap(a2),
+      ])
+    )
+  );
+}
+
+// LE Secure Connections numeric comparison value generation function g2,
+// returns the six digit value to compare
+function g2(u, v, x, y) {
+  const result = aesCmac(
+    swap(x),
+    Buffer.concat([swap(u), swap(v), swap(y)])
+  );
+  return result.readUInt32BE(12) % 1000000;
+}
+
+// P-256 key pair for LE Secure Connections: privateKey is 32 octets (big
+// endian), publicKey the X and Y coordinates in SMP PDU order
+function generateKeyPair() {
+  const ecdh = crypto.createECDH("prime256v1");
+  const point = ecdh.generateKeys();
+  return {
+    privateKey: ecdh.getPrivateKey(),
+    publicKey: Buffer.concat([
+      swap(point.subarray(1, 33)),
+      swap(point.subarray(33, 65)),
+    ]),
+  };
+}
+
+// DHKey in SMP PDU order, throws when publicKey is not a point of the curve
+function dhKey(privateKey, publicKey) {
+  const ecdh = crypto.createECDH("prime256v1");
+  ecdh.setPrivateKey(privateKey);
+  const point = Buffer.concat([
+    Buffer.of(0x04), // uncompressed
+    swap(publicKey.subarray(0, 32)),
+    swap(publicKey.subarray(32, 64)),
+  ]);
+  return swap(ecdh.computeSecret(point));
+}
+
+function xorInto(b1, b2) {
+  for (let i = 0; i < b1.length; i++) {
+    b1[i] ^= b2[i];
+  }
+}
+
 function xor(b1, b2) {
   const result = Buffer.alloc(b1.length);
   for (let i = 0; i < b1.length; i++) {
@@ -49,4 +171,11 @@ module.exports = {
   c1,
   s1,
   e,
+  aesCmac,
+  f4,
+  f5,
+  f6,
+  g2,
+  generateKeyPair,
+  dhKey,
 };
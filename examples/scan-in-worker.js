@@ -0,0 +1,60 @@
+const {
+  Worker,
+  isMainThread,
+  parentPort,
+  workerData,
+} = require("node:worker_threads");
+
+if (isMainThread) {
+  // Counters shared with the worker: advertisements, distinct addresses
+  const counters = new Int32Array(new SharedArrayBuffer(8));
+
+  // The whole Central lives in the worker, away from the application logic
+  const worker = new Worker(__filename, { workerData: { counters } });
+
+  worker.on("message", (batch) => {
+    // Strongest RSSI per address seen since the previous batch
+    for (const [address, rssi] of batch) {
+      console.log(address, rssi);
+    }
+    console.log(
+      "advertisements %d, addresses %d",
+      Atomics.load(counters, 0),
+      Atomics.load(counters, 1)
+    );
+  });
+  worker.on("error", (error) => console.error(error));
+
+  // Terminate in 15 seconds, the worker releases the adapter on exit
+  setTimeout(() => worker.terminate(), 15000);
+} else {
+  const Central = require("../central.js");
+
+  const { counters } = workerData;
+  const central = new Central();
+  const seen = new Set();
+  let batch = new Map();
+
+  central.on(
+    "advertisement",
+    (type, addressType, address, advLength, advData, rssi) => {
+      Atomics.add(counters, 0, 1);
+      if (!seen.has(address)) {
+        seen.add(address);
+        Atomics.add(counters, 1, 1);
+      }
+      if (!(batch.get(address) >= rssi)) batch.set(address, rssi);
+    }
+  );
+
+  // Compact messages, at most one per second
+  setInterval(() => {
+    if (batch.size === 0) return;
+    parentPort.postMessage([...batch]);
+    batch = new Map();
+  }, 1000);
+
+  central.start();
+  central.setScanParameters(1, 0x20, 0x20, 0, 0);
+  central.startScanning();
+}
@@ -0,0 +1,293 @@
+// gatt-cache.js
+
+const debug = require("debug")("ble-hci-central:gatt-cache");
+
+const fs = require("node:fs/promises");
+const path = require("node:path");
+
+// File format (little endian)
+// Header
+//   uint8_t magic[4] = "GATC";
+//   uint8_t version;
+//   uint8_t hash[16]; // Database Hash the attribute table was discovered with
+//   uint16_t num_services;
+// Service
+//   uint16_t start_handle, end_handle;
+//   uuid uuid;
+//   uint16_t num_included_services; // 0xffff: not discovered
+//   included_service included_services[];
+//   uint16_t num_characteristics; // 0xffff: not discovered
+//   characteristic characteristics[];
+// Included service
+//   uint16_t start_handle, end_handle;
+//   uuid uuid;
+// Characteristic
+//   uint16_t start_handle, end_handle;
+//   uint8_t properties;
+//   uint16_t handle; // Value handle
+//   uuid uuid;
+//   uint16_t num_descriptors; // 0xffff: not discovered
+//   descriptor descriptors[];
+// Descriptor
+//   uint16_t handle;
+//   uuid uuid;
+// uuid
+//   uint8_t length; // 2 or 16
+//   uint8_t uuid[length];
+const MAGIC = "GATC";
+const VERSION = 1;
+const HEADER_SIZE = 23;
+const NOT_DISCOVERED = 0xffff;
+
+class Writer {
+  constructor() {
+    this._chunks = [];
+  }
+
+  u8(value) {
+    this._chunks.push(Buffer.of(value));
+  }
+
+  u16(value) {
+    const buffer = Buffer.allocUnsafe(2);
+    buffer.writeUInt16LE(value, 0);
+    this._chunks.push(buffer);
+  }
+
+  uuid(uuid) {
+    // Short UUIDs are kept as discovered, unpadded hex
+    if (uuid.length <= 4) {
+      this.u8(2);
+      this.u16(parseInt(uuid, 16));
+    } else {
+      this.u8(16);
+      this._chunks.push(Buffer.from(uuid, "hex"));
+    }
+  }
+
+  bytes(buffer) {
+    this._chunks.push(buffer);
+  }
+
+  toBuffer() {
+    return Buffer.concat(this._chunks);
+  }
+}
+
+class Reader {
+  constructor(buffer, offset) {
+    this._buffer = buffer;
+    this._offset = offset;
+  }
+
+  u8() {
+    return this._buffer.readUInt8(this._offset++);
+  }
+
+  u16() {
+    const value = this._buffer.readUInt16LE(this._offset);
+    this._offset += 2;
+    return value;
+  }
+
+  uuid() {
+    const length = this.u8();
+    if (length === 2) return this.u16().toString(16);
+    const end = this._offset + length;
+    if (length !== 16 || end > this._buffer.length) {
+      throw new RangeError("Bad UUID length " + length);
+    }
+    const uuid = this._buffer.subarray(this._offset, end).toString("hex");
+    this._offset = end;
+    return uuid;
+  }
+}
+
+function encode(hash, services) {
+  const writer = new Writer();
+  writer.bytes(Buffer.from(MAGIC));
+  writer.u8(VERSION);
+  writer.bytes(hash);
+  const serviceList = Object.values(services);
+  writer.u16(serviceList.length);
+  for (const service of serviceList) {
+    writer.u16(service.startHandle);
+    writer.u16(service.endHandle);
+    writer.uuid(service.uuid);
+    const includedServices = Object.values(service.includedServices || {});
+    writer.u16(
+      service.includedServices ? includedServices.length : NOT_DISCOVERED
+    );
+    for (const includedService of includedServices) {
+      writer.u16(includedService.startHandle);
+      writer.u16(includedService.endHandle);
+      writer.uuid(includedService.uuid);
+    }
+    const characteristics = Object.values(service.characteristics || {});
+    writer.u16(
+      service.characteristics ? characteristics.length : NOT_DISCOVERED
+    );
+    for (const characteristic of characteristics) {
+      writer.u16(characteristic.startHandle);
+      writer.u16(characteristic.endHandle);
+      writer.u8(characteristic.properties);
+      writer.u16(characteristic.handle);
+      writer.uuid(characteristic.uuid);
+      const descriptors = Object.values(characteristic.descriptors || {});
+      writer.u16(
+        characteristic.descriptors ? descriptors.length : NOT_DISCOVERED
+      );
+      for (const descriptor of descriptors) {
+        writer.u16(descriptor.handle);
+        writer.uuid(descriptor.uuid);
+      }
+    }
+  }
+  return writer.toBuffer();
+}
+
+// Rebuilds services the way Gatt discovers them
+function decode(buffer) {
+  const reader = new Reader(buffer, HEADER_SIZE - 2);
+  const services = {};
+  const numServices = reader.u16();
+  for (let i = 0; i < numServices; i++) {
+    const service = {
+      startHandle: reader.u16(),
+      endHandle: reader.u16(),
+      isPrimary: true,
+      uuid: reader.uuid(),
+    };
+    const numIncludedServices = reader.u16();
+    if (numIncludedServices !== NOT_DISCOVERED) {
+      service.includedServices = {};
+      for (let j = 0; j < numIncludedServices; j++) {
+        const includedService = {
+          startHandle: reader.u16(),
+          endHandle: reader.u16(),
+          uuid: reader.uuid(),
+        };
+        service.includedServices[includedService.uuid] = includedService;
+      }
+    }
+    const numCharacteristics = reader.u16();
+    if (numCharacteristics !== NOT_DISCOVERED) {
+      service.characteristics = {};
+      for (let j = 0; j < numCharacteristics; j++) {
+        const characteristic = {
+          startHandle: reader.u16(),
+          endHandle: reader.u16(),
+          properties: reader.u8(),
+          handle: reader.u16(),
+          uuid: reader.uuid(),
+          serviceUuid: service.uuid,
+        };
+        const numDescriptors = reader.u16();
+        if (numDescriptors !== NOT_DISCOVERED) {
+          characteristic.descriptors = {};
+          for (let k = 0; k < numDescriptors; k++) {
+            const descriptor = {
+              handle: reader.u16(),
+              uuid: reader.uuid(),
+              serviceUuid: service.uuid,
+              characteristicUuid: characteristic.uuid,
+            };
+            characteristic.descriptors[descriptor.uuid] = descriptor;
+          }
+        }
+        service.characteristics[characteristic.uuid] = characteristic;
+      }
+    }
+    services[service.uuid] = service;
+  }
+  return services;
+}
+
+// Attribute tables of known peers, one file per peer address. A table is only
+// valid for the Database Hash it was discovered with: on reconnect the hash is
+// read once and discovery is skipped when it matches.
+// Files read or written are kept in memory, so that reconnecting to the same
+// peers doesn't hit the disk again.
+class GattCache {
+  constructor(directory) {
+    this._directory = directory;
+    this._entries = new Map(); // Encoded tables by peer address
+  }
+
+  _path(address) {
+    return path.join(this._directory, `${address}.gatt`);
+  }
+
+  async _read(address) {
+    let buffer = this._entries.get(address);
+    if (buffer) return buffer;
+    try {
+      buffer = await fs.readFile(this._path(address));
+    } catch (error) {
+      if (error.code !== "ENOENT") debug("GattCache._read: %o", error);
+      return;
+    }
+    if (
+      buffer.length < HEADER_SIZE ||
+      buffer.toString("latin1", 0, 4) !== MAGIC ||
+      buffer.readUInt8(4) !== VERSION
+    ) {
+      debug("GattCache._read: bad file %s", this._path(address));
+      return;
+    }
+    this._entries.set(address, buffer);
+    return buffer;
+  }
+
+  // Resolves the services cached for address and hash, undefined if none
+  async load(address, hash) {
+    const buffer = await this._read(address);
+    if (
+      !buffer ||
+      !hash ||
+      !hash.equals(buffer.subarray(5, HEADER_SIZE - 2))
+    ) {
+      return;
+    }
+    try {
+      return decode(buffer);
+    } catch (error) {
+      debug("GattCache.load: %s %o", address, error);
+      this._entries.delete(address);
+    }
+  }
+
+  async save(address, hash, services) {
+    const buffer = encode(hash, services);
+    this._entries.set(address, buffer);
+    await fs.mkdir(this._directory, { recursive: true });
+    // Written aside and renamed, a crash never leaves a truncated file
+    const file = this._path(address);
+    await fs.writeFile(file + ".tmp", buffer);
+    await fs.rename(file + ".tmp", file);
+  }
+
+  // Whether services hold what discoverAsync() would have discovered
+  static isComplete(services, includeDescriptors) {
+    if (!services) return false;
+    for (const service of Object.values(services)) {
+      if (!service.characteristics) return false;
+      if (!includeDescriptors) continue;
+      for (const characteristic of Object.values(service.characteristics)) {
+        if (!characteristic.descriptors) return false;
+      }
+    }
+    return true;
+  }
+
+  async delete(address) {
+    this._entries.delete(address);
+    try {
+      await fs.unlink(this._path(address));
+    } catch (error) {
+      if (error.code !== "ENOENT") throw error;
+    }
+  }
+}
+
+module.exports = GattCache;
@@ -15,6 +15,10 @@ module.exports = Object.freeze({
   GATT_PRESENTATION_FMT_CFG_UUID: 0x2904,
   GATT_AGGREGATE_FMT_CFG_UUID: 0x2905,
 
+  // GATT service characteristic UUIDs
+  GATT_SERVICE_CHANGED_UUID: 0x2a05,
+  GATT_DATABASE_HASH_UUID: 0x2b2a,
+
   // GATT Characteristic Properties Bitfield values
   GATT_CHRC_PROP_BROADCAST: 0x01,
   GATT_CHRC_PROP_READ: 0x02,
@@ -92,13 +92,23 @@ const {
   GATT_CHARACTERISTIC_UUID,
   GATT_CLIENT_CHARAC_CFG_UUID,
   GATT_SERVER_CHARAC_CFG_UUID,
+  GATT_SERVICE_CHANGED_UUID,
+  GATT_DATABASE_HASH_UUID,
+  GATT_CHRC_PROP_INDICATE,
 } = require("./gatt-defs.js");
 const { ACL_START_NO_FLUSH } = require("./hci-defs.js");
+const TimerWheel = require("./timer-wheel.js");
 
 const MAX_MTU = 247; // 517
-const ATT_TIMEOUT = 200;
+const ATT_TIMEOUT = 200; // Request retransmission timeout (msec)
+const ATT_TIMER_TICK = 10; // msec
+const ATT_TIMER_SLOTS = 256;
 const CCCD_MAX_DISTANCE = 3;
 
+// Retransmission timers of every ATT bearer: one wheel ticking while requests
+// are in flight, instead of an interval per request
+const attTimers = new TimerWheel(ATT_TIMER_TICK, ATT_TIMER_SLOTS);
+
 const attOpMap = {
   [ATT_OP_ERROR]: "ATT_OP_ERROR",
   [ATT_OP_MTU_REQ]: "ATT_OP_MTU_REQ",
@@ -151,17 +161,21 @@ const attEcodeMap = {
   [ATT_ECODE_INSUFF_RESOURCES]: "ATT_ECODE_INSUFF_RESOURCES",
 };
 
+// A request is sent again when no response arrives within its timeout, every
+// response (that may send the next step of the procedure) restarts the countdown
 class AttRequest {
   constructor(gatt, proxy, timeout) {
     this._gatt = gatt;
     this._proxy = proxy;
     this._timeout = timeout;
+    this._timer = undefined;
+    this._onTimeout = this.onTimeout.bind(this);
   }
 
   stop() {
-    if (this._gatt?._requestInterval) {
-      clearInterval(this._gatt._requestInterval);
-      delete this._gatt._requestInterval;
+    if (this._timer) {
+      attTimers.cancel(this._timer);
+      this._timer = undefined;
     }
   }
 
@@ -173,23 +187,33 @@ class AttRequest {
     return false;
   }
 
+  arm() {
+    this.stop();
+    if (this._timeout > 0 && !this._proxy.done()) {
+      this._timer = attTimers.schedule(this._onTimeout, this._timeout);
+    }
+  }
+
   send() {
     this._proxy.send();
-    if (this._timeout > 0) {
-      this.stop();
-      this._gatt._requestInterval = setInterval(
-        () => this._proxy.send(),
-        this._timeout
-      );
-    }
+    this.arm();
+  }
+
+  onTimeout() {
+    this._timer = undefined;
+    debug("AttRequest.onTimeout: address %s", this._gatt._address);
+    this._proxy.send();
+    this.arm();
   }
 
   recv(data) {
     this._proxy.recv(data);
+    this.arm();
   }
 
   error(opcode, handle, ecode) {
     this._proxy.error(opcode, handle, ecode);
+    this.arm();
   }
 }
 
@@ -203,7 +227,7 @@ class Gatt extends EventEmitter {
     this._services = {}; // Services (by service uuid)
     this._characteristics = {}; // Characteristics (by handle)
     this._descriptors = {}; // Descriptors (by handle)
-    this._requestQueue = [];
+    this._requestQueue = []; // Requests waiting for the one in flight
     this._mtu = 23;
     this._security = "low"; // low, medium, high
     this._onAclData = this.onAclData.bind(this);
@@ -221,10 +245,6 @@ class Gatt extends EventEmitter {
       this._pendingRequest.stop();
       delete this._pendingRequest;
     }
-    if (this._requestInterval) {
-      clearInterval(this._requestInterval);
-      delete this._requestInterval;
-    }
     for (const request of this._requestQueue) {
       request.stop();
     }
@@ -240,6 +260,63 @@ class Gatt extends EventEmitter {
     return this._services;
   }
 
+  // Attribute table from an earlier discovery (e.g. GattCache), as returned
+  // by getServices()
+  restore(services) {
+    this._services = services;
+    this._characteristics = {};
+    this._descriptors = {};
+    for (const service of Object.values(services)) {
+      for (const characteristic of Object.values(
+        service.characteristics || {}
+      )) {
+        this._characteristics[characteristic.handle] = characteristic;
+        for (const descriptor of Object.values(
+          characteristic.descriptors || {}
+        )) {
+          this._descriptors[descriptor.handle] = descriptor;
+        }
+      }
+      if (service.characteristics) {
+        this.subscribeServiceChanged(service.characteristics);
+      }
+    }
+  }
+
+  // Unbonded peers only indicate Service Changed to clients that enabled it,
+  // the write is reported through "notify" like any other subscription
+  subscribeServiceChanged(characteristics) {
+    const characteristic =
+      characteristics[GATT_SERVICE_CHANGED_UUID.toString(16)];
+    if (!characteristic) return;
+    if (!(characteristic.properties & GATT_CHRC_PROP_INDICATE)) return;
+    if (this._serviceChangedHandle === characteristic.handle) return;
+    this._serviceChangedHandle = characteristic.handle;
+    this.notify(characteristic.handle, 0x0002);
+  }
+
+  // Forgets the services overlapping the handle range, to be discovered again
+  invalidate(startHandle, endHandle) {
+    for (const [uuid, service] of Object.entries(this._services)) {
+      if (service.endHandle < startHandle) continue;
+      if (service.startHandle > endHandle) continue;
+      delete this._services[uuid];
+      for (const characteristic of Object.values(
+        service.characteristics || {}
+      )) {
+        delete this._characteristics[characteristic.handle];
+        if (characteristic.handle === this._serviceChangedHandle) {
+          delete this._serviceChangedHandle;
+        }
+        for (const descriptor of Object.values(
+          characteristic.descriptors || {}
+        )) {
+          delete this._descriptors[descriptor.handle];
+        }
+      }
+    }
+  }
+
   getServiceByUuid(serviceUuid) {
     return this._services[serviceUuid];
   }
@@ -268,11 +345,13 @@ class Gatt extends EventEmitter {
   }
 
   writeAtt(data, flags = ACL_START_NO_FLUSH) {
-    debug(
-      "Gatt.writeAtt: flags 0x%s, data %s",
-      flags.toString(16).padStart(2, "0"),
-      data.toString("hex")
-    );
+    if (debug.enabled) {
+      debug(
+        "Gatt.writeAtt: flags 0x%s, data %s",
+        flags.toString(16).padStart(2, "0"),
+        data.toString("hex")
+      );
+    }
     this._acl.write(flags, ATT_CID, data);
   }
 
@@ -283,13 +362,15 @@ class Gatt extends EventEmitter {
     // const commandFlag = !!(opcode & 0x40);
     // const authSignatureFlag = !!(opcode & 0x80);
 
-    debug(
-      "Gatt.onAclData: %d %s address %s, data %s",
-      opcode,
-      attOpMap[opcode],
-      this._address,
-      data.toString("hex")
-    );
+    if (debug.enabled) {
+      debug(
+        "Gatt.onAclData: %d %s address %s, data %s",
+        opcode,
+        attOpMap[opcode],
+        this._address,
+        data.toString("hex")
+      );
+    }
 
     // Echo response (maybe from USB dongle)
     // if (this._pendingRequest && !Buffer.compare(data, this._pendingRequest.buffer)) {
@@ -430,6 +511,8 @@ class Gatt extends EventEmitter {
       this._mtu = mtu;
       this.emit("mtu", this._address, this._mtu);
     }
+    if (this._pendingRequest) this._pendingRequest.recv(data);
+    this._pollRequestQueue();
   }
 
   onAttOpResponse(data) {
@@ -445,11 +528,13 @@ class Gatt extends EventEmitter {
     const handle = data.readUInt16LE(1);
     data = data.subarray(3);
 
-    debug(
-      "Gatt.onHandleNotify: handle %d, value %s",
-      handle,
-      data.toString("hex")
-    );
+    if (debug.enabled) {
+      debug(
+        "Gatt.onHandleNotify: handle %d, value %s",
+        handle,
+        data.toString("hex")
+      );
+    }
 
     // Notify listener(s)
     this.emit("notification", this._address, handle, data);
@@ -463,20 +548,44 @@ class Gatt extends EventEmitter {
     const handle = data.readUInt16LE(1);
     data = data.subarray(3);
 
-    debug(
-      "Gatt.onHandleInd: handle %d, value %s",
-      handle,
-      data.toString("hex")
-    );
+    if (debug.enabled) {
+      debug(
+        "Gatt.onHandleInd: handle %d, value %s",
+        handle,
+        data.toString("hex")
+      );
+    }
 
     // Format of Handle Value Confirmation (sent in response to a received Handle Value Indication)
     // uint8_t opcode = 0x1e;
-    this._queueRequest(this.newCommand(this.handleConfirmation()));
+    // Sent right away, even with a request in flight
+    this.sendCommand(this.handleConfirmation());
+
+    // Service Changed
+    // uint16_t start_handle; // Start of the affected attribute handle range
+    // uint16_t end_handle; // End of the affected attribute handle range
+    const characteristic = this._characteristics[handle];
+    if (
+      characteristic?.uuid === GATT_SERVICE_CHANGED_UUID.toString(16) &&
+      data.length >= 4
+    ) {
+      const startHandle = data.readUInt16LE(0);
+      const endHandle = data.readUInt16LE(2);
+      debug(
+        "Gatt.onHandleInd: service changed %s, startHandle %d, endHandle %d",
+        this._address,
+        startHandle,
+        endHandle
+      );
+      this.invalidate(startHandle, endHandle);
+      this.emit("serviceChanged", this._address, startHandle, endHandle);
+    }
 
     // Notify listener(s)
     this.emit("notification", this._address, handle, data);
   }
 
+  // A single request in flight per bearer, the next one is sent once it's done
   _pollRequestQueue = () => {
     if (this._pendingRequest) {
       if (!this._pendingRequest.done()) return;
@@ -497,15 +606,10 @@ class Gatt extends EventEmitter {
     this._pollRequestQueue();
   }
 
-  newCommand(data, flags = ACL_START_NO_FLUSH) {
-    let doneFlag = false;
-    const done = () => doneFlag;
-    const send = () => {
-      if (doneFlag) return;
-      this.writeAtt(data, flags);
-      doneFlag = true;
-    };
-    return new AttRequest(this, { done, send });
+  // Commands and confirmations expect no response, they don't wait for the
+  // request in flight
+  sendCommand(data, flags = ACL_START_NO_FLUSH) {
+    this.writeAtt(data, flags);
   }
 
   errorResponse(opcode, handle, reason) {
@@ -842,7 +946,26 @@ class Gatt extends EventEmitter {
   }
 
   exchangeMtu() {
-    this._queueRequest(this.newCommand(this.mtuRequest(MAX_MTU)));
+    let doneFlag = false;
+
+    const done = () => doneFlag;
+
+    const send = () => {
+      if (doneFlag) return;
+      this.writeAtt(this.mtuRequest(MAX_MTU));
+    };
+
+    const error = (opcode, handle, ecode) => {
+      if (opcode === ATT_OP_MTU_REQ) doneFlag = true;
+    };
+
+    const recv = (data) => {
+      if (data.readUInt8(0) === ATT_OP_MTU_RESP) doneFlag = true;
+    };
+
+    this._queueRequest(
+      new AttRequest(this, { done, send, error, recv }, ATT_TIMEOUT)
+    );
   }
 
   encrypt(options) {
@@ -853,13 +976,11 @@ class Gatt extends EventEmitter {
     let doneFlag = false;
     let startHandle = 0x0001;
     let endHandle = 0xffff;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       this.writeAtt(
         this.readByGroupTypeRequest(
           startHandle,
@@ -925,7 +1046,6 @@ class Gatt extends EventEmitter {
         doneFlag = true;
       } else {
         startHandle = lastEndHandle + 1;
-        lastSend = 0;
         send();
       }
     };
@@ -935,6 +1055,50 @@ class Gatt extends EventEmitter {
     );
   }
 
+  readDatabaseHash() {
+    // Database Hash characteristic read by type, no discovery needed
+    let doneFlag = false;
+
+    const done = () => doneFlag;
+
+    const send = () => {
+      if (doneFlag) return;
+      this.writeAtt(
+        this.readByTypeRequest(0x0001, 0xffff, GATT_DATABASE_HASH_UUID)
+      );
+    };
+
+    const error = (opcode, handle, ecode) => {
+      if (opcode === ATT_OP_READ_BY_TYPE_REQ) {
+        // Not supported by the server (GATT before 5.1)
+        this.emit("databaseHash", this._address, undefined);
+        doneFlag = true;
+      }
+    };
+
+    const recv = (data) => {
+      // Format of Read By Type Response
+      // uint8_t opcode = 0x09;
+      // uint8_t length; // 18
+      // uint16_t handle;
+      // uint8_t hash[16];
+      const opcode = data.readUInt8(0);
+      if (opcode !== ATT_OP_READ_BY_TYPE_RESP) return;
+      const length = data.readUInt8(1);
+      const hash =
+        length === 18 && data.length >= 20
+          ? Buffer.from(data.subarray(4, 20))
+          : undefined;
+      debug("Gatt.readDatabaseHash: %s %o", this._address, hash);
+      this.emit("databaseHash", this._address, hash);
+      doneFlag = true;
+    };
+
+    this._queueRequest(
+      new AttRequest(this, { done, send, error, recv }, ATT_TIMEOUT)
+    );
+  }
+
   discoverIncludedServices(serviceUuid) {
     const service = this._services[serviceUuid];
     if (!service) throw new Error("service not found " + serviceUuid);
@@ -944,13 +1108,11 @@ class Gatt extends EventEmitter {
     let doneFlag = false;
     let startHandle = service.startHandle;
     let endHandle = service.endHandle;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       this.writeAtt(
         this.readByTypeRequest(startHandle, endHandle, GATT_INCLUDED_SVC_UUID)
       );
@@ -1029,7 +1191,6 @@ class Gatt extends EventEmitter {
         doneFlag = true;
       } else {
         startHandle = lastEndHandle + 1;
-        lastSend = 0;
         send();
       }
     };
@@ -1049,13 +1210,11 @@ class Gatt extends EventEmitter {
     let doneFlag = false;
     let startHandle = service.startHandle;
     let endHandle = service.endHandle;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       this.writeAtt(
         this.readByTypeRequest(startHandle, endHandle, GATT_CHARACTERISTIC_UUID)
       );
@@ -1070,6 +1229,7 @@ class Gatt extends EventEmitter {
             serviceUuid,
             characteristics
           );
+          this.subscribeServiceChanged(characteristics);
           this.emit(
             "characteristicsDiscover",
             this._address,
@@ -1133,6 +1293,7 @@ class Gatt extends EventEmitter {
           serviceUuid,
           characteristics
         );
+        this.subscribeServiceChanged(characteristics);
         this.emit(
           "characteristicsDiscover",
           this._address,
@@ -1142,7 +1303,6 @@ class Gatt extends EventEmitter {
         doneFlag = true;
       } else {
         startHandle = lastHandle + 1;
-        lastSend = 0;
         send();
       }
     };
@@ -1177,13 +1337,11 @@ class Gatt extends EventEmitter {
     let doneFlag = false;
     let startHandle = characteristic.handle + 1;
     let endHandle = characteristic.endHandle;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       this.writeAtt(this.findInfoRequest(startHandle, endHandle));
     };
 
@@ -1268,7 +1426,6 @@ class Gatt extends EventEmitter {
         doneFlag = true;
       } else {
         startHandle = lastHandle + 1;
-        lastSend = 0;
         send();
       }
     };
@@ -1283,13 +1440,11 @@ class Gatt extends EventEmitter {
 
     let doneFlag = false;
     let attOp = ATT_OP_READ_REQ;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       if (attOp === ATT_OP_READ_REQ) {
         this.writeAtt(this.readRequest(handle));
       } else {
@@ -1334,7 +1489,6 @@ class Gatt extends EventEmitter {
       value = Buffer.concat([value, data]);
       if (data.length === this._mtu) {
         attOp = ATT_OP_READ_BLOB_REQ;
-        lastSend = 0;
         send();
       } else {
         this.emit(event, this._address, handle, value);
@@ -1357,13 +1511,11 @@ class Gatt extends EventEmitter {
 
   _write(handle, value, withoutResponse, event) {
     let doneFlag = false;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       this.writeAtt(this.writeRequest(handle, value));
     };
 
@@ -1395,7 +1547,7 @@ class Gatt extends EventEmitter {
     if (value.length > this._mtu - 3) {
       this._longWrite(handle, value, withoutResponse, event);
     } else if (withoutResponse) {
-      this._queueRequest(this.newCommand(this.writeCommand(handle, value)));
+      this.sendCommand(this.writeCommand(handle, value));
     } else {
       this._queueRequest(
         new AttRequest(this, { done, send, error, recv }, ATT_TIMEOUT)
@@ -1409,13 +1561,11 @@ class Gatt extends EventEmitter {
     let doneFlag = false;
     let attOp = ATT_OP_PREPARE_WRITE_REQ;
     let offset = 0;
-    let lastSend = 0;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       if (attOp === ATT_OP_PREPARE_WRITE_REQ) {
         const end = offset + chunkSize;
         const chunk = value.subarray(offset, end);
@@ -1441,7 +1591,7 @@ class Gatt extends EventEmitter {
       }
     };
 
-    const recv = (sentChunk) => (data) => {
+    const recv = (data) => {
       // Format of Prepare Write Response
       // uint8_t opcode = 0x17;
       // uint16_t handle; // The handle of the attribute to be written
@@ -1467,9 +1617,14 @@ class Gatt extends EventEmitter {
 
       // The response MUST contain the data packet echoed back to the caller
       const handle_ = data.readUInt16LE(1);
-      let offset = data.readUInt16LE(3);
+      const offset_ = data.readUInt16LE(3);
       data = data.subarray(5);
-      if (handle_ !== handle || data.length !== sentChunk.length) {
+      const sentChunk = value.subarray(offset, offset + chunkSize);
+      if (
+        handle_ !== handle ||
+        offset_ !== offset ||
+        data.length !== sentChunk.length
+      ) {
         debug(
           "Gatt._longWrite: bad response %s handle %d",
           this._address,
@@ -1490,11 +1645,9 @@ class Gatt extends EventEmitter {
 
       offset += chunkSize;
       if (offset < value.length) {
-        lastSend = 0;
         send();
       } else {
         attOp = ATT_OP_EXECUTE_WRITE_REQ;
-        lastSend = 0;
         send();
       }
     };
@@ -1515,15 +1668,13 @@ class Gatt extends EventEmitter {
   broadcast(handle, broadcast) {
     let doneFlag = false;
     let attOp = ATT_OP_READ_BY_TYPE_REQ;
-    let lastSend = 0;
     let descriptorHandle;
     let value;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       if (attOp === ATT_OP_READ_BY_TYPE_REQ) {
         const characteristic = this._characteristics[handle];
         const startHandle = characteristic
@@ -1584,7 +1735,6 @@ class Gatt extends EventEmitter {
           value = Buffer.allocUnsafe(2);
           value.writeUInt16LE(config, 0);
           attOp = ATT_OP_WRITE_REQ;
-          lastSend = 0;
           send();
           break;
         }
@@ -1610,15 +1760,13 @@ class Gatt extends EventEmitter {
   notify(handle, notify) {
     let doneFlag = false;
     let attOp = ATT_OP_READ_BY_TYPE_REQ;
-    let lastSend = 0;
     let descriptorHandle;
     let value;
 
     const done = () => doneFlag;
 
     const send = () => {
-      if (doneFlag || Date.now() - lastSend < ATT_TIMEOUT) return;
-      lastSend = Date.now();
+      if (doneFlag) return;
       if (attOp === ATT_OP_READ_BY_TYPE_REQ) {
         const characteristic = this._characteristics[handle];
         const startHandle = characteristic
@@ -1679,7 +1827,6 @@ class Gatt extends EventEmitter {
           value = Buffer.allocUnsafe(2);
           value.writeUInt16LE(config, 0);
           attOp = ATT_OP_WRITE_REQ;
-          lastSend = 0;
           send();
           break;
         }
@@ -6,8 +6,10 @@ const { randomBytes } = require("node:crypto");
 const { EventEmitter } = require("node:events");
 const os = require("node:os");
 
+const { compileBpfFilter } = require("./bpf.js");
 const { addressToBuffer, bufferToAddress } = require("./common.js");
-const { ENOMEM, ENOSYS } = require("./errno-defs.js");
+const { EINVAL, ENOMEM, ENOSYS, ETIMEDOUT } = require("./errno-defs.js");
+const { formatMetrics } = require("./metrics.js");
 const {
   ACL_START,
   ACL_CONT,
@@ -87,6 +89,7 @@ const {
 const HciSocket = require("./hci-socket.js");
 const hciStatusMap = require("./hci-status.json");
 const localCommandsMap = require("./hci-local-commands.json");
+const TimerWheel = require("./timer-wheel.js");
 
 const hciEventTypeMap = {
   [HCI_EVENT_PKT]: "HCI_EVENT_PKT",
@@ -177,6 +180,20 @@ const hciAclFlagMap = {
   [ACL_PICO_BCAST]: "ACL_PICO_BCAST",
 };
 
+const HCI_COMMAND_TIMEOUT = 2000; // Command Complete / Command Status timeout (msec)
+const HCI_COMMAND_TIMER_TICK = 50; // msec
+const HCI_COMMAND_TIMER_SLOTS = 64;
+
+// Command timeouts of every adapter
+const commandTimers = new TimerWheel(
+  HCI_COMMAND_TIMER_TICK,
+  HCI_COMMAND_TIMER_SLOTS
+);
+
+// Native advertising filter flags
+const ADV_FILTER_RSSI = 0x01;
+const ADV_FILTER_DUPLICATES = 0x02;
+
 // Next Thing Co. C.H.I.P always allow duplicates
 const isNextThingChip =
   os.platform() === "linux" && os.release().indexOf("-ntc") >= 0;
@@ -202,6 +219,8 @@ class Hci extends EventEmitter {
     super();
     options = options || {};
     this._isExtended = !!options.extended;
+    // Adapter to bind, the first one up by default
+    this._requestedDeviceId = options.deviceId;
     this.addressType =
       options.addressType === undefined
         ? LE_PUBLIC_ADDRESS
@@ -212,9 +231,56 @@ class Hci extends EventEmitter {
     this._aclDataBuffers = {};
     this._aclConnections = {};
     this._aclQueue = [];
-    this._socket = new HciSocket();
+    // Kernel receive time of the frame being dispatched (msec since epoch, 0
+    // if unknown) and the socket-to-JS delay of that frame (msec)
+    this.rxTimestamp = 0;
+    this.socketDelay = 0;
+    this._socketDelayStats = { count: 0, sum: 0, max: 0 };
+    // maxL2Sockets: simultaneous LE links, 0 to discover the controller limit
+    // from the first Connection Limit Exceeded failure (restored on reset)
+    // debugfsPath: directory holding the hciN connection parameter files
+    // transport: "fake" runs an in-process controller configured by fake
+    // ({ address, extended, advertisers, advInterval, eventsPerInterval,
+    // reportsPerEvent, maxConnections, aclPktLen, aclMaxPkt })
+    this._pendingCommands = new Map(); // Commands awaiting completion by opcode, oldest first
+    this._socket = new HciSocket({
+      maxL2Sockets: options.maxL2Sockets,
+      debugfsPath: options.debugfsPath,
+      transport: options.transport,
+      fake: Object.assign({ extended: this._isExtended }, options.fake),
+    });
     this._socket.on("error", this.onSocketError.bind(this));
     this._socket.on("data", this.onSocketData.bind(this));
+    this._socket.on("batch", this.onSocketBatch.bind(this));
+    this._socket.on("advReports", this.onSocketAdvReports.bind(this));
+    this._socket.on("notifyReports", this.onSocketNotifyReports.bind(this));
+    this._socket.on("l2SocketConnect", this.onSocketL2SocketConnect.bind(this));
+    this._socket.on("aclData", this.onSocketAclData.bind(this));
+    this._socket.on("drain", this.onSocketDrain.bind(this));
+    if (options.batchSize) this.setBatchSize(options.batchSize);
+    if (options.recvPool) this.setRecvPool(options.recvPool);
+    if (options.readerThread) this.setReaderThread(options.readerThread);
+    if (options.aclReassembly) this.setAclReassembly(options.aclReassembly);
+    if (options.aclScheduler) this.setAclScheduler(true);
+    if (options.writeQueue) this.setWriteQueue(options.writeQueue);
+    if (options.commandQueue) this.setCommandQueue(options.commandQueue);
+    if (options.advReports) this.setAdvReports(options.advReports);
+    if (options.bpfFilter) this.setBpfFilter(options.bpfFilter);
+    if (options.capture) this.setCapture(options.capture);
+  }
+
+  static getDeviceList() {
+    // Local adapters ({ id, name, address, up }), bound or not
+    return HciSocket.getDeviceList().map((device) => ({
+      id: device.id,
+      name: device.name,
+      address: bufferToAddress(device.address, 0),
+      up: device.up,
+    }));
+  }
+
+  get deviceId() {
+    return this._deviceId;
   }
 
   availableL2Sockets() {
@@ -225,12 +291,227 @@ class Hci extends EventEmitter {
     this._socket.setAuth(!!enabled);
   }
 
+  setConnectionParameters(
+    minInterval,
+    maxInterval,
+    latency,
+    supervisionTimeout
+  ) {
+    debug(
+      "Hci.setConnectionParameters: minInterval %d, maxInterval %d, latency %d, supervisionTimeout %d",
+      minInterval,
+      maxInterval,
+      latency,
+      supervisionTimeout
+    );
+    this._socket.setConnectionParameters(
+      minInterval,
+      maxInterval,
+      latency,
+      supervisionTimeout
+    );
+  }
+
   setEncrypt(enabled) {
     this._socket.setEncrypt(!!enabled);
   }
 
+  setBatchSize(batchSize) {
+    this._socket.setBatchSize(batchSize | 0);
+  }
+
+  setRecvPool(slots) {
+    // Frames are read into pooled slots handed over as external buffers, a slot
+    // returns to the pool once its buffer (and every subarray of it) is collected
+    this._socket.setRecvPool(slots | 0);
+  }
+
+  setReaderThread(slots) {
+    // A native thread drains the socket into a ring of the given number of
+    // frames, away from GC pauses and slow listeners, frames are then handed
+    // over in batches (0 reads from the event loop again)
+    this._socket.setReaderThread(slots | 0);
+  }
+
+  getReaderStats() {
+    return this._socket.getReaderStats();
+  }
+
+  setAclReassembly(maxPdu, timeout) {
+    // Fragmented L2CAP PDUs are reassembled natively and emitted whole,
+    // unfragmented ones still go through onHciAclDataPkt (0 disables)
+    this._socket.setAclReassembly(maxPdu | 0, timeout | 0);
+  }
+
+  setWriteQueue(maxBytes) {
+    // Non-blocking writes: packets the socket can't take yet are queued (up to
+    // maxBytes) and sent when it becomes writable, 0 restores blocking writes
+    this._socket.setWriteQueue(maxBytes | 0);
+  }
+
+  setCommandQueue(maxQueued) {
+    // HCI commands are held natively until the controller grants credits and
+    // sent as soon as it does, up to maxQueued waiting (0 disables)
+    this._socket.setCommandQueue(maxQueued | 0);
+  }
+
+  sendCommand(packet, timeout = HCI_COMMAND_TIMEOUT) {
+    // Resolves with the return parameters following the status of Command
+    // Complete (empty for Command Status), rejects on a failure status or when
+    // neither came within timeout msec, or right away when the native command
+    // or write queue is full (ENOBUFS). An LE Create Connection taken over by
+    // an L2CAP socket settles from the socket's outcome when it never reaches
+    // the controller. Completions are matched by opcode only: one for the same
+    // command issued by the kernel settles the oldest pending one. Unawaited
+    // commands may fail silently, as they did when writing without waiting.
+    const opcode = packet.readUInt16LE(1);
+    let command;
+    const promise = new Promise((resolve, reject) => {
+      command = { opcode, resolve, reject };
+      command.timer = commandTimers.schedule(
+        () => this.onCommandTimeout(command),
+        timeout
+      );
+      let commands = this._pendingCommands.get(opcode);
+      if (!commands) {
+        commands = [];
+        this._pendingCommands.set(opcode, commands);
+      }
+      commands.push(command);
+    });
+    promise.catch(() => {});
+    try {
+      this._socket.write(packet);
+    } catch (error) {
+      // Never queued, no credit to give back
+      debug("Hci.sendCommand: %s %o", hciCommandMap[opcode], error);
+      this.removeCommand(command);
+      commandTimers.cancel(command.timer);
+      command.reject(error);
+    }
+    return promise;
+  }
+
+  removeCommand(command) {
+    const commands = this._pendingCommands.get(command.opcode);
+    const index = commands ? commands.indexOf(command) : -1;
+    if (index < 0) return false;
+    commands.splice(index, 1);
+    if (commands.length === 0) this._pendingCommands.delete(command.opcode);
+    return true;
+  }
+
+  completeCommand(opcode, status, parameters) {
+    const commands = this._pendingCommands.get(opcode);
+    if (!commands) return;
+    const command = commands.shift();
+    if (commands.length === 0) this._pendingCommands.delete(opcode);
+    commandTimers.cancel(command.timer);
+    if (status === HCI_SUCCESS) {
+      command.resolve(parameters);
+    } else {
+      const error = new Error(
+        `${hciCommandMap[opcode] || opcode}: ${hciStatusMap[status]}`
+      );
+      error.opcode = opcode;
+      error.status = status;
+      command.reject(error);
+    }
+  }
+
+  abortPendingCommand(opcode, errno) {
+    // Settles the oldest command with opcode that will get no completion
+    const commands = this._pendingCommands.get(opcode);
+    if (!commands) return;
+    const command = commands[0];
+    this.removeCommand(command);
+    commandTimers.cancel(command.timer);
+    if (errno === 0) {
+      command.resolve(Buffer.alloc(0));
+      return;
+    }
+    const error = new Error(`${hciCommandMap[opcode]}: errno ${errno}`);
+    error.opcode = opcode;
+    error.errno = errno;
+    command.reject(error);
+  }
+
+  onCommandTimeout(command) {
+    if (!this.removeCommand(command)) return;
+    debug("Hci.onCommandTimeout: %s", hciCommandMap[command.opcode]);
+    // Withdraws the command if still queued natively, gives the credit back if
+    // sent, so that commands queued behind it are not held forever
+    this._socket.abortCommand(command.opcode);
+    const error = new Error(`${hciCommandMap[command.opcode]}: timeout`);
+    error.opcode = command.opcode;
+    error.errno = ETIMEDOUT;
+    command.reject(error);
+  }
+
+  write(packet) {
+    // Returns false when the packet was queued, wait for "drain" before writing more
+    // Throws ENOBUFS when it doesn't fit in the native command or write queue
+    return this._socket.write(packet) !== false;
+  }
+
+  inject(packet) {
+    // Fake transport only: deliver an HCI packet as if sent by the controller
+    this._socket.inject(packet);
+  }
+
+  setCapture(bytes) {
+    // Every frame read or written is recorded natively in a btsnoop ring of
+    // the given size (oldest frames are overwritten), 0 disables capture
+    this._socket.setCapture(bytes | 0);
+  }
+
+  dumpCapture(path) {
+    this._socket.dumpCapture(path);
+  }
+
+  streamCapture(path) {
+    // Continuously write captured frames to path from a background thread,
+    // no path stops streaming
+    this._socket.streamCapture(path);
+  }
+
+  setAclScheduler(enabled) {
+    // ACL fragments are queued natively per handle and sent round-robin as
+    // controller buffers are released by Number Of Completed Packets events
+    this._aclScheduler = !!enabled;
+    if (!this._aclScheduler) {
+      this._socket.setAclTxBuffers(0, 0);
+    } else if (this._aclBuffers) {
+      this._socket.setAclTxBuffers(
+        this._aclBuffers.pktLen,
+        this._aclBuffers.maxPkt
+      );
+    }
+  }
+
+  setAclMaxPdu(handle, maxPdu) {
+    this._socket.setAclMaxPdu(handle, maxPdu | 0);
+  }
+
+  setAdvReports(capacity) {
+    // Advertising reports are decoded natively into reusable typed arrays (one per field)
+    this._advReports = this._socket.setAdvReports(capacity | 0);
+    return this._advReports;
+  }
+
+  setNotifyReports(capacity) {
+    // Notifications of subscribed attributes are delivered natively into
+    // reusable typed arrays, skipping the ACL and ATT layers
+    this._notifyReports = this._socket.setNotifyReports(capacity | 0);
+    return this._notifyReports;
+  }
+
+  setNotifySubscription(handle, attHandle, enabled) {
+    this._socket.setNotifySubscription(handle, attHandle, !!enabled);
+  }
+
   start() {
-    this._deviceId = this._socket.bind();
+    this._deviceId = this._socket.bind(this._requestedDeviceId);
     debug("Hci.start: deviceId %d", this._deviceId);
     this.setSocketFilter();
     this._socket.start();
@@ -254,6 +535,7 @@ class Hci extends EventEmitter {
   }
 
   setAclBuffers(pktLen, maxPkt) {
+    if (this._aclScheduler) this._socket.setAclTxBuffers(pktLen, maxPkt);
     if (this._aclBuffers) {
       this._aclBuffers.pktLen = pktLen;
       this._aclBuffers.maxPkt = maxPkt;
@@ -263,6 +545,79 @@ class Hci extends EventEmitter {
     }
   }
 
+  setBpfFilter(filter) {
+    // Unlike setAdvFilter(), unwanted frames are dropped by the kernel, before
+    // being copied to user space (see bpf.js for the filter)
+    if (!filter) {
+      debug("Hci.setBpfFilter: detached");
+      this._socket.setBpfFilter();
+      return;
+    }
+    const program = compileBpfFilter(filter);
+    debug("Hci.setBpfFilter: %d instructions", program.length / 8);
+    this._socket.setBpfFilter(program);
+  }
+
+  setAdvFilter(filter) {
+    if (!filter) {
+      debug("Hci.setAdvFilter: cleared");
+      this._socket.setAdvFilter();
+      return;
+    }
+    const {
+      addresses = [], // Accepted addresses
+      rssi, // Minimum RSSI
+      adTypes = [], // At least one of these AD types must be present
+      manufacturerIds = [], // Accepted manufacturer specific data company IDs
+      serviceUuids = [], // Accepted service UUID prefixes
+      duplicateTtl = 0, // Drop identical reports (address + data) seen within this time (msec)
+    } = filter;
+    const uuids = serviceUuids.map((uuid) =>
+      Buffer.from(uuid.replace(/-/g, ""), "hex")
+    );
+    const packet = Buffer.allocUnsafe(
+      8 +
+        addresses.length * 6 +
+        1 +
+        adTypes.length +
+        1 +
+        manufacturerIds.length * 2 +
+        1 +
+        uuids.reduce((length, uuid) => length + 1 + uuid.length, 0)
+    );
+    let offset = 0;
+    offset = packet.writeUInt8(
+      (rssi !== undefined ? ADV_FILTER_RSSI : 0) |
+        (duplicateTtl > 0 ? ADV_FILTER_DUPLICATES : 0),
+      offset
+    );
+    offset = packet.writeInt8(rssi || 0, offset);
+    offset = packet.writeUInt32LE(duplicateTtl, offset);
+    offset = packet.writeUInt16LE(addresses.length, offset);
+    for (const address of addresses) {
+      offset += addressToBuffer(address).copy(packet, offset);
+    }
+    offset = packet.writeUInt8(adTypes.length, offset);
+    for (const adType of adTypes) {
+      offset = packet.writeUInt8(adType, offset);
+    }
+    offset = packet.writeUInt8(manufacturerIds.length, offset);
+    for (const manufacturerId of manufacturerIds) {
+      offset = packet.writeUInt16LE(manufacturerId, offset);
+    }
+    offset = packet.writeUInt8(uuids.length, offset);
+    for (const uuid of uuids) {
+      offset = packet.writeUInt8(uuid.length, offset);
+      offset += uuid.copy(packet, offset);
+    }
+    debug("Hci.setAdvFilter: %s", packet.toString("hex"));
+    this._socket.setAdvFilter(packet);
+  }
+
+  getAdvFilterStats() {
+    return this._socket.getAdvFilterStats();
+  }
+
   onSocketError(error) {
     debug("Hci.onSocketError: error %o", error);
 
@@ -275,7 +630,82 @@ class Hci extends EventEmitter {
     }
   }
 
-  onSocketData(data) {
+  onSocketL2SocketConnect(address, errno, sent) {
+    debug(
+      "Hci.onSocketL2SocketConnect: address %s, errno %d, sent %s",
+      address,
+      errno,
+      sent
+    );
+
+    if (!sent) {
+      // LE Create Connection never reached the controller, no Command Status
+      this.abortPendingCommand(OCF_LE_CREATE_CONN | (OGF_LE_CTL << 10), errno);
+    }
+    this.emit("l2SocketConnect", address, errno, sent);
+  }
+
+  onSocketAclData(handle, cid, pdu, timestamp) {
+    this.setRxTimestamp(timestamp);
+    debug(
+      "Hci.onSocketAclData: handle %d, cid %d, length %d",
+      handle,
+      cid,
+      pdu.length
+    );
+    this.emit("aclDataPkt", handle, cid, pdu);
+  }
+
+  onSocketDrain() {
+    debug("Hci.onSocketDrain");
+    this.emit("drain");
+  }
+
+  setRxTimestamp(timestamp) {
+    this.rxTimestamp = timestamp || 0;
+    if (!timestamp) {
+      this.socketDelay = 0;
+      return;
+    }
+    // The kernel timestamps frames with the wall clock: performance.now() drifts
+    // away from it, Date.now() only truncates to the millisecond
+    const delay = Math.max(0, Date.now() - timestamp);
+    const stats = this._socketDelayStats;
+    stats.count++;
+    stats.sum += delay;
+    if (delay > stats.max) stats.max = delay;
+    this.socketDelay = delay;
+  }
+
+  getStats() {
+    const stats = this._socket.getStats();
+    if (!this._aclScheduler) {
+      // Credits are accounted for here when the native scheduler is off
+      for (const connection of stats.connections) {
+        const aclConnection = this._aclConnections[connection.handle];
+        connection.pending = aclConnection ? aclConnection.pending : 0;
+        connection.queued = this._aclQueue.filter(
+          (acl) => acl.handle === connection.handle
+        ).length;
+      }
+    }
+    return stats;
+  }
+
+  getMetrics(labels) {
+    // Prometheus text exposition of getStats()
+    return formatMetrics([{ labels, stats: this.getStats() }]);
+  }
+
+  getSocketDelayStats() {
+    // Socket-to-JS delay of the frames received since the last call (msec)
+    const { count, sum, max } = this._socketDelayStats;
+    this._socketDelayStats = { count: 0, sum: 0, max: 0 };
+    return { count, mean: count ? sum / count : 0, max };
+  }
+
+  onSocketData(data, timestamp) {
+    this.setRxTimestamp(timestamp);
     try {
       // debug("Hci.onSocketData: data %o", data.toString("hex"));
       // uint8_t evt_type;
@@ -310,6 +740,30 @@ class Hci extends EventEmitter {
     }
   }
 
+  onSocketBatch(data, offsets, timestamps) {
+    // Frame i spans offsets[i] to offsets[i + 1]
+    for (let i = 0; i < offsets.length - 1; i++) {
+      this.onSocketData(
+        data.subarray(offsets[i], offsets[i + 1]),
+        timestamps && timestamps[i]
+      );
+    }
+  }
+
+  onSocketNotifyReports(count) {
+    // WARNING: arrays are reused, values must be consumed synchronously
+    const reports = this._notifyReports;
+    this.setRxTimestamp(count > 0 ? reports.timestamp[count - 1] : 0);
+    this.emit("notifyReports", count, reports);
+  }
+
+  onSocketAdvReports(count) {
+    // WARNING: arrays are reused, reports must be consumed synchronously
+    // Each report carries the receive time of its frame (timestamp column)
+    this.setRxTimestamp(count > 0 ? this._advReports.timestamp[count - 1] : 0);
+    this.emit("leAdvertisingReports", count, this._advReports);
+  }
+
   onHciCommandPkt(data) {
     // uint8_t evt_type;
     // uint16_t opcode; // OCF & OGF
@@ -533,9 +987,9 @@ class Hci extends EventEmitter {
     // uint8_t plen;
     // uint8_t ncmd;
     // ...
-    const ncmd = data.readUInt8(3);
+    const ncmd = data.readUInt8(3); // Commands the controller can take, not a count of completions
     data = data.subarray(4);
-    for (let icmd = 0; icmd < ncmd && data.length >= 3; icmd++) {
+    if (data.length >= 3) {
       // uint16_t opcode;
       // uint8_t status;
       // ...
@@ -543,14 +997,14 @@ class Hci extends EventEmitter {
       const status = data.readUInt8(2);
 
       debug(
-        "Hci.onEvtCmdComplete: %s ncmd %d/%d, dlen %d, status %d %s",
+        "Hci.onEvtCmdComplete: %s ncmd %d, dlen %d, status %d %s",
         hciCommandMap[opcode],
-        icmd,
         ncmd,
         data.length,
         status,
         hciStatusMap[status]
       );
+      this.completeCommand(opcode, status, data.subarray(3));
 
       switch (opcode) {
         case OCF_RESET | (OGF_HOST_CTL << 10): {
@@ -761,8 +1215,8 @@ class Hci extends EventEmitter {
           // uint8_t status;
           // uint16_t handle;
           // int8_t rssi;
-          const handle = result.readUInt16LE(3);
-          const rssi = result.readInt8(5);
+          const handle = data.readUInt16LE(3);
+          const rssi = data.readInt8(5);
           data = data.subarray(6);
           if (status !== HCI_SUCCESS) break;
 
@@ -773,6 +1227,7 @@ class Hci extends EventEmitter {
             rssi
           );
           this.emit("rssiRead", handle, rssi);
+          break;
         }
 
         default: {
@@ -811,6 +1266,7 @@ class Hci extends EventEmitter {
       status,
       hciStatusMap[status]
     );
+    this.completeCommand(opcode, status, data.subarray(7));
 
     switch (opcode) {
       case OCF_LE_CREATE_CONN | (OGF_LE_CTL << 10):
@@ -1061,7 +1517,9 @@ class Hci extends EventEmitter {
         advLength,
         advData,
         rssi,
-        numReports
+        numReports,
+        this.rxTimestamp,
+        this.socketDelay
       );
     }
   }
@@ -1134,7 +1592,9 @@ class Hci extends EventEmitter {
           directAddressType,
           directAddress,
           advData,
-          numReports
+          numReports,
+          this.rxTimestamp,
+          this.socketDelay
         );
       }
     } catch (error) {
@@ -1195,7 +1655,13 @@ class Hci extends EventEmitter {
       const connection = this._aclConnections[handle];
       if (connection) connection.pending++;
       debug("Hci.flushAclQueue: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      try {
+        this._socket.write(packet);
+      } catch (error) {
+        // Dropped by a full write queue, its buffer is free again
+        if (connection) connection.pending--;
+        this.onSocketError(error);
+      }
     }
   }
 
@@ -1203,6 +1669,23 @@ class Hci extends EventEmitter {
     const ACL_HEADER_SIZE = 5;
     const L2CAP_HEADER_SIZE = 4;
     const aclBuffers = await this.getAclBuffers();
+    if (this._aclScheduler) {
+      debug(
+        "Hci.writeAclDataPkt: native %d %s cid %d, length %d",
+        flags,
+        hciAclFlagMap[flags],
+        cid,
+        data.length
+      );
+      if (!this._socket.writeAcl(handle, flags, cid, data)) {
+        // Refused by the scheduler (handle or length out of range, reset)
+        const error = new Error(`writeAcl: handle ${handle}, data dropped`);
+        error.errno = EINVAL;
+        error.handle = handle;
+        this.emit("error", error);
+      }
+      return;
+    }
     let aclLength = Math.min(
       L2CAP_HEADER_SIZE + data.length,
       aclBuffers.pktLen
@@ -1281,7 +1764,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0x00, 3);
     debug("Hci.reset: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   writeConnAcceptTimeout(timeout = 32000) {
@@ -1297,7 +1780,7 @@ class Hci extends EventEmitter {
     // data
     packet.writeUInt16LE(timeout, 4);
     debug("Hci.writeConnAcceptTimeout: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   writePageTimeout(timeout = 32000) {
@@ -1310,7 +1793,7 @@ class Hci extends EventEmitter {
     // data
     packet.writeUInt16LE(timeout, 4);
     debug("Hci.writePageTimeout: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leSetRandomAddress(address) {
@@ -1325,7 +1808,7 @@ class Hci extends EventEmitter {
     address.copy(packet, 4); // peer address
 
     debug("Hci.leSetRandomAddress: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readLocalCommands() {
@@ -1336,7 +1819,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0x00, 3);
     debug("Hci.readLocalCommands: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   setPhy(txPhy = 0x05, rxPhy = 0x05) {
@@ -1352,7 +1835,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(rxPhy, 6); // rx phy: 0x01 LE 1M, 0x03 LE 1M + LE 2M, 0x05 LE 1M + LE CODED, 0x07 LE 1M + LE 2M +  LE CODED
 
     debug("Hci.setCodedPhySupport: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   setEventFilter() {
@@ -1369,7 +1852,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(0x00, 4);
     packet.writeUInt8(0x00, 5);
     debug("Hci.setEventFilter: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   setEventMask() {
@@ -1384,7 +1867,7 @@ class Hci extends EventEmitter {
     // data
     eventMask.copy(packet, 4);
     debug("Hci.setEventMask: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leSetEventMask() {
@@ -1401,7 +1884,7 @@ class Hci extends EventEmitter {
     // data
     leEventMask.copy(packet, 4);
     debug("Hci.leSetEventMask: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readLocalVersion() {
@@ -1412,7 +1895,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0, 3);
     debug("Hci.readLocalVersion: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   writeSimplePairingMode(enabled) {
@@ -1429,7 +1912,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(enabled ? 0x01 : 0x00, 4); // mode
 
     debug("Hci.writeSimplePairingMode: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   writeLeHostSupported() {
@@ -1443,7 +1926,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(0x01, 4); // LE
     packet.writeUInt8(0x00, 5); // simultaneous LE host
     debug("Hci.writeLeHostSupported: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readLeHostSupported() {
@@ -1454,7 +1937,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0, 3);
     debug("Hci.readLeHostSupported: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   deleteStoredLinkKey() {
@@ -1465,7 +1948,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0, 3);
     debug("Hci.deleteStoredLinkKey: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readBufferSize() {
@@ -1476,7 +1959,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0x00, 3);
     debug("Hci.readBufferSize: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leReadBufferSize() {
@@ -1487,7 +1970,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0, 3);
     debug("Hci.leReadBufferSize: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readBdAddr() {
@@ -1498,7 +1981,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0x00, 3);
     debug("Hci.readBdAddr: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leClearResolvingList() {
@@ -1510,7 +1993,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(0, 3);
 
     debug("Hci.leClearResolvingList: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   writeDefaultLinkPolicy() {
@@ -1527,7 +2010,7 @@ class Hci extends EventEmitter {
     packet.writeUInt16LE(0x0007, 4); // LE
 
     debug("Hci.writeDefaultLinkPolicy: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leSetScanParameters(type, interval, window, ownAddressType, filter) {
@@ -1553,7 +2036,7 @@ class Hci extends EventEmitter {
       packet.writeUInt16LE(window, 15); // phy CODED - scan window (msec * 1.6)
 
       debug("Hci.leSetScanParameters: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     } else {
       const packet = Buffer.allocUnsafe(4 + 7);
       // header
@@ -1569,7 +2052,7 @@ class Hci extends EventEmitter {
       packet.writeUInt8(filter || 0, 10); // filter: 0x00 all event types
 
       debug("Hci.leSetScanParameters: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     }
   }
 
@@ -1591,7 +2074,7 @@ class Hci extends EventEmitter {
       packet.writeUInt16LE(duration || 0, 6); // duration
       packet.writeUInt16LE(period || 0, 8); // period
       debug("Hci.leSetScanEnable: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     } else {
       const packet = Buffer.allocUnsafe(4 + 2);
       // header
@@ -1603,7 +2086,7 @@ class Hci extends EventEmitter {
       packet.writeUInt8(enabled ? 0x01 : 0x00, 4); // enable: 0 disabled, 1 enabled
       packet.writeUInt8(filterDuplicates ? 0x01 : 0x00, 5); // filterDuplicates: 0 allow duplicates, 1 filter duplicates
       debug("Hci.leSetScanEnable: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     }
   }
 
@@ -1650,7 +2133,7 @@ class Hci extends EventEmitter {
       packet.writeUInt16LE(minCeLength, 42); // phy CODED - min ce length
       packet.writeUInt16LE(maxCeLength, 44); // phy CODED - max ce length
       debug("Hci.leCreateConn: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     } else {
       const packet = Buffer.allocUnsafe(4 + 25);
       // header
@@ -1672,7 +2155,7 @@ class Hci extends EventEmitter {
       packet.writeUInt16LE(minCeLength, 25); // min ce length
       packet.writeUInt16LE(maxCeLength, 27); // max ce length
       debug("Hci.leCreateConn: write %s", packet.toString("hex"));
-      this._socket.write(packet);
+      return this.sendCommand(packet);
     }
   }
 
@@ -1685,7 +2168,7 @@ class Hci extends EventEmitter {
     packet.writeUInt8(0x0, 3);
 
     debug("Hci.leCreateConnCancel: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leClearWhiteList() {
@@ -1696,7 +2179,7 @@ class Hci extends EventEmitter {
     // length
     packet.writeUInt8(0, 3);
     debug("Hci.leClearWhiteList: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leAddDeviceToWhiteList(addressType, address) {
@@ -1716,7 +2199,7 @@ class Hci extends EventEmitter {
     addressToBuffer(address).copy(packet, 5);
 
     debug("Hci.leAddDeviceToWhiteList: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leRemoveDeviceFromWhiteList(addressType, address) {
@@ -1736,7 +2219,7 @@ class Hci extends EventEmitter {
     addressToBuffer(address).copy(packet, 5);
 
     debug("Hci.leRemoveDeviceFromWhiteList: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leConnUpdate(handle, minInterval, maxInterval, latency, supervisionTimeout) {
@@ -1755,7 +2238,7 @@ class Hci extends EventEmitter {
     packet.writeUInt16LE(0x0000, 14); // min ce length
     packet.writeUInt16LE(0x0000, 16); // max ce length
     debug("Hci.leConnUpdate: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   leStartEncryption(handle, random, diversifier, key) {
@@ -1775,7 +2258,7 @@ class Hci extends EventEmitter {
     diversifier.copy(packet, 14);
     key.copy(packet, 16);
     debug("Hci.leStartEncryption: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   disconnect(handle, reason = HCI_OE_USER_ENDED_CONNECTION) {
@@ -1789,7 +2272,7 @@ class Hci extends EventEmitter {
     packet.writeUInt16LE(handle, 4); // handle
     packet.writeUInt8(reason, 6); // reason
     debug("Hci.disconnect: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 
   readRssi(handle) {
@@ -1802,7 +2285,7 @@ class Hci extends EventEmitter {
     // data
     packet.writeUInt16LE(handle, 4); // handle
     debug("Hci.readRssi: write %s", packet.toString("hex"));
-    this._socket.write(packet);
+    return this.sendCommand(packet);
   }
 }
 
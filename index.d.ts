@@ -10,9 +10,106 @@ export declare const GattDefs: any;
 export declare const HciDefs: any;
 export declare const SmpDefs: any;
 
+// Decoded advertising reports, one typed array per field, reused across events
+export interface AdvReports {
+    type: Uint16Array;
+    addressType: Uint8Array;
+    address: Float64Array;
+    rssi: Int8Array;
+    advOffset: Uint32Array;
+    advLength: Uint8Array;
+    extended: Uint8Array;
+    numReports: Uint8Array;
+    primaryPhy: Uint8Array;
+    secondaryPhy: Uint8Array;
+    sid: Uint8Array;
+    txPower: Int8Array;
+    periodicAdvInterval: Uint16Array;
+    directAddressType: Uint8Array;
+    directAddress: Float64Array;
+    timestamp: Float64Array;
+    payload: Buffer;
+}
+
+// Notifications of subscribed characteristics, one typed array per field, reused across events
+export interface NotifyReports {
+    connectionHandle: Uint16Array;
+    handle: Uint16Array;
+    valueOffset: Uint32Array;
+    valueLength: Uint16Array;
+    timestamp: Float64Array;
+    payload: Buffer;
+}
+
+export interface HciTraffic {
+    frames: number;
+    bytes: number;
+}
+
+// Latency histogram (usec), buckets[i] counts the samples below bounds[i] not counted by the previous buckets
+export interface HciHistogram {
+    count: number;
+    sum: number;
+    buckets: number[];
+    bounds: number[];
+}
+
+export interface HciStats {
+    rx: { unknown: HciTraffic; command: HciTraffic; acl: HciTraffic; sco: HciTraffic; event: HciTraffic; iso: HciTraffic };
+    tx: { unknown: HciTraffic; command: HciTraffic; acl: HciTraffic; sco: HciTraffic; event: HciTraffic; iso: HciTraffic };
+    events: { [code: number]: HciTraffic };
+    leEvents: { [subevent: number]: HciTraffic };
+    commandLatency: HciHistogram;
+    connectLatency: HciHistogram;
+    connectErrors: { [status: number]: number };
+    l2ConnectErrors: { [errno: number]: number };
+    connections: { handle: number; pending: number; queued: number }[];
+    commandQueue: { credits: number; queued: number; inFlight: number; sent: number; completed: number; timeouts: number; dropped: number };
+    writeQueue: { packets: number; bytes: number };
+    aclScheduler: { inFlight: number; queued: number; sent: number; dropped: number; completed: number };
+    aclReassembly: { complete: number; oversized: number; malformed: number; orphaned: number; stale: number };
+    recvPool: { pooled: number; copied: number };
+    capture: { records: number; bytes: number; drops: number };
+    advFilter: { accepted: number; rssi: number; address: number; adType: number; manufacturerId: number; serviceUuid: number; duplicate: number };
+    reader: { capacity: number; frames: number; highWater: number; stalls: number };
+    notifyReports: { subscriptions: number; delivered: number; fallback: number };
+}
+
+// Local adapter, as listed by the kernel
+export interface HciDevice {
+    id: number;
+    name: string;
+    address: string;
+    up: boolean;
+}
+
+export declare const deviceId: number;
+export declare function getDeviceList(): HciDevice[];
 export declare function availableL2Sockets(): number;
+export declare function connectionCount(): number;
 export declare function setAuth(enabled: boolean): void;
+export declare function setGattCache(directory: string | null): void;
+export declare function setConnectionParameters(minInterval: number, maxInterval: number, latency: number, supervisionTimeout: number): void;
 export declare function setEncrypt(enabled: boolean): void;
+export declare function setBatchSize(batchSize: number): void;
+export declare function setRecvPool(slots: number): void;
+export declare function setReaderThread(slots: number): void;
+export declare function getReaderStats(): { capacity: number; frames: number; highWater: number; stalls: number };
+export declare function setAclReassembly(maxPdu: number, timeout?: number): void;
+export declare function setAclScheduler(enabled: boolean): void;
+export declare function setWriteQueue(maxBytes: number): void;
+export declare function setCommandQueue(maxQueued: number): void;
+export declare function inject(packet: Buffer): void;
+export declare function setCapture(bytes: number): void;
+export declare function dumpCapture(path: string): void;
+export declare function streamCapture(path?: string): void;
+export declare function getSocketDelayStats(): { count: number; mean: number; max: number };
+export declare function setAdvReports(capacity: number): AdvReports | undefined;
+export declare function setAdvFilter(filter?: { addresses?: string[]; rssi?: number; adTypes?: number[]; manufacturerIds?: number[]; serviceUuids?: string[]; duplicateTtl?: number }): void;
+export declare function setBpfFilter(filter?: { leSubevents?: number[]; addresses?: string[]; rssi?: number; adTypes?: number[] }): void;
+export declare function getAdvFilterStats(): { accepted: number; rssi: number; address: number; adType: number; manufacturerId: number; serviceUuid: number; duplicate: number };
+export declare function getStats(): HciStats;
+export declare function getMetrics(labels?: { [label: string]: string }): string;
 
 export declare function start(): void;
 export declare function on(event: "start", listener: () => void): events.EventEmitter;
@@ -32,7 +129,7 @@ export declare function once(event: "error", listener: (error: Error) => void):
 export declare function on(event: "address", listener: (addressType: number, address: string) => void): events.EventEmitter;
 export declare function once(event: "address", listener: (addressType: number, address: string) => void): events.EventEmitter;
 
-export declare function setScanParameters(type: number, interval: number, window: number, ownAddressType: number, filter: number): void;
+export declare function setScanParameters(type: number, interval: number, window: number, ownAddressType: number, filter: number): Promise<Buffer>;
 export declare function setScanParametersAsync(type: number, interval: number, window: number, ownAddressType: number, filter: number): Promise<number>;
 export declare function on(event: "scanParametersSet", listener: (status: number) => void): events.EventEmitter;
 export declare function once(event: "scanParametersSet", listener: (status: number) => void): events.EventEmitter;
@@ -47,8 +144,10 @@ export declare function stopScanningAsync(): Promise<number>;
 export declare function on(event: "scanStop", listener: (status: number) => void): events.EventEmitter;
 export declare function once(event: "scanStop", listener: (status: number) => void): events.EventEmitter;
 
-export declare function on(event: "advertisement", listener: (type: number, addressType: number, address: string, advLength: number, advData: Buffer, rssi: number, numReports: number) => void): events.EventEmitter;
-export declare function once(event: "advertisement", listener: (type: number, addressType: number, address: string, advLength: number, advData: Buffer, rssi: number, numReports: number) => void): events.EventEmitter;
+export declare function on(event: "advertisement", listener: (type: number, addressType: number, address: string, advLength: number, advData: Buffer, rssi: number, numReports: number, timestamp: number, delay: number) => void): events.EventEmitter;
+export declare function once(event: "advertisement", listener: (type: number, addressType: number, address: string, advLength: number, advData: Buffer, rssi: number, numReports: number, timestamp: number, delay: number) => void): events.EventEmitter;
+export declare function on(event: "advertisements", listener: (count: number, reports: AdvReports) => void): events.EventEmitter;
+export declare function once(event: "advertisements", listener: (count: number, reports: AdvReports) => void): events.EventEmitter;
 export declare function on(event: "extendedAdvertisement", listener: (type: number, addressType: number, address: string, primaryPhy: number, secondaryPhy: number, sid: number, txpower: number, rssi: number, periodicAdvInterval: number, directAddressType: number, directAddress: string, advData: Buffer, numReports: number) => void): events.EventEmitter;
 export declare function once(event: "extendedAdvertisement", listener: (type: number, addressType: number, address: string, primaryPhy: number, secondaryPhy: number, sid: number, txpower: number, rssi: number, periodicAdvInterval: number, directAddressType: number, directAddress: string, advData: Buffer, numReports: number) => void): events.EventEmitter;
 
@@ -57,6 +156,15 @@ export declare function connectAsync(addressType: number, address: string, param
 export declare function on(event: "connect", listener: (status: number, handle: number, role: number, addressType: number, address: string, interval: number, latency: number, supervisionTimeout: number, masterClockAccuracy: number, localResolvablePrivateAddress: string, peerResolvablePrivateAddress: string) => void): events.EventEmitter;
 export declare function once(event: "connect", listener: (status: number, handle: number, role: number, addressType: number, address: string, interval: number, latency: number, supervisionTimeout: number, masterClockAccuracy: number, localResolvablePrivateAddress: string, peerResolvablePrivateAddress: string) => void): events.EventEmitter;
 
+export declare function on(event: "drain", listener: () => void): events.EventEmitter;
+export declare function once(event: "drain", listener: () => void): events.EventEmitter;
+
+export declare function on(event: "l2SocketConnect", listener: (address: string, errno: number, sent: boolean) => void): events.EventEmitter;
+export declare function once(event: "l2SocketConnect", listener: (address: string, errno: number, sent: boolean) => void): events.EventEmitter;
+
+export declare function bulkConnect(devices: { addressType: number; address: string }[], parameters?: any): void;
+export declare function bulkConnectAsync(devices: { addressType: number; address: string }[], parameters?: any): Promise<{ connected: string[]; failed: string[] }>;
+
 export declare function disconnect(address: string): void;
 export declare function disconnectAsync(address: string): Promise<any>;
 export declare function on(event: "disconnect", listener: (address: string, reason: number) => void): events.EventEmitter;
@@ -130,8 +238,16 @@ export declare function notifyAsync(address: string, handle: number, notify: num
 export declare function on(event: "notify", listener: (address: string, handle: number, descriptorHandle: number, notify: number, error: Error) => void): events.EventEmitter;
 export declare function once(event: "notify", listener: (address: string, handle: number, descriptorHandle: number, notify: number, error: Error) => void): events.EventEmitter;
 
-export declare function on(event: "notification", listener: (address: string, handle: number, value: Buffer) => void): events.EventEmitter;
-export declare function once(event: "notification", listener: (address: string, handle: number, value: Buffer) => void): events.EventEmitter;
+export declare function setNotificationReports(capacity: number): NotifyReports | undefined;
+export declare function subscribeNotifications(address: string, handle: number): void;
+export declare function unsubscribeNotifications(address: string, handle: number): void;
+export declare function addressOf(connectionHandle: number): string | undefined;
+export declare function on(event: "notifications", listener: (count: number, reports: NotifyReports) => void): events.EventEmitter;
+export declare function once(event: "notifications", listener: (count: number, reports: NotifyReports) => void): events.EventEmitter;
+export declare function on(event: "notification", listener: (address: string, handle: number, value: Buffer, timestamp: number, delay: number) => void): events.EventEmitter;
+export declare function once(event: "notification", listener: (address: string, handle: number, value: Buffer, timestamp: number, delay: number) => void): events.EventEmitter;
+export declare function on(event: "serviceChanged", listener: (address: string, startHandle: number, endHandle: number) => void): events.EventEmitter;
+export declare function once(event: "serviceChanged", listener: (address: string, startHandle: number, endHandle: number) => void): events.EventEmitter;
 
 export declare function readDescriptor(address: string, handle: number): void;
 export declare function readDescriptorAsync(address: string, handle: number): Promise<any>;
@@ -143,3 +259,22 @@ export declare function writeDescriptorAsync(address: string, handle: number, va
 export declare function on(event: "writeDescriptor", listener: (address: string, handle: number, value: Buffer, error: Error) => void): events.EventEmitter;
 export declare function once(event: "writeDescriptor", listener: (address: string, handle: number, value: Buffer, error: Error) => void): events.EventEmitter;
 
+// Several local adapters driven as one central, every event carries the adapter id as last argument
+export declare class MultiCentral extends events.EventEmitter {
+    constructor(options?: { deviceIds?: number[]; readerThread?: number; [option: string]: any });
+    static getDeviceList(): HciDevice[];
+    readonly centrals: Map<number, any>;
+    getCentral(deviceId: number): any;
+    getDeviceId(address: string): number | undefined;
+    availableL2Sockets(): number;
+    connectionCount(): number;
+    leastLoaded(): number;
+    getReaderStats(): { [deviceId: number]: { capacity: number; frames: number; highWater: number; stalls: number } };
+    getAdvFilterStats(): { [deviceId: number]: { accepted: number; rssi: number; address: number; adType: number; manufacturerId: number; serviceUuid: number; duplicate: number } };
+    getStats(): { [deviceId: number]: HciStats };
+    getMetrics(labels?: { [label: string]: string }): string;
+    connect(addressType: number, address: string, parameters: any): void;
+    connectAsync(addressType: number, address: string, parameters: any): Promise<any>;
+    cancelConnect(address: string): void;
+    [method: string]: any;
+}
@@ -1,5 +1,7 @@
 // index.js
 
 const Central = require("./central.js");
+const MultiCentral = require("./multi-central.js");
 const central = new Central();
 module.exports = central;
+module.exports.MultiCentral = MultiCentral;
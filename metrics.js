@@ -0,0 +1,269 @@
+// metrics.js
+
+// Prometheus text exposition of getStats() results
+
+const errno = require("./errno-defs.js");
+
+// Metric families: type, help
+const families = {
+  frames_total: ["counter", "HCI frames by direction and packet type"],
+  bytes_total: ["counter", "HCI bytes by direction and packet type"],
+  events_total: ["counter", "HCI events received by event code"],
+  event_bytes_total: ["counter", "HCI event bytes received by event code"],
+  le_events_total: ["counter", "LE meta events received by subevent code"],
+  command_latency_seconds: [
+    "histogram",
+    "HCI command write to Command Complete or Command Status",
+  ],
+  connect_latency_seconds: [
+    "histogram",
+    "LE Create Connection write to LE Connection Complete",
+  ],
+  connect_errors_total: ["counter", "Failed LE connections by HCI status"],
+  l2_connect_errors_total: [
+    "counter",
+    "Failed L2CAP socket connections by errno",
+  ],
+  connections: ["gauge", "Established connections"],
+  acl_pending_packets: [
+    "gauge",
+    "ACL packets sent and not completed by connection",
+  ],
+  acl_queued_packets: [
+    "gauge",
+    "ACL packets waiting for controller buffers by connection",
+  ],
+  command_queue_credits: [
+    "gauge",
+    "HCI commands the controller can currently accept",
+  ],
+  command_queue_queued: ["gauge", "HCI commands waiting for credits"],
+  command_queue_in_flight: ["gauge", "HCI commands sent and not completed"],
+  command_queue_commands_total: [
+    "counter",
+    "HCI commands handled by the native command queue",
+  ],
+  write_queue_packets: ["gauge", "Packets waiting for the socket"],
+  write_queue_bytes: ["gauge", "Bytes waiting for the socket"],
+  acl_scheduler_in_flight: [
+    "gauge",
+    "ACL fragments sent by the native scheduler and not completed",
+  ],
+  acl_scheduler_fragments_total: [
+    "counter",
+    "ACL fragments handled by the native scheduler",
+  ],
+  acl_reassembly_pdus_total: [
+    "counter",
+    "L2CAP PDUs handled by native reassembly",
+  ],
+  adv_reports_total: [
+    "counter",
+    "Advertising reports accepted or dropped by the native filter",
+  ],
+  notify_subscriptions: [
+    "gauge",
+    "Characteristics whose notifications are routed natively",
+  ],
+  notify_reports_total: [
+    "counter",
+    "Notifications of subscribed characteristics delivered in batches or by the ATT layer",
+  ],
+  recv_pool_frames_total: [
+    "counter",
+    "Frames received into pooled slots or copied",
+  ],
+  reader_frames_total: ["counter", "Frames received by the reader thread"],
+  reader_stalls_total: [
+    "counter",
+    "Times the reader thread waited for the ring to have room",
+  ],
+  reader_high_water: ["gauge", "Highest number of reader ring slots in use"],
+  reader_capacity: ["gauge", "Reader ring slots"],
+  capture_records_total: ["counter", "Frames captured in btsnoop format"],
+  capture_bytes_total: ["counter", "Bytes captured in btsnoop format"],
+  capture_drops_total: [
+    "counter",
+    "Frames lost because the capture ring was full",
+  ],
+};
+
+const errnoNames = {};
+for (const [name, value] of Object.entries(errno)) {
+  if (errnoNames[value] === undefined) errnoNames[value] = name;
+}
+
+function hex(code) {
+  return "0x" + Number(code).toString(16).padStart(2, "0");
+}
+
+function formatLabels(labels) {
+  const pairs = Object.entries(labels).map(([name, value]) => {
+    const escaped = String(value)
+      .replace(/\\/g, "\\\\")
+      .replace(/"/g, '\\"')
+      .replace(/\n/g, "\\n");
+    return `${name}="${escaped}"`;
+  });
+  return pairs.length ? `{${pairs.join(",")}}` : "";
+}
+
+function formatValue(value) {
+  return value === Infinity ? "+Inf" : String(value);
+}
+
+// Samples are grouped by family under a single HELP / TYPE header, whatever
+// the order they are added in (e.g. one adapter after the other)
+class MetricSet {
+  constructor(prefix) {
+    this._prefix = prefix;
+    this._samples = new Map(); // Sample lines by family
+  }
+
+  add(family, labels, value, suffix = "") {
+    let samples = this._samples.get(family);
+    if (!samples) {
+      samples = [];
+      this._samples.set(family, samples);
+    }
+    const name = `${this._prefix}_${family}${suffix}`;
+    samples.push(`${name}${formatLabels(labels)} ${formatValue(value)}`);
+  }
+
+  // Bucket counts from getStats() are per bucket with bounds in usec,
+  // Prometheus wants them cumulative with bounds in seconds
+  addHistogram(family, labels, histogram) {
+    let cumulative = 0;
+    for (let i = 0; i < histogram.buckets.length; i++) {
+      cumulative += histogram.buckets[i];
+      const le = formatValue(histogram.bounds[i] / 1e6);
+      this.add(family, { ...labels, le }, cumulative, "_bucket");
+    }
+    this.add(family, labels, histogram.sum / 1e6, "_sum");
+    this.add(family, labels, histogram.count, "_count");
+  }
+
+  toString() {
+    let text = "";
+    for (const [family, samples] of this._samples) {
+      const [type, help] = families[family];
+      const name = `${this._prefix}_${family}`;
+      text += `# HELP ${name} ${help}\n# TYPE ${name} ${type}\n`;
+      text += samples.join("\n") + "\n";
+    }
+    return text;
+  }
+}
+
+function addCounts(metrics, family, labels, label, counts, format) {
+  for (const [key, count] of Object.entries(counts)) {
+    const value = format ? format(key) : key;
+    metrics.add(family, { ...labels, [label]: value }, count);
+  }
+}
+
+function addStats(metrics, labels, stats) {
+  for (const direction of ["rx", "tx"]) {
+    for (const [type, traffic] of Object.entries(stats[direction])) {
+      const sampleLabels = { ...labels, direction, type };
+      metrics.add("frames_total", sampleLabels, traffic.frames);
+      metrics.add("bytes_total", sampleLabels, traffic.bytes);
+    }
+  }
+  for (const [code, traffic] of Object.entries(stats.events)) {
+    const sampleLabels = { ...labels, code: hex(code) };
+    metrics.add("events_total", sampleLabels, traffic.frames);
+    metrics.add("event_bytes_total", sampleLabels, traffic.bytes);
+  }
+  for (const [subevent, traffic] of Object.entries(stats.leEvents)) {
+    const sampleLabels = { ...labels, subevent: hex(subevent) };
+    metrics.add("le_events_total", sampleLabels, traffic.frames);
+  }
+
+  metrics.addHistogram("command_latency_seconds", labels, stats.commandLatency);
+  metrics.addHistogram("connect_latency_seconds", labels, stats.connectLatency);
+  addCounts(
+    metrics,
+    "connect_errors_total",
+    labels,
+    "status",
+    stats.connectErrors,
+    hex
+  );
+  addCounts(
+    metrics,
+    "l2_connect_errors_total",
+    labels,
+    "errno",
+    stats.l2ConnectErrors,
+    (code) => errnoNames[code] || code
+  );
+
+  metrics.add("connections", labels, stats.connections.length);
+  for (const { handle, pending, queued } of stats.connections) {
+    metrics.add("acl_pending_packets", { ...labels, handle }, pending);
+    metrics.add("acl_queued_packets", { ...labels, handle }, queued);
+  }
+  const { credits, queued, inFlight: commands, ...commandQueue } =
+    stats.commandQueue;
+  metrics.add("command_queue_credits", labels, credits);
+  metrics.add("command_queue_queued", labels, queued);
+  metrics.add("command_queue_in_flight", labels, commands);
+  addCounts(
+    metrics,
+    "command_queue_commands_total",
+    labels,
+    "state",
+    commandQueue
+  );
+  metrics.add("write_queue_packets", labels, stats.writeQueue.packets);
+  metrics.add("write_queue_bytes", labels, stats.writeQueue.bytes);
+
+  const { inFlight, ...scheduler } = stats.aclScheduler;
+  metrics.add("acl_scheduler_in_flight", labels, inFlight);
+  addCounts(
+    metrics,
+    "acl_scheduler_fragments_total",
+    labels,
+    "state",
+    scheduler
+  );
+  addCounts(
+    metrics,
+    "acl_reassembly_pdus_total",
+    labels,
+    "result",
+    stats.aclReassembly
+  );
+  addCounts(metrics, "adv_reports_total", labels, "result", stats.advFilter);
+  const { subscriptions, ...notifyReports } = stats.notifyReports;
+  metrics.add("notify_subscriptions", labels, subscriptions);
+  addCounts(metrics, "notify_reports_total", labels, "result", notifyReports);
+  addCounts(
+    metrics,
+    "recv_pool_frames_total",
+    labels,
+    "result",
+    stats.recvPool
+  );
+
+  const { reader, capture } = stats;
+  metrics.add("reader_frames_total", labels, reader.frames);
+  metrics.add("reader_stalls_total", labels, reader.stalls);
+  metrics.add("reader_high_water", labels, reader.highWater);
+  metrics.add("reader_capacity", labels, reader.capacity);
+  metrics.add("capture_records_total", labels, capture.records);
+  metrics.add("capture_bytes_total", labels, capture.bytes);
+  metrics.add("capture_drops_total", labels, capture.drops);
+}
+
+// entries: [{ labels, stats }], e.g. one entry per adapter labelled by device
+function formatMetrics(entries, prefix = "ble_hci") {
+  const metrics = new MetricSet(prefix);
+  for (const { labels, stats } of entries) {
+    addStats(metrics, labels || {}, stats);
+  }
+  return metrics.toString();
+}
+
+module.exports = { formatMetrics };
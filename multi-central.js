@@ -0,0 +1,339 @@
+// multi-central.js
+
+const debug = require("debug")("ble-hci-central:multi-central");
+
+const { EventEmitter } = require("node:events");
+
+const Central = require("./central.js");
+const Hci = require("./hci.js");
+const { HCI_SUCCESS } = require("./hci-defs.js");
+const { formatMetrics } = require("./metrics.js");
+
+const READER_THREAD_DEFAULT = 4096; // Reader thread ring per adapter (frames)
+
+// Methods taking a peer address first, routed to the adapter owning the link
+const addressMethods = [
+  "disconnect",
+  "disconnectAsync",
+  "exchangeMtu",
+  "exchangeMtuAsync",
+  "encrypt",
+  "updateConnectionParameters",
+  "updateConnectionParametersAsync",
+  "discoverServices",
+  "discoverServicesAsync",
+  "discoverIncludedServices",
+  "discoverIncludedServicesAsync",
+  "discoverCharacteristics",
+  "discoverCharacteristicsAsync",
+  "discoverDescriptors",
+  "discoverDescriptorsAsync",
+  "discoverAsync",
+  "getMtu",
+  "getServices",
+  "getServiceByUuid",
+  "getCharacteristicByUuid",
+  "getCharacteristicByHandle",
+  "getDescriptorByHandle",
+  "read",
+  "readAsync",
+  "write",
+  "writeAsync",
+  "broadcast",
+  "broadcastAsync",
+  "notify",
+  "notifyAsync",
+  "subscribeNotifications",
+  "unsubscribeNotifications",
+  "readDescriptor",
+  "readDescriptorAsync",
+  "writeDescriptor",
+  "writeDescriptorAsync",
+];
+
+// Methods applied to every adapter, async ones resolve once all adapters did
+const adapterMethods = [
+  "start",
+  "stop",
+  "reset",
+  "setAuth",
+  "setGattCache",
+  "setEncrypt",
+  "setConnectionParameters",
+  "setBatchSize",
+  "setRecvPool",
+  "setReaderThread",
+  "setAclReassembly",
+  "setAclScheduler",
+  "setWriteQueue",
+  "setCommandQueue",
+  "setCapture",
+  "setAdvReports",
+  "setAdvFilter",
+  "setNotificationReports",
+  "setBpfFilter",
+  "setScanParameters",
+  "setScanParametersAsync",
+  "startScanning",
+  "startScanningAsync",
+  "stopScanning",
+  "stopScanningAsync",
+];
+
+// Several local adapters driven as one central: scanning runs on all of them
+// and new links go to the least loaded one, so that link count and scan
+// throughput scale with the number of controllers.
+// Every event carries the id of the adapter it comes from as last argument.
+class MultiCentral extends EventEmitter {
+  constructor(options) {
+    super();
+    options = options || {};
+    // deviceIds: adapters to open, every adapter listed by the kernel by default
+    // readerThread: reader thread ring per adapter, 0 reads from the event loop
+    const deviceIds =
+      options.deviceIds ||
+      (options.transport === "fake"
+        ? [0]
+        : Hci.getDeviceList().map((device) => device.id));
+    this._centrals = new Map(); // Centrals by adapter id
+    this._owners = {}; // Adapter ids by peer address, from connect to disconnect
+    this._forwarded = new Set(); // Events forwarded from every adapter
+    for (const deviceId of deviceIds) {
+      const central = new Central(
+        Object.assign({}, options, {
+          deviceId,
+          readerThread:
+            options.readerThread === undefined
+              ? READER_THREAD_DEFAULT
+              : options.readerThread,
+          fake: Object.assign(
+            {
+              address: `c0:00:00:00:00:${(deviceId + 1)
+                .toString(16)
+                .padStart(2, "0")}`,
+            },
+            options.fake
+          ),
+        })
+      );
+      central.on("connect", this.onConnect.bind(this, deviceId));
+      central.on(
+        "l2SocketConnect",
+        this.onL2SocketConnect.bind(this, deviceId)
+      );
+      central.on("disconnect", this.onDisconnect.bind(this, deviceId));
+      this._centrals.set(deviceId, central);
+    }
+    debug("MultiCentral: deviceIds %o", deviceIds);
+
+    // Subscribe to an adapter event only once someone listens for it, Central
+    // skips work (e.g. per-report advertisement events) nobody listens for
+    this.on("newListener", (event) => {
+      if (event === "newListener" || event === "removeListener") return;
+      if (this._forwarded.has(event)) return;
+      this._forwarded.add(event);
+      for (const [deviceId, central] of this._centrals) {
+        central.on(event, (...args) => this.emit(event, ...args, deviceId));
+      }
+    });
+  }
+
+  static getDeviceList() {
+    return Hci.getDeviceList();
+  }
+
+  get centrals() {
+    return this._centrals;
+  }
+
+  getCentral(deviceId) {
+    return this._centrals.get(deviceId);
+  }
+
+  getDeviceId(address) {
+    return this._owners[address];
+  }
+
+  availableL2Sockets() {
+    let available = 0;
+    for (const central of this._centrals.values()) {
+      available += central.availableL2Sockets();
+    }
+    return available;
+  }
+
+  connectionCount() {
+    let count = 0;
+    for (const central of this._centrals.values()) {
+      count += central.connectionCount();
+    }
+    return count;
+  }
+
+  getReaderStats() {
+    const stats = {};
+    for (const [deviceId, central] of this._centrals) {
+      stats[deviceId] = central.getReaderStats();
+    }
+    return stats;
+  }
+
+  getAdvFilterStats() {
+    const stats = {};
+    for (const [deviceId, central] of this._centrals) {
+      stats[deviceId] = central.getAdvFilterStats();
+    }
+    return stats;
+  }
+
+  getStats() {
+    const stats = {};
+    for (const [deviceId, central] of this._centrals) {
+      stats[deviceId] = central.getStats();
+    }
+    return stats;
+  }
+
+  getMetrics(labels) {
+    // One set of metric families, adapters told apart by the device label
+    const entries = [];
+    for (const [deviceId, central] of this._centrals) {
+      entries.push({
+        labels: Object.assign({}, labels, { device: `hci${deviceId}` }),
+        stats: central.getStats(),
+      });
+    }
+    return formatMetrics(entries);
+  }
+
+  leastLoaded() {
+    // Fewest links established or pending, adapters with free L2CAP sockets first
+    let best;
+    let bestFull;
+    let bestCount;
+    for (const [deviceId, central] of this._centrals) {
+      const full = central.availableL2Sockets() === 0;
+      const count = central.connectionCount();
+      if (
+        best === undefined ||
+        (bestFull && !full) ||
+        (bestFull === full && count < bestCount)
+      ) {
+        best = deviceId;
+        bestFull = full;
+        bestCount = count;
+      }
+    }
+    return best;
+  }
+
+  connect(addressType, address, parameters) {
+    const deviceId = this.placeConnection(address);
+    this._centrals.get(deviceId).connect(addressType, address, parameters);
+  }
+
+  connectAsync(addressType, address, parameters) {
+    const deviceId = this.placeConnection(address);
+    return this._centrals
+      .get(deviceId)
+      .connectAsync(addressType, address, parameters);
+  }
+
+  bulkConnect(devices, parameters) {
+    // Placed one by one, so that bulk targets count towards adapter load
+    for (const device of devices) {
+      const deviceId = this.placeConnection(device.address);
+      this._centrals.get(deviceId).bulkConnect([device], parameters);
+    }
+  }
+
+  async bulkConnectAsync(devices, parameters) {
+    const groups = new Map();
+    for (const device of devices) {
+      const deviceId = this.placeConnection(device.address);
+      if (!groups.has(deviceId)) groups.set(deviceId, []);
+      groups.get(deviceId).push(device);
+      this._centrals.get(deviceId).bulkConnect([device], parameters);
+    }
+    const results = await Promise.all(
+      [...groups].map(([deviceId, group]) =>
+        this._centrals.get(deviceId).bulkConnectAsync(group, parameters)
+      )
+    );
+    return {
+      connected: results.flatMap((result) => result.connected),
+      failed: results.flatMap((result) => result.failed),
+    };
+  }
+
+  placeConnection(address) {
+    // A peer already connected or connecting stays on its adapter
+    let deviceId = this._owners[address];
+    if (deviceId === undefined) {
+      deviceId = this.leastLoaded();
+      this._owners[address] = deviceId;
+    }
+    debug(
+      "MultiCentral.placeConnection: address %s, deviceId %d",
+      address,
+      deviceId
+    );
+    return deviceId;
+  }
+
+  cancelConnect(address) {
+    const central = this.centralFor(address);
+    central.cancelConnect(address);
+    // Only an attempt already sent to the controller reports back (with an error)
+    if (
+      central._handles[address] === undefined &&
+      central._connectionInProgress?.address !== address
+    ) {
+      delete this._owners[address];
+    }
+  }
+
+  centralFor(address) {
+    const deviceId = this._owners[address];
+    if (deviceId === undefined) {
+      throw new Error(`No adapter holds a link to ${address}`);
+    }
+    return this._centrals.get(deviceId);
+  }
+
+  onConnect(deviceId, status, handle, role, addressType, address) {
+    if (status !== HCI_SUCCESS && this._owners[address] === deviceId) {
+      delete this._owners[address];
+    }
+  }
+
+  onL2SocketConnect(deviceId, address, errno) {
+    if (errno !== 0 && this._owners[address] === deviceId) {
+      delete this._owners[address];
+    }
+  }
+
+  onDisconnect(deviceId, address, reason) {
+    if (this._owners[address] === deviceId) {
+      delete this._owners[address];
+    }
+  }
+}
+
+for (const method of addressMethods) {
+  MultiCentral.prototype[method] = function (address, ...args) {
+    return this.centralFor(address)[method](address, ...args);
+  };
+}
+
+for (const method of adapterMethods) {
+  MultiCentral.prototype[method] = function (...args) {
+    const results = [];
+    for (const central of this._centrals.values()) {
+      results.push(central[method](...args));
+    }
+    return method.endsWith("Async") ? Promise.all(results) : results;
+  };
+}
+
+module.exports = MultiCentral;
@@ -0,0 +1,14 @@
+// smp-crypto.js
+
+// crypto.js functions implemented by the addon (see src/SmpCrypto.h): AES key
+// schedules are cached, no cipher object or byte reversed copy is allocated
+// per call
+
+const os = require("node:os");
+
+const { r } = require("./crypto.js");
+const {
+  SmpCrypto,
+} = require(`./lib/${os.platform()}/${os.arch()}/hci_socket.node`);
+
+module.exports = { r, ...SmpCrypto };
@@ -12,6 +12,13 @@ module.exports = Object.freeze({
   SMP_PAIRING_FAILED: 0x05,
   SMP_ENCRYPT_INFO: 0x06,
   SMP_MASTER_IDENT: 0x07,
+  SMP_PAIRING_PUBLIC_KEY: 0x0c,
+  SMP_PAIRING_DHKEY_CHECK: 0x0d,
+
+  // SMP Pairing Failed reasons
+  SMP_REASON_CONFIRM_VALUE_FAILED: 0x04,
+  SMP_REASON_INVALID_PARAMETERS: 0x0a,
+  SMP_REASON_DHKEY_CHECK_FAILED: 0x0b,
 
   // SMP Out-Of-Band mode
   OOB_DATA_DISABLE: 0x00,
@@ -5,7 +5,7 @@ const debug = require("debug")("ble-hci-central:smp");
 const { EventEmitter } = require("node:events");
 
 const { addressToBuffer } = require("./common.js");
-const crypto = require("./crypto.js");
+const crypto = require("./smp-crypto.js");
 const { ACL_START_NO_FLUSH } = require("./hci-defs.js");
 const {
   SMP_CID,
@@ -16,14 +16,32 @@ const {
   SMP_PAIRING_FAILED,
   SMP_ENCRYPT_INFO,
   SMP_MASTER_IDENT,
+  SMP_PAIRING_PUBLIC_KEY,
+  SMP_PAIRING_DHKEY_CHECK,
+  SMP_REASON_CONFIRM_VALUE_FAILED,
+  SMP_REASON_INVALID_PARAMETERS,
+  SMP_REASON_DHKEY_CHECK_FAILED,
   OOB_DATA_DISABLE,
   KEY_DIST_ENC_KEY_MASK,
   IO_CAP_NO_INPUT_NO_OUTPUT,
   AUTH_REQ_BOND_MASK,
+  AUTH_REQ_SC_MASK,
   KEY_DIST_NONE,
 } = require("./smp-defs.js");
 
-// Security Manager Protocol
+// PDU lengths, code included: peer data must not reach the native crypto short
+const SMP_PDU_LENGTHS = {
+  [SMP_PAIRING_RESPONSE]: 7,
+  [SMP_PAIRING_CONFIRM]: 17,
+  [SMP_PAIRING_RANDOM]: 17,
+  [SMP_ENCRYPT_INFO]: 17,
+  [SMP_MASTER_IDENT]: 11,
+  [SMP_PAIRING_PUBLIC_KEY]: 65,
+  [SMP_PAIRING_DHKEY_CHECK]: 17,
+};
+
+// Security Manager Protocol, initiator side: legacy pairing, or LE Secure
+// Connections (Just Works) when both sides set the SC flag in AuthReq
 class Smp extends EventEmitter {
   constructor(
     acl,
@@ -57,12 +75,13 @@ class Smp extends EventEmitter {
     const {
       ioCaps = IO_CAP_NO_INPUT_NO_OUTPUT, // NoInputNoOutput
       oobData = OOB_DATA_DISABLE, // OOB data not present
-      authReq = AUTH_REQ_BOND_MASK, // Authentication requirement (Bonding, no MITM, no SC)
+      authReq = AUTH_REQ_BOND_MASK, // Authentication requirement (Bonding, no MITM, no SC), add AUTH_REQ_SC_MASK for LE Secure Connections
       maxKeySize = 16, // Max encryption key size (128 bit)
       initiatorKeyDist = KEY_DIST_NONE, // Initiator key distribution (none)
       responderKeyDist = KEY_DIST_ENC_KEY_MASK, // Responder key distribution (EncKey)
     } = options || {};
 
+    this._keyPair = this._dhKey = this._macKey = undefined;
     this._preq = Buffer.from([
       SMP_PAIRING_REQUEST,
       ioCaps, // IO capability: NoInputNoOutput
@@ -77,8 +96,18 @@ class Smp extends EventEmitter {
   }
 
   onAclData(cid, data) {
-    if (cid !== SMP_CID) return;
+    if (cid !== SMP_CID || data.length === 0) return;
     const code = data.readUInt8(0);
+    const length = SMP_PDU_LENGTHS[code];
+    if (length !== undefined && data.length !== length) {
+      debug(
+        "Smp.onAclData: invalid length %d, data %s",
+        data.length,
+        data.toString("hex")
+      );
+      this.pairingFailed(SMP_REASON_INVALID_PARAMETERS);
+      return;
+    }
     switch (code) {
       case SMP_PAIRING_RESPONSE:
         this.onPairingResponse(data);
@@ -98,6 +127,12 @@ class Smp extends EventEmitter {
       case SMP_MASTER_IDENT:
         this.onMasterIdent(data);
         break;
+      case SMP_PAIRING_PUBLIC_KEY:
+        this.onPairingPublicKey(data);
+        break;
+      case SMP_PAIRING_DHKEY_CHECK:
+        this.onPairingDhKeyCheck(data);
+        break;
     }
   }
 
@@ -109,6 +144,18 @@ class Smp extends EventEmitter {
 
   onPairingResponse(data) {
     this._pres = data;
+    this._sc = !!(this._preq[3] & this._pres[3] & AUTH_REQ_SC_MASK);
+    if (this._sc) {
+      // LE Secure Connections: public keys first, then the responder commits
+      this._keyPair = crypto.generateKeyPair();
+      this.writeSmp(
+        Buffer.concat([
+          Buffer.from([SMP_PAIRING_PUBLIC_KEY]),
+          this._keyPair.publicKey,
+        ])
+      );
+      return;
+    }
     this._tk = Buffer.from("00000000000000000000000000000000", "hex");
     this._r = crypto.r();
     this.writeSmp(
@@ -130,10 +177,15 @@ class Smp extends EventEmitter {
 
   onPairingConfirm(data) {
     this._pcnf = data;
+    if (this._sc) this._r = crypto.r(); // Na
     this.writeSmp(Buffer.concat([Buffer.from([SMP_PAIRING_RANDOM]), this._r]));
   }
 
   onPairingRandom(data) {
+    if (this._sc) {
+      this.onScPairingRandom(data);
+      return;
+    }
     const r = data.subarray(1);
     const pcnf = Buffer.concat([
       Buffer.from([SMP_PAIRING_CONFIRM]),
@@ -152,11 +204,83 @@ class Smp extends EventEmitter {
       const stk = crypto.s1(this._tk, r, this._r);
       this.emit("stk", stk);
     } else {
-      this.writeSmp(Buffer.from([SMP_PAIRING_RANDOM, SMP_PAIRING_CONFIRM]));
-      this.emit("fail");
+      this.pairingFailed(SMP_REASON_CONFIRM_VALUE_FAILED);
     }
   }
 
+  onPairingPublicKey(data) {
+    if (!this._keyPair) return;
+    this._pkb = data.subarray(1, 65);
+    try {
+      this._dhKey = crypto.dhKey(this._keyPair.privateKey, this._pkb);
+    } catch (error) {
+      // Not a point of the curve
+      debug("Smp.onPairingPublicKey: %o", error);
+      this.pairingFailed(SMP_REASON_DHKEY_CHECK_FAILED);
+    }
+  }
+
+  onScPairingRandom(data) {
+    if (!this._dhKey) return;
+    const na = this._r;
+    const nb = data.subarray(1);
+    const pkax = this._keyPair.publicKey.subarray(0, 32);
+    const pkbx = this._pkb.subarray(0, 32);
+    // Cb = f4(PKbx, PKax, Nb, 0)
+    const cb = crypto.f4(pkbx, pkax, nb, Buffer.of(0));
+    if (!cb.equals(this._pcnf.subarray(1))) {
+      this.pairingFailed(SMP_REASON_CONFIRM_VALUE_FAILED);
+      return;
+    }
+    if (debug.enabled) {
+      // Just Works: nothing to compare with the user
+      debug("Smp.onScPairingRandom: value %d", crypto.g2(pkax, pkbx, na, nb));
+    }
+    this._nb = nb;
+    this._a = Buffer.concat([this._ia, this._iat]);
+    this._b = Buffer.concat([this._ra, this._rat]);
+    const { macKey, ltk } = crypto.f5(this._dhKey, na, nb, this._a, this._b);
+    this._macKey = macKey;
+    this._ltk = ltk;
+    // Ea = f6(MacKey, Na, Nb, 0, IOcapA, A, B)
+    const ea = crypto.f6(
+      macKey,
+      na,
+      nb,
+      Buffer.alloc(16),
+      this._preq.subarray(1, 4),
+      this._a,
+      this._b
+    );
+    this.writeSmp(Buffer.concat([Buffer.from([SMP_PAIRING_DHKEY_CHECK]), ea]));
+  }
+
+  onPairingDhKeyCheck(data) {
+    if (!this._macKey) return;
+    // Eb = f6(MacKey, Nb, Na, 0, IOcapB, B, A)
+    const eb = crypto.f6(
+      this._macKey,
+      this._nb,
+      this._r,
+      Buffer.alloc(16),
+      this._pres.subarray(1, 4),
+      this._b,
+      this._a
+    );
+    if (!eb.equals(data.subarray(1))) {
+      this.pairingFailed(SMP_REASON_DHKEY_CHECK_FAILED);
+      return;
+    }
+    // The LTK encrypts the link right away, as the STK of legacy pairing does
+    this.emit("ltk", this._ltk);
+    this.emit("stk", this._ltk);
+  }
+
+  pairingFailed(reason) {
+    this.writeSmp(Buffer.from([SMP_PAIRING_FAILED, reason]));
+    this.emit("fail");
+  }
+
   onPairingFailed(data) {
     this.emit("fail");
   }
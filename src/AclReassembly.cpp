@@ -0,0 +1,171 @@
+// AclReassembly.cpp
+
+#include "AclReassembly.h"
+
+#include <string.h>
+
+// HCI ACL packet boundary flags
+#define ACL_CONT 0x01
+#define ACL_START 0x02
+
+AclReassembly::AclReassembly() : _enabled(false), _maxPdu(0), _timeout(ACL_REASSEMBLY_TIMEOUT), _lastSweep(0), _pending(0), _counters() {
+}
+
+bool AclReassembly::enabled() const {
+    return _enabled;
+}
+
+void AclReassembly::configure(int maxPdu, uint32_t timeout) {
+    if (maxPdu <= 0) {
+        _enabled = false;
+        _pending = 0;
+        _partials.clear();
+        _partials.shrink_to_fit();
+        memset(&_counters, 0, sizeof(_counters));
+        return;
+    }
+    _enabled = true;
+    _maxPdu = maxPdu < ACL_REASSEMBLY_PDU_MAX ? maxPdu : ACL_REASSEMBLY_PDU_MAX;
+    _timeout = timeout > 0 ? timeout : ACL_REASSEMBLY_TIMEOUT;
+    if (_partials.empty()) {
+        _partials.resize(ACL_REASSEMBLY_HANDLES);
+        for (Partial& partial : _partials) {
+            partial.length = -1;
+            partial.expected = 0;
+            partial.cid = 0;
+            partial.maxPdu = 0;
+            partial.started = 0;
+        }
+    }
+}
+
+void AclReassembly::setMaxPdu(uint16_t handle, int maxPdu) {
+    if (!_enabled || handle >= ACL_REASSEMBLY_HANDLES) {
+        return;
+    }
+    _partials[handle].maxPdu = maxPdu > 0 && maxPdu < ACL_REASSEMBLY_PDU_MAX ? maxPdu : 0;
+}
+
+void AclReassembly::reset(uint16_t handle) {
+    if (!_enabled || handle >= ACL_REASSEMBLY_HANDLES) {
+        return;
+    }
+    Partial& partial = _partials[handle];
+    discard(partial);
+    partial.maxPdu = 0;
+    // Release large buffers of closed links
+    std::vector<char>().swap(partial.data);
+}
+
+bool AclReassembly::process(const char* frame, int length, uint64_t now, Pdu* pdu) {
+    // Data format
+    // uint8_t evt_type: HCI_ACLDATA_PKT (0x02)
+    // uint16_t handle: handle & flags (PB, BC)
+    // uint16_t dlen
+    // uint8_t data[0..dlen-1]
+    pdu->data = nullptr;
+    if (length < 5) {
+        return false;
+    }
+    uint16_t handle = (uint8_t)frame[1] | ((uint8_t)frame[2] << 8);
+    uint8_t flags = (handle >> 12) & 0x03;
+    handle = handle & 0x0fff;
+    int dlen = (uint8_t)frame[3] | ((uint8_t)frame[4] << 8);
+    if (dlen > length - 5) {
+        return false;
+    }
+    const char* fragment = frame + 5;
+
+    if (_pending > 0 && now - _lastSweep >= _timeout) {
+        sweep(now);
+    }
+
+    Partial& partial = _partials[handle];
+    if (flags == ACL_START) {
+        // uint16_t length
+        // uint16_t cid
+        // uint8_t data[0..length-1]
+        if (dlen < 4) {
+            return false;
+        }
+        int pduLength = (uint8_t)fragment[0] | ((uint8_t)fragment[1] << 8);
+        uint16_t cid = (uint8_t)fragment[2] | ((uint8_t)fragment[3] << 8);
+        if (pduLength == dlen - 4) {
+            // Unfragmented, left to the regular frame path
+            return false;
+        }
+        if (partial.length >= 0) {
+            // A new start aborts the previous PDU
+            _counters.malformed++;
+            discard(partial);
+        }
+        int maxPdu = partial.maxPdu > 0 ? partial.maxPdu : _maxPdu;
+        if (pduLength > maxPdu) {
+            _counters.oversized++;
+            return true;
+        }
+        if (dlen - 4 > pduLength) {
+            _counters.malformed++;
+            return true;
+        }
+        if ((int)partial.data.size() < pduLength) {
+            partial.data.resize(pduLength);
+        }
+        memcpy(partial.data.data(), fragment + 4, dlen - 4);
+        partial.length = dlen - 4;
+        partial.expected = pduLength;
+        partial.cid = cid;
+        partial.started = now;
+        _pending++;
+        return true;
+    } else if (flags == ACL_CONT) {
+        if (partial.length < 0) {
+            _counters.orphaned++;
+            return true;
+        }
+        if (now - partial.started >= _timeout) {
+            _counters.stale++;
+            discard(partial);
+            return true;
+        }
+        if (partial.length + dlen > partial.expected) {
+            _counters.malformed++;
+            discard(partial);
+            return true;
+        }
+        memcpy(partial.data.data() + partial.length, fragment, dlen);
+        partial.length += dlen;
+        if (partial.length == partial.expected) {
+            pdu->handle = handle;
+            pdu->cid = partial.cid;
+            pdu->data = partial.data.data();
+            pdu->length = partial.length;
+            _counters.complete++;
+            discard(partial);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+const AclReassembly::Counters& AclReassembly::counters() const {
+    return _counters;
+}
+
+void AclReassembly::discard(Partial& partial) {
+    if (partial.length >= 0) {
+        partial.length = -1;
+        _pending--;
+    }
+}
+
+void AclReassembly::sweep(uint64_t now) {
+    for (Partial& partial : _partials) {
+        if (partial.length >= 0 && now - partial.started >= _timeout) {
+            _counters.stale++;
+            discard(partial);
+        }
+    }
+    _lastSweep = now;
+}
@@ -0,0 +1,66 @@
+// AclReassembly.h
+
+#ifndef ACL_REASSEMBLY_H
+#define ACL_REASSEMBLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#define ACL_REASSEMBLY_HANDLES 4096
+#define ACL_REASSEMBLY_PDU_MAX 65535
+#define ACL_REASSEMBLY_TIMEOUT 10000  // msec
+
+// L2CAP PDU reassembly from HCI ACL start / continuation fragments.
+// Each handle owns a buffer sized from the L2CAP length field, reused across PDUs.
+class AclReassembly {
+   public:
+    struct Counters {
+        uint64_t complete;   // PDUs reassembled from fragments
+        uint64_t oversized;  // PDUs above the handle max PDU size
+        uint64_t malformed;  // Fragments overflowing the announced length
+        uint64_t orphaned;   // Continuations without a start
+        uint64_t stale;      // Partial PDUs discarded after the timeout
+    };
+
+    struct Pdu {
+        uint16_t handle;
+        uint16_t cid;
+        const char* data;  // Valid until the next fragment of the same handle
+        int length;
+    };
+
+    AclReassembly();
+
+    bool enabled() const;
+    void configure(int maxPdu, uint32_t timeout);
+    void setMaxPdu(uint16_t handle, int maxPdu);
+    void reset(uint16_t handle);
+    bool process(const char* frame, int length, uint64_t now, Pdu* pdu);
+    const Counters& counters() const;
+
+   private:
+    struct Partial {
+        std::vector<char> data;
+        int length;
+        int expected;
+        uint16_t cid;
+        uint16_t maxPdu;  // 0 for the default
+        uint64_t started;
+    };
+
+    void discard(Partial& partial);
+    void sweep(uint64_t now);
+
+   private:
+    bool _enabled;
+    int _maxPdu;
+    uint32_t _timeout;
+    uint64_t _lastSweep;
+    int _pending;  // Partial PDUs in progress
+    std::vector<Partial> _partials;  // By connection handle
+    Counters _counters;
+};
+
+#endif  // ACL_REASSEMBLY_H
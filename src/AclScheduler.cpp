@@ -0,0 +1,238 @@
+// AclScheduler.cpp
+
+#include "AclScheduler.h"
+
+#include <string.h>
+
+#define HCI_ACLDATA_PKT 0x02
+#define ACL_CONT 0x01
+#define ACL_HEADER_SIZE 5
+#define L2CAP_HEADER_SIZE 4
+
+AclScheduler::AclScheduler() : _pktLen(0), _maxPkt(0), _inFlight(0), _cursor(0), _counters() {
+}
+
+bool AclScheduler::enabled() const {
+    return _pktLen > 0 && _maxPkt > 0;
+}
+
+void AclScheduler::configure(int pktLen, int maxPkt) {
+    _pktLen = pktLen > 0 ? pktLen : 0;
+    _maxPkt = maxPkt > 0 ? maxPkt : 0;
+    if (!enabled()) {
+        _inFlight = 0;
+        _queues.clear();
+        _queues.shrink_to_fit();
+        _active.clear();
+        _cursor = 0;
+    } else if (_queues.empty()) {
+        _queues.resize(ACL_SCHEDULER_HANDLES);
+        for (Queue& queue : _queues) {
+            queue.head = 0;
+            queue.pending = 0;
+            queue.active = false;
+        }
+    }
+}
+
+bool AclScheduler::enqueue(uint16_t handle, uint8_t flags, uint16_t cid, const char* data, int length) {
+    if (!enabled() || handle >= ACL_SCHEDULER_HANDLES || length < 0 || length > 0xffff) {
+        return false;
+    }
+    Queue& queue = _queues[handle];
+
+    // First fragment carries the L2CAP header
+    int total = L2CAP_HEADER_SIZE + length;
+    int fragments = (total + _pktLen - 1) / _pktLen;
+    size_t offset = queue.data.size();
+    queue.data.resize(offset + total + fragments * ACL_HEADER_SIZE);
+    char* p = queue.data.data() + offset;
+
+    int aclLength = total < _pktLen ? total : _pktLen;
+    p[0] = HCI_ACLDATA_PKT;
+    p[1] = handle & 0xff;
+    p[2] = ((handle >> 8) & 0x0f) | (flags << 4);
+    p[3] = aclLength & 0xff;
+    p[4] = aclLength >> 8;
+    p[5] = length & 0xff;
+    p[6] = length >> 8;
+    p[7] = cid & 0xff;
+    p[8] = cid >> 8;
+    memcpy(p + ACL_HEADER_SIZE + L2CAP_HEADER_SIZE, data, aclLength - L2CAP_HEADER_SIZE);
+    queue.lengths.push_back(ACL_HEADER_SIZE + aclLength);
+    p += ACL_HEADER_SIZE + aclLength;
+    data += aclLength - L2CAP_HEADER_SIZE;
+    length -= aclLength - L2CAP_HEADER_SIZE;
+
+    while (length > 0) {
+        aclLength = length < _pktLen ? length : _pktLen;
+        p[0] = HCI_ACLDATA_PKT;
+        p[1] = handle & 0xff;
+        p[2] = ((handle >> 8) & 0x0f) | (ACL_CONT << 4);
+        p[3] = aclLength & 0xff;
+        p[4] = aclLength >> 8;
+        memcpy(p + ACL_HEADER_SIZE, data, aclLength);
+        queue.lengths.push_back(ACL_HEADER_SIZE + aclLength);
+        p += ACL_HEADER_SIZE + aclLength;
+        data += aclLength;
+        length -= aclLength;
+    }
+    _counters.queued += fragments;
+
+    if (!queue.active) {
+        queue.active = true;
+        _active.push_back(handle);
+    }
+    return true;
+}
+
+void AclScheduler::complete(uint16_t handle, int numPkts) {
+    if (!enabled() || handle >= ACL_SCHEDULER_HANDLES) {
+        return;
+    }
+    Queue& queue = _queues[handle];
+    if (numPkts > queue.pending) {
+        numPkts = queue.pending;
+    }
+    queue.pending -= numPkts;
+    _inFlight -= numPkts;
+    _counters.completed += numPkts;
+}
+
+void AclScheduler::remove(uint16_t handle) {
+    if (!enabled() || handle >= ACL_SCHEDULER_HANDLES) {
+        return;
+    }
+    // The controller flushes the packets of a closed link, their credits are returned
+    Queue& queue = _queues[handle];
+    _inFlight -= queue.pending;
+    _counters.dropped += queue.lengths.size();
+    queue.pending = 0;
+    queue.lengths.clear();
+    queue.head = 0;
+    std::vector<char>().swap(queue.data);
+    if (queue.active) {
+        queue.active = false;
+        for (size_t i = 0; i < _active.size(); i++) {
+            if (_active[i] == handle) {
+                _active.erase(_active.begin() + i);
+                if (_cursor > i) {
+                    _cursor--;
+                }
+                break;
+            }
+        }
+    }
+}
+
+int AclScheduler::schedule(Fragment* fragments, int max) {
+    // One fragment per handle per round, as long as the controller has buffers
+    int credits = _maxPkt - _inFlight;
+    if (max > credits) {
+        max = credits;
+    }
+    if (_active.empty() || max <= 0) {
+        return 0;
+    }
+    if (_cursor >= _active.size()) {
+        _cursor = 0;
+    }
+
+    _peek.assign(_active.size(), 0);
+    _peekOffsets.assign(_active.size(), 0);
+    int count = 0;
+    size_t idle = 0;  // Consecutive handles without a fragment left
+    size_t i = _cursor;
+    while (count < max && idle < _active.size()) {
+        Queue& queue = _queues[_active[i]];
+        size_t& peek = _peek[i];
+        if (peek < queue.lengths.size()) {
+            fragments[count].handle = _active[i];
+            fragments[count].data = queue.data.data() + queue.head + _peekOffsets[i];
+            fragments[count].length = queue.lengths[peek];
+            _peekOffsets[i] += queue.lengths[peek];
+            count++;
+            peek++;
+            idle = 0;
+        } else {
+            idle++;
+        }
+        i = (i + 1) % _active.size();
+    }
+    return count;
+}
+
+void AclScheduler::commit(const Fragment* fragments, int sent, int dropped) {
+    for (int i = 0; i < sent + dropped; i++) {
+        Queue& queue = _queues[fragments[i].handle];
+        pop(queue);
+        if (i < sent) {
+            queue.pending++;
+            _inFlight++;
+            _counters.sent++;
+        } else {
+            // The rest of the PDU is useless to the peer, up to the next start fragment
+            _counters.dropped++;
+            while (!queue.lengths.empty() && ((queue.data[queue.head + 2] >> 4) & 0x03) == ACL_CONT) {
+                pop(queue);
+                _counters.dropped++;
+            }
+        }
+    }
+
+    if (sent + dropped == 0) {
+        return;
+    }
+
+    // Drop empty queues from the rotation, resume after the last served handle
+    uint16_t last = fragments[sent + dropped - 1].handle;
+    size_t cursor = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < _active.size(); i++) {
+        Queue& queue = _queues[_active[i]];
+        if (queue.lengths.empty()) {
+            queue.active = false;
+        } else {
+            _active[n++] = _active[i];
+        }
+        if (_active[i] == last) {
+            cursor = n;
+        }
+    }
+    _active.resize(n);
+    _cursor = n > 0 ? cursor % n : 0;
+}
+
+int AclScheduler::inFlight() const {
+    return _inFlight;
+}
+
+int AclScheduler::queued(uint16_t handle) const {
+    if (!enabled() || handle >= ACL_SCHEDULER_HANDLES) {
+        return 0;
+    }
+    return (int)_queues[handle].lengths.size();
+}
+
+int AclScheduler::pending(uint16_t handle) const {
+    if (!enabled() || handle >= ACL_SCHEDULER_HANDLES) {
+        return 0;
+    }
+    return _queues[handle].pending;
+}
+
+const AclScheduler::Counters& AclScheduler::counters() const {
+    return _counters;
+}
+
+void AclScheduler::pop(Queue& queue) {
+    queue.head += queue.lengths.front();
+    queue.lengths.pop_front();
+    if (queue.lengths.empty()) {
+        queue.head = 0;
+        queue.data.clear();
+    } else if (queue.head > 4096 && queue.head * 2 > queue.data.size()) {
+        queue.data.erase(queue.data.begin(), queue.data.begin() + queue.head);
+        queue.head = 0;
+    }
+}
@@ -0,0 +1,70 @@
+// AclScheduler.h
+
+#ifndef ACL_SCHEDULER_H
+#define ACL_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+#define ACL_SCHEDULER_HANDLES 4096
+#define ACL_SCHEDULER_BATCH_MAX 64
+
+// ACL transmit scheduler: per-handle fragment queues served round-robin,
+// bounded by the controller ACL buffer credits (Number Of Completed Packets).
+class AclScheduler {
+   public:
+    struct Counters {
+        uint64_t queued;     // Fragments queued
+        uint64_t sent;       // Fragments handed to the controller
+        uint64_t dropped;    // Fragments dropped (disconnection, send failure)
+        uint64_t completed;  // Credits returned by the controller
+    };
+
+    struct Fragment {
+        uint16_t handle;
+        const char* data;  // Valid until commit()
+        int length;
+    };
+
+    AclScheduler();
+
+    bool enabled() const;
+    void configure(int pktLen, int maxPkt);
+    bool enqueue(uint16_t handle, uint8_t flags, uint16_t cid, const char* data, int length);
+    void complete(uint16_t handle, int numPkts);
+    void remove(uint16_t handle);
+    int schedule(Fragment* fragments, int max);
+    // Dropped fragments follow the sent ones and take the rest of their PDU along
+    void commit(const Fragment* fragments, int sent, int dropped);
+    int inFlight() const;
+    int queued(uint16_t handle) const;
+    int pending(uint16_t handle) const;
+    const Counters& counters() const;
+
+   private:
+    struct Queue {
+        std::vector<char> data;  // Complete HCI ACL frames, back to back
+        size_t head;
+        std::deque<uint16_t> lengths;
+        int pending;  // Fragments sent, not completed yet
+        bool active;  // Listed in _active
+    };
+
+    void pop(Queue& queue);
+
+   private:
+    int _pktLen;
+    int _maxPkt;
+    int _inFlight;
+    std::vector<Queue> _queues;  // By connection handle
+    std::vector<uint16_t> _active;  // Handles with queued fragments, round-robin order
+    size_t _cursor;
+    std::vector<size_t> _peek;  // Scratch per active handle during schedule(): fragments
+    std::vector<size_t> _peekOffsets;  // and bytes already scheduled
+    Counters _counters;
+};
+
+#endif  // ACL_SCHEDULER_H
@@ -0,0 +1,241 @@
+// AdvFilter.cpp
+
+#include "AdvFilter.h"
+
+#include <string.h>
+
+// AD types carrying service UUIDs (incomplete / complete lists)
+#define AD_TYPE_UUID16_SOME 0x02
+#define AD_TYPE_UUID16_ALL 0x03
+#define AD_TYPE_UUID32_SOME 0x04
+#define AD_TYPE_UUID32_ALL 0x05
+#define AD_TYPE_UUID128_SOME 0x06
+#define AD_TYPE_UUID128_ALL 0x07
+#define AD_TYPE_MANUFACTURER_DATA 0xff
+
+static inline uint64_t AddressToKey(const uint8_t* addr) {
+    uint64_t key = 0;
+    for (int i = 5; i >= 0; i--) {
+        key = (key << 8) | addr[i];
+    }
+    return key;
+}
+
+AdvFilter::AdvFilter() : _enabled(false), _flags(0), _rssi(0), _duplicateTtl(0), _duplicatesPurge(ADV_FILTER_DUPLICATES_PURGE), _counters() {
+}
+
+bool AdvFilter::enabled() const {
+    return _enabled;
+}
+
+void AdvFilter::clear() {
+    _enabled = false;
+    _flags = 0;
+    _rssi = 0;
+    _duplicateTtl = 0;
+    _addresses.clear();
+    _adTypes.clear();
+    _manufacturerIds.clear();
+    _serviceUuids.clear();
+    _duplicates.clear();
+    _duplicatesPurge = ADV_FILTER_DUPLICATES_PURGE;
+    memset(&_counters, 0, sizeof(_counters));
+}
+
+bool AdvFilter::parse(const uint8_t* data, int length) {
+    // Data format
+    // uint8_t flags: ADV_FILTER_RSSI (0x01), ADV_FILTER_DUPLICATES (0x02)
+    // int8_t rssi
+    // uint32_t duplicate_ttl (msec)
+    // uint16_t num_addresses
+    //  bdaddr_t address
+    // uint8_t num_ad_types
+    //  uint8_t ad_type
+    // uint8_t num_manufacturer_ids
+    //  uint16_t manufacturer_id
+    // uint8_t num_service_uuids
+    //  uint8_t uuid_length
+    //  uint8_t uuid[0..uuid_length-1] (big endian prefix)
+    const uint8_t* p = data;
+    const uint8_t* end = data + length;
+
+    clear();
+
+    if (end - p < 8) {
+        return false;
+    }
+    _flags = p[0];
+    _rssi = (int8_t)p[1];
+    _duplicateTtl = p[2] | (p[3] << 8) | (p[4] << 16) | ((uint32_t)p[5] << 24);
+    int numAddresses = p[6] | (p[7] << 8);
+    p += 8;
+
+    if (end - p < numAddresses * 6 + 1) {
+        clear();
+        return false;
+    }
+    _addresses.reserve(numAddresses);
+    for (int i = 0; i < numAddresses; i++, p += 6) {
+        _addresses.insert(AddressToKey(p));
+    }
+
+    int numAdTypes = *p++;
+    if (end - p < numAdTypes + 1) {
+        clear();
+        return false;
+    }
+    _adTypes.assign(p, p + numAdTypes);
+    p += numAdTypes;
+
+    int numManufacturerIds = *p++;
+    if (end - p < numManufacturerIds * 2 + 1) {
+        clear();
+        return false;
+    }
+    for (int i = 0; i < numManufacturerIds; i++, p += 2) {
+        _manufacturerIds.push_back(p[0] | (p[1] << 8));
+    }
+
+    int numServiceUuids = *p++;
+    for (int i = 0; i < numServiceUuids; i++) {
+        if (end - p < 1 || end - p < 1 + p[0] || p[0] > 16) {
+            clear();
+            return false;
+        }
+        _serviceUuids.emplace_back(p + 1, p + 1 + p[0]);
+        p += 1 + p[0];
+    }
+
+    _enabled = true;
+    return true;
+}
+
+bool AdvFilter::accept(const uint8_t* addr, int8_t rssi, const uint8_t* adv, int advLength, uint64_t now) {
+    if ((_flags & ADV_FILTER_RSSI) && rssi < _rssi) {
+        _counters.rssi++;
+        return false;
+    }
+    if (!_addresses.empty() && _addresses.find(AddressToKey(addr)) == _addresses.end()) {
+        _counters.address++;
+        return false;
+    }
+    if (!_adTypes.empty() && !matchAdType(adv, advLength)) {
+        _counters.adType++;
+        return false;
+    }
+    if (!_manufacturerIds.empty() && !matchManufacturerId(adv, advLength)) {
+        _counters.manufacturerId++;
+        return false;
+    }
+    if (!_serviceUuids.empty() && !matchServiceUuid(adv, advLength)) {
+        _counters.serviceUuid++;
+        return false;
+    }
+    if ((_flags & ADV_FILTER_DUPLICATES) && matchDuplicate(addr, adv, advLength, now)) {
+        _counters.duplicate++;
+        return false;
+    }
+    _counters.accepted++;
+    return true;
+}
+
+const AdvFilter::Counters& AdvFilter::counters() const {
+    return _counters;
+}
+
+bool AdvFilter::matchAdType(const uint8_t* adv, int advLength) const {
+    // AD structure: uint8_t length, uint8_t type, uint8_t data[0..length-2]
+    for (int i = 0; i + 1 < advLength && adv[i] != 0; i += adv[i] + 1) {
+        for (uint8_t adType : _adTypes) {
+            if (adv[i + 1] == adType) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool AdvFilter::matchManufacturerId(const uint8_t* adv, int advLength) const {
+    for (int i = 0; i + 1 < advLength && adv[i] != 0; i += adv[i] + 1) {
+        if (adv[i + 1] == AD_TYPE_MANUFACTURER_DATA && adv[i] >= 3 && i + 3 < advLength) {
+            uint16_t manufacturerId = adv[i + 2] | (adv[i + 3] << 8);
+            for (uint16_t id : _manufacturerIds) {
+                if (manufacturerId == id) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool AdvFilter::matchServiceUuid(const uint8_t* adv, int advLength) const {
+    for (int i = 0; i + 1 < advLength && adv[i] != 0; i += adv[i] + 1) {
+        int uuidLength;
+        switch (adv[i + 1]) {
+            case AD_TYPE_UUID16_SOME:
+            case AD_TYPE_UUID16_ALL:
+                uuidLength = 2;
+                break;
+            case AD_TYPE_UUID32_SOME:
+            case AD_TYPE_UUID32_ALL:
+                uuidLength = 4;
+                break;
+            case AD_TYPE_UUID128_SOME:
+            case AD_TYPE_UUID128_ALL:
+                uuidLength = 16;
+                break;
+            default:
+                continue;
+        }
+        int end = i + 1 + adv[i];
+        if (end > advLength) {
+            end = advLength;
+        }
+        for (int j = i + 2; j + uuidLength <= end; j += uuidLength) {
+            // UUIDs are little endian on air, prefixes are big endian
+            for (const std::vector<uint8_t>& prefix : _serviceUuids) {
+                if ((int)prefix.size() > uuidLength) {
+                    continue;
+                }
+                bool match = true;
+                for (size_t k = 0; k < prefix.size() && match; k++) {
+                    match = adv[j + uuidLength - 1 - k] == prefix[k];
+                }
+                if (match) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool AdvFilter::matchDuplicate(const uint8_t* addr, const uint8_t* adv, int advLength, uint64_t now) {
+    // FNV-1a over address and payload
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 6; i++) {
+        hash = (hash ^ addr[i]) * 0x100000001b3ULL;
+    }
+    for (int i = 0; i < advLength; i++) {
+        hash = (hash ^ adv[i]) * 0x100000001b3ULL;
+    }
+
+    auto it = _duplicates.find(hash);
+    if (it != _duplicates.end() && now < it->second) {
+        return true;
+    }
+
+    if (_duplicates.size() >= _duplicatesPurge) {
+        for (auto i = _duplicates.begin(); i != _duplicates.end();) {
+            if (now >= i->second) {
+                i = _duplicates.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        _duplicatesPurge = _duplicates.size() * 2 > ADV_FILTER_DUPLICATES_PURGE ? _duplicates.size() * 2 : ADV_FILTER_DUPLICATES_PURGE;
+    }
+    _duplicates[hash] = now + _duplicateTtl;
+    return false;
+}
@@ -0,0 +1,59 @@
+// AdvFilter.h
+
+#ifndef ADV_FILTER_H
+#define ADV_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define ADV_FILTER_RSSI 0x01
+#define ADV_FILTER_DUPLICATES 0x02
+#define ADV_FILTER_DUPLICATES_PURGE 4096
+
+// Advertising report filter, applied before reports cross into JS.
+// Every configured rule must match, rules are evaluated from the cheapest one.
+class AdvFilter {
+   public:
+    struct Counters {
+        uint64_t accepted;
+        uint64_t rssi;
+        uint64_t address;
+        uint64_t adType;
+        uint64_t manufacturerId;
+        uint64_t serviceUuid;
+        uint64_t duplicate;
+    };
+
+    AdvFilter();
+
+    bool enabled() const;
+    void clear();
+    bool parse(const uint8_t* data, int length);
+    bool accept(const uint8_t* addr, int8_t rssi, const uint8_t* adv, int advLength, uint64_t now);
+    const Counters& counters() const;
+
+   private:
+    bool matchAdType(const uint8_t* adv, int advLength) const;
+    bool matchManufacturerId(const uint8_t* adv, int advLength) const;
+    bool matchServiceUuid(const uint8_t* adv, int advLength) const;
+    bool matchDuplicate(const uint8_t* addr, const uint8_t* adv, int advLength, uint64_t now);
+
+   private:
+    bool _enabled;
+    uint8_t _flags;
+    int8_t _rssi;
+    uint32_t _duplicateTtl;
+    std::unordered_set<uint64_t> _addresses;
+    std::vector<uint8_t> _adTypes;
+    std::vector<uint16_t> _manufacturerIds;
+    std::vector<std::vector<uint8_t>> _serviceUuids;  // Big endian prefixes
+    std::unordered_map<uint64_t, uint64_t> _duplicates;  // Expiry time by report hash
+    size_t _duplicatesPurge;
+    Counters _counters;
+};
+
+#endif  // ADV_FILTER_H
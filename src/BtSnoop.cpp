@@ -0,0 +1,265 @@
+// BtSnoop.cpp
+
+#include "BtSnoop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#define BT_SNOOP_VERSION 1
+#define BT_SNOOP_HCI_UART 1002
+#define BT_SNOOP_FLAG_RECEIVED 0x01
+#define BT_SNOOP_FLAG_COMMAND_EVENT 0x02
+#define BT_SNOOP_EPOCH_DELTA 0x00dcddb30f2f8000ULL  // usec from 0000-01-01 to 1970-01-01
+
+static inline void PutUInt32BE(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static int WriteAll(int fd, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t rc = ::write(fd, p, length);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        p += rc;
+        length -= rc;
+    }
+    return 0;
+}
+
+BtSnoop::BtSnoop() : _ring(nullptr), _capacity(0), _head(0), _tail(0), _counters(), _stop(false), _streamFd(-1), _streaming(false), _streamPosition(0), _streamError(0), _wake(false) {
+}
+
+BtSnoop::~BtSnoop() {
+    close();
+}
+
+int BtSnoop::open(size_t capacity) {
+    close();
+    if (capacity == 0) {
+        return 0;
+    }
+    if (capacity < BT_SNOOP_CAPTURE_MIN) {
+        capacity = BT_SNOOP_CAPTURE_MIN;
+    } else if (capacity > BT_SNOOP_CAPTURE_MAX) {
+        capacity = BT_SNOOP_CAPTURE_MAX;
+    }
+
+    void* ring = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return errno;
+    }
+    _ring = (uint8_t*)ring;
+    _capacity = capacity;
+    _head = 0;
+    _tail = 0;
+    memset(&_counters, 0, sizeof(_counters));
+    return 0;
+}
+
+void BtSnoop::close() {
+    stopStream();
+    if (_ring != nullptr) {
+        munmap(_ring, _capacity);
+        _ring = nullptr;
+        _capacity = 0;
+    }
+}
+
+void BtSnoop::record(const char* data, int length, bool received) {
+    // uint32_t original_length
+    // uint32_t included_length
+    // uint32_t flags
+    // uint32_t cumulative_drops
+    // int64_t timestamp (usec since 0000-01-01)
+    uint64_t size = BT_SNOOP_RECORD_HEADER_SIZE + length;
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    if (size > _capacity) {
+        return;
+    }
+    if (_streaming.load(std::memory_order_relaxed)) {
+        uint64_t pending = head + size - _streamPosition.load(std::memory_order_acquire);
+        if (pending > _capacity / 2 && !_wake.load(std::memory_order_relaxed) && !_wake.exchange(true)) {
+            // Half full, don't wait for the next periodic flush
+            _cond.notify_one();
+        }
+        if (pending > _capacity) {
+            // The stream thread is behind, don't overwrite what it hasn't written yet
+            _counters.drops++;
+            return;
+        }
+    }
+
+    // Make room by discarding the oldest records
+    while (head + size - _tail > _capacity) {
+        uint8_t included[4];
+        copyOut(_tail + 4, included, 4);
+        _tail += BT_SNOOP_RECORD_HEADER_SIZE + (((uint32_t)included[0] << 24) | (included[1] << 16) | (included[2] << 8) | included[3]);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t timestamp = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 + BT_SNOOP_EPOCH_DELTA;
+    uint8_t type = length > 0 ? data[0] : 0;
+    uint32_t flags = (received ? BT_SNOOP_FLAG_RECEIVED : 0) | (type == 0x01 || type == 0x04 ? BT_SNOOP_FLAG_COMMAND_EVENT : 0);
+
+    uint8_t header[BT_SNOOP_RECORD_HEADER_SIZE];
+    PutUInt32BE(header, length);
+    PutUInt32BE(header + 4, length);
+    PutUInt32BE(header + 8, flags);
+    PutUInt32BE(header + 12, (uint32_t)_counters.drops);
+    PutUInt32BE(header + 16, timestamp >> 32);
+    PutUInt32BE(header + 20, (uint32_t)timestamp);
+    copyIn(head, header, sizeof(header));
+    copyIn(head + sizeof(header), data, length);
+    _head.store(head + size, std::memory_order_release);
+
+    _counters.records++;
+    _counters.bytes += size;
+}
+
+int BtSnoop::dump(const char* path) {
+    if (_ring == nullptr) {
+        return ENODATA;
+    }
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return errno;
+    }
+    int err = WriteHeader(fd);
+    if (err == 0) {
+        err = writeRing(fd, _tail, _head.load(std::memory_order_relaxed));
+    }
+    if (::close(fd) < 0 && err == 0) {
+        err = errno;
+    }
+    return err;
+}
+
+int BtSnoop::startStream(const char* path) {
+    if (_ring == nullptr) {
+        return ENODATA;
+    }
+    stopStream();
+
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return errno;
+    }
+    int err = WriteHeader(fd);
+    if (err != 0) {
+        ::close(fd);
+        return err;
+    }
+
+    // The stream starts with what the ring already holds
+    _streamFd = fd;
+    _streamPosition.store(_tail);
+    _streamError = 0;
+    _stop = false;
+    _wake = false;
+    _streaming = true;
+    _thread = std::thread(&BtSnoop::streamLoop, this);
+    return 0;
+}
+
+// Returns the first write error of the stream thread, if any
+int BtSnoop::stopStream() {
+    if (!_thread.joinable()) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_one();
+    _thread.join();
+    _streaming = false;
+    ::close(_streamFd);
+    _streamFd = -1;
+    return _streamError;
+}
+
+bool BtSnoop::streaming() const {
+    return _streaming;
+}
+
+const BtSnoop::Counters& BtSnoop::counters() const {
+    return _counters;
+}
+
+void BtSnoop::copyIn(uint64_t position, const void* data, size_t length) {
+    size_t offset = position % _capacity;
+    size_t first = length < _capacity - offset ? length : _capacity - offset;
+    memcpy(_ring + offset, data, first);
+    memcpy(_ring, (const uint8_t*)data + first, length - first);
+}
+
+void BtSnoop::copyOut(uint64_t position, void* data, size_t length) const {
+    size_t offset = position % _capacity;
+    size_t first = length < _capacity - offset ? length : _capacity - offset;
+    memcpy(data, _ring + offset, first);
+    memcpy((uint8_t*)data + first, _ring, length - first);
+}
+
+int BtSnoop::writeRing(int fd, uint64_t from, uint64_t to) const {
+    while (from < to) {
+        size_t offset = from % _capacity;
+        size_t length = to - from < _capacity - offset ? to - from : _capacity - offset;
+        int err = WriteAll(fd, _ring + offset, length);
+        if (err != 0) {
+            return err;
+        }
+        from += length;
+    }
+    return 0;
+}
+
+void BtSnoop::streamLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        // Flushed periodically, or early when the ring is half full
+        _cond.wait_for(lock, std::chrono::milliseconds(BT_SNOOP_STREAM_INTERVAL_MS), [this] { return _stop || _wake; });
+        bool stop = _stop;
+        _wake = false;
+
+        uint64_t head = _head.load(std::memory_order_acquire);
+        uint64_t position = _streamPosition.load(std::memory_order_relaxed);
+        if (head > position) {
+            int err = writeRing(_streamFd, position, head);
+            if (err != 0) {
+                // Give up streaming, the ring keeps capturing
+                _streamError = err;
+                _streaming = false;
+                return;
+            }
+            _streamPosition.store(head, std::memory_order_release);
+        }
+        if (stop) {
+            return;
+        }
+    }
+}
+
+int BtSnoop::WriteHeader(int fd) {
+    // uint8_t identification[8] = "btsnoop\0"
+    // uint32_t version
+    // uint32_t datalink
+    uint8_t header[BT_SNOOP_HEADER_SIZE] = {'b', 't', 's', 'n', 'o', 'o', 'p', 0};
+    PutUInt32BE(header + 8, BT_SNOOP_VERSION);
+    PutUInt32BE(header + 12, BT_SNOOP_HCI_UART);
+    return WriteAll(fd, header, sizeof(header));
+}
@@ -0,0 +1,75 @@
+// BtSnoop.h
+
+#ifndef BT_SNOOP_H
+#define BT_SNOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define BT_SNOOP_CAPTURE_MIN (64 * 1024)
+#define BT_SNOOP_CAPTURE_MAX (1024 * 1024 * 1024)
+#define BT_SNOOP_HEADER_SIZE 16
+#define BT_SNOOP_RECORD_HEADER_SIZE 24
+#define BT_SNOOP_STREAM_INTERVAL_MS 100
+
+// Capture ring of HCI frames in btsnoop format (datalink 1002, H4 framing).
+// Records are appended by the event loop thread into an anonymous memory map,
+// oldest records are overwritten. The ring can be dumped to a file on demand
+// and / or streamed to a file by a background thread; while streaming, records
+// that would overwrite data not yet written out are dropped and counted.
+class BtSnoop {
+   public:
+    struct Counters {
+        uint64_t records;  // Records captured
+        uint64_t bytes;    // Bytes captured, headers included
+        uint64_t drops;    // Records dropped while streaming
+    };
+
+    BtSnoop();
+    ~BtSnoop();
+
+    bool enabled() const {
+        return _ring != nullptr;
+    }
+    int open(size_t capacity);
+    void close();
+    void record(const char* data, int length, bool received);
+    int dump(const char* path);
+    int startStream(const char* path);
+    int stopStream();
+    bool streaming() const;
+    const Counters& counters() const;
+
+   private:
+    void copyIn(uint64_t position, const void* data, size_t length);
+    void copyOut(uint64_t position, void* data, size_t length) const;
+    int writeRing(int fd, uint64_t from, uint64_t to) const;
+    void streamLoop();
+
+    static int WriteHeader(int fd);
+
+   private:
+    uint8_t* _ring;
+    size_t _capacity;
+    std::atomic<uint64_t> _head;  // Total bytes appended
+    uint64_t _tail;  // Position of the oldest record
+    Counters _counters;
+
+    // Streaming
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _stop;
+    int _streamFd;
+    std::atomic<bool> _streaming;
+    std::atomic<uint64_t> _streamPosition;  // Bytes written to the stream file
+    std::atomic<int> _streamError;
+    std::atomic<bool> _wake;  // Early flush requested
+};
+
+#endif  // BT_SNOOP_H
@@ -0,0 +1,153 @@
+// CommandQueue.cpp
+
+#include "CommandQueue.h"
+
+#include <iterator>
+
+#define HCI_EVENT_PKT 0x04
+#define EVT_CMD_COMPLETE 0x0e
+#define EVT_CMD_STATUS 0x0f
+#define OPCODE_RESET 0x0c03
+
+CommandQueue::CommandQueue() : _maxQueued(0), _credits(1), _counters() {
+}
+
+bool CommandQueue::enabled() const {
+    return _maxQueued > 0;
+}
+
+void CommandQueue::configure(int maxQueued) {
+    _maxQueued = maxQueued > 0 ? maxQueued : 0;
+    if (!enabled()) {
+        _queue.clear();
+        _inFlight.clear();
+        _credits = 1;
+    }
+}
+
+bool CommandQueue::enqueue(const char* data, int length) {
+    if ((int)_queue.size() >= _maxQueued) {
+        _counters.dropped++;
+        return false;
+    }
+    _queue.emplace_back(data, data + length);
+    _counters.queued++;
+    return true;
+}
+
+// Moves the next command into command if the controller can take it
+bool CommandQueue::next(std::vector<char>* command) {
+    if (_queue.empty() || _credits <= 0) {
+        return false;
+    }
+    command->swap(_queue.front());
+    _queue.pop_front();
+    _credits--;
+    _counters.sent++;
+
+    if (command->size() >= 3) {
+        if (_inFlight.size() == COMMAND_QUEUE_IN_FLIGHT_MAX) {
+            _inFlight.pop_front();
+        }
+        _inFlight.push_back((uint8_t)(*command)[1] | ((uint8_t)(*command)[2] << 8));
+    }
+    return true;
+}
+
+// Returns true when queued commands can be sent
+bool CommandQueue::onEvent(const char* data, int length) {
+    if (!enabled() || length < 3 || data[0] != HCI_EVENT_PKT) {
+        return false;
+    }
+
+    if (data[1] == EVT_CMD_COMPLETE && length >= 6) {
+        // uint8_t evt_type: HCI_EVENT_PKT (0x04)
+        // uint8_t sub_evt_type: EVT_CMD_COMPLETE (0x0e)
+        // uint8_t pkt_len
+        // uint8_t ncmd
+        // uint16_t opcode
+        // ...
+        complete((uint8_t)data[4] | ((uint8_t)data[5] << 8), data[3]);
+    } else if (data[1] == EVT_CMD_STATUS && length >= 7) {
+        // uint8_t evt_type: HCI_EVENT_PKT (0x04)
+        // uint8_t sub_evt_type: EVT_CMD_STATUS (0x0f)
+        // uint8_t pkt_len
+        // uint8_t status
+        // uint8_t ncmd
+        // uint16_t opcode
+        complete((uint8_t)data[5] | ((uint8_t)data[6] << 8), data[4]);
+    } else {
+        return false;
+    }
+    return _credits > 0 && !_queue.empty();
+}
+
+// A command that never completed: like the kernel, assume the controller can
+// take one more command rather than stalling the queue forever. A command
+// still waiting for a credit is withdrawn, it must not run once given up on.
+void CommandQueue::timeout(uint16_t opcode) {
+    for (auto it = _inFlight.begin(); it != _inFlight.end(); ++it) {
+        if (*it == opcode) {
+            _inFlight.erase(it);
+            _counters.timeouts++;
+            if (_credits <= 0) {
+                _credits = 1;
+            }
+            return;
+        }
+    }
+    for (auto it = _queue.begin(); it != _queue.end(); ++it) {
+        if (it->size() >= 3 && ((uint8_t)(*it)[1] | ((uint8_t)(*it)[2] << 8)) == opcode) {
+            _queue.erase(it);
+            _counters.timeouts++;
+            return;
+        }
+    }
+}
+
+// A command returned by next() that never reached the controller (taken over
+// natively): nothing will complete it, its credit is given back
+void CommandQueue::unsent(uint16_t opcode) {
+    for (auto it = _inFlight.rbegin(); it != _inFlight.rend(); ++it) {
+        if (*it == opcode) {
+            _inFlight.erase(std::next(it).base());
+            _credits++;
+            _counters.sent--;
+            return;
+        }
+    }
+}
+
+int CommandQueue::credits() const {
+    return _credits;
+}
+
+int CommandQueue::queued() const {
+    return (int)_queue.size();
+}
+
+int CommandQueue::inFlight() const {
+    return (int)_inFlight.size();
+}
+
+const CommandQueue::Counters& CommandQueue::counters() const {
+    return _counters;
+}
+
+void CommandQueue::complete(uint16_t opcode, uint8_t ncmd) {
+    // Opcode 0x0000 only grants credits
+    _credits = ncmd;
+    if (opcode == OPCODE_RESET) {
+        // Commands sent before the reset will never complete
+        _inFlight.clear();
+        _counters.completed++;
+        return;
+    }
+    for (auto it = _inFlight.begin(); it != _inFlight.end(); ++it) {
+        if (*it == opcode) {
+            _inFlight.erase(it);
+            _counters.completed++;
+            return;
+        }
+    }
+}
@@ -0,0 +1,54 @@
+// CommandQueue.h
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+#define COMMAND_QUEUE_IN_FLIGHT_MAX 64  // Commands awaiting completion, older ones are forgotten
+
+// HCI command flow control: commands are held until the controller grants
+// credits and pipelined up to the depth it allows. Every Command Complete and
+// Command Status event carries Num_HCI_Command_Packets, the number of commands
+// the host may send from then on, and completes the oldest command in flight
+// with its opcode.
+class CommandQueue {
+   public:
+    struct Counters {
+        uint64_t queued;     // Commands queued
+        uint64_t sent;       // Commands handed to the controller
+        uint64_t completed;  // Command Complete / Command Status matched to a command in flight
+        uint64_t timeouts;   // Commands given up on
+        uint64_t dropped;    // Commands refused because the queue was full
+    };
+
+    CommandQueue();
+
+    bool enabled() const;
+    void configure(int maxQueued);
+    bool enqueue(const char* data, int length);
+    bool next(std::vector<char>* command);
+    bool onEvent(const char* data, int length);
+    void timeout(uint16_t opcode);
+    void unsent(uint16_t opcode);
+    int credits() const;
+    int queued() const;
+    int inFlight() const;
+    const Counters& counters() const;
+
+   private:
+    void complete(uint16_t opcode, uint8_t ncmd);
+
+   private:
+    int _maxQueued;  // 0 when disabled
+    int _credits;
+    std::deque<std::vector<char>> _queue;  // Complete HCI command packets
+    std::deque<uint16_t> _inFlight;  // Opcodes, oldest first
+    Counters _counters;
+};
+
+#endif  // COMMAND_QUEUE_H
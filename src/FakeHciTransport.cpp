@@ -0,0 +1,522 @@
+// FakeHciTransport.cpp
+
+#include "FakeHciTransport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Opcodes (OGF << 10 | OCF) answered with return parameters
+#define FAKE_OP_DISCONNECT 0x0406
+#define FAKE_OP_RESET 0x0c03
+#define FAKE_OP_READ_LE_HOST_SUPPORTED 0x0c6c
+#define FAKE_OP_READ_LOCAL_VERSION 0x1001
+#define FAKE_OP_READ_LOCAL_COMMANDS 0x1002
+#define FAKE_OP_READ_BUFFER_SIZE 0x1005
+#define FAKE_OP_READ_BD_ADDR 0x1009
+#define FAKE_OP_READ_RSSI 0x1405
+#define FAKE_OP_LE_READ_BUFFER_SIZE 0x2002
+#define FAKE_OP_LE_SET_SCAN_ENABLE 0x200c
+#define FAKE_OP_LE_CREATE_CONN 0x200d
+#define FAKE_OP_LE_CREATE_CONN_CANCEL 0x200e
+#define FAKE_OP_LE_CONN_UPDATE 0x2013
+#define FAKE_OP_LE_SET_EXTENDED_SCAN_ENABLE 0x2042
+#define FAKE_OP_LE_EXTENDED_CREATE_CONN 0x2043
+
+#ifndef EVT_LE_CONN_UPDATE_COMPLETE
+#define EVT_LE_CONN_UPDATE_COMPLETE 0x03
+#endif
+#ifndef EVT_LE_EXTENDED_ADVERTISING_REPORT
+#define EVT_LE_EXTENDED_ADVERTISING_REPORT 0x0d
+#endif
+#ifndef HCI_MAX_NUMBER_OF_CONNECTIONS
+#define HCI_MAX_NUMBER_OF_CONNECTIONS 0x09
+#endif
+
+#define FAKE_HANDLE_FIRST 0x0040
+#define FAKE_FRAME_MAX (HCI_MAX_FRAME_SIZE)
+
+FakeHciTransport::FakeHciTransport(const FakeControllerOptions& options, uv_loop_t* loop) : _options(options), _controllerFd(-1), _loop(loop), _pollHandle(nullptr), _timer(nullptr), _scanning(false), _extendedScan(false), _nextAdvertiser(0), _advCounter(0), _nextHandle(FAKE_HANDLE_FIRST) {
+}
+
+FakeHciTransport::~FakeHciTransport() {
+    close();
+}
+
+void FakeHciTransport::DefaultOptions(FakeControllerOptions* options) {
+    // Random static address C0:00:00:00:00:01
+    static const uint8_t address[6] = {0x01, 0x00, 0x00, 0x00, 0x00, 0xc0};
+    memcpy(options->address, address, sizeof(address));
+    options->extended = false;
+    options->advertisers = 100;
+    options->advInterval = 10;
+    options->eventsPerInterval = 1;
+    options->reportsPerEvent = 1;
+    options->maxConnections = 8;
+    options->aclPktLen = 251;
+    options->aclMaxPkt = 8;
+}
+
+int FakeHciTransport::open() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        _syscall = "socketpair@FakeHciTransport::open";
+        return errno;
+    }
+    _fd = fds[0];
+    _controllerFd = fds[1];
+
+    int flags = fcntl(_controllerFd, F_GETFL);
+    fcntl(_controllerFd, F_SETFL, flags | O_NONBLOCK);
+
+    _pollHandle = new uv_poll_t();
+    if (uv_poll_init(_loop, _pollHandle, _controllerFd) < 0) {
+        delete _pollHandle;
+        _pollHandle = nullptr;
+        _syscall = "uv_poll_init@FakeHciTransport::open";
+        return EINVAL;
+    }
+    _pollHandle->data = this;
+    _timer = new uv_timer_t();
+    uv_timer_init(_loop, _timer);
+    _timer->data = this;
+
+    // The controller does not keep the process alive by itself
+    uv_unref((uv_handle_t*)_pollHandle);
+    uv_unref((uv_handle_t*)_timer);
+    updatePoll();
+    return 0;
+}
+
+void FakeHciTransport::close() {
+    if (_pollHandle != nullptr) {
+        uv_poll_stop(_pollHandle);
+        uv_close((uv_handle_t*)_pollHandle, FakeHciTransport::CloseCallback);
+        _pollHandle = nullptr;
+    }
+    if (_timer != nullptr) {
+        uv_timer_stop(_timer);
+        uv_close((uv_handle_t*)_timer, FakeHciTransport::CloseCallback);
+        _timer = nullptr;
+    }
+    for (auto& entry : _connections) {
+        if (entry.second.l2Fd != -1) {
+            ::close(entry.second.l2Fd);
+        }
+    }
+    _connections.clear();
+    _outbox.clear();
+    if (_controllerFd != -1) {
+        ::close(_controllerFd);
+        _controllerFd = -1;
+    }
+    HciTransport::close();
+}
+
+int FakeHciTransport::deviceIdFor(const int* deviceId, bool isUp) {
+    return deviceId != nullptr ? *deviceId : 0;
+}
+
+int FakeHciTransport::bind(int deviceId, uint8_t* address, uint8_t* addressType) {
+    memcpy(address, _options.address, 6);
+    *addressType = BDADDR_LE_PUBLIC;
+    return 0;
+}
+
+bool FakeHciTransport::isDeviceUp(int deviceId) {
+    return _controllerFd != -1;
+}
+
+int FakeHciTransport::setFilter(const char* data, int length) {
+    // The controller only sends what the host asks for
+    return 0;
+}
+
+int FakeHciTransport::enableTimestamps() {
+    // Receive time of the host end as a SOL_SOCKET / SCM_TIMESTAMP control message
+    int opt = 1;
+    if (setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMP, &opt, sizeof(opt)) < 0) {
+        _syscall = "setsockopt(SOL_SOCKET,SO_TIMESTAMP)@FakeHciTransport::enableTimestamps";
+        return errno;
+    }
+    return 0;
+}
+
+int FakeHciTransport::setAuth(int deviceId, bool enabled) {
+    return 0;
+}
+
+int FakeHciTransport::setEncrypt(int deviceId, bool enabled) {
+    return 0;
+}
+
+int FakeHciTransport::l2Connect(const struct sockaddr_l2* src, const struct sockaddr_l2* dst, int* fd) {
+    // Stand-in for the kernel: the L2CAP socket is one end of a socketpair and
+    // connecting it creates the LE connection in the controller
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        _syscall = "socketpair@L2Socket::connect";
+        return errno;
+    }
+    int handle = createConnection(dst->l2_bdaddr.b, dst->l2_bdaddr_type - 1);
+    if (handle < 0) {
+        ::close(fds[1]);
+    } else {
+        _connections[handle].l2Fd = fds[1];
+    }
+    *fd = fds[0];
+    return EINPROGRESS;
+}
+
+void FakeHciTransport::inject(const char* data, int length) {
+    send((const uint8_t*)data, length);
+}
+
+void FakeHciTransport::onPoll(int events) {
+    if (events & UV_WRITABLE) {
+        flush();
+    }
+    if (events & UV_READABLE) {
+        uint8_t data[FAKE_FRAME_MAX];
+        ssize_t length;
+        while ((length = read(_controllerFd, data, sizeof(data))) > 0) {
+            if (data[0] == HCI_COMMAND_PKT && length >= 4) {
+                command(data, length);
+            } else if (data[0] == HCI_ACLDATA_PKT && length >= 5) {
+                aclData(data, length);
+            }
+        }
+
+        // Acknowledge the ACL packets of this read burst in a single event
+        if (!_completed.empty()) {
+            uint8_t event[3 + 1 + 4 * 63] = {HCI_EVENT_PKT, EVT_NUM_COMP_PKTS};
+            int n = 0;
+            for (auto& entry : _completed) {
+                event[4 + n * 4] = entry.first & 0xff;
+                event[5 + n * 4] = entry.first >> 8;
+                event[6 + n * 4] = entry.second & 0xff;
+                event[7 + n * 4] = entry.second >> 8;
+                if (++n == 63) {
+                    break;
+                }
+            }
+            event[2] = 1 + n * 4;
+            event[3] = n;
+            send(event, 4 + n * 4);
+            _completed.clear();
+        }
+    }
+}
+
+void FakeHciTransport::onTimer() {
+    for (int i = 0; i < _options.eventsPerInterval; i++) {
+        advertise();
+    }
+}
+
+void FakeHciTransport::updatePoll() {
+    if (_pollHandle != nullptr) {
+        uv_poll_start(_pollHandle, UV_READABLE | (_outbox.empty() ? 0 : UV_WRITABLE), FakeHciTransport::PollCallback);
+    }
+}
+
+void FakeHciTransport::command(const uint8_t* data, int length) {
+    // uint8_t evt_type: HCI_COMMAND_PKT (0x01)
+    // uint16_t opcode
+    // uint8_t plen
+    // uint8_t params[0..plen-1]
+    uint16_t opcode = data[1] | (data[2] << 8);
+    const uint8_t* params = data + 4;
+    int plen = length - 4;
+    uint8_t rp[65] = {0};  // Status first
+
+    switch (opcode) {
+        case FAKE_OP_READ_LOCAL_VERSION: {
+            // hci_ver, hci_rev, lmp_ver, manufacturer, lmp_subver
+            const uint8_t version[8] = {0x0c, 0x00, 0x00, 0x0c, 0xf1, 0x05, 0x00, 0x00};
+            memcpy(rp + 1, version, sizeof(version));
+            commandComplete(opcode, rp, 1 + sizeof(version));
+            break;
+        }
+        case FAKE_OP_READ_LOCAL_COMMANDS: {
+            if (_options.extended) {
+                // LE Set Extended Scan Parameters / Enable (octet 37, bits 5-6)
+                rp[1 + 37] = 0x30;
+            }
+            commandComplete(opcode, rp, 65);
+            break;
+        }
+        case FAKE_OP_READ_BUFFER_SIZE: {
+            // acl_mtu, sco_mtu, acl_max_pkt, sco_max_pkt
+            rp[1] = _options.aclPktLen & 0xff;
+            rp[2] = _options.aclPktLen >> 8;
+            rp[4] = _options.aclMaxPkt & 0xff;
+            rp[5] = _options.aclMaxPkt >> 8;
+            commandComplete(opcode, rp, 8);
+            break;
+        }
+        case FAKE_OP_READ_BD_ADDR: {
+            memcpy(rp + 1, _options.address, 6);
+            commandComplete(opcode, rp, 7);
+            break;
+        }
+        case FAKE_OP_READ_LE_HOST_SUPPORTED: {
+            rp[1] = 0x01;
+            commandComplete(opcode, rp, 3);
+            break;
+        }
+        case FAKE_OP_READ_RSSI: {
+            // handle, rssi
+            if (plen >= 2) {
+                rp[1] = params[0];
+                rp[2] = params[1];
+            }
+            rp[3] = (uint8_t)-50;
+            commandComplete(opcode, rp, 4);
+            break;
+        }
+        case FAKE_OP_LE_READ_BUFFER_SIZE: {
+            // pkt_len, max_pkt
+            rp[1] = _options.aclPktLen & 0xff;
+            rp[2] = _options.aclPktLen >> 8;
+            rp[3] = _options.aclMaxPkt;
+            commandComplete(opcode, rp, 4);
+            break;
+        }
+        case FAKE_OP_LE_SET_SCAN_ENABLE:
+        case FAKE_OP_LE_SET_EXTENDED_SCAN_ENABLE: {
+            commandComplete(opcode, rp, 1);
+            setScan(plen > 0 && params[0] != 0, opcode == FAKE_OP_LE_SET_EXTENDED_SCAN_ENABLE);
+            break;
+        }
+        case FAKE_OP_LE_CREATE_CONN: {
+            // interval, window, initiator_filter, peer_bdaddr_type, peer_bdaddr, ...
+            commandStatus(opcode, 0x00);
+            if (plen >= 12) {
+                createConnection(params + 6, params[5]);
+            }
+            break;
+        }
+        case FAKE_OP_LE_EXTENDED_CREATE_CONN: {
+            // initiator_filter, own_address_type, peer_address_type, peer_address, ...
+            commandStatus(opcode, 0x00);
+            if (plen >= 9) {
+                createConnection(params + 3, params[2]);
+            }
+            break;
+        }
+        case FAKE_OP_LE_CREATE_CONN_CANCEL: {
+            commandComplete(opcode, rp, 1);
+            break;
+        }
+        case FAKE_OP_DISCONNECT: {
+            // handle, reason
+            uint16_t handle = plen >= 2 ? (params[0] | (params[1] << 8)) & 0x0fff : 0;
+            bool known = _connections.find(handle) != _connections.end();
+            commandStatus(opcode, known ? 0x00 : 0x02);  // Unknown Connection Identifier
+            if (known) {
+                disconnect(handle, 0x16);  // Connection Terminated By Local Host
+            }
+            break;
+        }
+        case FAKE_OP_LE_CONN_UPDATE: {
+            // handle, min_interval, max_interval, latency, supervision_timeout, ...
+            commandStatus(opcode, 0x00);
+            if (plen >= 10) {
+                uint8_t event[3 + 10] = {HCI_EVENT_PKT, EVT_LE_META_EVENT, 10, EVT_LE_CONN_UPDATE_COMPLETE, 0x00};
+                memcpy(event + 5, params, 2);  // handle
+                memcpy(event + 7, params + 4, 6);  // max_interval, latency, supervision_timeout
+                send(event, sizeof(event));
+            }
+            break;
+        }
+        case FAKE_OP_RESET:
+        default: {
+            if (opcode == FAKE_OP_RESET) {
+                setScan(false, false);
+            }
+            commandComplete(opcode, rp, 1);
+            break;
+        }
+    }
+}
+
+void FakeHciTransport::aclData(const uint8_t* data, int length) {
+    uint16_t handle = (data[1] | (data[2] << 8)) & 0x0fff;
+    if (_connections.find(handle) != _connections.end()) {
+        _completed[handle]++;
+    }
+}
+
+void FakeHciTransport::send(const uint8_t* data, int length) {
+    if (_controllerFd == -1) {
+        return;
+    }
+    if (_outbox.empty()) {
+        ssize_t rc;
+        while ((rc = ::send(_controllerFd, data, length, MSG_DONTWAIT)) < 0 && errno == EINTR) {
+        }
+        if (rc >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return;
+        }
+    }
+    _outbox.emplace_back(data, data + length);
+    updatePoll();
+}
+
+void FakeHciTransport::flush() {
+    while (!_outbox.empty()) {
+        std::vector<uint8_t>& frame = _outbox.front();
+        ssize_t rc = ::send(_controllerFd, frame.data(), frame.size(), MSG_DONTWAIT);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        _outbox.pop_front();
+    }
+    updatePoll();
+}
+
+void FakeHciTransport::commandComplete(uint16_t opcode, const uint8_t* params, int length) {
+    uint8_t event[6 + 65] = {HCI_EVENT_PKT, EVT_CMD_COMPLETE, (uint8_t)(3 + length), 0x01, (uint8_t)(opcode & 0xff), (uint8_t)(opcode >> 8)};
+    memcpy(event + 6, params, length);
+    send(event, 6 + length);
+}
+
+void FakeHciTransport::commandStatus(uint16_t opcode, uint8_t status) {
+    uint8_t event[7] = {HCI_EVENT_PKT, EVT_CMD_STATUS, 4, status, 0x01, (uint8_t)(opcode & 0xff), (uint8_t)(opcode >> 8)};
+    send(event, sizeof(event));
+}
+
+// Returns the new connection handle, -1 when the connection limit is exceeded
+int FakeHciTransport::createConnection(const uint8_t* address, uint8_t addressType) {
+    // status, handle, role, peer_bdaddr_type, peer_bdaddr, interval, latency, supervision_timeout, master_clock_accuracy
+    uint8_t event[3 + 19] = {HCI_EVENT_PKT, EVT_LE_META_EVENT, 19, EVT_LE_CONN_COMPLETE};
+    int handle = -1;
+    if ((int)_connections.size() >= _options.maxConnections) {
+        event[4] = HCI_MAX_NUMBER_OF_CONNECTIONS;
+    } else {
+        while (_connections.find(_nextHandle) != _connections.end()) {
+            _nextHandle = _nextHandle >= 0x0eff ? FAKE_HANDLE_FIRST : _nextHandle + 1;
+        }
+        handle = _nextHandle;
+        _nextHandle = _nextHandle >= 0x0eff ? FAKE_HANDLE_FIRST : _nextHandle + 1;
+        Connection& connection = _connections[handle];
+        memcpy(connection.address, address, 6);
+        connection.l2Fd = -1;
+        event[5] = handle & 0xff;
+        event[6] = handle >> 8;
+        event[15] = 24;  // 30 ms
+        event[19] = 72;  // 720 ms
+    }
+    event[7] = 0x00;  // Central
+    event[8] = addressType;
+    memcpy(event + 9, address, 6);
+    send(event, sizeof(event));
+    return handle;
+}
+
+void FakeHciTransport::disconnect(uint16_t handle, uint8_t reason) {
+    auto it = _connections.find(handle);
+    if (it == _connections.end()) {
+        return;
+    }
+    if (it->second.l2Fd != -1) {
+        ::close(it->second.l2Fd);
+    }
+    _connections.erase(it);
+    _completed.erase(handle);
+
+    uint8_t event[7] = {HCI_EVENT_PKT, EVT_DISCONN_COMPLETE, 4, 0x00, (uint8_t)(handle & 0xff), (uint8_t)(handle >> 8), reason};
+    send(event, sizeof(event));
+}
+
+void FakeHciTransport::setScan(bool enabled, bool extended) {
+    _scanning = enabled && _options.advertisers > 0;
+    _extendedScan = extended;
+    if (_timer == nullptr) {
+        return;
+    }
+    if (_scanning) {
+        uint64_t interval = _options.advInterval > 0 ? _options.advInterval : 1;
+        uv_timer_start(_timer, FakeHciTransport::TimerCallback, interval, interval);
+    } else {
+        uv_timer_stop(_timer);
+    }
+}
+
+void FakeHciTransport::advertise() {
+    // Advertising data: flags, manufacturer specific data (0xffff) with a running counter
+    uint8_t adv[11] = {0x02, 0x01, 0x06, 0x07, 0xff, 0xff, 0xff};
+    uint8_t event[FAKE_FRAME_MAX] = {HCI_EVENT_PKT, EVT_LE_META_EVENT};
+    int length = 5;
+    int reports = _extendedScan ? 1 : _options.reportsPerEvent;
+    if (reports < 1) {
+        reports = 1;
+    } else if (reports > 8) {
+        reports = 8;
+    }
+
+    for (int i = 0; i < reports; i++) {
+        int index = _nextAdvertiser;
+        _nextAdvertiser = (_nextAdvertiser + 1) % _options.advertisers;
+        uint32_t counter = _advCounter++;
+        memcpy(adv + 7, &counter, 4);
+        // Random static address C0:xx:xx:xx:xx:xx from the advertiser index
+        uint8_t address[6] = {(uint8_t)(index & 0xff), (uint8_t)((index >> 8) & 0xff), (uint8_t)((index >> 16) & 0xff), 0x00, 0x00, 0xc0};
+        int8_t rssi = -40 - (index % 50);
+
+        uint8_t* p = event + length;
+        if (_extendedScan) {
+            // event_type, address_type, address, primary_phy, secondary_phy, sid, tx_power, rssi,
+            // periodic_adv_interval, direct_address_type, direct_address, data_length, data
+            p[0] = 0x13;  // Legacy ADV_IND
+            p[1] = 0x00;
+            p[2] = 0x01;  // Random
+            memcpy(p + 3, address, 6);
+            p[9] = 0x01;  // LE 1M
+            p[10] = 0x00;
+            p[11] = 0xff;
+            p[12] = 0x7f;  // Not available
+            p[13] = (uint8_t)rssi;
+            memset(p + 14, 0, 9);
+            p[23] = sizeof(adv);
+            memcpy(p + 24, adv, sizeof(adv));
+            length += 24 + sizeof(adv);
+        } else {
+            // event_type, address_type, address, data_length, data, rssi
+            p[0] = 0x00;  // ADV_IND
+            p[1] = 0x01;  // Random
+            memcpy(p + 2, address, 6);
+            p[8] = sizeof(adv);
+            memcpy(p + 9, adv, sizeof(adv));
+            p[9 + sizeof(adv)] = (uint8_t)rssi;
+            length += 10 + sizeof(adv);
+        }
+    }
+    event[2] = length - 3;
+    event[3] = _extendedScan ? EVT_LE_EXTENDED_ADVERTISING_REPORT : EVT_LE_ADVERTISING_REPORT;
+    event[4] = reports;
+    send(event, length);
+}
+
+void FakeHciTransport::PollCallback(uv_poll_t* handle, int status, int events) {
+    FakeHciTransport* p = (FakeHciTransport*)handle->data;
+    p->onPoll(events);
+}
+
+void FakeHciTransport::TimerCallback(uv_timer_t* handle) {
+    FakeHciTransport* p = (FakeHciTransport*)handle->data;
+    p->onTimer();
+}
+
+void FakeHciTransport::CloseCallback(uv_handle_t* handle) {
+    if (handle->type == UV_POLL) {
+        delete (uv_poll_t*)handle;
+    } else {
+        delete (uv_timer_t*)handle;
+    }
+}
@@ -0,0 +1,89 @@
+// FakeHciTransport.h
+
+#ifndef FAKE_HCI_TRANSPORT_H
+#define FAKE_HCI_TRANSPORT_H
+
+#include <uv.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "HciTransport.h"
+
+struct FakeControllerOptions {
+    uint8_t address[6];  // Little endian
+    bool extended;  // Advertise the extended scan commands
+    int advertisers;  // Synthetic advertiser population
+    int advInterval;  // Msec between advertising bursts while scanning
+    int eventsPerInterval;  // Advertising report events per burst
+    int reportsPerEvent;  // Reports per legacy advertising report event
+    int maxConnections;  // Connection Limit Exceeded above this
+    int aclPktLen;
+    int aclMaxPkt;
+};
+
+// In-process controller on the other end of a socketpair, driven by the event loop.
+// Answers the commands issued by hci.js, generates advertising reports while scanning,
+// completes connections and returns ACL credits. Frames can also be injected from JS.
+class FakeHciTransport : public HciTransport {
+   public:
+    FakeHciTransport(const FakeControllerOptions& options, uv_loop_t* loop);
+    ~FakeHciTransport();
+
+    static void DefaultOptions(FakeControllerOptions* options);
+
+    int open() override;
+    void close() override;
+    int deviceIdFor(const int* deviceId, bool isUp) override;
+    int bind(int deviceId, uint8_t* address, uint8_t* addressType) override;
+    bool isDeviceUp(int deviceId) override;
+    int setFilter(const char* data, int length) override;
+    int enableTimestamps() override;
+    int setAuth(int deviceId, bool enabled) override;
+    int setEncrypt(int deviceId, bool enabled) override;
+    int l2Connect(const struct sockaddr_l2* src, const struct sockaddr_l2* dst, int* fd) override;
+
+    void inject(const char* data, int length);
+
+   private:
+    struct Connection {
+        uint8_t address[6];
+        int l2Fd;  // Peer end of the fake L2CAP socket, -1 if none
+    };
+
+    void onPoll(int events);
+    void onTimer();
+    void updatePoll();
+    void command(const uint8_t* data, int length);
+    void aclData(const uint8_t* data, int length);
+    void send(const uint8_t* data, int length);
+    void flush();
+    void commandComplete(uint16_t opcode, const uint8_t* params, int length);
+    void commandStatus(uint16_t opcode, uint8_t status);
+    int createConnection(const uint8_t* address, uint8_t addressType);
+    void disconnect(uint16_t handle, uint8_t reason);
+    void setScan(bool enabled, bool extended);
+    void advertise();
+
+    static void PollCallback(uv_poll_t* handle, int status, int events);
+    static void TimerCallback(uv_timer_t* handle);
+    static void CloseCallback(uv_handle_t* handle);
+
+   private:
+    FakeControllerOptions _options;
+    int _controllerFd;
+    uv_loop_t* _loop;  // Loop of the thread that created the socket
+    uv_poll_t* _pollHandle;
+    uv_timer_t* _timer;
+    std::deque<std::vector<uint8_t>> _outbox;  // Frames waiting for room in the socket
+    bool _scanning;
+    bool _extendedScan;
+    int _nextAdvertiser;
+    uint32_t _advCounter;
+    uint16_t _nextHandle;
+    std::map<uint16_t, Connection> _connections;
+    std::map<uint16_t, int> _completed;  // ACL packets to acknowledge, by handle
+};
+
+#endif  // FAKE_HCI_TRANSPORT_H
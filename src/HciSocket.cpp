@@ -3,17 +3,49 @@
 #include "HciSocket.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <node_buffer.h>
-#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 using namespace v8;
 
-Nan::Persistent<v8::FunctionTemplate> HciSocket::constructor;
+template <typename A, typename T>
+static Local<A> NewTypedArray(int length, T** contents) {
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), length * sizeof(T));
+    Local<A> array = A::New(buffer, 0, length);
+    Nan::TypedArrayContents<T> arrayContents(array);
+    *contents = *arrayContents;
+    return array;
+}
+
+// Drops the first count entries of a report column, rest entries follow
+template <typename T>
+static inline void ShiftColumn(T* column, int count, int rest) {
+    memmove(column, column + count, rest * sizeof(T));
+}
+
+static inline void AddressToString(const uint8_t* addr, char* str) {
+    snprintf(str, 13, "%02x%02x%02x%02x%02x%02x", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+}
+
+static inline uint64_t AddressToKey(const uint8_t* addr) {
+    uint64_t key = 0;
+    for (int i = 5; i >= 0; i--) {
+        key = (key << 8) | addr[i];
+    }
+    return key;
+}
 
-L2Socket::L2Socket(HciSocket* parent, uint8_t* srcAddr, uint8_t srcType, uint8_t* dstAddr, uint8_t dstType) : _parent(parent), _socket(-1), _handle(0x0fff), _src({}), _dst({}), _errno(0), _syscall("") {
+static inline double AddressToNumber(const uint8_t* addr) {
+    return (double)AddressToKey(addr);
+}
+
+L2Socket::L2Socket(HciSocket* parent, uint8_t* srcAddr, uint8_t srcType, uint8_t* dstAddr, uint8_t dstType) : _parent(parent), _socket(-1), _handle(0x0fff), _src({}), _dst({}), _pollHandle(nullptr), _connecting(false), _errno(0), _syscall("") {
 #ifdef DEBUG
     printf("[L2Socket::L2Socket] srcAddr %02x%02x%02x%02x%02x%02x, srcType %u, dstAddr %02x%02x%02x%02x%02x%02x, dstType %u\n",
            srcAddr[5], srcAddr[4], srcAddr[3], srcAddr[2], srcAddr[1], srcAddr[0], srcType,
@@ -40,69 +72,71 @@ L2Socket::~L2Socket() {
 }
 
 void L2Socket::connect() {
-    _socket = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
-    if (_socket < 0) {
-#ifdef DEBUG
-        printf("[L2Socket::connect] socket() %d %s\n", errno, strerror(errno));
-#endif
-        _errno = errno;
-        _syscall = "socket@L2Socket::connect";
-        return;
+    _syscall = "";
+    _errno = _parent->_transport->l2Connect(&_src, &_dst, &_socket);
+    if (_errno != 0) {
+        _syscall = _parent->_transport->syscall();
     }
-
-    int rc = ::bind(_socket, (struct sockaddr*)&_src, sizeof(_src));
-    if (rc < 0) {
-#ifdef DEBUG
-        printf("[L2Socket::connect] bind() %d %s\n", errno, strerror(errno));
-#endif
-        _errno = errno;
-        _syscall = "bind@L2Socket::connect";
-        close(_socket);
+    if (_errno == EINPROGRESS) {
+        _pollHandle = new uv_poll_t();
+        if (uv_poll_init_socket(Nan::GetCurrentEventLoop(), _pollHandle, _socket) < 0) {
+            delete _pollHandle;
+            _pollHandle = nullptr;
+            _syscall = "uv_poll_init_socket@L2Socket::connect";
+            close(_socket);
+            _socket = -1;
+            return;
+        }
+        _pollHandle->data = this;
+        uv_poll_start(_pollHandle, UV_WRITABLE, L2Socket::PollCallback);
+        _connecting = true;
+    } else if (_errno != 0 && _errno != EISCONN) {
         _socket = -1;
-        return;
     }
+}
 
-    struct l2cap_options opts = {};
-    memset(&opts, 0, sizeof(opts));
-    socklen_t len = sizeof(opts);
+void L2Socket::poll(int status) {
+    int err = 0;
+    socklen_t len = sizeof(err);
 
-    rc = getsockopt(_socket, SOL_L2CAP, L2CAP_OPTIONS, &opts, &len);
-    if (rc < 0) {
-#ifdef DEBUG
-        printf("[L2Socket::connect] getsockopt(SOL_L2CAP,L2CAP_OPTIONS) %d %s\n", errno, strerror(errno));
-#endif
-        _errno = errno;
-        _syscall = "getsockopt@L2Socket::connect";
-        close(_socket);
-        _socket = -1;
-        return;
+    if (status < 0) {
+        err = -status;
+    } else if (getsockopt(_socket, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
     }
-#ifdef DEBUG
-    printf("[L2Socket::connect] omtu %d, imtu %d, flush_to %d, mode %d, fcs %d, max_tx %d, txwin_size %d\n",
-           opts.omtu, opts.imtu, opts.flush_to, opts.mode, opts.fcs, opts.max_tx, opts.txwin_size);
-#endif
+    stopPoll();
 
-    // WARNING: sends OCF_LE_CREATE_CONN to controller
-    while ((rc = ::connect(_socket, (struct sockaddr*)&_dst, sizeof(_dst))) < 0) {
 #ifdef DEBUG
-        printf("[L2Socket::connect] connect() %d %s\n", errno, strerror(errno));
+    printf("[L2Socket::poll] connect() %d %s\n", err, strerror(err));
 #endif
-        _errno = errno;
+    if (err != 0) {
+        _errno = err;
         _syscall = "connect@L2Socket::connect";
-        if (errno == EISCONN) {
-            return;
-        } else if (errno != EINTR) {
-            close(_socket);
-            _socket = -1;
-            return;
-        }
+        close(_socket);
+        _socket = -1;
+    } else {
+        _errno = 0;
+        _syscall = "";
     }
 
-    _errno = 0;
-    _syscall = "";
+    // WARNING: this socket may be released by the parent
+    // In progress, the kernel has sent LE Create Connection
+    _parent->l2SocketOnConnect(this, true);
+}
+
+void L2Socket::stopPoll() {
+    if (_pollHandle != nullptr) {
+        uv_poll_stop(_pollHandle);
+        uv_close((uv_handle_t*)_pollHandle, (uv_close_cb)L2Socket::PollCloseCallback);
+        _pollHandle = nullptr;
+    }
+    _connecting = false;
 }
 
 void L2Socket::disconnect() {
+    stopPoll();
+    // Unmapped while the handle is known, events of the old connection must not reach a reused socket
+    _parent->clearL2SocketHandle(this);
     if (_socket != -1) {
         if (close(_socket) < 0) {
 #ifdef DEBUG
@@ -120,11 +154,23 @@ bool L2Socket::connected() const {
     return _socket != -1;
 }
 
+bool L2Socket::connecting() const {
+    return _connecting;
+}
+
+void L2Socket::PollCloseCallback(uv_poll_t* handle) {
+    delete handle;
+}
+
+void L2Socket::PollCallback(uv_poll_t* handle, int status, int events) {
+    L2Socket* p = (L2Socket*)handle->data;
+    p->poll(status);
+}
+
 NAN_MODULE_INIT(HciSocket::Init) {
     Nan::HandleScope scope;
 
     v8::Local<v8::FunctionTemplate> ctor = Nan::New<v8::FunctionTemplate>(HciSocket::New);
-    constructor.Reset(ctor);
     ctor->InstanceTemplate()->SetInternalFieldCount(1);
     ctor->SetClassName(Nan::New("HciSocket").ToLocalChecked());
 
@@ -133,353 +179,1330 @@ NAN_MODULE_INIT(HciSocket::Init) {
     Nan::SetPrototypeMethod(ctor, "bind", Bind);
     Nan::SetPrototypeMethod(ctor, "isDeviceUp", IsDeviceUp);
     Nan::SetPrototypeMethod(ctor, "setFilter", SetFilter);
+    Nan::SetPrototypeMethod(ctor, "setBpfFilter", SetBpfFilter);
     Nan::SetPrototypeMethod(ctor, "stop", Stop);
     Nan::SetPrototypeMethod(ctor, "write", Write);
+    Nan::SetPrototypeMethod(ctor, "setBatchSize", SetBatchSize);
+    Nan::SetPrototypeMethod(ctor, "setAdvReports", SetAdvReports);
+    Nan::SetPrototypeMethod(ctor, "setAdvFilter", SetAdvFilter);
+    Nan::SetPrototypeMethod(ctor, "setNotifyReports", SetNotifyReports);
+    Nan::SetPrototypeMethod(ctor, "setNotifySubscription", SetNotifySubscription);
+    Nan::SetPrototypeMethod(ctor, "getAdvFilterStats", GetAdvFilterStats);
+    Nan::SetPrototypeMethod(ctor, "setConnectionParameters", SetConnectionParameters);
+    Nan::SetPrototypeMethod(ctor, "setRecvPool", SetRecvPool);
+    Nan::SetPrototypeMethod(ctor, "setAclReassembly", SetAclReassembly);
+    Nan::SetPrototypeMethod(ctor, "setAclMaxPdu", SetAclMaxPdu);
+    Nan::SetPrototypeMethod(ctor, "setAclTxBuffers", SetAclTxBuffers);
+    Nan::SetPrototypeMethod(ctor, "writeAcl", WriteAcl);
+    Nan::SetPrototypeMethod(ctor, "setWriteQueue", SetWriteQueue);
+    Nan::SetPrototypeMethod(ctor, "inject", Inject);
+    Nan::SetPrototypeMethod(ctor, "setCapture", SetCapture);
+    Nan::SetPrototypeMethod(ctor, "dumpCapture", DumpCapture);
+    Nan::SetPrototypeMethod(ctor, "streamCapture", StreamCapture);
+    Nan::SetPrototypeMethod(ctor, "setReaderThread", SetReaderThread);
+    Nan::SetPrototypeMethod(ctor, "getReaderStats", GetReaderStats);
+    Nan::SetMethod(ctor, "getDeviceList", GetDeviceList);
+    Nan::SetPrototypeMethod(ctor, "getStats", GetStats);
+    Nan::SetPrototypeMethod(ctor, "setCommandQueue", SetCommandQueue);
+    Nan::SetPrototypeMethod(ctor, "abortCommand", AbortCommand);
 
     Nan::Set(target, Nan::New("HciSocket").ToLocalChecked(), Nan::GetFunction(ctor).ToLocalChecked());
 }
 
-HciSocket::HciSocket() : node::ObjectWrap(), _socket(-1), _deviceId(0), _pollHandle(), _address(), _addressType(BDADDR_LE_PUBLIC), _availableL2Sockets(L2_SOCKETS_MAX) {
-    for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-        _l2Sockets[i] = nullptr;
+HciSocket::HciSocket(int maxL2Sockets, const char* debugfsPath, HciTransport* transport) : node::ObjectWrap(), _transport(transport), _socket(-1), _deviceId(0), _pollHandle(nullptr), _started(false), _address(), _addressType(BDADDR_LE_PUBLIC), _l2SocketsMax(maxL2Sockets), _l2SocketsLimit(maxL2Sockets), _l2SocketsByHandle(HCI_HANDLES_MAX, nullptr), _asyncResource(nullptr), _batchSize(0), _recvPool(nullptr), _advReports(), _notifyReports(), _debugfsPath(debugfsPath), _connParamsDeviceId(-1), _aclBlocked(false), _writeQueueMax(0), _writeQueueBytes(0), _writeNeedDrain(false), _rxTimestamp(0), _readerAsync(nullptr), _readerDraining(false), _closed(false) {
+    _l2Sockets.reserve(maxL2Sockets);
+    for (int i = 0; i < CONN_PARAMS_COUNT; i++) {
+        _connParamsFds[i] = -1;
+        _connParamsValues[i] = -1;
     }
 
-    int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
-    if (fd < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "socket@HciSocket::HciSocket"));
+    int err = _transport->open();
+    if (err != 0) {
+        Nan::ThrowError(Nan::ErrnoException(err, _transport->syscall()));
         return;
     }
-    _socket = fd;
-
-    // int opt = 1;
-    // if (setsockopt(fd, SOL_HCI, HCI_DATA_DIR, &opt, sizeof(opt)) < 0) {
-    //     Nan::ThrowError(Nan::ErrnoException(errno, "setsockopt(SOL_HCI,HCI_DATA_DIR)@HciSocket::HciSocket"));
-    //     return;
-    // }
+    _socket = _transport->fd();
 
-    // opt = 1;
-    // if (setsockopt(fd, SOL_HCI, HCI_TIME_STAMP, &opt, sizeof(opt)) < 0) {
-    //     Nan::ThrowError(Nan::ErrnoException(errno, "setsockopt(SOL_HCI,HCI_TIME_STAMP)@HciSocket::HciSocket"));
-    //     return;
-    // }
+    // Without kernel timestamps frames are reported with timestamp 0
+    err = _transport->enableTimestamps();
+#ifdef DEBUG
+    if (err != 0) {
+        printf("[HciSocket::HciSocket] %s %d %s\n", _transport->syscall(), err, strerror(err));
+    }
+#endif
 
-    if (uv_poll_init(uv_default_loop(), &_pollHandle, _socket) < 0) {
+    // Handles belong to the loop of the creating thread, main or worker
+    _pollHandle = new uv_poll_t();
+    if (uv_poll_init(Nan::GetCurrentEventLoop(), _pollHandle, _socket) < 0) {
+        delete _pollHandle;
+        _pollHandle = nullptr;
         Nan::ThrowError("uv_poll_init failed");
         return;
     }
-    _pollHandle.data = this;
+    _pollHandle->data = this;
+
+    // A worker's loop is closed when it exits, with or without this object
+    // having been collected
+    node::AddEnvironmentCleanupHook(Isolate::GetCurrent(), HciSocket::CleanupHook, this);
 }
 
 HciSocket::~HciSocket() {
-    for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-        if (_l2Sockets[i] != nullptr) {
-            _l2Sockets[i]->disconnect();
-            _l2Sockets[i] = nullptr;
-            _availableL2Sockets++;
-        }
+    if (!_closed) {
+        node::RemoveEnvironmentCleanupHook(Isolate::GetCurrent(), HciSocket::CleanupHook, this);
+        release();
+    }
+    delete _asyncResource;
+}
+
+// Releases the sockets, threads and loop handles
+void HciSocket::release() {
+    _closed = true;
+    _started = false;
+    for (auto& entry : _l2Sockets) {
+        entry.second->disconnect();
     }
-    uv_close((uv_handle_t*)&_pollHandle, (uv_close_cb)HciSocket::PollCloseCallback);
-    close(_socket);
+    _l2Sockets.clear();
+    closeConnectionParameters();
+    setRecvPool(0);
+    stopReader();
+    _reader.reset();
+    _capture.close();
+    if (_pollHandle != nullptr) {
+        uv_poll_stop(_pollHandle);
+        uv_close((uv_handle_t*)_pollHandle, (uv_close_cb)HciSocket::PollCloseCallback);
+        _pollHandle = nullptr;
+    }
+    _transport->close();
+}
+
+void HciSocket::CleanupHook(void* arg) {
+    HciSocket* p = (HciSocket*)arg;
+    p->release();
+    p->This.Reset();
+    p->_advReportsObject.Reset();
+    p->_notifyReportsObject.Reset();
+    delete p->_asyncResource;
+    p->_asyncResource = nullptr;
+    // The wrapper is never collected once the environment is torn down
+    delete p;
 }
 
 int HciSocket::availableL2Sockets() const {
-    return _availableL2Sockets;
+    int available = _l2SocketsLimit - (int)_l2Sockets.size();
+    return available > 0 ? available : 0;
 }
 
 void HciSocket::start() {
-    if (uv_poll_start(&_pollHandle, UV_READABLE, HciSocket::PollCallback) < 0) {
+    _started = true;
+    if (_reader != nullptr) {
+        startReader();
+        updatePoll();
+        return;
+    }
+    if (_pollHandle == nullptr) {
+        return;
+    }
+    if (uv_poll_start(_pollHandle, UV_READABLE | (_writeQueue.empty() && !_aclBlocked ? 0 : UV_WRITABLE), HciSocket::PollCallback) < 0) {
         Nan::ThrowError("uv_poll_start failed");
     }
 }
 
-int HciSocket::bind(int* deviceId) {
-    struct sockaddr_hci a = {};
-    struct hci_dev_info di = {};
-
-    memset(&a, 0, sizeof(a));
-    a.hci_family = AF_BLUETOOTH;
-    a.hci_dev = deviceIdFor(deviceId, true);
-    // a.hci_channel = HCI_CHANNEL_RAW;
+// Watch for writability only while writes are pending
+void HciSocket::updatePoll() {
+    int events = (_started && _reader == nullptr ? UV_READABLE : 0) | (_writeQueue.empty() && !_aclBlocked ? 0 : UV_WRITABLE);
+    if (_pollHandle == nullptr) {
+        return;
+    } else if (events == 0) {
+        uv_poll_stop(_pollHandle);
+    } else {
+        uv_poll_start(_pollHandle, events, HciSocket::PollCallback);
+    }
+}
 
-    _deviceId = a.hci_dev;
+int HciSocket::bind(int* deviceId) {
+    _deviceId = deviceIdFor(deviceId, true);
 
 #ifdef DEBUG
     printf("[HciSocket::bind] deviceId %d\n", _deviceId);
 #endif
 
-    if (ioctl(_socket, HCIDEVRESET, _deviceId) < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "ioctl(HCIDEVRESET)@HciSocket::bind"));
-        return -1;
-    }
-
-    if (ioctl(_socket, HCIDEVDOWN, _deviceId) < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "ioctl(HCIDEVDOWN)@HciSocket::bind"));
-        return -1;
-    }
-
-    if (ioctl(_socket, HCIDEVUP, _deviceId) < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "ioctl(HCIDEVUP)@HciSocket::bind"));
-        return -1;
-    }
-
-    if (::bind(_socket, (struct sockaddr*)&a, sizeof(a)) < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "bind@HciSocket::bind"));
-        return -1;
-    }
-
     // Get the local address and address type
-    memset(&di, 0, sizeof(di));
-    di.dev_id = _deviceId;
     memset(_address, 0, sizeof(_address));
     _addressType = 0;
 
-    if (ioctl(_socket, HCIGETDEVINFO, (void*)&di) < 0) {
-        Nan::ThrowError(Nan::ErrnoException(errno, "ioctl(HCIGETDEVINFO)@HciSocket::bind"));
+    int err = _transport->bind(_deviceId, _address, &_addressType);
+    if (err != 0) {
+        Nan::ThrowError(Nan::ErrnoException(err, _transport->syscall()));
         return -1;
     }
 
-    memcpy(_address, &di.bdaddr, sizeof(di.bdaddr));
-    _addressType = di.type;
-    if (_addressType != BDADDR_LE_RANDOM) {
-        _addressType = BDADDR_LE_PUBLIC;
-    }
-
     return _deviceId;
 }
 
 bool HciSocket::isDeviceUp() {
-    struct hci_dev_info di = {};
-    bool isUp = false;
-
-    memset(&di, 0x00, sizeof(di));
-    di.dev_id = _deviceId;
+    return _transport->isDeviceUp(_deviceId);
+}
 
-    if (ioctl(_socket, HCIGETDEVINFO, (void*)&di) > -1) {
-        isUp = (di.flags & (1 << HCI_UP)) != 0;
+void HciSocket::setFilter(char* data, int length) {
+    int err = _transport->setFilter(data, length);
+    if (err != 0) {
+        emitErrnoError(err, _transport->syscall());
     }
-
-    return isUp;
 }
 
-void HciSocket::setFilter(char* data, int length) {
-    if (setsockopt(_socket, SOL_HCI, HCI_FILTER, data, length) < 0) {
-        emitErrnoError(errno, "setsockopt(SOL_HCI,HCI_FILTER)@HciSocket::setFilter");
+// Frames the program rejects are dropped by the kernel, before being queued to the socket
+void HciSocket::setBpfFilter(char* data, int length) {
+    int err = _transport->attachFilter(data, length);
+    if (err != 0) {
+        emitErrnoError(err, _transport->syscall());
     }
 }
 
 void HciSocket::setAuth(bool enabled) {
-    struct hci_dev_req dr = {};
+    int err = _transport->setAuth(_deviceId, enabled);
+    if (err != 0) {
+        emitErrnoError(err, _transport->syscall());
+    }
+}
+
+void HciSocket::setEncrypt(bool enabled) {
+    int err = _transport->setEncrypt(_deviceId, enabled);
+    if (err != 0) {
+        emitErrnoError(err, _transport->syscall());
+    }
+}
 
-    dr.dev_id = _deviceId;
-    dr.dev_opt = enabled ? AUTH_ENABLED : AUTH_DISABLED;
+void HciSocket::setBatchSize(int batchSize) {
+    if (batchSize < 0) {
+        batchSize = 0;
+    } else if (batchSize > HCI_BATCH_SIZE_MAX) {
+        batchSize = HCI_BATCH_SIZE_MAX;
+    }
+    if (_reader != nullptr && batchSize < 2) {
+        // The reader thread hands frames over in batches
+        batchSize = HCI_BATCH_SIZE_READER;
+    }
 
-    if (ioctl(_socket, HCISETAUTH, (unsigned long)&dr) < 0) {
-        emitErrnoError(errno, "ioctl(HCISETAUTH)@HciSocket::setAuth");
+    _batchSize = batchSize;
+    _batchData.assign(batchSize * HCI_MAX_FRAME_SIZE, 0);
+    _batchIovs.assign(batchSize, {});
+    _batchMsgs.assign(batchSize, {});
+    _batchOffsets.assign(batchSize, 0);
+    _batchTimestamps.assign(batchSize, 0);
+    _batchControl.assign(batchSize * HCI_CONTROL_SIZE, 0);
+    _batchFrames.assign(batchSize, {});
+    for (int i = 0; i < batchSize; i++) {
+        _batchIovs[i].iov_base = &_batchData[i * HCI_MAX_FRAME_SIZE];
+        _batchIovs[i].iov_len = HCI_MAX_FRAME_SIZE;
+        _batchMsgs[i].msg_hdr.msg_iov = &_batchIovs[i];
+        _batchMsgs[i].msg_hdr.msg_iovlen = 1;
+        _batchMsgs[i].msg_hdr.msg_control = &_batchControl[i * HCI_CONTROL_SIZE];
+        _batchMsgs[i].msg_hdr.msg_controllen = HCI_CONTROL_SIZE;
     }
 }
 
-void HciSocket::setEncrypt(bool enabled) {
-    struct hci_dev_req dr = {};
+void HciSocket::setRecvPool(int slots) {
+    if (slots < 0) {
+        slots = 0;
+    } else if (slots > RECV_POOL_SLOTS_MAX) {
+        slots = RECV_POOL_SLOTS_MAX;
+    }
 
-    dr.dev_id = _deviceId;
-    dr.dev_opt = enabled ? ENCRYPT_P2P : ENCRYPT_DISABLED;
+    // Slots still referenced by JS keep the previous pool alive
+    if (_recvPool != nullptr) {
+        _recvPool->detach();
+        _recvPool = nullptr;
+    }
+    if (slots > 0) {
+        _recvPool = new RecvPool(slots, HCI_MAX_FRAME_SIZE);
+    }
+}
 
-    if (ioctl(_socket, HCISETENCRYPT, (unsigned long)&dr) < 0) {
-        emitErrnoError(errno, "ioctl(HCISETENCRYPT)@HciSocket::setEncrypt");
+// Kernel receive time of a frame in msec since the epoch, 0 if not available
+static double ControlTimestamp(struct msghdr* msg) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        bool hci = cmsg->cmsg_level == SOL_HCI && cmsg->cmsg_type == HCI_CMSG_TSTAMP;
+        bool socket = cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMP;
+        if (!hci && !socket) {
+            continue;
+        }
+        size_t size = cmsg->cmsg_len - CMSG_LEN(0);
+        if (size == sizeof(struct timeval)) {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+        } else if (size == 2 * sizeof(int32_t)) {
+            // 32-bit kernel timeval, userspace built with 64-bit time_t
+            int32_t tv[2];
+            memcpy(tv, CMSG_DATA(cmsg), sizeof(tv));
+            return tv[0] * 1e3 + tv[1] / 1e3;
+        }
     }
+    return 0;
 }
 
 void HciSocket::poll() {
     Nan::HandleScope scope;
 
+    if (_batchSize > 1) {
+        pollBatch();
+        return;
+    }
+
     int length = 0;
-    char data[HCI_MAX_FRAME_SIZE];
+    char frame[HCI_MAX_FRAME_SIZE];
+
+    // Read straight into a pool slot when one is free, the event handlers may replace the pool
+    RecvPool* pool = _recvPool;
+    char* data = pool != nullptr ? pool->acquire() : nullptr;
+    if (data == nullptr) {
+        pool = nullptr;
+        data = frame;
+    }
 
-    length = read(_socket, data, sizeof(data));
+    struct iovec iov = {data, HCI_MAX_FRAME_SIZE};
+    char control[HCI_CONTROL_SIZE];
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    length = recvmsg(_socket, &msg, 0);
 
     if (length > 0) {
+        _rxTimestamp = ControlTimestamp(&msg);
+        trace(data, length, true);
         l2SocketOnHciRead(data, length);
 
-        Local<Value> argv[2] = {
-            Nan::New("data").ToLocalChecked(),
-            Nan::CopyBuffer(data, length).ToLocalChecked()};
+        if (aclSchedulerOnHciRead(data, length)) {
+            flushAcl();
+        }
+        if (_commandQueue.onEvent(data, length)) {
+            flushCommands();
+        }
 
-        Nan::AsyncResource res("HciSocket::poll");
-        res.runInAsyncScope(
-               Nan::New<Object>(this->This),
-               Nan::New("emit").ToLocalChecked(),
-               2,
-               argv)
-            .FromMaybe(v8::Local<v8::Value>());
+        AclReassembly::Pdu pdu;
+        if (!advFilterOnHciRead(data, &length)) {
+            length = 0;
+        } else if (advReportsOnHciRead(data, length)) {
+            flushAdvReports(_advReports.count);
+            length = 0;
+        } else if (notifyReportsOnHciRead(data, length)) {
+            flushNotifyReports(_notifyReports.count);
+            length = 0;
+        } else if (aclReassemblyOnHciRead(data, length, &pdu)) {
+            if (pdu.data != nullptr) {
+                if (notifyReportsOnPdu(pdu.handle, pdu.cid, pdu.data, pdu.length)) {
+                    flushNotifyReports(_notifyReports.count);
+                } else {
+                    emitAclData(pdu.handle, pdu.cid, Nan::CopyBuffer(pdu.data, pdu.length).ToLocalChecked(), _rxTimestamp);
+                }
+            }
+            length = 0;
+        }
     }
-}
 
-void HciSocket::stop() {
-    uv_poll_stop(&_pollHandle);
+    if (length <= 0) {
+        if (pool != nullptr) {
+            pool->release(data);
+        }
+        return;
+    }
+
+    Local<Value> argv[3] = {
+        Nan::New("data").ToLocalChecked(),
+        pool != nullptr ? Nan::NewBuffer(data, length, RecvPool::FreeCallback, pool).ToLocalChecked() : Nan::CopyBuffer(data, length).ToLocalChecked(),
+        Nan::New(_rxTimestamp)};
+    emitEvent(3, argv);
 }
 
-void HciSocket::write(char* data, int length) {
-    if (l2SocketOnHciWrite(data, length)) {
+void HciSocket::pollBatch() {
+    // Drain the socket without blocking: recvmmsg() returns as soon as the next read
+    // would block (EAGAIN) or the batch budget is exhausted
+    for (int i = 0; i < _batchSize; i++) {
+        _batchMsgs[i].msg_hdr.msg_controllen = HCI_CONTROL_SIZE;
+    }
+    int count = recvmmsg(_socket, _batchMsgs.data(), _batchSize, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            emitErrnoError(errno, "recvmmsg@HciSocket::pollBatch");
+        }
         return;
     }
-    if (::write(_socket, data, length) < 0) {
-        emitErrnoError(errno, "write@HciSocket::write");
+    if (count == 0) {
+        return;
     }
-}
-
-void HciSocket::emitErrnoError(int err_no, const char* syscall) {
-    v8::Local<v8::Value> error = Nan::ErrnoException(err_no, syscall, strerror(err_no));
 
-    Local<Value> argv[2] = {
-        Nan::New("error").ToLocalChecked(),
-        error};
-    Nan::AsyncResource res("HciSocket::emitErrnoError");
-    res.runInAsyncScope(
-           Nan::New<Object>(this->This),
-           Nan::New("emit").ToLocalChecked(),
-           2,
-           argv)
-        .FromMaybe(v8::Local<v8::Value>());
+    for (int i = 0; i < count; i++) {
+        _batchFrames[i].data = &_batchData[i * HCI_MAX_FRAME_SIZE];
+        _batchFrames[i].length = _batchMsgs[i].msg_len;
+        _batchFrames[i].timestamp = ControlTimestamp(&_batchMsgs[i].msg_hdr);
+    }
+    processBatch(count);
 }
 
-int HciSocket::deviceIdFor(const int* pDeviceId, bool isUp) {
-    int deviceId = 0;  // default
-
-    if (pDeviceId == nullptr) {
-        struct hci_dev_list_req* dl;
-        struct hci_dev_req* dr;
-
-        dl = (hci_dev_list_req*)calloc(HCI_MAX_DEV * sizeof(*dr) + sizeof(*dl), 1);
-        dr = dl->dev_req;
-        dl->dev_num = HCI_MAX_DEV;
-
-        if (ioctl(_socket, HCIGETDEVLIST, dl) > -1) {
-            for (int i = 0; i < dl->dev_num; i++, dr++) {
-                bool devUp = dr->dev_opt & (1 << HCI_UP);
-                if (isUp == devUp) {
-                    // choose the first device that is match
-                    // it would be good to also HCIGETDEVINFO and check the HCI_RAW flag
-                    deviceId = dr->dev_id;
-                    break;
-                }
+void HciSocket::processBatch(int count) {
+    // Decode advertising reports and reassemble ACL fragments natively, compact the
+    // remaining frames so that frame i spans offsets[i] to offsets[i + 1]
+    char* data = _batchData.data();
+    uint32_t length = 0;
+    int frames = 0;
+    bool credits = false;
+    bool commandCredits = false;
+    _batchAclPdus.clear();
+    _batchAclData.clear();
+    _batchMarks.clear();
+    for (int i = 0; i < count; i++) {
+        char* frame = _batchFrames[i].data;
+        int frameLength = _batchFrames[i].length;
+        AclReassembly::Pdu pdu;
+        _rxTimestamp = _batchFrames[i].timestamp;
+        trace(frame, frameLength, true);
+        credits |= aclSchedulerOnHciRead(frame, frameLength);
+        commandCredits |= _commandQueue.onEvent(frame, frameLength);
+        if (!advFilterOnHciRead(frame, &frameLength) || advReportsOnHciRead(frame, frameLength) || notifyReportsOnHciRead(frame, frameLength)) {
+            continue;
+        }
+        if (aclReassemblyOnHciRead(frame, frameLength, &pdu)) {
+            if (pdu.data != nullptr && !notifyReportsOnPdu(pdu.handle, pdu.cid, pdu.data, pdu.length)) {
+                // The reassembly buffer is reused by the next fragment of this handle
+                _batchAclPdus.push_back({frames, pdu.handle, pdu.cid, (uint32_t)_batchAclData.size(), (uint32_t)pdu.length, _rxTimestamp, {_advReports.count, _notifyReports.count}});
+                _batchAclData.insert(_batchAclData.end(), pdu.data, pdu.data + pdu.length);
             }
+            continue;
         }
+        if (frame != data + length) {
+            memmove(data + length, frame, frameLength);
+        }
+        _batchTimestamps[frames] = _rxTimestamp;
+        _batchMarks.push_back({_advReports.count, _notifyReports.count});
+        _batchOffsets[frames++] = length;
+        length += frameLength;
+    }
 
-        free(dl);
-    } else {
-        deviceId = *pDeviceId;
+    if (credits) {
+        flushAcl();
+    }
+    if (commandCredits) {
+        flushCommands();
     }
 
-    return deviceId;
-}
+    // Everything handed to JS is created before the first event, since callbacks may resize the batch buffers
+    Local<Object> batch;
+    Local<ArrayBuffer> offsetsBuffer;
+    Local<ArrayBuffer> timestampsBuffer;
+    if (frames > 0) {
+        timestampsBuffer = ArrayBuffer::New(Isolate::GetCurrent(), frames * sizeof(double));
+        Nan::TypedArrayContents<double> timestamps(Float64Array::New(timestampsBuffer, 0, frames));
+        memcpy(*timestamps, _batchTimestamps.data(), frames * sizeof(double));
+
+        offsetsBuffer = ArrayBuffer::New(Isolate::GetCurrent(), (frames + 1) * sizeof(uint32_t));
+        Local<Uint32Array> offsets = Uint32Array::New(offsetsBuffer, 0, frames + 1);
+        Nan::TypedArrayContents<uint32_t> offsetsContents(offsets);
+        uint32_t* offset = *offsetsContents;
+        for (int i = 0; i < frames; i++) {
+            offset[i] = _batchOffsets[i];
+        }
+        offset[frames] = length;
 
-void HciSocket::l2SocketOnHciRead(char* data, int length) {
-    if (length == 22 && data[0] == HCI_EVENT_PKT && data[1] == EVT_LE_META_EVENT && data[2] == 19 && data[3] == EVT_LE_CONN_COMPLETE && data[4] == 0x00) {
-        // On HCI Event - LE Meta Event - LE Connection Complete => manually create L2CAP socket or update existing
-#ifdef DEBUG
-        printf("[HciSocket::l2SocketOnHciRead] evt_type HCI_EVENT_PKT, sub_evt_type EVT_LE_META_EVENT, sub_evt EVT_LE_CONN_COMPLETE\n");
-#endif
-        // Data format
-        // uint8_t evt_type: HCI_EVENT_PKT (0x04)
-        // uint8_t sub_evt_type: EVT_LE_META_EVENT (0x3b)
-        // uint8_t pkt_len: (19)
-        // uint8_t sub_evt: EVT_LE_CONN_COMPLETE (0x01)
-        // uint8_t status
-        // uint16_t handle
-        // uint8_t role
-        // uint8_t peer_bdaddr_type
-        // bdaddr_t peer_bdaddr
-        // uint16_t interval
-        // uint16_t latency
-        // uint16_t supervision_timeout
-        // uint8_t master_clock_accuracy
-        uint16_t handle = *((uint16_t*)(&data[5]));
-        handle = handle & 0x0fff;  // Remove flags
-        uint8_t peerAddrType = data[8] + 1;
-        uint8_t* peerAddr = (uint8_t*)(&data[9]);
-#ifdef DEBUG
-        uint16_t interval = (data[16] << 8) | data[15];
-        uint16_t latency = (data[18] << 8) | data[17];
-        uint16_t timeout = (data[20] << 8) | data[19];
-        printf("[HciSocket::l2SocketOnHciRead] handle %u, peerAddrType %u, peerAddr %02x%02x%02x%02x%02x%02x, interval %u, latency %u, timeout %u\n",
-               handle, peerAddrType, peerAddr[5], peerAddr[4], peerAddr[3], peerAddr[2], peerAddr[1], peerAddr[0], interval, latency, timeout);
-#endif
+        batch = Nan::CopyBuffer(data, length).ToLocalChecked();
 
-        std::shared_ptr<L2Socket> l2Socket = nullptr;
-        for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-            if (_l2Sockets[i] != nullptr) {
-                uint8_t* sockAddr = (uint8_t*)_l2Sockets[i]->_dst.l2_bdaddr.b;
-                if (!memcmp(sockAddr, peerAddr, 6)) {
-                    l2Socket = _l2Sockets[i];
-                    break;
-                }
-            }
+        // Frames are inspected from the copy
+        char* batchData = node::Buffer::Data(batch);
+        for (int i = 0; i < frames; i++) {
+            l2SocketOnHciRead(batchData + offset[i], offset[i + 1] - offset[i]);
         }
+    }
 
-        if (l2Socket != nullptr) {
-#ifdef DEBUG
-            printf("[HciSocket::l2SocketOnHciRead] socket found (connected %d)\n", l2Socket->connected());
-#endif
-            l2Socket->_handle = handle;
-        } else {
-#ifdef DEBUG
-            printf("[HciSocket::l2SocketOnHciRead] socket not found (available %d)\n", _availableL2Sockets);
-#endif
-            l2Socket = std::make_shared<L2Socket>(this, _address, _addressType, peerAddr, peerAddrType);
-            if (!l2Socket->connected()) {
-#ifdef DEBUG
-                printf("[HciSocket::l2SocketOnHciRead] socket not connected\n");
-#endif
-                emitErrnoError(l2Socket->_errno, l2Socket->_syscall);
-                return;
+    std::vector<BatchAclPdu> pdus;
+    pdus.swap(_batchAclPdus);
+    std::vector<Local<Object>> pduBuffers;
+    pduBuffers.reserve(pdus.size());
+    for (const BatchAclPdu& pdu : pdus) {
+        pduBuffers.push_back(Nan::CopyBuffer(_batchAclData.data() + pdu.offset, pdu.length).ToLocalChecked());
+    }
+
+    // Keep the frames, the reassembled PDUs and the reports in the order they were received:
+    // reports queued before a frame or a PDU are flushed ahead of it
+    std::vector<BatchReportsMark> marks;
+    marks.swap(_batchMarks);
+    BatchReportsMark flushed = {0, 0};
+    int first = 0;
+    size_t next = 0;
+    for (int i = 0; i <= frames; i++) {
+        for (; next < pdus.size() && pdus[next].frame == i; next++) {
+            if (i > first) {
+                emitBatch(batch, offsetsBuffer, timestampsBuffer, first, i);
+                first = i;
             }
-            l2Socket->_handle = handle;
-            for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-                if (_l2Sockets[i] == nullptr) {
-                    _l2Sockets[i] = l2Socket;
-                    _availableL2Sockets--;
-                    break;
-                }
+            flushBatchReports(pdus[next].reports, &flushed);
+            emitAclData(pdus[next].handle, pdus[next].cid, pduBuffers[next], pdus[next].timestamp);
+        }
+        if (i < frames && (marks[i].advReports > flushed.advReports || marks[i].notifyReports > flushed.notifyReports)) {
+            if (i > first) {
+                emitBatch(batch, offsetsBuffer, timestampsBuffer, first, i);
+                first = i;
             }
+            flushBatchReports(marks[i], &flushed);
         }
-    } else if (length == 7 && data[0] == HCI_EVENT_PKT && data[1] == EVT_DISCONN_COMPLETE && data[2] == 4 && data[3] == 0x00) {
-        // On HCI Event - Disconn Complete => manually destroy L2CAP socket
-#ifdef DEBUG
-        printf("[HciSocket::l2SocketOnHciRead] evt_type HCI_EVENT_PKT, sub_evt_type EVT_DISCONN_COMPLETE\n");
-#endif
+    }
+    if (frames > first) {
+        emitBatch(batch, offsetsBuffer, timestampsBuffer, first, frames);
+    }
+    pdus.clear();
+    _batchAclPdus.swap(pdus);
+    marks.clear();
+    _batchMarks.swap(marks);
+
+    flushAdvReports(_advReports.count);
+    flushNotifyReports(_notifyReports.count);
+}
+
+// Flushes the reports queued up to mark, flushed counts those already emitted in this batch
+void HciSocket::flushBatchReports(const BatchReportsMark& mark, BatchReportsMark* flushed) {
+    flushAdvReports(mark.advReports - flushed->advReports);
+    flushNotifyReports(mark.notifyReports - flushed->notifyReports);
+    *flushed = mark;
+}
+
+// Emit batch frames first to last (excluded), offsets are shared and absolute into the batch
+void HciSocket::emitBatch(Local<Object> batch, Local<ArrayBuffer> offsetsBuffer, Local<ArrayBuffer> timestampsBuffer, int first, int last) {
+    Local<Value> argv[4] = {
+        Nan::New("batch").ToLocalChecked(),
+        batch,
+        Uint32Array::New(offsetsBuffer, first * sizeof(uint32_t), last - first + 1),
+        Float64Array::New(timestampsBuffer, first * sizeof(double), last - first)};
+    emitEvent(4, argv);
+}
+
+void HciSocket::setAclReassembly(int maxPdu, uint32_t timeout) {
+    _aclReassembly.configure(maxPdu, timeout);
+}
+
+void HciSocket::setAclMaxPdu(uint16_t handle, int maxPdu) {
+    _aclReassembly.setMaxPdu(handle & 0x0fff, maxPdu);
+}
+
+bool HciSocket::aclReassemblyOnHciRead(char* data, int length, AclReassembly::Pdu* pdu) {
+    pdu->data = nullptr;
+    if (!_aclReassembly.enabled()) {
+        return false;
+    }
+
+    if (length == 7 && data[0] == HCI_EVENT_PKT && data[1] == EVT_DISCONN_COMPLETE && data[3] == 0x00) {
+        // On HCI Event - Disconn Complete => drop the partial PDU of the handle
+        uint16_t handle = ((uint8_t)data[5] << 8) | (uint8_t)data[4];
+        _aclReassembly.reset(handle & 0x0fff);
+        return false;
+    }
+
+    if (length < 1 || data[0] != HCI_ACLDATA_PKT) {
+        return false;
+    }
+    return _aclReassembly.process(data, length, uv_hrtime() / 1000000, pdu);
+}
+
+void HciSocket::setAclTxBuffers(int pktLen, int maxPkt) {
+    _aclScheduler.configure(pktLen, maxPkt);
+}
+
+bool HciSocket::writeAcl(uint16_t handle, uint8_t flags, uint16_t cid, char* data, int length) {
+    if (!_aclScheduler.enqueue(handle & 0x0fff, flags, cid, data, length)) {
+        return false;
+    }
+    flushAcl();
+    return true;
+}
+
+// Returns true when controller buffers were released
+bool HciSocket::aclSchedulerOnHciRead(char* data, int length) {
+    if (!_aclScheduler.enabled() || length < 4 || data[0] != HCI_EVENT_PKT) {
+        return false;
+    }
+
+    if (data[1] == EVT_NUM_COMP_PKTS) {
+        // On HCI Event - Number Of Completed Packets => return credits
         // Data format
         // uint8_t evt_type: HCI_EVENT_PKT (0x04)
-        // uint8_t sub_evt_type: EVT_DISCONN_COMPLETE (0x05)
-        // uint8_t pkt_len: (4)
-        // uint8_t status
-        // uint16_t handle
-        // uint8_t reason
-        uint16_t handle = *((uint16_t*)(&data[4]));
-        handle = handle & 0x0fff;  // Remove flags
-
-#ifdef DEBUG
-        printf("[HciSocket::l2SocketOnHciRead] handle %u\n", handle);
-#endif
+        // uint8_t sub_evt_type: EVT_NUM_COMP_PKTS (0x13)
+        // uint8_t pkt_len
+        // uint8_t num_hndl
+        //  uint16_t handle
+        //  uint16_t num_pkts
+        int numHandles = (uint8_t)data[3];
+        if (length < 4 + numHandles * 4) {
+            return false;
+        }
+        for (int i = 0; i < numHandles; i++) {
+            uint16_t handle = ((uint8_t)data[5 + i * 4] << 8) | (uint8_t)data[4 + i * 4];
+            uint16_t numPkts = ((uint8_t)data[7 + i * 4] << 8) | (uint8_t)data[6 + i * 4];
+            _aclScheduler.complete(handle & 0x0fff, numPkts);
+        }
+        return true;
+    } else if (length == 7 && data[1] == EVT_DISCONN_COMPLETE && data[3] == 0x00) {
+        // On HCI Event - Disconn Complete => drop the queue of the handle
+        uint16_t handle = ((uint8_t)data[5] << 8) | (uint8_t)data[4];
+        _aclScheduler.remove(handle & 0x0fff);
+        return true;
+    }
+    return false;
+}
 
-        for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-            if (_l2Sockets[i] != nullptr && _l2Sockets[i]->_handle == handle) {
-#ifdef DEBUG
-                printf("[HciSocket::l2SocketOnHciRead] socket found (connected %d)\n", _l2Sockets[i]->connected());
-#endif
-                _l2Sockets[i]->disconnect();
-                _l2Sockets[i] = nullptr;
-                _availableL2Sockets++;
-                break;
+// Send queued fragments while the controller has buffers, several per syscall
+void HciSocket::flushAcl() {
+    AclScheduler::Fragment fragments[ACL_SCHEDULER_BATCH_MAX];
+    struct mmsghdr msgs[ACL_SCHEDULER_BATCH_MAX];
+    struct iovec iovs[ACL_SCHEDULER_BATCH_MAX];
+
+    int count;
+    while ((count = _aclScheduler.schedule(fragments, ACL_SCHEDULER_BATCH_MAX)) > 0) {
+        memset(msgs, 0, count * sizeof(struct mmsghdr));
+        for (int i = 0; i < count; i++) {
+            iovs[i].iov_base = (void*)fragments[i].data;
+            iovs[i].iov_len = fragments[i].length;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(_socket, msgs, count, _writeQueueMax > 0 ? MSG_DONTWAIT : 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Resumed by flushWrites() once the socket is writable
+                _aclBlocked = true;
+                updatePoll();
+                return;
             }
+            // Drop the failing PDU, the other fragments are retried on the next credits
+            int err = errno;
+            _aclScheduler.commit(fragments, 0, 1);
+            emitErrnoError(err, "sendmmsg@HciSocket::flushAcl");
+            return;
+        }
+        for (int i = 0; i < sent; i++) {
+            trace(fragments[i].data, fragments[i].length, false);
         }
+        _aclScheduler.commit(fragments, sent, 0);
     }
 }
 
-bool HciSocket::l2SocketOnHciWrite(char* data, int length) {
-    if (length == 29 && data[0] == HCI_COMMAND_PKT && ((data[2] << 8) | data[1]) == (OCF_LE_CREATE_CONN | (OGF_LE_CTL << 10)) && data[3] == 25) {
-        // On HCI Command - LE Create Conn => manually create L2CAP socket
-#ifdef DEBUG
-        printf("[HciSocket::l2SocketOnHciWrite] evt_type HCI_COMMAND_PKT, command OCF_LE_CREATE_CONN\n");
+void HciSocket::emitAclData(uint16_t handle, uint16_t cid, Local<Object> pdu, double timestamp) {
+    Local<Value> argv[5] = {
+        Nan::New("aclData").ToLocalChecked(),
+        Nan::New((uint32_t)handle),
+        Nan::New((uint32_t)cid),
+        pdu,
+        Nan::New(timestamp)};
+    emitEvent(5, argv);
+}
+
+Local<Value> HciSocket::setAdvReports(int capacity) {
+    Nan::EscapableHandleScope scope;
+
+    if (capacity < 0) {
+        capacity = 0;
+    } else if (capacity > ADV_REPORTS_MAX) {
+        capacity = ADV_REPORTS_MAX;
+    }
+
+    _advReports = {};
+    _advReportsObject.Reset();
+    if (capacity == 0) {
+        return scope.Escape(Nan::Undefined());
+    }
+
+    AdvReports& r = _advReports;
+    Local<Object> payload = Nan::NewBuffer(capacity * ADV_DATA_MAX).ToLocalChecked();
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("type").ToLocalChecked(), NewTypedArray<Uint16Array>(capacity, &r.type));
+    Nan::Set(object, Nan::New("addressType").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.addressType));
+    Nan::Set(object, Nan::New("address").ToLocalChecked(), NewTypedArray<Float64Array>(capacity, &r.address));
+    Nan::Set(object, Nan::New("rssi").ToLocalChecked(), NewTypedArray<Int8Array>(capacity, &r.rssi));
+    Nan::Set(object, Nan::New("advOffset").ToLocalChecked(), NewTypedArray<Uint32Array>(capacity, &r.advOffset));
+    Nan::Set(object, Nan::New("advLength").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.advLength));
+    Nan::Set(object, Nan::New("extended").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.extended));
+    Nan::Set(object, Nan::New("numReports").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.numReports));
+    Nan::Set(object, Nan::New("primaryPhy").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.primaryPhy));
+    Nan::Set(object, Nan::New("secondaryPhy").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.secondaryPhy));
+    Nan::Set(object, Nan::New("sid").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.sid));
+    Nan::Set(object, Nan::New("txPower").ToLocalChecked(), NewTypedArray<Int8Array>(capacity, &r.txPower));
+    Nan::Set(object, Nan::New("periodicAdvInterval").ToLocalChecked(), NewTypedArray<Uint16Array>(capacity, &r.periodicAdvInterval));
+    Nan::Set(object, Nan::New("directAddressType").ToLocalChecked(), NewTypedArray<Uint8Array>(capacity, &r.directAddressType));
+    Nan::Set(object, Nan::New("directAddress").ToLocalChecked(), NewTypedArray<Float64Array>(capacity, &r.directAddress));
+    Nan::Set(object, Nan::New("timestamp").ToLocalChecked(), NewTypedArray<Float64Array>(capacity, &r.timestamp));
+    Nan::Set(object, Nan::New("payload").ToLocalChecked(), payload);
+    r.payload = node::Buffer::Data(payload);
+    r.payloadSize = capacity * ADV_DATA_MAX;
+    r.capacity = capacity;
+
+    _advReportsObject.Reset(object);
+    return scope.Escape(object);
+}
+
+bool HciSocket::advReportsOnHciRead(char* data, int length) {
+    AdvReports& r = _advReports;
+
+    if (r.capacity == 0 || length < 5 || data[0] != HCI_EVENT_PKT || data[1] != EVT_LE_META_EVENT) {
+        return false;
+    }
+    if (data[3] != EVT_LE_ADVERTISING_REPORT && data[3] != EVT_LE_EXTENDED_ADVERTISING_REPORT) {
+        return false;
+    }
+
+    // Data format
+    // uint8_t evt_type: HCI_EVENT_PKT (0x04)
+    // uint8_t sub_evt_type: EVT_LE_META_EVENT (0x3e)
+    // uint8_t pkt_len
+    // uint8_t sub_evt: EVT_LE_ADVERTISING_REPORT (0x02) or EVT_LE_EXTENDED_ADVERTISING_REPORT (0x0d)
+    // uint8_t num_reports
+    // ...
+    bool extended = data[3] == EVT_LE_EXTENDED_ADVERTISING_REPORT;
+    int numReports = (uint8_t)data[4];
+    const uint8_t* p = (const uint8_t*)&data[5];
+    const uint8_t* end = (const uint8_t*)&data[length];
+
+    // Reports are committed only once the whole frame has been decoded: malformed
+    // frames or frames that don't fit are left to the JS parser
+    int count = r.count;
+    uint32_t payloadLength = r.payloadLength;
+    for (int i = 0; i < numReports; i++, count++) {
+        const uint8_t* adv;
+        uint8_t advLength;
+
+        if (count >= r.capacity) {
+            return false;
+        }
+
+        if (extended) {
+            // uint16_t evt_type
+            // uint8_t bdaddr_type
+            // bdaddr_t bdaddr
+            // uint8_t primary_phy
+            // uint8_t secondary_phy
+            // uint8_t sid
+            // int8_t txpower
+            // int8_t rssi
+            // uint16_t periodic_adv_interval
+            // uint8_t direct_bdaddr_type
+            // bdaddr_t direct_bdaddr
+            // uint8_t adv_length
+            // uint8_t adv_data[0..adv_length-1]
+            if (end - p < 24 || end - p < 24 + p[23]) {
+                return false;
+            }
+            advLength = p[23];
+            adv = &p[24];
+            r.type[count] = p[0] | (p[1] << 8);
+            r.addressType[count] = p[2];
+            r.address[count] = AddressToNumber(&p[3]);
+            r.primaryPhy[count] = p[9];
+            r.secondaryPhy[count] = p[10];
+            r.sid[count] = p[11];
+            r.txPower[count] = (int8_t)p[12];
+            r.rssi[count] = (int8_t)p[13];
+            r.periodicAdvInterval[count] = p[14] | (p[15] << 8);
+            r.directAddressType[count] = p[16];
+            r.directAddress[count] = AddressToNumber(&p[17]);
+            p += 24 + advLength;
+        } else {
+            // uint8_t evt_type
+            // uint8_t bdaddr_type
+            // bdaddr_t bdaddr
+            // uint8_t adv_length
+            // uint8_t adv_data[0..adv_length-1]
+            // int8_t rssi
+            if (end - p < 10 || end - p < 10 + p[8]) {
+                return false;
+            }
+            advLength = p[8];
+            adv = &p[9];
+            r.type[count] = p[0];
+            r.addressType[count] = p[1];
+            r.address[count] = AddressToNumber(&p[2]);
+            r.rssi[count] = (int8_t)p[9 + advLength];
+            r.primaryPhy[count] = 0;
+            r.secondaryPhy[count] = 0;
+            r.sid[count] = 0;
+            r.txPower[count] = 0;
+            r.periodicAdvInterval[count] = 0;
+            r.directAddressType[count] = 0;
+            r.directAddress[count] = 0;
+            p += 10 + advLength;
+        }
+
+        if (payloadLength + advLength > r.payloadSize) {
+            return false;
+        }
+        memcpy(&r.payload[payloadLength], adv, advLength);
+        r.advOffset[count] = payloadLength;
+        r.advLength[count] = advLength;
+        r.extended[count] = extended;
+        r.numReports[count] = numReports;
+        r.timestamp[count] = _rxTimestamp;
+        payloadLength += advLength;
+    }
+
+    r.count = count;
+    r.payloadLength = payloadLength;
+    return true;
+}
+
+void HciSocket::setAdvFilter(char* data, int length) {
+    if (data == nullptr || length == 0) {
+        _advFilter.clear();
+    } else if (!_advFilter.parse((const uint8_t*)data, length)) {
+        emitErrnoError(EINVAL, "setAdvFilter@HciSocket::setAdvFilter");
+    }
+}
+
+Local<Object> HciSocket::getAdvFilterStats() {
+    Nan::EscapableHandleScope scope;
+
+    const AdvFilter::Counters& counters = _advFilter.counters();
+    Local<Object> stats = Nan::New<Object>();
+    Nan::Set(stats, Nan::New("accepted").ToLocalChecked(), Nan::New<Number>((double)counters.accepted));
+    Nan::Set(stats, Nan::New("rssi").ToLocalChecked(), Nan::New<Number>((double)counters.rssi));
+    Nan::Set(stats, Nan::New("address").ToLocalChecked(), Nan::New<Number>((double)counters.address));
+    Nan::Set(stats, Nan::New("adType").ToLocalChecked(), Nan::New<Number>((double)counters.adType));
+    Nan::Set(stats, Nan::New("manufacturerId").ToLocalChecked(), Nan::New<Number>((double)counters.manufacturerId));
+    Nan::Set(stats, Nan::New("serviceUuid").ToLocalChecked(), Nan::New<Number>((double)counters.serviceUuid));
+    Nan::Set(stats, Nan::New("duplicate").ToLocalChecked(), Nan::New<Number>((double)counters.duplicate));
+    return scope.Escape(stats);
+}
+
+bool HciSocket::advFilterOnHciRead(char* data, int* length) {
+    if (!_advFilter.enabled() || *length < 5 || data[0] != HCI_EVENT_PKT || data[1] != EVT_LE_META_EVENT) {
+        return true;
+    }
+    if (data[3] != EVT_LE_ADVERTISING_REPORT && data[3] != EVT_LE_EXTENDED_ADVERTISING_REPORT) {
+        return true;
+    }
+
+    // Accepted reports are compacted in place, see advReportsOnHciRead for the data format
+    bool extended = data[3] == EVT_LE_EXTENDED_ADVERTISING_REPORT;
+    int numReports = (uint8_t)data[4];
+    uint8_t* p = (uint8_t*)&data[5];
+    uint8_t* end = (uint8_t*)&data[*length];
+    uint8_t* out = p;
+    int accepted = 0;
+    uint64_t now = uv_hrtime() / 1000000;
+
+    for (int i = 0; i < numReports; i++) {
+        const uint8_t* addr;
+        const uint8_t* adv;
+        uint8_t advLength;
+        int8_t rssi;
+        int reportLength;
+
+        if (extended) {
+            if (end - p < 24 || end - p < 24 + p[23]) {
+                break;
+            }
+            addr = &p[3];
+            rssi = (int8_t)p[13];
+            advLength = p[23];
+            adv = &p[24];
+            reportLength = 24 + advLength;
+        } else {
+            if (end - p < 10 || end - p < 10 + p[8]) {
+                break;
+            }
+            addr = &p[2];
+            advLength = p[8];
+            adv = &p[9];
+            rssi = (int8_t)p[9 + advLength];
+            reportLength = 10 + advLength;
+        }
+
+        if (_advFilter.accept(addr, rssi, adv, advLength, now)) {
+            if (out != p) {
+                memmove(out, p, reportLength);
+            }
+            out += reportLength;
+            accepted++;
+        }
+        p += reportLength;
+    }
+
+    if (accepted == 0) {
+        return false;
+    }
+
+    *length = out - (uint8_t*)data;
+    data[2] = *length - 3;
+    data[4] = accepted;
+    return true;
+}
+
+Local<Value> HciSocket::setNotifyReports(int capacity) {
+    Nan::EscapableHandleScope scope;
+
+    if (capacity < 0) {
+        capacity = 0;
+    } else if (capacity > NOTIFY_REPORTS_MAX) {
+        capacity = NOTIFY_REPORTS_MAX;
+    }
+
+    _notifyReports = {};
+    _notifyReportsObject.Reset();
+    if (capacity == 0) {
+        return scope.Escape(Nan::Undefined());
+    }
+
+    NotifyReports& r = _notifyReports;
+    Local<Object> payload = Nan::NewBuffer(capacity * NOTIFY_VALUE_MAX).ToLocalChecked();
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("connectionHandle").ToLocalChecked(), NewTypedArray<Uint16Array>(capacity, &r.connectionHandle));
+    Nan::Set(object, Nan::New("handle").ToLocalChecked(), NewTypedArray<Uint16Array>(capacity, &r.handle));
+    Nan::Set(object, Nan::New("valueOffset").ToLocalChecked(), NewTypedArray<Uint32Array>(capacity, &r.valueOffset));
+    Nan::Set(object, Nan::New("valueLength").ToLocalChecked(), NewTypedArray<Uint16Array>(capacity, &r.valueLength));
+    Nan::Set(object, Nan::New("timestamp").ToLocalChecked(), NewTypedArray<Float64Array>(capacity, &r.timestamp));
+    Nan::Set(object, Nan::New("payload").ToLocalChecked(), payload);
+    r.payload = node::Buffer::Data(payload);
+    r.payloadSize = capacity * NOTIFY_VALUE_MAX;
+    r.capacity = capacity;
+
+    _notifyReportsObject.Reset(object);
+    return scope.Escape(object);
+}
+
+void HciSocket::setNotifySubscription(uint16_t handle, uint16_t attHandle, bool enabled) {
+    if (enabled) {
+        _notifyTable.subscribe(handle, attHandle);
+    } else {
+        _notifyTable.unsubscribe(handle, attHandle);
+    }
+}
+
+// Single fragment L2CAP PDUs, fragmented ones come from native reassembly
+bool HciSocket::notifyReportsOnHciRead(char* data, int length) {
+    if (_notifyTable.empty() || length < 4) {
+        return false;
+    }
+
+    if (length == 7 && data[0] == HCI_EVENT_PKT && data[1] == EVT_DISCONN_COMPLETE && data[3] == 0x00) {
+        // On HCI Event - Disconn Complete => drop the subscriptions of the handle
+        uint16_t handle = ((uint8_t)data[5] << 8) | (uint8_t)data[4];
+        _notifyTable.removeConnection(handle & 0x0fff);
+        return false;
+    }
+
+    // Data format
+    // uint8_t evt_type: HCI_ACLDATA_PKT (0x02)
+    // uint16_t handle: handle (12 bits) | pb flag (2 bits) | bc flag (2 bits)
+    // uint16_t acl_length
+    // uint16_t l2cap_length
+    // uint16_t cid
+    // uint8_t pdu[l2cap_length]
+    if (length < 9 || data[0] != HCI_ACLDATA_PKT) {
+        return false;
+    }
+    uint16_t handle = ((uint8_t)data[2] << 8) | (uint8_t)data[1];
+    uint8_t flags = (handle >> 12) & 0x03;
+    int aclLength = ((uint8_t)data[4] << 8) | (uint8_t)data[3];
+    int l2capLength = ((uint8_t)data[6] << 8) | (uint8_t)data[5];
+    if (flags == ACL_CONT || aclLength != length - 5 || l2capLength != aclLength - 4) {
+        return false;
+    }
+    uint16_t cid = ((uint8_t)data[8] << 8) | (uint8_t)data[7];
+    return notifyReportsOnPdu(handle & 0x0fff, cid, &data[9], l2capLength);
+}
+
+bool HciSocket::notifyReportsOnPdu(uint16_t handle, uint16_t cid, const char* pdu, int length) {
+    NotifyReports& r = _notifyReports;
+
+    // Handle Value Notification
+    // uint8_t opcode: ATT_OP_HANDLE_NOTIFY (0x1b)
+    // uint16_t handle
+    // uint8_t value[]
+    if (r.capacity == 0 || cid != ATT_CID || length < 3 || (uint8_t)pdu[0] != ATT_OP_HANDLE_NOTIFY) {
+        return false;
+    }
+    uint16_t attHandle = ((uint8_t)pdu[2] << 8) | (uint8_t)pdu[1];
+    if (!_notifyTable.subscribed(handle, attHandle)) {
+        return false;
+    }
+    int valueLength = length - 3;
+    if (r.count >= r.capacity || r.payloadLength + valueLength > r.payloadSize) {
+        // Left to the JS ATT layer
+        _notifyTable.counters().fallback++;
+        return false;
+    }
+    memcpy(&r.payload[r.payloadLength], &pdu[3], valueLength);
+    r.connectionHandle[r.count] = handle;
+    r.handle[r.count] = attHandle;
+    r.valueOffset[r.count] = r.payloadLength;
+    r.valueLength[r.count] = valueLength;
+    r.timestamp[r.count] = _rxTimestamp;
+    r.payloadLength += valueLength;
+    r.count++;
+    _notifyTable.counters().delivered++;
+    return true;
+}
+
+// Emits the first count reports, the ones queued after them move to the front
+void HciSocket::flushNotifyReports(int count) {
+    if (count > _notifyReports.count) {
+        count = _notifyReports.count;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    Local<Value> argv[2] = {
+        Nan::New("notifyReports").ToLocalChecked(),
+        Nan::New(count)};
+    emitEvent(2, argv);
+
+    // Values stay in place in the payload, only the columns move
+    NotifyReports& r = _notifyReports;
+    int rest = r.count - count;
+    if (rest <= 0) {
+        r.count = 0;
+        r.payloadLength = 0;
+        return;
+    }
+    ShiftColumn(r.connectionHandle, count, rest);
+    ShiftColumn(r.handle, count, rest);
+    ShiftColumn(r.valueOffset, count, rest);
+    ShiftColumn(r.valueLength, count, rest);
+    ShiftColumn(r.timestamp, count, rest);
+    r.count = rest;
+}
+
+// Emits the first count reports, the ones queued after them move to the front
+void HciSocket::flushAdvReports(int count) {
+    if (count > _advReports.count) {
+        count = _advReports.count;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    Local<Value> argv[2] = {
+        Nan::New("advReports").ToLocalChecked(),
+        Nan::New(count)};
+    emitEvent(2, argv);
+
+    // Data stays in place in the payload, only the columns move
+    AdvReports& r = _advReports;
+    int rest = r.count - count;
+    if (rest <= 0) {
+        r.count = 0;
+        r.payloadLength = 0;
+        return;
+    }
+    ShiftColumn(r.type, count, rest);
+    ShiftColumn(r.addressType, count, rest);
+    ShiftColumn(r.address, count, rest);
+    ShiftColumn(r.rssi, count, rest);
+    ShiftColumn(r.advOffset, count, rest);
+    ShiftColumn(r.advLength, count, rest);
+    ShiftColumn(r.extended, count, rest);
+    ShiftColumn(r.numReports, count, rest);
+    ShiftColumn(r.primaryPhy, count, rest);
+    ShiftColumn(r.secondaryPhy, count, rest);
+    ShiftColumn(r.sid, count, rest);
+    ShiftColumn(r.txPower, count, rest);
+    ShiftColumn(r.periodicAdvInterval, count, rest);
+    ShiftColumn(r.directAddressType, count, rest);
+    ShiftColumn(r.directAddress, count, rest);
+    ShiftColumn(r.timestamp, count, rest);
+    r.count = rest;
+}
+
+void HciSocket::stop() {
+    _started = false;
+    stopReader();
+    updatePoll();
+}
+
+// Returns false when the write was queued, "drain" is emitted once the queue is flushed
+// Writes refused by a full command or write queue throw ENOBUFS
+bool HciSocket::write(char* data, int length) {
+    if (_commandQueue.enabled() && length > 0 && data[0] == HCI_COMMAND_PKT) {
+        // Held until the controller has a credit for it
+        if (!_commandQueue.enqueue(data, length)) {
+            // Thrown, false means queued
+            Nan::ThrowError(Nan::ErrnoException(ENOBUFS, "write@HciSocket::write"));
+            return true;
+        }
+        flushCommands();
+        return true;
+    }
+    int rc = writeFrame(data, length);
+    if (rc == HCI_WRITE_DROPPED) {
+        Nan::ThrowError(Nan::ErrnoException(ENOBUFS, "write@HciSocket::write"));
+    }
+    return rc != HCI_WRITE_QUEUED;
+}
+
+// Returns one of HCI_WRITE_SENT, HCI_WRITE_QUEUED, HCI_WRITE_DROPPED, HCI_WRITE_UNSENT
+int HciSocket::writeFrame(char* data, int length) {
+    // Timed from here, the kernel may send the command on our behalf
+    _stats.onCommand(data, length);
+    int rc = l2SocketOnHciWrite(data, length);
+    if (rc != HCI_WRITE_QUEUED) {
+        return rc;
+    }
+
+    if (_writeQueueMax == 0) {
+        if (::write(_socket, data, length) < 0) {
+            emitErrnoError(errno, "write@HciSocket::write");
+        } else {
+            trace(data, length, false);
+        }
+        return HCI_WRITE_SENT;
+    }
+
+    if (_writeQueue.empty()) {
+        ssize_t rc;
+        while ((rc = send(_socket, data, length, MSG_DONTWAIT)) < 0 && errno == EINTR) {
+        }
+        if (rc >= 0) {
+            trace(data, length, false);
+            return HCI_WRITE_SENT;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            emitErrnoError(errno, "send@HciSocket::write");
+            return HCI_WRITE_SENT;
+        }
+    }
+
+    if (_writeQueueBytes + length > _writeQueueMax) {
+        // Not waiting for "drain": nothing may be queued to arm it
+        return HCI_WRITE_DROPPED;
+    }
+    _writeQueue.emplace_back(data, data + length);
+    _writeQueueBytes += length;
+    _writeNeedDrain = true;
+    updatePoll();
+    return HCI_WRITE_QUEUED;
+}
+
+void HciSocket::setCommandQueue(int maxQueued) {
+    if (maxQueued < 0) {
+        maxQueued = 0;
+    } else if (maxQueued > HCI_COMMAND_QUEUE_MAX) {
+        maxQueued = HCI_COMMAND_QUEUE_MAX;
+    }
+    // Commands still queued are dropped when disabling
+    _commandQueue.configure(maxQueued);
+}
+
+// The command will not complete anymore (e.g. timed out in JS)
+void HciSocket::abortCommand(uint16_t opcode) {
+    _commandQueue.timeout(opcode);
+    flushCommands();
+}
+
+void HciSocket::flushCommands() {
+    std::vector<char> command;
+    while (_commandQueue.next(&command)) {
+        int rc = writeFrame(command.data(), (int)command.size());
+        if (rc == HCI_WRITE_DROPPED) {
+            emitErrnoError(ENOBUFS, "write@HciSocket::flushCommands");
+        }
+        if (rc == HCI_WRITE_DROPPED || rc == HCI_WRITE_UNSENT) {
+            // No Command Complete or Command Status will give its credit back
+            _commandQueue.unsent((uint8_t)command[1] | ((uint8_t)command[2] << 8));
+        }
+    }
+}
+
+void HciSocket::setWriteQueue(int maxBytes) {
+    if (maxBytes < 0) {
+        maxBytes = 0;
+    } else if (maxBytes > HCI_WRITE_QUEUE_MAX) {
+        maxBytes = HCI_WRITE_QUEUE_MAX;
+    }
+
+    // Switching back to blocking writes flushes the queue first
+    _writeQueueMax = maxBytes;
+    if (maxBytes == 0) {
+        for (std::vector<char>& packet : _writeQueue) {
+            if (::write(_socket, packet.data(), packet.size()) < 0) {
+                emitErrnoError(errno, "write@HciSocket::setWriteQueue");
+            } else {
+                trace(packet.data(), packet.size(), false);
+            }
+        }
+        _writeQueue.clear();
+        _writeQueueBytes = 0;
+        _aclBlocked = false;
+        updatePoll();
+    }
+}
+
+void HciSocket::flushWrites() {
+    while (!_writeQueue.empty()) {
+        std::vector<char>& packet = _writeQueue.front();
+        ssize_t rc = send(_socket, packet.data(), packet.size(), MSG_DONTWAIT);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            // Drop the packet, the remaining ones may still go through
+            emitErrnoError(errno, "send@HciSocket::flushWrites");
+        } else {
+            trace(packet.data(), packet.size(), false);
+        }
+        _writeQueueBytes -= packet.size();
+        _writeQueue.pop_front();
+    }
+
+    if (_aclBlocked) {
+        _aclBlocked = false;
+        flushAcl();
+    }
+    updatePoll();
+
+    if (_writeQueue.empty() && !_aclBlocked && _writeNeedDrain) {
+        _writeNeedDrain = false;
+        Local<Value> argv[1] = {
+            Nan::New("drain").ToLocalChecked()};
+        emitEvent(1, argv);
+    }
+}
+
+void HciSocket::emitEvent(int argc, Local<Value>* argv) {
+    _asyncResource->runInAsyncScope(
+                      Nan::New<Object>(this->This),
+                      Nan::New("emit").ToLocalChecked(),
+                      argc,
+                      argv)
+        .FromMaybe(v8::Local<v8::Value>());
+}
+
+void HciSocket::emitErrnoError(int err_no, const char* syscall) {
+    v8::Local<v8::Value> error = Nan::ErrnoException(err_no, syscall, strerror(err_no));
+
+    Local<Value> argv[2] = {
+        Nan::New("error").ToLocalChecked(),
+        error};
+    emitEvent(2, argv);
+}
+
+int HciSocket::deviceIdFor(const int* pDeviceId, bool isUp) {
+    return _transport->deviceIdFor(pDeviceId, isUp);
+}
+
+void HciSocket::l2SocketOnHciRead(char* data, int length) {
+    if (length == 22 && data[0] == HCI_EVENT_PKT && data[1] == EVT_LE_META_EVENT && data[2] == 19 && data[3] == EVT_LE_CONN_COMPLETE && data[4] == HCI_MAX_NUMBER_OF_CONNECTIONS) {
+        // On HCI Event - LE Meta Event - LE Connection Complete with Connection Limit Exceeded => the controller limit is the number of established links
+        int established = 0;
+        for (auto& entry : _l2Sockets) {
+            if (entry.second->_handle != 0x0fff) {
+                established++;
+            }
+        }
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciRead] connection limit exceeded (limit %d, established %d)\n", _l2SocketsLimit, established);
+#endif
+        // Links of other processes count for the controller, not here: the limit found can be lower
+        if (established > 0 && established < _l2SocketsLimit) {
+            _l2SocketsLimit = established;
+        }
+    } else if (length == 7 && data[0] == HCI_EVENT_PKT && data[1] == EVT_CMD_COMPLETE && ((data[5] << 8) | data[4]) == (OCF_RESET | (OGF_HOST_CTL << 10)) && data[6] == 0x00) {
+        // On HCI Event - Command Complete - Reset => the controller dropped every link, discover the limit again
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciRead] reset (limit %d => %d)\n", _l2SocketsLimit, _l2SocketsMax);
+#endif
+        _l2SocketsLimit = _l2SocketsMax;
+    } else if (length == 22 && data[0] == HCI_EVENT_PKT && data[1] == EVT_LE_META_EVENT && data[2] == 19 && data[3] == EVT_LE_CONN_COMPLETE && data[4] == 0x00) {
+        // On HCI Event - LE Meta Event - LE Connection Complete => manually create L2CAP socket or update existing
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciRead] evt_type HCI_EVENT_PKT, sub_evt_type EVT_LE_META_EVENT, sub_evt EVT_LE_CONN_COMPLETE\n");
+#endif
+        // Data format
+        // uint8_t evt_type: HCI_EVENT_PKT (0x04)
+        // uint8_t sub_evt_type: EVT_LE_META_EVENT (0x3b)
+        // uint8_t pkt_len: (19)
+        // uint8_t sub_evt: EVT_LE_CONN_COMPLETE (0x01)
+        // uint8_t status
+        // uint16_t handle
+        // uint8_t role
+        // uint8_t peer_bdaddr_type
+        // bdaddr_t peer_bdaddr
+        // uint16_t interval
+        // uint16_t latency
+        // uint16_t supervision_timeout
+        // uint8_t master_clock_accuracy
+        uint16_t handle = *((uint16_t*)(&data[5]));
+        handle = handle & 0x0fff;  // Remove flags
+        uint8_t peerAddrType = data[8] + 1;
+        uint8_t* peerAddr = (uint8_t*)(&data[9]);
+#ifdef DEBUG
+        uint16_t interval = (data[16] << 8) | data[15];
+        uint16_t latency = (data[18] << 8) | data[17];
+        uint16_t timeout = (data[20] << 8) | data[19];
+        printf("[HciSocket::l2SocketOnHciRead] handle %u, peerAddrType %u, peerAddr %02x%02x%02x%02x%02x%02x, interval %u, latency %u, timeout %u\n",
+               handle, peerAddrType, peerAddr[5], peerAddr[4], peerAddr[3], peerAddr[2], peerAddr[1], peerAddr[0], interval, latency, timeout);
+#endif
+
+        std::shared_ptr<L2Socket> l2Socket = findL2Socket(peerAddr);
+
+        if (l2Socket != nullptr) {
+#ifdef DEBUG
+            printf("[HciSocket::l2SocketOnHciRead] socket found (connected %d)\n", l2Socket->connected());
+#endif
+            setL2SocketHandle(l2Socket.get(), handle);
+        } else {
+#ifdef DEBUG
+            printf("[HciSocket::l2SocketOnHciRead] socket not found (available %d)\n", availableL2Sockets());
+#endif
+            l2Socket = std::make_shared<L2Socket>(this, _address, _addressType, peerAddr, peerAddrType);
+            if (!l2Socket->connected()) {
+#ifdef DEBUG
+                printf("[HciSocket::l2SocketOnHciRead] socket not connected\n");
+#endif
+                emitErrnoError(l2Socket->_errno, l2Socket->_syscall);
+                return;
+            }
+            addL2Socket(l2Socket);
+            setL2SocketHandle(l2Socket.get(), handle);
+            if (!l2Socket->connecting()) {
+                l2SocketOnConnect(l2Socket.get(), true);
+            }
+        }
+    } else if (length == 7 && data[0] == HCI_EVENT_PKT && data[1] == EVT_DISCONN_COMPLETE && data[2] == 4 && data[3] == 0x00) {
+        // On HCI Event - Disconn Complete => manually destroy L2CAP socket
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciRead] evt_type HCI_EVENT_PKT, sub_evt_type EVT_DISCONN_COMPLETE\n");
+#endif
+        // Data format
+        // uint8_t evt_type: HCI_EVENT_PKT (0x04)
+        // uint8_t sub_evt_type: EVT_DISCONN_COMPLETE (0x05)
+        // uint8_t pkt_len: (4)
+        // uint8_t status
+        // uint16_t handle
+        // uint8_t reason
+        uint16_t handle = *((uint16_t*)(&data[4]));
+        handle = handle & 0x0fff;  // Remove flags
+
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciRead] handle %u\n", handle);
+#endif
+
+        L2Socket* l2Socket = _l2SocketsByHandle[handle];
+        if (l2Socket != nullptr) {
+#ifdef DEBUG
+            printf("[HciSocket::l2SocketOnHciRead] socket found (connected %d)\n", l2Socket->connected());
+#endif
+            l2Socket->disconnect();
+            removeL2Socket(l2Socket);
+        }
+    }
+}
+
+// Returns HCI_WRITE_QUEUED when the frame is to be written as is
+int HciSocket::l2SocketOnHciWrite(char* data, int length) {
+    if (length == 29 && data[0] == HCI_COMMAND_PKT && ((data[2] << 8) | data[1]) == (OCF_LE_CREATE_CONN | (OGF_LE_CTL << 10)) && data[3] == 25) {
+        // On HCI Command - LE Create Conn => manually create L2CAP socket
+#ifdef DEBUG
+        printf("[HciSocket::l2SocketOnHciWrite] evt_type HCI_COMMAND_PKT, command OCF_LE_CREATE_CONN\n");
 #endif
         // Data format
         // uint8_t evt_type: HCI_COMMAND_PKT (0x01)
@@ -497,6 +1520,11 @@ bool HciSocket::l2SocketOnHciWrite(char* data, int length) {
         // uint16_t supervision_timeout
         // uint16_t min_ce_length
         // uint16_t max_ce_length
+        if (data[8] != 0) {
+            // Initiating to the filter accept list, no peer to open a socket to: the
+            // command goes to the controller and sockets are created on LE Connection Complete
+            return HCI_WRITE_QUEUED;
+        }
         uint8_t peerAddrType = data[9] + 1;
         uint8_t* peerAddr = (uint8_t*)(&data[10]);
         uint16_t minInterval = (data[18] << 8) | data[17];
@@ -510,71 +1538,431 @@ bool HciSocket::l2SocketOnHciWrite(char* data, int length) {
                interval, window, peerAddrType, peerAddr[5], peerAddr[4], peerAddr[3], peerAddr[2], peerAddr[1], peerAddr[0], minInterval, maxInterval, latency, timeout);
 #endif
 
-        std::shared_ptr<L2Socket> l2Socket = nullptr;
-        for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-            if (_l2Sockets[i] != nullptr) {
-                uint8_t* sockAddr = (uint8_t*)_l2Sockets[i]->_dst.l2_bdaddr.b;
-                if (!memcmp(sockAddr, peerAddr, 6)) {
-                    l2Socket = _l2Sockets[i];
-                    break;
-                }
-            }
-        }
+        std::shared_ptr<L2Socket> l2Socket = findL2Socket(peerAddr);
 
         if (l2Socket != nullptr) {
 #ifdef DEBUG
             printf("[HciSocket::l2SocketOnHciWrite] socket found (connected %d)\n", l2Socket->connected());
 #endif
-            setConnectionParameters(minInterval, maxInterval, latency, timeout);
+            int err = setConnectionParameters(minInterval, maxInterval, latency, timeout);
+            if (err != 0) {
+                // The connection goes on with the parameters in use
+                emitErrnoError(err, "write@HciSocket::setConnectionParameters");
+            }
             l2Socket->disconnect();
             l2Socket->connect();
-        } else if (_availableL2Sockets > 0) {
+            if (!l2Socket->connecting()) {
+                l2SocketOnConnect(l2Socket.get(), false);
+                return HCI_WRITE_UNSENT;
+            }
+        } else if (availableL2Sockets() > 0) {
 #ifdef DEBUG
-            printf("[HciSocket::l2SocketOnHciWrite] socket not found (available %d)\n", _availableL2Sockets);
+            printf("[HciSocket::l2SocketOnHciWrite] socket not found (available %d)\n", availableL2Sockets());
 #endif
-            setConnectionParameters(minInterval, maxInterval, latency, timeout);
+            int err = setConnectionParameters(minInterval, maxInterval, latency, timeout);
+            if (err != 0) {
+                // The connection goes on with the parameters in use
+                emitErrnoError(err, "write@HciSocket::setConnectionParameters");
+            }
             l2Socket = std::make_shared<L2Socket>(this, _address, _addressType, peerAddr, peerAddrType);
             if (!l2Socket->connected()) {
 #ifdef DEBUG
                 printf("[HciSocket::l2SocketOnHciWrite] socket not connected\n");
 #endif
                 emitErrnoError(l2Socket->_errno, l2Socket->_syscall);
-                return false;
+                return HCI_WRITE_QUEUED;
             }
-            for (int i = 0; i < L2_SOCKETS_MAX; i++) {
-                if (_l2Sockets[i] == nullptr) {
-                    _l2Sockets[i] = l2Socket;
-                    _availableL2Sockets--;
-                    break;
-                }
+            addL2Socket(l2Socket);
+            if (!l2Socket->connecting()) {
+                l2SocketOnConnect(l2Socket.get(), false);
+                return HCI_WRITE_UNSENT;
             }
+        } else {
+            // No L2CAP socket left, the command is not sent either
+            _stats.onL2ConnectError(ENOBUFS);
+            emitL2SocketConnect(peerAddr, ENOBUFS, false);
+            return HCI_WRITE_UNSENT;
+        }
+
+        // Skip sending this command to HCI, because the command is sent by the connect() operation
+        return HCI_WRITE_SENT;
+    }
+
+    return HCI_WRITE_QUEUED;
+}
+
+// Called when a L2CAP socket connection completes, successfully or not, sent
+// telling whether LE Create Connection reached the controller
+void HciSocket::l2SocketOnConnect(L2Socket* l2Socket, bool sent) {
+    Nan::HandleScope scope;
+
+    // Keep the socket alive until the end of this call, it may be removed from the table
+    std::shared_ptr<L2Socket> ref = findL2Socket(l2Socket->_dst.l2_bdaddr.b);
+
+    int err = l2Socket->connected() ? 0 : l2Socket->_errno;
+    if (err != 0) {
+        if (ref.get() == l2Socket) {
+            removeL2Socket(l2Socket);
+        }
+        _stats.onL2ConnectError(err);
+        emitErrnoError(err, l2Socket->_syscall);
+    }
+
+    emitL2SocketConnect(l2Socket->_dst.l2_bdaddr.b, err, sent);
+}
+
+void HciSocket::emitL2SocketConnect(const uint8_t* addr, int err, bool sent) {
+    Nan::HandleScope scope;
+
+    char address[13];
+    AddressToString(addr, address);
+#ifdef DEBUG
+    printf("[HciSocket::emitL2SocketConnect] address %s, errno %d, sent %d\n", address, err, sent);
+#endif
+
+    Local<Value> argv[4] = {
+        Nan::New("l2SocketConnect").ToLocalChecked(),
+        Nan::New(address).ToLocalChecked(),
+        Nan::New(err),
+        Nan::New(sent)};
+    emitEvent(4, argv);
+}
+
+std::shared_ptr<L2Socket> HciSocket::findL2Socket(const uint8_t* addr) const {
+    auto it = _l2Sockets.find(AddressToKey(addr));
+    return it != _l2Sockets.end() ? it->second : nullptr;
+}
+
+void HciSocket::addL2Socket(const std::shared_ptr<L2Socket>& l2Socket) {
+    _l2Sockets[AddressToKey(l2Socket->_dst.l2_bdaddr.b)] = l2Socket;
+}
+
+void HciSocket::setL2SocketHandle(L2Socket* l2Socket, uint16_t handle) {
+    clearL2SocketHandle(l2Socket);
+    l2Socket->_handle = handle;
+    _l2SocketsByHandle[handle] = l2Socket;
+}
+
+void HciSocket::clearL2SocketHandle(L2Socket* l2Socket) {
+    if (l2Socket->_handle < HCI_HANDLES_MAX && _l2SocketsByHandle[l2Socket->_handle] == l2Socket) {
+        _l2SocketsByHandle[l2Socket->_handle] = nullptr;
+    }
+}
+
+void HciSocket::removeL2Socket(L2Socket* l2Socket) {
+    clearL2SocketHandle(l2Socket);
+    // WARNING: may release the socket
+    _l2Sockets.erase(AddressToKey(l2Socket->_dst.l2_bdaddr.b));
+}
+
+// Debugfs files holding the connection parameters used by the kernel on LE Create Connection
+static const char* const CONN_PARAMS_FILES[CONN_PARAMS_COUNT] = {
+    "conn_min_interval",
+    "conn_max_interval",
+    "conn_latency",
+    "supervision_timeout"};
+
+// Override the HCI devices connection parameters using debugfs
+// Returns 0 on success, errno otherwise
+int HciSocket::setConnectionParameters(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout) {
+    if (_connParamsDeviceId != _deviceId) {
+        closeConnectionParameters();
+        _connParamsDeviceId = _deviceId;
+    }
+
+    // The kernel rejects min > max: the current bounds are read when the files are opened and the
+    // interval bounds written in an order that never inverts them
+    int err;
+    if ((err = openConnectionParameter(0)) != 0 || (err = openConnectionParameter(1)) != 0) {
+        return err;
+    }
+    if (_connParamsValues[1] != -1 && minInterval > _connParamsValues[1]) {
+        err = writeConnectionParameter(1, maxInterval);
+        if (err == 0) {
+            err = writeConnectionParameter(0, minInterval);
+        }
+    } else {
+        err = writeConnectionParameter(0, minInterval);
+        if (err == EINVAL) {
+            // Current max unknown and below minInterval
+            err = writeConnectionParameter(1, maxInterval);
+            if (err == 0) {
+                err = writeConnectionParameter(0, minInterval);
+            }
+        } else if (err == 0) {
+            err = writeConnectionParameter(1, maxInterval);
+        }
+    }
+    if (err != 0 || (err = writeConnectionParameter(2, latency)) != 0) {
+        return err;
+    }
+    return writeConnectionParameter(3, timeout);
+}
+
+int HciSocket::openConnectionParameter(int index) {
+    if (_connParamsFds[index] != -1) {
+        return 0;
+    }
+    std::string path = _debugfsPath + "/hci" + std::to_string(_deviceId) + "/" + CONN_PARAMS_FILES[index];
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+#ifdef DEBUG
+        printf("[HciSocket::openConnectionParameter] open(%s) %d %s\n", path.c_str(), errno, strerror(errno));
+#endif
+        return errno;
+    }
+    _connParamsFds[index] = fd;
+
+    // Value in use, unknown (-1) when unreadable
+    char buf[16];
+    ssize_t length = pread(fd, buf, sizeof(buf) - 1, 0);
+    _connParamsValues[index] = -1;
+    if (length > 0) {
+        buf[length] = 0;
+        char* end;
+        unsigned long value = strtoul(buf, &end, 0);
+        if (end != buf && value <= 0xffff) {
+            _connParamsValues[index] = (int)value;
+        }
+    }
+    return 0;
+}
+
+int HciSocket::writeConnectionParameter(int index, uint16_t value) {
+    int err = openConnectionParameter(index);
+    if (err != 0) {
+        return err;
+    }
+    if (_connParamsValues[index] == value) {
+        return 0;
+    }
+
+    char buf[8];
+    int length = snprintf(buf, sizeof(buf), "%u\n", value);
+    if (pwrite(_connParamsFds[index], buf, length, 0) != length) {
+        int err = errno;
+#ifdef DEBUG
+        printf("[HciSocket::writeConnectionParameter] pwrite(%s) %d %s\n", CONN_PARAMS_FILES[index], err, strerror(err));
+#endif
+        _connParamsValues[index] = -1;
+        return err != 0 ? err : EIO;
+    }
+    // Debugfs attributes ignore the file size, a regular file (stand-in directory) must not keep stale digits
+    if (ftruncate(_connParamsFds[index], length) < 0) {
+        // Not supported by debugfs
+    }
+    _connParamsValues[index] = value;
+    return 0;
+}
+
+void HciSocket::closeConnectionParameters() {
+    for (int i = 0; i < CONN_PARAMS_COUNT; i++) {
+        if (_connParamsFds[i] != -1) {
+            close(_connParamsFds[i]);
+            _connParamsFds[i] = -1;
+        }
+        _connParamsValues[i] = -1;
+    }
+}
+
+// Frame read from or written to the socket: statistics, then capture when enabled
+void HciSocket::trace(const char* data, int length, bool received) {
+    _stats.onFrame(data, length, received);
+    if (_capture.enabled()) {
+        _capture.record(data, length, received);
+    }
+}
+
+void HciSocket::setReaderThread(int slots) {
+    if (slots < 0) {
+        slots = 0;
+    } else if (slots > RECV_RING_SLOTS_MAX) {
+        slots = RECV_RING_SLOTS_MAX;
+    }
+
+    // Frames the previous ring still holds are processed before polling takes over again
+    stopReader();
+    if (_reader != nullptr && _started && !_readerDraining) {
+        drainReader();
+    }
+    _reader.reset();
+    if (slots > 0) {
+        _reader = std::make_shared<RecvRing>(slots, HCI_MAX_FRAME_SIZE, HCI_CONTROL_SIZE);
+        if (_batchSize < 2) {
+            setBatchSize(HCI_BATCH_SIZE_READER);
         }
+        if (_started) {
+            startReader();
+        }
+    }
+    updatePoll();
+}
 
-        // Return true to skip sending this command to HCI, because the command will be sent by the connect() operation
-        return true;
+void HciSocket::startReader() {
+    if (_readerAsync != nullptr) {
+        return;
+    }
+    _readerAsync = new uv_async_t;
+    uv_async_init(Nan::GetCurrentEventLoop(), _readerAsync, HciSocket::ReaderCallback);
+    _readerAsync->data = this;
+
+    int err = _reader->start(_socket, _readerAsync);
+    if (err != 0) {
+        // Fall back to polling
+        stopReader();
+        _reader.reset();
+        emitErrnoError(err, "eventfd@HciSocket::startReader");
+        return;
     }
+    // Frames left over from before stop()
+    uv_async_send(_readerAsync);
+}
 
-    return false;
+// Frames already in the ring stay there until the next start()
+void HciSocket::stopReader() {
+    if (_readerAsync == nullptr) {
+        return;
+    }
+    _reader->stop();
+    uv_close((uv_handle_t*)_readerAsync, HciSocket::ReaderCloseCallback);
+    _readerAsync = nullptr;
 }
 
-// Override the HCI devices connection parameters using debugfs
-void HciSocket::setConnectionParameters(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout) {
-    char command[80];
-    sprintf(command, "echo %u > /sys/kernel/debug/bluetooth/hci%d/conn_min_interval", minInterval, _deviceId);
-    system(command);
-    sprintf(command, "echo %u > /sys/kernel/debug/bluetooth/hci%d/conn_max_interval", maxInterval, _deviceId);
-    system(command);
-    sprintf(command, "echo %u > /sys/kernel/debug/bluetooth/hci%d/conn_latency", latency, _deviceId);
-    system(command);
-    sprintf(command, "echo %u > /sys/kernel/debug/bluetooth/hci%d/supervision_timeout", timeout, _deviceId);
-    system(command);
+void HciSocket::drainReader() {
+    // Event handlers may replace the ring, keep this one alive until done
+    std::shared_ptr<RecvRing> ring = _reader;
+
+    int err = ring->error();
+    if (err != 0) {
+        emitErrnoError(err, "recvmmsg@HciSocket::readerThread");
+    }
+
+    // Bounded so that a saturated reader can't starve the loop, the rest is drained on the next iteration
+    uint32_t budget = ring->capacity();
+    while (_started && _reader == ring && budget > 0) {
+        uint32_t first;
+        uint32_t count = ring->readable(&first);
+        if (count > budget) {
+            count = budget;
+        }
+        if (count > (uint32_t)_batchSize) {
+            count = _batchSize;
+        }
+        if (count == 0) {
+            return;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            _batchFrames[i].data = ring->data(first + i);
+            _batchFrames[i].length = ring->length(first + i);
+            _batchFrames[i].timestamp = ControlTimestamp(ring->header(first + i));
+        }
+        // Slots are released once processed, the frames are read in place
+        _readerDraining = true;
+        processBatch(count);
+        _readerDraining = false;
+        ring->consume(count);
+        budget -= count;
+    }
+    if (budget == 0 && _readerAsync != nullptr) {
+        uv_async_send(_readerAsync);
+    }
+}
+
+Local<Object> HciSocket::getReaderStats() {
+    Nan::EscapableHandleScope scope;
+
+    RecvRing::Counters counters = {};
+    if (_reader != nullptr) {
+        counters = _reader->counters();
+    }
+    Local<Object> stats = Nan::New<Object>();
+    Nan::Set(stats, Nan::New("capacity").ToLocalChecked(), Nan::New<Number>((double)counters.capacity));
+    Nan::Set(stats, Nan::New("frames").ToLocalChecked(), Nan::New<Number>((double)counters.frames));
+    Nan::Set(stats, Nan::New("highWater").ToLocalChecked(), Nan::New<Number>((double)counters.highWater));
+    Nan::Set(stats, Nan::New("stalls").ToLocalChecked(), Nan::New<Number>((double)counters.stalls));
+    return scope.Escape(stats);
+}
+
+static void ParseFakeControllerOptions(Local<Object> options, FakeControllerOptions* fakeOptions) {
+    Local<Value> value = Nan::Get(options, Nan::New("address").ToLocalChecked()).ToLocalChecked();
+    if (value->IsString()) {
+        // "xx:xx:xx:xx:xx:xx", most significant byte first
+        unsigned int b[6];
+        if (sscanf(*Nan::Utf8String(value), "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0]) == 6) {
+            for (int i = 0; i < 6; i++) {
+                fakeOptions->address[i] = b[i];
+            }
+        }
+    }
+    value = Nan::Get(options, Nan::New("extended").ToLocalChecked()).ToLocalChecked();
+    if (value->IsBoolean()) {
+        fakeOptions->extended = Nan::To<bool>(value).FromJust();
+    }
+    const struct {
+        const char* name;
+        int* value;
+        int min;
+    } ints[] = {
+        {"advertisers", &fakeOptions->advertisers, 0},
+        {"advInterval", &fakeOptions->advInterval, 1},
+        {"eventsPerInterval", &fakeOptions->eventsPerInterval, 1},
+        {"reportsPerEvent", &fakeOptions->reportsPerEvent, 1},
+        {"maxConnections", &fakeOptions->maxConnections, 0},
+        {"aclPktLen", &fakeOptions->aclPktLen, 27},
+        {"aclMaxPkt", &fakeOptions->aclMaxPkt, 1},
+    };
+    for (const auto& option : ints) {
+        value = Nan::Get(options, Nan::New(option.name).ToLocalChecked()).ToLocalChecked();
+        if (value->IsInt32() || value->IsUint32()) {
+            int n = Nan::To<int32_t>(value).FromJust();
+            *option.value = n < option.min ? option.min : n;
+        }
+    }
 }
 
 NAN_METHOD(HciSocket::New) {
     Nan::HandleScope scope;
-    HciSocket* p = new HciSocket();
+    int maxL2Sockets = L2_SOCKETS_DEFAULT;
+    std::string debugfsPath = DEBUGFS_BLUETOOTH_PATH;
+    if (info.Length() > 0 && info[0]->IsObject()) {
+        // Options
+        Local<Object> options = Nan::To<Object>(info[0]).ToLocalChecked();
+        Local<Value> value = Nan::Get(options, Nan::New("debugfsPath").ToLocalChecked()).ToLocalChecked();
+        if (value->IsString()) {
+            debugfsPath = *Nan::Utf8String(value);
+        }
+        value = Nan::Get(options, Nan::New("maxL2Sockets").ToLocalChecked()).ToLocalChecked();
+        if (value->IsInt32() || value->IsUint32()) {
+            // 0 => discover the controller limit: starting from L2_SOCKETS_MAX, it is lowered to the links
+            // established when LE Connection Complete reports Connection Limit Exceeded, and restored on
+            // HCI Reset. Until the first failure availableL2Sockets() counts against L2_SOCKETS_MAX.
+            maxL2Sockets = Nan::To<int32_t>(value).FromJust();
+            if (maxL2Sockets <= 0 || maxL2Sockets > L2_SOCKETS_MAX) {
+                maxL2Sockets = L2_SOCKETS_MAX;
+            }
+        }
+    }
+    HciTransport* transport = nullptr;
+    if (info.Length() > 0 && info[0]->IsObject()) {
+        Local<Object> options = Nan::To<Object>(info[0]).ToLocalChecked();
+        Local<Value> value = Nan::Get(options, Nan::New("transport").ToLocalChecked()).ToLocalChecked();
+        if (value->IsString() && std::string(*Nan::Utf8String(value)) == "fake") {
+            FakeControllerOptions fakeOptions;
+            FakeHciTransport::DefaultOptions(&fakeOptions);
+            value = Nan::Get(options, Nan::New("fake").ToLocalChecked()).ToLocalChecked();
+            if (value->IsObject()) {
+                ParseFakeControllerOptions(Nan::To<Object>(value).ToLocalChecked(), &fakeOptions);
+            }
+            transport = new FakeHciTransport(fakeOptions, Nan::GetCurrentEventLoop());
+        }
+    }
+    if (transport == nullptr) {
+        transport = new RawHciTransport();
+    }
+    HciSocket* p = new HciSocket(maxL2Sockets, debugfsPath.c_str(), transport);
     p->Wrap(info.This());
     p->This.Reset(info.This());
+    p->_asyncResource = new Nan::AsyncResource("HciSocket", info.This());
     info.GetReturnValue().Set(info.This());
 }
 
@@ -627,6 +2015,18 @@ NAN_METHOD(HciSocket::SetFilter) {
     info.GetReturnValue().SetUndefined();
 }
 
+NAN_METHOD(HciSocket::SetBpfFilter) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0 && node::Buffer::HasInstance(info[0])) {
+        p->setBpfFilter(node::Buffer::Data(info[0]), node::Buffer::Length(info[0]));
+    } else {
+        // No program: detach
+        p->setBpfFilter(nullptr, 0);
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
 NAN_METHOD(HciSocket::SetAuth) {
     Nan::HandleScope scope;
     HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
@@ -664,17 +2064,477 @@ NAN_METHOD(HciSocket::Write) {
     if (info.Length() > 0) {
         Local<Value> arg0 = info[0];
         if (arg0->IsObject()) {
-            p->write(node::Buffer::Data(arg0), node::Buffer::Length(arg0));
+            info.GetReturnValue().Set(p->write(node::Buffer::Data(arg0), node::Buffer::Length(arg0)));
+            return;
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetCommandQueue) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0 && (info[0]->IsInt32() || info[0]->IsUint32())) {
+        p->setCommandQueue(Nan::To<int32_t>(info[0]).FromJust());
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::AbortCommand) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0 && (info[0]->IsInt32() || info[0]->IsUint32())) {
+        p->abortCommand(Nan::To<uint32_t>(info[0]).FromJust() & 0xffff);
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetWriteQueue) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            p->setWriteQueue(Nan::To<int32_t>(arg0).FromJust());
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::Inject) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    FakeHciTransport* fake = dynamic_cast<FakeHciTransport*>(p->_transport.get());
+    if (fake == nullptr) {
+        Nan::ThrowError("inject requires the fake transport");
+        return;
+    }
+    if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+        Nan::ThrowTypeError("usage: inject(data)");
+        return;
+    }
+    Local<Object> buffer = Nan::To<Object>(info[0]).ToLocalChecked();
+    fake->inject(node::Buffer::Data(buffer), node::Buffer::Length(buffer));
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetCapture) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            int bytes = Nan::To<int32_t>(arg0).FromJust();
+            int err = p->_capture.open(bytes > 0 ? bytes : 0);
+            if (err != 0) {
+                Nan::ThrowError(Nan::ErrnoException(err, "mmap@HciSocket::setCapture"));
+                return;
+            }
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::DumpCapture) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("usage: dumpCapture(path)");
+        return;
+    }
+    Nan::Utf8String path(info[0]);
+    int err = p->_capture.dump(*path);
+    if (err != 0) {
+        Nan::ThrowError(Nan::ErrnoException(err, "write@HciSocket::dumpCapture", nullptr, *path));
+        return;
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::StreamCapture) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    int err;
+    if (info.Length() > 0 && info[0]->IsString()) {
+        Nan::Utf8String path(info[0]);
+        err = p->_capture.startStream(*path);
+        if (err != 0) {
+            Nan::ThrowError(Nan::ErrnoException(err, "open@HciSocket::streamCapture", nullptr, *path));
+            return;
+        }
+    } else {
+        // Stopping reports a write error the stream thread gave up on
+        err = p->_capture.stopStream();
+        if (err != 0) {
+            Nan::ThrowError(Nan::ErrnoException(err, "write@HciSocket::streamCapture"));
+            return;
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetReaderThread) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            p->setReaderThread(Nan::To<int32_t>(arg0).FromJust());
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::GetStats) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    info.GetReturnValue().Set(p->getStats());
+}
+
+NAN_METHOD(HciSocket::GetReaderStats) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    info.GetReturnValue().Set(p->getReaderStats());
+}
+
+// Static, lists the local adapters without binding to any of them
+NAN_METHOD(HciSocket::GetDeviceList) {
+    Nan::HandleScope scope;
+    RawHciTransport transport;
+    std::vector<HciDevice> devices;
+    int err = transport.open();
+    if (err == 0) {
+        err = transport.deviceList(&devices);
+    }
+    transport.close();
+    if (err != 0) {
+        Nan::ThrowError(Nan::ErrnoException(err, transport.syscall()));
+        return;
+    }
+
+    Local<Array> list = Nan::New<Array>((int)devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        Local<Object> device = Nan::New<Object>();
+        Nan::Set(device, Nan::New("id").ToLocalChecked(), Nan::New(devices[i].id));
+        Nan::Set(device, Nan::New("name").ToLocalChecked(), Nan::New(devices[i].name).ToLocalChecked());
+        Nan::Set(device, Nan::New("address").ToLocalChecked(), Nan::CopyBuffer((const char*)devices[i].address, sizeof(devices[i].address)).ToLocalChecked());
+        Nan::Set(device, Nan::New("up").ToLocalChecked(), Nan::New(devices[i].up));
+        Nan::Set(list, (uint32_t)i, device);
+    }
+    info.GetReturnValue().Set(list);
+}
+
+NAN_METHOD(HciSocket::SetAclTxBuffers) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 1 && (info[0]->IsInt32() || info[0]->IsUint32()) && (info[1]->IsInt32() || info[1]->IsUint32())) {
+        p->setAclTxBuffers(Nan::To<int32_t>(info[0]).FromJust(), Nan::To<int32_t>(info[1]).FromJust());
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::WriteAcl) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() < 4 || !info[0]->IsUint32() || !info[1]->IsUint32() || !info[2]->IsUint32() || !node::Buffer::HasInstance(info[3])) {
+        Nan::ThrowTypeError("usage: writeAcl(handle, flags, cid, data)");
+        return;
+    }
+    bool queued = p->writeAcl(
+        Nan::To<uint32_t>(info[0]).FromJust(),
+        Nan::To<uint32_t>(info[1]).FromJust(),
+        Nan::To<uint32_t>(info[2]).FromJust(),
+        node::Buffer::Data(info[3]),
+        node::Buffer::Length(info[3]));
+    info.GetReturnValue().Set(queued);
+}
+
+NAN_METHOD(HciSocket::SetBatchSize) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            p->setBatchSize(Nan::To<int32_t>(arg0).FromJust());
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetRecvPool) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            p->setRecvPool(Nan::To<int32_t>(arg0).FromJust());
+        }
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetAclReassembly) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    int maxPdu = 0;
+    uint32_t timeout = 0;
+    if (info.Length() > 0 && (info[0]->IsInt32() || info[0]->IsUint32())) {
+        maxPdu = Nan::To<int32_t>(info[0]).FromJust();
+    }
+    if (info.Length() > 1 && info[1]->IsUint32()) {
+        timeout = Nan::To<uint32_t>(info[1]).FromJust();
+    }
+    p->setAclReassembly(maxPdu, timeout);
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetAclMaxPdu) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 1 && info[0]->IsUint32() && (info[1]->IsInt32() || info[1]->IsUint32())) {
+        p->setAclMaxPdu(Nan::To<uint32_t>(info[0]).FromJust(), Nan::To<int32_t>(info[1]).FromJust());
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetAdvReports) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    int capacity = 0;
+    if (info.Length() > 0) {
+        Local<Value> arg0 = info[0];
+        if (arg0->IsInt32() || arg0->IsUint32()) {
+            capacity = Nan::To<int32_t>(arg0).FromJust();
         }
     }
+    info.GetReturnValue().Set(p->setAdvReports(capacity));
+}
+
+NAN_METHOD(HciSocket::SetAdvFilter) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 0 && info[0]->IsObject()) {
+        Local<Value> arg0 = info[0];
+        p->setAdvFilter(node::Buffer::Data(arg0), node::Buffer::Length(arg0));
+    } else {
+        p->setAdvFilter(nullptr, 0);
+    }
+    info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(HciSocket::SetNotifyReports) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    int capacity = 0;
+    if (info.Length() > 0 && (info[0]->IsInt32() || info[0]->IsUint32())) {
+        capacity = Nan::To<int32_t>(info[0]).FromJust();
+    }
+    info.GetReturnValue().Set(p->setNotifyReports(capacity));
+}
+
+NAN_METHOD(HciSocket::SetNotifySubscription) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() > 2 && info[0]->IsUint32() && info[1]->IsUint32()) {
+        uint16_t handle = Nan::To<uint32_t>(info[0]).FromJust() & 0x0fff;
+        uint16_t attHandle = Nan::To<uint32_t>(info[1]).FromJust() & 0xffff;
+        p->setNotifySubscription(handle, attHandle, Nan::To<bool>(info[2]).FromJust());
+    }
     info.GetReturnValue().SetUndefined();
 }
 
+NAN_METHOD(HciSocket::GetAdvFilterStats) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    info.GetReturnValue().Set(p->getAdvFilterStats());
+}
+
 void HciSocket::PollCloseCallback(uv_poll_t* handle) {
     delete handle;
 }
 
 void HciSocket::PollCallback(uv_poll_t* handle, int status, int events) {
     HciSocket* p = (HciSocket*)handle->data;
-    p->poll();
+    if (events & UV_WRITABLE) {
+        Nan::HandleScope scope;
+        p->flushWrites();
+    }
+    if ((events & UV_READABLE) && p->_started) {
+        p->poll();
+    }
+}
+
+static Local<Object> TrafficToObject(const HciStats::Traffic& traffic) {
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("frames").ToLocalChecked(), Nan::New<Number>((double)traffic.frames));
+    Nan::Set(object, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>((double)traffic.bytes));
+    return object;
+}
+
+static Local<Object> TrafficByTypeToObject(const HciStats::Traffic* traffic) {
+    static const char* names[HCI_STATS_PACKET_TYPES] = {"unknown", "command", "acl", "sco", "event", "iso"};
+    Local<Object> object = Nan::New<Object>();
+    for (int i = 0; i < HCI_STATS_PACKET_TYPES; i++) {
+        Nan::Set(object, Nan::New(names[i]).ToLocalChecked(), TrafficToObject(traffic[i]));
+    }
+    return object;
+}
+
+// Codes that were never seen are left out
+static Local<Object> TrafficByCodeToObject(const HciStats::Traffic* traffic, int count) {
+    Local<Object> object = Nan::New<Object>();
+    for (int i = 0; i < count; i++) {
+        if (traffic[i].frames > 0) {
+            Nan::Set(object, i, TrafficToObject(traffic[i]));
+        }
+    }
+    return object;
+}
+
+static Local<Object> CountsToObject(const uint64_t* counts, int count) {
+    Local<Object> object = Nan::New<Object>();
+    for (int i = 0; i < count; i++) {
+        if (counts[i] > 0) {
+            Nan::Set(object, i, Nan::New<Number>((double)counts[i]));
+        }
+    }
+    return object;
+}
+
+// Bucket counts are not cumulative, bounds are upper bounds in usec (the last one is Infinity)
+static Local<Object> HistogramToObject(const HciStats::Histogram& histogram) {
+    Local<Array> buckets = Nan::New<Array>(HCI_STATS_LATENCY_BUCKETS);
+    Local<Array> bounds = Nan::New<Array>(HCI_STATS_LATENCY_BUCKETS);
+    for (int i = 0; i < HCI_STATS_LATENCY_BUCKETS; i++) {
+        uint64_t bound = HciStats::BucketBound(i);
+        Nan::Set(buckets, i, Nan::New<Number>((double)histogram.buckets[i]));
+        Nan::Set(bounds, i, Nan::New<Number>(bound > 0 ? (double)bound : INFINITY));
+    }
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("count").ToLocalChecked(), Nan::New<Number>((double)histogram.count));
+    Nan::Set(object, Nan::New("sum").ToLocalChecked(), Nan::New<Number>((double)histogram.sum));
+    Nan::Set(object, Nan::New("buckets").ToLocalChecked(), buckets);
+    Nan::Set(object, Nan::New("bounds").ToLocalChecked(), bounds);
+    return object;
+}
+
+Local<Object> HciSocket::getStats() {
+    Nan::EscapableHandleScope scope;
+
+    const HciStats::Counters& counters = _stats.counters();
+    Local<Object> stats = Nan::New<Object>();
+    Nan::Set(stats, Nan::New("rx").ToLocalChecked(), TrafficByTypeToObject(counters.rx));
+    Nan::Set(stats, Nan::New("tx").ToLocalChecked(), TrafficByTypeToObject(counters.tx));
+    Nan::Set(stats, Nan::New("events").ToLocalChecked(), TrafficByCodeToObject(counters.events, HCI_STATS_EVENT_CODES));
+    Nan::Set(stats, Nan::New("leEvents").ToLocalChecked(), TrafficByCodeToObject(counters.leEvents, HCI_STATS_LE_SUBEVENTS));
+    Nan::Set(stats, Nan::New("commandLatency").ToLocalChecked(), HistogramToObject(counters.commandLatency));
+    Nan::Set(stats, Nan::New("connectLatency").ToLocalChecked(), HistogramToObject(counters.connectLatency));
+    Nan::Set(stats, Nan::New("connectErrors").ToLocalChecked(), CountsToObject(counters.connectStatus, 256));
+    Nan::Set(stats, Nan::New("l2ConnectErrors").ToLocalChecked(), CountsToObject(counters.l2ConnectErrno, HCI_STATS_ERRNO_MAX));
+
+    // ACL credits outstanding and fragments queued per connection (native scheduler only)
+    Local<Array> connections = Nan::New<Array>((int)_stats.connections().size());
+    uint32_t index = 0;
+    for (uint16_t handle : _stats.connections()) {
+        Local<Object> connection = Nan::New<Object>();
+        Nan::Set(connection, Nan::New("handle").ToLocalChecked(), Nan::New<Number>(handle));
+        Nan::Set(connection, Nan::New("pending").ToLocalChecked(), Nan::New<Number>(_aclScheduler.pending(handle)));
+        Nan::Set(connection, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(_aclScheduler.queued(handle)));
+        Nan::Set(connections, index++, connection);
+    }
+    Nan::Set(stats, Nan::New("connections").ToLocalChecked(), connections);
+
+    const CommandQueue::Counters& commands = _commandQueue.counters();
+    Local<Object> commandQueue = Nan::New<Object>();
+    Nan::Set(commandQueue, Nan::New("credits").ToLocalChecked(), Nan::New<Number>(_commandQueue.credits()));
+    Nan::Set(commandQueue, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(_commandQueue.queued()));
+    Nan::Set(commandQueue, Nan::New("inFlight").ToLocalChecked(), Nan::New<Number>(_commandQueue.inFlight()));
+    Nan::Set(commandQueue, Nan::New("sent").ToLocalChecked(), Nan::New<Number>((double)commands.sent));
+    Nan::Set(commandQueue, Nan::New("completed").ToLocalChecked(), Nan::New<Number>((double)commands.completed));
+    Nan::Set(commandQueue, Nan::New("timeouts").ToLocalChecked(), Nan::New<Number>((double)commands.timeouts));
+    Nan::Set(commandQueue, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>((double)commands.dropped));
+    Nan::Set(stats, Nan::New("commandQueue").ToLocalChecked(), commandQueue);
+
+    NotifyTable::Counters& notify = _notifyTable.counters();
+    Local<Object> notifyReports = Nan::New<Object>();
+    Nan::Set(notifyReports, Nan::New("subscriptions").ToLocalChecked(), Nan::New<Number>((double)_notifyTable.size()));
+    Nan::Set(notifyReports, Nan::New("delivered").ToLocalChecked(), Nan::New<Number>((double)notify.delivered));
+    Nan::Set(notifyReports, Nan::New("fallback").ToLocalChecked(), Nan::New<Number>((double)notify.fallback));
+    Nan::Set(stats, Nan::New("notifyReports").ToLocalChecked(), notifyReports);
+
+    Local<Object> writeQueue = Nan::New<Object>();
+    Nan::Set(writeQueue, Nan::New("packets").ToLocalChecked(), Nan::New<Number>((double)_writeQueue.size()));
+    Nan::Set(writeQueue, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>(_writeQueueBytes));
+    Nan::Set(stats, Nan::New("writeQueue").ToLocalChecked(), writeQueue);
+
+    const AclScheduler::Counters& scheduler = _aclScheduler.counters();
+    Local<Object> aclScheduler = Nan::New<Object>();
+    Nan::Set(aclScheduler, Nan::New("inFlight").ToLocalChecked(), Nan::New<Number>(_aclScheduler.inFlight()));
+    Nan::Set(aclScheduler, Nan::New("queued").ToLocalChecked(), Nan::New<Number>((double)scheduler.queued));
+    Nan::Set(aclScheduler, Nan::New("sent").ToLocalChecked(), Nan::New<Number>((double)scheduler.sent));
+    Nan::Set(aclScheduler, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>((double)scheduler.dropped));
+    Nan::Set(aclScheduler, Nan::New("completed").ToLocalChecked(), Nan::New<Number>((double)scheduler.completed));
+    Nan::Set(stats, Nan::New("aclScheduler").ToLocalChecked(), aclScheduler);
+
+    const AclReassembly::Counters& reassembly = _aclReassembly.counters();
+    Local<Object> aclReassembly = Nan::New<Object>();
+    Nan::Set(aclReassembly, Nan::New("complete").ToLocalChecked(), Nan::New<Number>((double)reassembly.complete));
+    Nan::Set(aclReassembly, Nan::New("oversized").ToLocalChecked(), Nan::New<Number>((double)reassembly.oversized));
+    Nan::Set(aclReassembly, Nan::New("malformed").ToLocalChecked(), Nan::New<Number>((double)reassembly.malformed));
+    Nan::Set(aclReassembly, Nan::New("orphaned").ToLocalChecked(), Nan::New<Number>((double)reassembly.orphaned));
+    Nan::Set(aclReassembly, Nan::New("stale").ToLocalChecked(), Nan::New<Number>((double)reassembly.stale));
+    Nan::Set(stats, Nan::New("aclReassembly").ToLocalChecked(), aclReassembly);
+
+    RecvPool::Counters pool = {};
+    if (_recvPool != nullptr) {
+        pool = _recvPool->counters();
+    }
+    Local<Object> recvPool = Nan::New<Object>();
+    Nan::Set(recvPool, Nan::New("pooled").ToLocalChecked(), Nan::New<Number>((double)pool.pooled));
+    Nan::Set(recvPool, Nan::New("copied").ToLocalChecked(), Nan::New<Number>((double)pool.copied));
+    Nan::Set(stats, Nan::New("recvPool").ToLocalChecked(), recvPool);
+
+    const BtSnoop::Counters& snoop = _capture.counters();
+    Local<Object> capture = Nan::New<Object>();
+    Nan::Set(capture, Nan::New("records").ToLocalChecked(), Nan::New<Number>((double)snoop.records));
+    Nan::Set(capture, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>((double)snoop.bytes));
+    Nan::Set(capture, Nan::New("drops").ToLocalChecked(), Nan::New<Number>((double)snoop.drops));
+    Nan::Set(stats, Nan::New("capture").ToLocalChecked(), capture);
+
+    Nan::Set(stats, Nan::New("advFilter").ToLocalChecked(), getAdvFilterStats());
+    Nan::Set(stats, Nan::New("reader").ToLocalChecked(), getReaderStats());
+    return scope.Escape(stats);
+}
+
+void HciSocket::ReaderCallback(uv_async_t* handle) {
+    HciSocket* p = (HciSocket*)handle->data;
+    Nan::HandleScope scope;
+    p->drainReader();
+}
+
+void HciSocket::ReaderCloseCallback(uv_handle_t* handle) {
+    delete (uv_async_t*)handle;
+}
+
+NAN_METHOD(HciSocket::SetConnectionParameters) {
+    Nan::HandleScope scope;
+    HciSocket* p = node::ObjectWrap::Unwrap<HciSocket>(info.This());
+    if (info.Length() < 4) {
+        Nan::ThrowTypeError("usage: setConnectionParameters(minInterval, maxInterval, latency, timeout)");
+        return;
+    }
+    uint16_t params[CONN_PARAMS_COUNT];
+    for (int i = 0; i < CONN_PARAMS_COUNT; i++) {
+        if (!info[i]->IsUint32() || Nan::To<uint32_t>(info[i]).FromJust() > 0xffff) {
+            Nan::ThrowTypeError("connection parameters must be 16-bit unsigned integers");
+            return;
+        }
+        params[i] = (uint16_t)Nan::To<uint32_t>(info[i]).FromJust();
+    }
+    int err = p->setConnectionParameters(params[0], params[1], params[2], params[3]);
+    if (err != 0) {
+        Nan::ThrowError(Nan::ErrnoException(err, "write@HciSocket::setConnectionParameters"));
+        return;
+    }
+    info.GetReturnValue().SetUndefined();
 }
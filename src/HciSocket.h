@@ -9,14 +9,122 @@
 #include <nan.h>
 #include <node.h>
 
+#include "AclReassembly.h"
+#include "AclScheduler.h"
+#include "AdvFilter.h"
+#include "BtSnoop.h"
+#include "CommandQueue.h"
+#include "FakeHciTransport.h"
+#include "HciStats.h"
+#include "HciTransport.h"
+#include "NotifyTable.h"
+#include "RecvPool.h"
+#include "RecvRing.h"
+
+#include <deque>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define L2_SOCKETS_DEFAULT 5
+#define L2_SOCKETS_MAX 255
+#define HCI_HANDLES_MAX 4096
+#define HCI_BATCH_SIZE_MAX 256
+#define HCI_BATCH_SIZE_READER 64  // Batch size used by the reader thread when none is set
+#define HCI_WRITE_QUEUE_MAX (16 * 1024 * 1024)
+#define HCI_COMMAND_QUEUE_MAX 256  // Commands held until the controller has credits
+#define HCI_WRITE_SENT 0     // Written, or sent by the kernel on our behalf
+#define HCI_WRITE_QUEUED 1   // Held in the write queue, "drain" follows
+#define HCI_WRITE_DROPPED 2  // Refused, the write queue is full
+#define HCI_WRITE_UNSENT 3   // Taken over natively, never reached the controller
+#define ADV_REPORTS_MAX 4096
+#define ADV_DATA_MAX 255
+#define NOTIFY_REPORTS_MAX 4096
+#define NOTIFY_VALUE_MAX 244  // ATT_MTU 247, longer values are left to JS
+#define HCI_CONTROL_SIZE 64  // Ancillary data of a received frame (timestamp)
 
-#define L2_SOCKETS_MAX 5
+#ifndef EVT_LE_EXTENDED_ADVERTISING_REPORT
+#define EVT_LE_EXTENDED_ADVERTISING_REPORT 0x0d
+#endif
+#ifndef ACL_CONT
+#define ACL_CONT 0x01
+#endif
+#ifndef HCI_MAX_NUMBER_OF_CONNECTIONS
+#define HCI_MAX_NUMBER_OF_CONNECTIONS 0x09
+#endif
+#define DEBUGFS_BLUETOOTH_PATH "/sys/kernel/debug/bluetooth"
+#define CONN_PARAMS_COUNT 4
 #define L2_CONNECT_TIMEOUT 60000000000
 #define ATT_CID 0x0004
+#define ATT_OP_HANDLE_NOTIFY 0x1b
 
 class HciSocket;
 
+// Decoded advertising reports, one column per field (struct-of-arrays).
+// Columns are typed arrays owned by JS, reused across polls.
+struct AdvReports {
+    int capacity;
+    int count;
+    uint16_t* type;
+    uint8_t* addressType;
+    double* address;  // 48-bit address as a number
+    int8_t* rssi;
+    uint32_t* advOffset;  // Offset of adv data into payload
+    uint8_t* advLength;
+    uint8_t* extended;
+    uint8_t* numReports;  // Reports in the HCI event the report came from
+    uint8_t* primaryPhy;
+    uint8_t* secondaryPhy;
+    uint8_t* sid;
+    int8_t* txPower;
+    uint16_t* periodicAdvInterval;
+    uint8_t* directAddressType;
+    double* directAddress;
+    double* timestamp;  // Kernel receive time (msec since epoch)
+    char* payload;
+    uint32_t payloadSize;
+    uint32_t payloadLength;
+};
+
+// Notifications of subscribed attributes, one column per field like AdvReports
+struct NotifyReports {
+    int capacity;
+    int count;
+    uint16_t* connectionHandle;
+    uint16_t* handle;  // Attribute handle
+    uint32_t* valueOffset;  // Offset of the value into payload
+    uint16_t* valueLength;
+    double* timestamp;  // Kernel receive time (msec since epoch)
+    char* payload;
+    uint32_t payloadSize;
+    uint32_t payloadLength;
+};
+
+// Frame received by pollBatch() or by the reader thread, before it is processed
+struct BatchFrame {
+    char* data;
+    int length;
+    double timestamp;  // Kernel receive time (msec since epoch), 0 if unknown
+};
+
+// Reports queued natively before a batch frame or PDU, flushed ahead of it
+struct BatchReportsMark {
+    int advReports;
+    int notifyReports;
+};
+
+// L2CAP PDU completed while draining a batch, emitted after the frames preceding it
+struct BatchAclPdu {
+    int frame;  // Index of the first batch frame following the PDU
+    uint16_t handle;
+    uint16_t cid;
+    uint32_t offset;  // Offset of the PDU into the batch PDU data
+    uint32_t length;
+    double timestamp;  // Kernel receive time of the last fragment
+    BatchReportsMark reports;
+};
+
 class L2Socket {
     friend class HciSocket;
 
@@ -26,6 +134,14 @@ class L2Socket {
     void disconnect();
     void connect();
     bool connected() const;
+    bool connecting() const;
+
+   private:
+    void poll(int status);
+    void stopPoll();
+
+    static void PollCloseCallback(uv_poll_t* handle);
+    static void PollCallback(uv_poll_t* handle, int status, int events);
 
    private:
     HciSocket* _parent;
@@ -33,6 +149,8 @@ class L2Socket {
     uint16_t _handle;
     struct sockaddr_l2 _src;
     struct sockaddr_l2 _dst;
+    uv_poll_t* _pollHandle;
+    bool _connecting;
 
    private:
     int _errno;
@@ -48,15 +166,39 @@ class HciSocket : public node::ObjectWrap {
     static NAN_METHOD(Bind);
     static NAN_METHOD(IsDeviceUp);
     static NAN_METHOD(SetFilter);
+    static NAN_METHOD(SetBpfFilter);
     static NAN_METHOD(SetAuth);
     static NAN_METHOD(SetEncrypt);
     static NAN_METHOD(AvailableL2Sockets);
     static NAN_METHOD(Start);
     static NAN_METHOD(Stop);
     static NAN_METHOD(Write);
+    static NAN_METHOD(SetBatchSize);
+    static NAN_METHOD(SetAdvReports);
+    static NAN_METHOD(SetAdvFilter);
+    static NAN_METHOD(SetNotifyReports);
+    static NAN_METHOD(SetNotifySubscription);
+    static NAN_METHOD(GetAdvFilterStats);
+    static NAN_METHOD(SetConnectionParameters);
+    static NAN_METHOD(SetRecvPool);
+    static NAN_METHOD(SetAclReassembly);
+    static NAN_METHOD(SetAclMaxPdu);
+    static NAN_METHOD(SetAclTxBuffers);
+    static NAN_METHOD(WriteAcl);
+    static NAN_METHOD(SetWriteQueue);
+    static NAN_METHOD(Inject);
+    static NAN_METHOD(SetCapture);
+    static NAN_METHOD(DumpCapture);
+    static NAN_METHOD(StreamCapture);
+    static NAN_METHOD(SetReaderThread);
+    static NAN_METHOD(GetReaderStats);
+    static NAN_METHOD(GetDeviceList);
+    static NAN_METHOD(GetStats);
+    static NAN_METHOD(SetCommandQueue);
+    static NAN_METHOD(AbortCommand);
 
    private:
-    HciSocket();
+    HciSocket(int maxL2Sockets, const char* debugfsPath, HciTransport* transport);
     ~HciSocket();
 
     int availableL2Sockets() const;
@@ -64,32 +206,127 @@ class HciSocket : public node::ObjectWrap {
     int bind(int* deviceId);
     bool isDeviceUp();
     void setFilter(char* data, int length);
+    void setBpfFilter(char* data, int length);
     void setAuth(bool enabled);
     void setEncrypt(bool enabled);
     void stop();
-    void write(char* data, int length);
+    bool write(char* data, int length);
+    int writeFrame(char* data, int length);
+    void setCommandQueue(int maxQueued);
+    void abortCommand(uint16_t opcode);
+    void flushCommands();
+    void setWriteQueue(int maxBytes);
+    void flushWrites();
+    void updatePoll();
+    void setBatchSize(int batchSize);
+    void setRecvPool(int slots);
     void poll();
+    void pollBatch();
+    void processBatch(int count);
+    void emitBatch(v8::Local<v8::Object> batch, v8::Local<v8::ArrayBuffer> offsets, v8::Local<v8::ArrayBuffer> timestamps, int first, int last);
+    void setAclReassembly(int maxPdu, uint32_t timeout);
+    void setAclMaxPdu(uint16_t handle, int maxPdu);
+    bool aclReassemblyOnHciRead(char* data, int length, AclReassembly::Pdu* pdu);
+    void emitAclData(uint16_t handle, uint16_t cid, v8::Local<v8::Object> pdu, double timestamp);
+    void setAclTxBuffers(int pktLen, int maxPkt);
+    bool writeAcl(uint16_t handle, uint8_t flags, uint16_t cid, char* data, int length);
+    bool aclSchedulerOnHciRead(char* data, int length);
+    void flushAcl();
+    v8::Local<v8::Value> setAdvReports(int capacity);
+    bool advReportsOnHciRead(char* data, int length);
+    void setAdvFilter(char* data, int length);
+    v8::Local<v8::Object> getAdvFilterStats();
+    bool advFilterOnHciRead(char* data, int* length);
+    void flushAdvReports(int count);
+    v8::Local<v8::Value> setNotifyReports(int capacity);
+    void setNotifySubscription(uint16_t handle, uint16_t attHandle, bool enabled);
+    bool notifyReportsOnHciRead(char* data, int length);
+    bool notifyReportsOnPdu(uint16_t handle, uint16_t cid, const char* pdu, int length);
+    void flushNotifyReports(int count);
+    void flushBatchReports(const BatchReportsMark& mark, BatchReportsMark* flushed);
+    void emitEvent(int argc, v8::Local<v8::Value>* argv);
     void emitErrnoError(int err_no, const char* syscall);
     int deviceIdFor(const int* deviceId, bool isUp);
     void l2SocketOnHciRead(char* data, int length);
-    bool l2SocketOnHciWrite(char* data, int length);
-    void setConnectionParameters(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+    int l2SocketOnHciWrite(char* data, int length);
+    void l2SocketOnConnect(L2Socket* l2Socket, bool sent);
+    void emitL2SocketConnect(const uint8_t* addr, int err, bool sent);
+    std::shared_ptr<L2Socket> findL2Socket(const uint8_t* addr) const;
+    void addL2Socket(const std::shared_ptr<L2Socket>& l2Socket);
+    void setL2SocketHandle(L2Socket* l2Socket, uint16_t handle);
+    void clearL2SocketHandle(L2Socket* l2Socket);
+    void removeL2Socket(L2Socket* l2Socket);
+    int setConnectionParameters(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+    int openConnectionParameter(int index);
+    int writeConnectionParameter(int index, uint16_t value);
+    void closeConnectionParameters();
+    void trace(const char* data, int length, bool received);
+    void setReaderThread(int slots);
+    void startReader();
+    void stopReader();
+    void drainReader();
+    v8::Local<v8::Object> getReaderStats();
+    v8::Local<v8::Object> getStats();
+    void release();
 
+    static void CleanupHook(void* arg);
     static void PollCloseCallback(uv_poll_t* handle);
     static void PollCallback(uv_poll_t* handle, int status, int events);
+    static void ReaderCallback(uv_async_t* handle);
+    static void ReaderCloseCallback(uv_handle_t* handle);
 
    private:
     Nan::Persistent<v8::Object> This;
 
-    int _socket;
+    std::unique_ptr<HciTransport> _transport;
+    int _socket;  // Transport file descriptor
     int _deviceId;
-    uv_poll_t _pollHandle;
+    uv_poll_t* _pollHandle;
+    bool _started;  // Reading, between start() and stop()
     uint8_t _address[6];
     uint8_t _addressType;
-    int _availableL2Sockets;
-    std::shared_ptr<L2Socket> _l2Sockets[L2_SOCKETS_MAX];
-
-    static Nan::Persistent<v8::FunctionTemplate> constructor;
+    int _l2SocketsMax;  // Configured limit, restored on HCI Reset
+    int _l2SocketsLimit;  // Configured limit, lowered on Connection Limit Exceeded
+    std::unordered_map<uint64_t, std::shared_ptr<L2Socket>> _l2Sockets;  // By peer address
+    std::vector<L2Socket*> _l2SocketsByHandle;  // By connection handle, HCI_HANDLES_MAX entries
+    Nan::AsyncResource* _asyncResource;
+    int _batchSize;
+    RecvPool* _recvPool;
+    std::vector<char> _batchData;
+    std::vector<struct mmsghdr> _batchMsgs;
+    std::vector<struct iovec> _batchIovs;
+    std::vector<uint32_t> _batchOffsets;
+    std::vector<double> _batchTimestamps;
+    std::vector<char> _batchControl;  // HCI_CONTROL_SIZE per message
+    std::vector<BatchFrame> _batchFrames;
+    std::vector<BatchAclPdu> _batchAclPdus;
+    std::vector<char> _batchAclData;
+    std::vector<BatchReportsMark> _batchMarks;  // By batch frame
+    AclReassembly _aclReassembly;
+    AclScheduler _aclScheduler;
+    AdvReports _advReports;
+    Nan::Persistent<v8::Object> _advReportsObject;
+    AdvFilter _advFilter;
+    NotifyReports _notifyReports;
+    Nan::Persistent<v8::Object> _notifyReportsObject;
+    NotifyTable _notifyTable;
+    std::string _debugfsPath;
+    int _connParamsDeviceId;  // Device the cached descriptors belong to
+    int _connParamsFds[CONN_PARAMS_COUNT];
+    int _connParamsValues[CONN_PARAMS_COUNT];  // Last written values, -1 if unknown
+    bool _aclBlocked;  // Fragments waiting for the socket to become writable
+    int _writeQueueMax;  // 0 for blocking writes
+    int _writeQueueBytes;
+    std::deque<std::vector<char>> _writeQueue;
+    bool _writeNeedDrain;
+    CommandQueue _commandQueue;
+    BtSnoop _capture;
+    HciStats _stats;
+    double _rxTimestamp;  // Kernel receive time of the frame being processed, 0 if unknown
+    std::shared_ptr<RecvRing> _reader;  // Reader thread ring, replaces polling for reads
+    uv_async_t* _readerAsync;  // Reader thread wakeup, while the thread runs
+    bool _readerDraining;  // Ring slots are being processed
+    bool _closed;  // Loop handles released, by the destructor or the environment cleanup hook
 };
 
 #endif  // HCI_SOCKET_H
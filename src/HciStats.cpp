@@ -0,0 +1,163 @@
+// HciStats.cpp
+
+#include "HciStats.h"
+
+#include <string.h>
+#include <time.h>
+
+#define H4_COMMAND 0x01
+#define H4_EVENT 0x04
+#define EVT_DISCONNECTION_COMPLETE 0x05
+#define EVT_COMMAND_COMPLETE 0x0e
+#define EVT_COMMAND_STATUS 0x0f
+#define EVT_LE_META 0x3e
+#define LE_CONNECTION_COMPLETE 0x01
+#define LE_ENHANCED_CONNECTION_COMPLETE 0x0a
+#define OPCODE_LE_CREATE_CONNECTION 0x200d
+#define OPCODE_LE_EXTENDED_CREATE_CONNECTION 0x2043
+
+HciStats::HciStats() : _counters(), _commands(), _commandsCount(0), _connectStart(0) {
+}
+
+void HciStats::clear() {
+    memset(&_counters, 0, sizeof(_counters));
+    _commandsCount = 0;
+    _connectStart = 0;
+}
+
+// Every command handed to the socket, including the ones the kernel issues on our behalf
+void HciStats::onCommand(const char* data, int length) {
+    if (length < 3 || data[0] != H4_COMMAND) {
+        return;
+    }
+    uint16_t opcode = (uint8_t)data[1] | ((uint8_t)data[2] << 8);
+
+    int i = 0;
+    while (i < _commandsCount && _commands[i].opcode != opcode) {
+        i++;
+    }
+    if (i == HCI_STATS_COMMANDS_MAX) {
+        // Never completed, forget the oldest
+        i = 0;
+    }
+    if (i < _commandsCount) {
+        memmove(&_commands[i], &_commands[i + 1], (_commandsCount - i - 1) * sizeof(PendingCommand));
+        _commandsCount--;
+    }
+    uint64_t now = Now();
+    _commands[_commandsCount++] = {opcode, now};
+
+    if (opcode == OPCODE_LE_CREATE_CONNECTION || opcode == OPCODE_LE_EXTENDED_CREATE_CONNECTION) {
+        _connectStart = now;
+    }
+}
+
+void HciStats::onFrame(const char* data, int length, bool received) {
+    if (length < 1) {
+        return;
+    }
+    uint8_t type = data[0];
+    Traffic& traffic = (received ? _counters.rx : _counters.tx)[type < HCI_STATS_PACKET_TYPES ? type : 0];
+    traffic.frames++;
+    traffic.bytes += length;
+
+    if (!received || type != H4_EVENT || length < 3) {
+        return;
+    }
+    uint8_t code = data[1];
+    _counters.events[code].frames++;
+    _counters.events[code].bytes += length;
+
+    switch (code) {
+        case EVT_COMMAND_COMPLETE:
+            // uint8_t num_hci_command_packets, uint16_t opcode, ...
+            if (length >= 6) {
+                complete((uint8_t)data[4] | ((uint8_t)data[5] << 8), Now());
+            }
+            break;
+        case EVT_COMMAND_STATUS:
+            // uint8_t status, uint8_t num_hci_command_packets, uint16_t opcode
+            if (length >= 7) {
+                uint16_t opcode = (uint8_t)data[5] | ((uint8_t)data[6] << 8);
+                complete(opcode, Now());
+                if (data[3] != 0 && (opcode == OPCODE_LE_CREATE_CONNECTION || opcode == OPCODE_LE_EXTENDED_CREATE_CONNECTION)) {
+                    _counters.connectStatus[(uint8_t)data[3]]++;
+                    _connectStart = 0;
+                }
+            }
+            break;
+        case EVT_DISCONNECTION_COMPLETE:
+            // uint8_t status, uint16_t handle, uint8_t reason
+            if (length >= 6 && data[3] == 0) {
+                _connections.erase(((uint8_t)data[4] | ((uint8_t)data[5] << 8)) & 0x0fff);
+            }
+            break;
+        case EVT_LE_META:
+            if (length >= 4) {
+                uint8_t subevent = data[3];
+                if (subevent < HCI_STATS_LE_SUBEVENTS) {
+                    _counters.leEvents[subevent].frames++;
+                    _counters.leEvents[subevent].bytes += length;
+                }
+                // uint8_t status, uint16_t handle, ...
+                if ((subevent == LE_CONNECTION_COMPLETE || subevent == LE_ENHANCED_CONNECTION_COMPLETE) && length >= 7) {
+                    uint8_t status = data[4];
+                    if (status == 0) {
+                        if (_connectStart != 0) {
+                            Add(&_counters.connectLatency, (Now() - _connectStart) / 1000);
+                        }
+                        _connections.insert(((uint8_t)data[5] | ((uint8_t)data[6] << 8)) & 0x0fff);
+                    } else {
+                        _counters.connectStatus[status]++;
+                    }
+                    _connectStart = 0;
+                }
+            }
+            break;
+    }
+}
+
+void HciStats::onL2ConnectError(int err) {
+    _counters.l2ConnectErrno[err > 0 && err < HCI_STATS_ERRNO_MAX ? err : 0]++;
+}
+
+const HciStats::Counters& HciStats::counters() const {
+    return _counters;
+}
+
+const std::set<uint16_t>& HciStats::connections() const {
+    return _connections;
+}
+
+// Upper bound (usec, excluded) of a latency bucket, 0 for the open ended one
+uint64_t HciStats::BucketBound(int bucket) {
+    return bucket < HCI_STATS_LATENCY_BUCKETS - 1 ? (uint64_t)2 << bucket : 0;
+}
+
+void HciStats::complete(uint16_t opcode, uint64_t now) {
+    for (int i = 0; i < _commandsCount; i++) {
+        if (_commands[i].opcode == opcode) {
+            Add(&_counters.commandLatency, (now - _commands[i].time) / 1000);
+            memmove(&_commands[i], &_commands[i + 1], (_commandsCount - i - 1) * sizeof(PendingCommand));
+            _commandsCount--;
+            return;
+        }
+    }
+}
+
+void HciStats::Add(Histogram* histogram, uint64_t usec) {
+    int bucket = 0;
+    while (bucket < HCI_STATS_LATENCY_BUCKETS - 1 && usec >= ((uint64_t)2 << bucket)) {
+        bucket++;
+    }
+    histogram->count++;
+    histogram->sum += usec;
+    histogram->buckets[bucket]++;
+}
+
+// Only read for the frames being timed, not on every frame
+uint64_t HciStats::Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,75 @@
+// HciStats.h
+
+#ifndef HCI_STATS_H
+#define HCI_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <set>
+
+#define HCI_STATS_PACKET_TYPES 6  // Unknown (0) and H4 packet types 0x01 to 0x05
+#define HCI_STATS_EVENT_CODES 256
+#define HCI_STATS_LE_SUBEVENTS 64
+#define HCI_STATS_LATENCY_BUCKETS 24  // Bucket i ends at 2^(i+1) usec, the last one is open ended
+#define HCI_STATS_ERRNO_MAX 256
+#define HCI_STATS_COMMANDS_MAX 64  // Commands awaiting completion, older ones are forgotten
+
+// Traffic counters and latency histograms of an HCI socket.
+// Updated by the event loop thread as frames are read and written: plain
+// counters in fixed arrays, nothing on the hot path allocates or takes a lock.
+class HciStats {
+   public:
+    struct Traffic {
+        uint64_t frames;
+        uint64_t bytes;
+    };
+
+    struct Histogram {
+        uint64_t count;
+        uint64_t sum;  // usec
+        uint64_t buckets[HCI_STATS_LATENCY_BUCKETS];
+    };
+
+    struct Counters {
+        Traffic rx[HCI_STATS_PACKET_TYPES];  // By H4 packet type
+        Traffic tx[HCI_STATS_PACKET_TYPES];
+        Traffic events[HCI_STATS_EVENT_CODES];  // Received events by event code
+        Traffic leEvents[HCI_STATS_LE_SUBEVENTS];  // Received LE meta events by subevent code
+        Histogram commandLatency;  // Command written to Command Complete / Command Status
+        Histogram connectLatency;  // LE Create Connection written to successful LE Connection Complete
+        uint64_t connectStatus[256];  // Failed LE Connection Complete by HCI status
+        uint64_t l2ConnectErrno[HCI_STATS_ERRNO_MAX];  // Failed L2CAP socket connections by errno
+    };
+
+    HciStats();
+
+    void clear();
+    void onCommand(const char* data, int length);
+    void onFrame(const char* data, int length, bool received);
+    void onL2ConnectError(int err);
+    const Counters& counters() const;
+    const std::set<uint16_t>& connections() const;
+
+    static uint64_t BucketBound(int bucket);
+
+   private:
+    struct PendingCommand {
+        uint16_t opcode;
+        uint64_t time;  // Write time (nsec)
+    };
+
+    void complete(uint16_t opcode, uint64_t now);
+
+    static void Add(Histogram* histogram, uint64_t usec);
+    static uint64_t Now();
+
+   private:
+    Counters _counters;
+    PendingCommand _commands[HCI_STATS_COMMANDS_MAX];  // Oldest first
+    int _commandsCount;
+    uint64_t _connectStart;  // Write time of the pending LE Create Connection, 0 if none
+    std::set<uint16_t> _connections;  // Connection handles
+};
+
+#endif  // HCI_STATS_H
@@ -0,0 +1,305 @@
+// HciTransport.cpp
+
+#include "HciTransport.h"
+
+#include <errno.h>
+#include <linux/filter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+HciTransport::HciTransport() : _fd(-1), _syscall("") {
+}
+
+HciTransport::~HciTransport() {
+}
+
+int HciTransport::fd() const {
+    return _fd;
+}
+
+const char* HciTransport::syscall() const {
+    return _syscall;
+}
+
+int HciTransport::attachFilter(const char* program, int length) {
+    if (length == 0) {
+        int dummy = 0;
+        if (setsockopt(_fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)) < 0 && errno != ENOENT) {
+            _syscall = "setsockopt(SOL_SOCKET,SO_DETACH_FILTER)@HciSocket::setBpfFilter";
+            return errno;
+        }
+        return 0;
+    }
+    if (length % sizeof(struct sock_filter) != 0 || length / sizeof(struct sock_filter) > BPF_MAXINSNS) {
+        _syscall = "setsockopt(SOL_SOCKET,SO_ATTACH_FILTER)@HciSocket::setBpfFilter";
+        return EINVAL;
+    }
+    // The kernel copies and validates the program
+    struct sock_fprog fprog = {};
+    fprog.len = (unsigned short)(length / sizeof(struct sock_filter));
+    fprog.filter = (struct sock_filter*)program;
+    if (setsockopt(_fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        _syscall = "setsockopt(SOL_SOCKET,SO_ATTACH_FILTER)@HciSocket::setBpfFilter";
+        return errno;
+    }
+    return 0;
+}
+
+void HciTransport::close() {
+    if (_fd != -1) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+int RawHciTransport::open() {
+    int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+    if (fd < 0) {
+        _syscall = "socket@HciSocket::HciSocket";
+        return errno;
+    }
+    _fd = fd;
+
+    // int opt = 1;
+    // if (setsockopt(fd, SOL_HCI, HCI_DATA_DIR, &opt, sizeof(opt)) < 0) {
+    //     _syscall = "setsockopt(SOL_HCI,HCI_DATA_DIR)@HciSocket::HciSocket";
+    //     return errno;
+    // }
+
+    return 0;
+}
+
+int RawHciTransport::deviceIdFor(const int* pDeviceId, bool isUp) {
+    int deviceId = 0;  // default
+
+    if (pDeviceId == nullptr) {
+        struct hci_dev_list_req* dl;
+        struct hci_dev_req* dr;
+
+        dl = (hci_dev_list_req*)calloc(HCI_MAX_DEV * sizeof(*dr) + sizeof(*dl), 1);
+        dr = dl->dev_req;
+        dl->dev_num = HCI_MAX_DEV;
+
+        if (ioctl(_fd, HCIGETDEVLIST, dl) > -1) {
+            for (int i = 0; i < dl->dev_num; i++, dr++) {
+                bool devUp = dr->dev_opt & (1 << HCI_UP);
+                if (isUp == devUp) {
+                    // choose the first device that is match
+                    // it would be good to also HCIGETDEVINFO and check the HCI_RAW flag
+                    deviceId = dr->dev_id;
+                    break;
+                }
+            }
+        }
+
+        free(dl);
+    } else {
+        deviceId = *pDeviceId;
+    }
+
+    return deviceId;
+}
+
+int RawHciTransport::bind(int deviceId, uint8_t* address, uint8_t* addressType) {
+    struct sockaddr_hci a = {};
+    struct hci_dev_info di = {};
+
+    memset(&a, 0, sizeof(a));
+    a.hci_family = AF_BLUETOOTH;
+    a.hci_dev = deviceId;
+    // a.hci_channel = HCI_CHANNEL_RAW;
+
+    if (ioctl(_fd, HCIDEVRESET, deviceId) < 0) {
+        _syscall = "ioctl(HCIDEVRESET)@HciSocket::bind";
+        return errno;
+    }
+
+    if (ioctl(_fd, HCIDEVDOWN, deviceId) < 0) {
+        _syscall = "ioctl(HCIDEVDOWN)@HciSocket::bind";
+        return errno;
+    }
+
+    if (ioctl(_fd, HCIDEVUP, deviceId) < 0) {
+        _syscall = "ioctl(HCIDEVUP)@HciSocket::bind";
+        return errno;
+    }
+
+    if (::bind(_fd, (struct sockaddr*)&a, sizeof(a)) < 0) {
+        _syscall = "bind@HciSocket::bind";
+        return errno;
+    }
+
+    // Get the local address and address type
+    memset(&di, 0, sizeof(di));
+    di.dev_id = deviceId;
+
+    if (ioctl(_fd, HCIGETDEVINFO, (void*)&di) < 0) {
+        _syscall = "ioctl(HCIGETDEVINFO)@HciSocket::bind";
+        return errno;
+    }
+
+    memcpy(address, &di.bdaddr, sizeof(di.bdaddr));
+    *addressType = di.type;
+    if (*addressType != BDADDR_LE_RANDOM) {
+        *addressType = BDADDR_LE_PUBLIC;
+    }
+
+    return 0;
+}
+
+bool RawHciTransport::isDeviceUp(int deviceId) {
+    struct hci_dev_info di = {};
+    bool isUp = false;
+
+    memset(&di, 0x00, sizeof(di));
+    di.dev_id = deviceId;
+
+    if (ioctl(_fd, HCIGETDEVINFO, (void*)&di) > -1) {
+        isUp = (di.flags & (1 << HCI_UP)) != 0;
+    }
+
+    return isUp;
+}
+
+int RawHciTransport::deviceList(std::vector<HciDevice>* devices) {
+    struct hci_dev_list_req* dl;
+    struct hci_dev_req* dr;
+
+    dl = (hci_dev_list_req*)calloc(HCI_MAX_DEV * sizeof(*dr) + sizeof(*dl), 1);
+    dr = dl->dev_req;
+    dl->dev_num = HCI_MAX_DEV;
+
+    if (ioctl(_fd, HCIGETDEVLIST, dl) < 0) {
+        _syscall = "ioctl(HCIGETDEVLIST)@HciSocket::getDeviceList";
+        int err = errno;
+        free(dl);
+        return err;
+    }
+
+    devices->clear();
+    for (int i = 0; i < dl->dev_num; i++, dr++) {
+        HciDevice device = {};
+        device.id = dr->dev_id;
+        device.up = (dr->dev_opt & (1 << HCI_UP)) != 0;
+
+        // Name and address are left empty if the device went away meanwhile
+        struct hci_dev_info di = {};
+        di.dev_id = dr->dev_id;
+        if (ioctl(_fd, HCIGETDEVINFO, (void*)&di) > -1) {
+            snprintf(device.name, sizeof(device.name), "%s", di.name);
+            memcpy(device.address, &di.bdaddr, sizeof(device.address));
+        }
+        devices->push_back(device);
+    }
+
+    free(dl);
+    return 0;
+}
+
+int RawHciTransport::enableTimestamps() {
+    // Frames carry the kernel receive time as a SOL_HCI / HCI_CMSG_TSTAMP control message
+    int opt = 1;
+    if (setsockopt(_fd, SOL_HCI, HCI_TIME_STAMP, &opt, sizeof(opt)) < 0) {
+        _syscall = "setsockopt(SOL_HCI,HCI_TIME_STAMP)@HciSocket::HciSocket";
+        return errno;
+    }
+    return 0;
+}
+
+int RawHciTransport::setFilter(const char* data, int length) {
+    if (setsockopt(_fd, SOL_HCI, HCI_FILTER, data, length) < 0) {
+        _syscall = "setsockopt(SOL_HCI,HCI_FILTER)@HciSocket::setFilter";
+        return errno;
+    }
+    return 0;
+}
+
+int RawHciTransport::setAuth(int deviceId, bool enabled) {
+    struct hci_dev_req dr = {};
+
+    dr.dev_id = deviceId;
+    dr.dev_opt = enabled ? AUTH_ENABLED : AUTH_DISABLED;
+
+    if (ioctl(_fd, HCISETAUTH, (unsigned long)&dr) < 0) {
+        _syscall = "ioctl(HCISETAUTH)@HciSocket::setAuth";
+        return errno;
+    }
+    return 0;
+}
+
+int RawHciTransport::setEncrypt(int deviceId, bool enabled) {
+    struct hci_dev_req dr = {};
+
+    dr.dev_id = deviceId;
+    dr.dev_opt = enabled ? ENCRYPT_P2P : ENCRYPT_DISABLED;
+
+    if (ioctl(_fd, HCISETENCRYPT, (unsigned long)&dr) < 0) {
+        _syscall = "ioctl(HCISETENCRYPT)@HciSocket::setEncrypt";
+        return errno;
+    }
+    return 0;
+}
+
+int RawHciTransport::l2Connect(const struct sockaddr_l2* src, const struct sockaddr_l2* dst, int* fd) {
+    int s = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_L2CAP);
+    if (s < 0) {
+#ifdef DEBUG
+        printf("[L2Socket::connect] socket() %d %s\n", errno, strerror(errno));
+#endif
+        _syscall = "socket@L2Socket::connect";
+        return errno;
+    }
+
+    int rc = ::bind(s, (struct sockaddr*)src, sizeof(*src));
+    if (rc < 0) {
+#ifdef DEBUG
+        printf("[L2Socket::connect] bind() %d %s\n", errno, strerror(errno));
+#endif
+        int err = errno;
+        _syscall = "bind@L2Socket::connect";
+        ::close(s);
+        return err;
+    }
+
+    struct l2cap_options opts = {};
+    memset(&opts, 0, sizeof(opts));
+    socklen_t len = sizeof(opts);
+
+    rc = getsockopt(s, SOL_L2CAP, L2CAP_OPTIONS, &opts, &len);
+    if (rc < 0) {
+#ifdef DEBUG
+        printf("[L2Socket::connect] getsockopt(SOL_L2CAP,L2CAP_OPTIONS) %d %s\n", errno, strerror(errno));
+#endif
+        int err = errno;
+        _syscall = "getsockopt@L2Socket::connect";
+        ::close(s);
+        return err;
+    }
+#ifdef DEBUG
+    printf("[L2Socket::connect] omtu %d, imtu %d, flush_to %d, mode %d, fcs %d, max_tx %d, txwin_size %d\n",
+           opts.omtu, opts.imtu, opts.flush_to, opts.mode, opts.fcs, opts.max_tx, opts.txwin_size);
+#endif
+
+    // WARNING: sends OCF_LE_CREATE_CONN to controller
+    // The socket is non-blocking, completion is notified by the poll handle when the socket becomes writable
+    *fd = s;
+    while ((rc = ::connect(s, (struct sockaddr*)dst, sizeof(*dst))) < 0) {
+#ifdef DEBUG
+        printf("[L2Socket::connect] connect() %d %s\n", errno, strerror(errno));
+#endif
+        _syscall = "connect@L2Socket::connect";
+        if (errno == EISCONN || errno == EINPROGRESS) {
+            return errno;
+        } else if (errno != EINTR) {
+            int err = errno;
+            ::close(s);
+            *fd = -1;
+            return err;
+        }
+    }
+    return 0;
+}
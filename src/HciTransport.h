@@ -0,0 +1,69 @@
+// HciTransport.h
+
+#ifndef HCI_TRANSPORT_H
+#define HCI_TRANSPORT_H
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/l2cap.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Local adapter, as listed by the kernel
+struct HciDevice {
+    int id;
+    char name[8];
+    uint8_t address[6];
+    bool up;
+};
+
+// Transport under HciSocket: provides the HCI file descriptor (read, written and
+// polled by HciSocket) and the device / L2CAP operations around it.
+// Operations return 0 or an errno, syscall() names the failing call.
+class HciTransport {
+   public:
+    HciTransport();
+    virtual ~HciTransport();
+
+    int fd() const;
+    const char* syscall() const;
+
+    virtual int open() = 0;
+    virtual void close();
+    virtual int deviceIdFor(const int* deviceId, bool isUp) = 0;
+    virtual int bind(int deviceId, uint8_t* address, uint8_t* addressType) = 0;
+    virtual bool isDeviceUp(int deviceId) = 0;
+    virtual int setFilter(const char* data, int length) = 0;
+    virtual int enableTimestamps() = 0;
+    virtual int setAuth(int deviceId, bool enabled) = 0;
+    virtual int setEncrypt(int deviceId, bool enabled) = 0;
+
+    // Attaches a classic BPF program (struct sock_filter[]) to the socket, detaches it when length is 0
+    virtual int attachFilter(const char* program, int length);
+
+    // Opens a non-blocking L2CAP ATT socket to dst, returns 0 (connected), EISCONN, EINPROGRESS or an errno
+    virtual int l2Connect(const struct sockaddr_l2* src, const struct sockaddr_l2* dst, int* fd) = 0;
+
+   protected:
+    int _fd;
+    const char* _syscall;
+};
+
+// Raw HCI socket on a local adapter (AF_BLUETOOTH, SOCK_RAW, BTPROTO_HCI)
+class RawHciTransport : public HciTransport {
+   public:
+    int open() override;
+    int deviceIdFor(const int* deviceId, bool isUp) override;
+    int bind(int deviceId, uint8_t* address, uint8_t* addressType) override;
+    bool isDeviceUp(int deviceId) override;
+    int setFilter(const char* data, int length) override;
+    int enableTimestamps() override;
+    int setAuth(int deviceId, bool enabled) override;
+    int setEncrypt(int deviceId, bool enabled) override;
+    int l2Connect(const struct sockaddr_l2* src, const struct sockaddr_l2* dst, int* fd) override;
+
+    int deviceList(std::vector<HciDevice>* devices);
+};
+
+#endif  // HCI_TRANSPORT_H
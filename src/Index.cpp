@@ -3,9 +3,13 @@
 #include <nan.h>
 
 #include "HciSocket.h"
+#include "SmpCryptoBinding.h"
 
 NAN_MODULE_INIT(InitModule) {
     HciSocket::Init(target);
+    SmpCryptoBinding::Init(target);
 }
 
-NODE_MODULE(hci_socket, InitModule);
\ No newline at end of file
+// Loadable from worker threads, every instance lives on the loop of the thread
+// that created it
+NAN_MODULE_WORKER_ENABLED(hci_socket, InitModule)
\ No newline at end of file
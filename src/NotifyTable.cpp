@@ -0,0 +1,45 @@
+// NotifyTable.cpp
+
+#include "NotifyTable.h"
+
+NotifyTable::NotifyTable() : _counters() {
+}
+
+bool NotifyTable::empty() const {
+    return _subscriptions.empty();
+}
+
+void NotifyTable::subscribe(uint16_t handle, uint16_t attHandle) {
+    _subscriptions.insert(Key(handle, attHandle));
+}
+
+void NotifyTable::unsubscribe(uint16_t handle, uint16_t attHandle) {
+    _subscriptions.erase(Key(handle, attHandle));
+}
+
+// Connection handles are reused, subscriptions don't survive the link
+void NotifyTable::removeConnection(uint16_t handle) {
+    for (auto it = _subscriptions.begin(); it != _subscriptions.end();) {
+        if ((*it >> 16) == (handle & 0x0fff)) {
+            it = _subscriptions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool NotifyTable::subscribed(uint16_t handle, uint16_t attHandle) const {
+    return _subscriptions.count(Key(handle, attHandle)) > 0;
+}
+
+size_t NotifyTable::size() const {
+    return _subscriptions.size();
+}
+
+NotifyTable::Counters& NotifyTable::counters() {
+    return _counters;
+}
+
+uint32_t NotifyTable::Key(uint16_t handle, uint16_t attHandle) {
+    return ((uint32_t)(handle & 0x0fff) << 16) | attHandle;
+}
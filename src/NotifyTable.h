@@ -0,0 +1,39 @@
+// NotifyTable.h
+
+#ifndef NOTIFY_TABLE_H
+#define NOTIFY_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_set>
+
+// ATT notifications routed natively, by connection handle and attribute handle.
+// Handle Value Notifications of a subscribed attribute skip the JS ACL / ATT
+// layers and are delivered in batches.
+class NotifyTable {
+   public:
+    struct Counters {
+        uint64_t delivered;  // Values delivered in batches
+        uint64_t fallback;  // Values left to JS because the batch was full
+    };
+
+    NotifyTable();
+
+    bool empty() const;
+    void subscribe(uint16_t handle, uint16_t attHandle);
+    void unsubscribe(uint16_t handle, uint16_t attHandle);
+    void removeConnection(uint16_t handle);
+    bool subscribed(uint16_t handle, uint16_t attHandle) const;
+    size_t size() const;
+    Counters& counters();
+
+   private:
+    static uint32_t Key(uint16_t handle, uint16_t attHandle);
+
+   private:
+    std::unordered_set<uint32_t> _subscriptions;  // Connection handle << 16 | attribute handle
+    Counters _counters;
+};
+
+#endif  // NOTIFY_TABLE_H
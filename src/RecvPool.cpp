@@ -0,0 +1,59 @@
+// RecvPool.cpp
+
+#include "RecvPool.h"
+
+RecvPool::RecvPool(int slots, int slotSize) : _slotSize(slotSize), _memory((size_t)slots * slotSize), _outstanding(0), _detached(false), _counters() {
+    _free.reserve(slots);
+    for (int i = slots - 1; i >= 0; i--) {
+        _free.push_back(&_memory[(size_t)i * slotSize]);
+    }
+}
+
+RecvPool::~RecvPool() {
+}
+
+char* RecvPool::acquire() {
+    if (_free.empty()) {
+        _counters.copied++;
+        return nullptr;
+    }
+    char* slot = _free.back();
+    _free.pop_back();
+    _outstanding++;
+    _counters.pooled++;
+    return slot;
+}
+
+void RecvPool::release(char* slot) {
+    _outstanding--;
+    if (_detached) {
+        if (_outstanding == 0) {
+            delete this;
+        }
+        return;
+    }
+    _free.push_back(slot);
+}
+
+void RecvPool::detach() {
+    _detached = true;
+    if (_outstanding == 0) {
+        delete this;
+    }
+}
+
+int RecvPool::slotSize() const {
+    return _slotSize;
+}
+
+int RecvPool::available() const {
+    return (int)_free.size();
+}
+
+RecvPool::Counters& RecvPool::counters() {
+    return _counters;
+}
+
+void RecvPool::FreeCallback(char* data, void* hint) {
+    ((RecvPool*)hint)->release(data);
+}
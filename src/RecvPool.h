@@ -0,0 +1,47 @@
+// RecvPool.h
+
+#ifndef RECV_POOL_H
+#define RECV_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#define RECV_POOL_SLOTS_MAX 65536
+
+// Fixed size receive slots handed to JS as external buffers.
+// A slot returns to the pool when its buffer is garbage collected, it is never
+// reused while JS can still see it: when the pool is exhausted the caller copies.
+class RecvPool {
+   public:
+    struct Counters {
+        uint64_t pooled;  // Frames received into a slot
+        uint64_t copied;  // Frames copied because no slot was free
+    };
+
+    RecvPool(int slots, int slotSize);
+
+    char* acquire();
+    void release(char* slot);
+    void detach();
+    int slotSize() const;
+    int available() const;
+    Counters& counters();
+
+    // node::Buffer::FreeCallback, hint is the pool
+    static void FreeCallback(char* data, void* hint);
+
+   private:
+    ~RecvPool();
+
+   private:
+    int _slotSize;
+    std::vector<char> _memory;
+    std::vector<char*> _free;
+    int _outstanding;  // Slots owned by JS or by the reader
+    bool _detached;  // Owner released the pool, delete with the last slot
+    Counters _counters;
+};
+
+#endif  // RECV_POOL_H
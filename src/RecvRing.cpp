@@ -0,0 +1,218 @@
+// RecvRing.cpp
+
+#include "RecvRing.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+RecvRing::RecvRing(int slots, int slotSize, int controlSize) : _mask(0), _slotSize(slotSize), _controlSize(controlSize), _fd(-1), _wakeFd(-1), _async(nullptr), _error(0), _head(0), _tail(0), _frames(0), _stalls(0), _highWater(0), _stalled(false), _stopping(false) {
+    uint32_t capacity = RECV_RING_SLOTS_MIN;
+    while (capacity < (uint32_t)slots && capacity < RECV_RING_SLOTS_MAX) {
+        capacity <<= 1;
+    }
+    _mask = capacity - 1;
+
+    _memory.assign((size_t)capacity * slotSize, 0);
+    _control.assign((size_t)capacity * controlSize, 0);
+    _iovs.assign(capacity, {});
+    _msgs.assign(capacity, {});
+    for (uint32_t i = 0; i < capacity; i++) {
+        _iovs[i].iov_base = &_memory[(size_t)i * slotSize];
+        _iovs[i].iov_len = slotSize;
+        _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+        _msgs[i].msg_hdr.msg_iovlen = 1;
+        _msgs[i].msg_hdr.msg_control = &_control[(size_t)i * controlSize];
+        _msgs[i].msg_hdr.msg_controllen = controlSize;
+    }
+}
+
+RecvRing::~RecvRing() {
+    stop();
+}
+
+int RecvRing::start(int fd, uv_async_t* async) {
+    stop();
+
+    _wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_wakeFd < 0) {
+        return errno;
+    }
+    _fd = fd;
+    _async = async;
+    _error = 0;
+    _stalled = false;
+    _stopping = false;
+    _thread = std::thread(&RecvRing::readLoop, this);
+    return 0;
+}
+
+// Frames already in the ring stay there until consumed
+void RecvRing::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+    _stopping = true;
+    uint64_t value = 1;
+    if (write(_wakeFd, &value, sizeof(value)) < 0) {
+        // The counter can't overflow, nothing else can fail here
+    }
+    _thread.join();
+    close(_wakeFd);
+    _wakeFd = -1;
+    _fd = -1;
+    _async = nullptr;
+}
+
+// Returns the errno that stopped the reader thread once, 0 if none
+int RecvRing::error() {
+    return _error.exchange(0);
+}
+
+uint32_t RecvRing::readable(uint32_t* first) const {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t available = _head.load(std::memory_order_acquire) - tail;
+    uint32_t contiguous = _mask + 1 - (tail & _mask);
+    *first = tail;
+    return available < contiguous ? available : contiguous;
+}
+
+void RecvRing::consume(uint32_t count) {
+    _tail.store(_tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    // Pairs with the fence of readLoop(): either the reader sees the new tail or this sees the flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (count > 0 && _stalled.exchange(false) && _wakeFd >= 0) {
+        // Resume the reader, the ring has room again
+        uint64_t value = 1;
+        if (write(_wakeFd, &value, sizeof(value)) < 0) {
+            // The counter can't overflow, nothing else can fail here
+        }
+    }
+}
+
+char* RecvRing::data(uint32_t index) {
+    return &_memory[(size_t)(index & _mask) * _slotSize];
+}
+
+int RecvRing::length(uint32_t index) const {
+    return _msgs[index & _mask].msg_len;
+}
+
+struct msghdr* RecvRing::header(uint32_t index) {
+    return &_msgs[index & _mask].msg_hdr;
+}
+
+uint32_t RecvRing::capacity() const {
+    return _mask + 1;
+}
+
+RecvRing::Counters RecvRing::counters() const {
+    Counters counters;
+    counters.frames = _frames.load(std::memory_order_relaxed);
+    counters.stalls = _stalls.load(std::memory_order_relaxed);
+    counters.highWater = _highWater.load(std::memory_order_relaxed);
+    counters.capacity = _mask + 1;
+    return counters;
+}
+
+uint32_t RecvRing::writable(uint32_t* first) const {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t free = _mask + 1 - (head - _tail.load(std::memory_order_acquire));
+    uint32_t contiguous = _mask + 1 - (head & _mask);
+    *first = head;
+    return free < contiguous ? free : contiguous;
+}
+
+void RecvRing::produce(uint32_t count) {
+    uint32_t head = _head.load(std::memory_order_relaxed) + count;
+    _head.store(head, std::memory_order_release);
+    _frames.fetch_add(count, std::memory_order_relaxed);
+
+    uint32_t used = head - _tail.load(std::memory_order_relaxed);
+    if (used > _highWater.load(std::memory_order_relaxed)) {
+        _highWater.store(used, std::memory_order_relaxed);
+    }
+}
+
+void RecvRing::readLoop() {
+    struct pollfd fds[2] = {{_fd, POLLIN, 0}, {_wakeFd, POLLIN, 0}};
+    for (;;) {
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _error = errno;
+            uv_async_send(_async);
+            return;
+        }
+        if (fds[1].revents != 0) {
+            uint64_t value;
+            if (read(_wakeFd, &value, sizeof(value)) < 0) {
+                // Already reset by an earlier read, nothing to do
+            }
+            if (_stopping) {
+                return;
+            }
+            fds[0].events = POLLIN;
+        }
+        if (fds[0].revents & POLLNVAL) {
+            _error = EBADF;
+            uv_async_send(_async);
+            return;
+        }
+
+        // Drain until the socket would block
+        for (;;) {
+            uint32_t first;
+            uint32_t count = writable(&first);
+            int result;
+            if (count == 0) {
+                // Ring full: leave the frames in the kernel receive queue until
+                // consume() frees slots, checking again once the flag is visible to it
+                _stalled = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (writable(&first) == 0) {
+                    _stalls.fetch_add(1, std::memory_order_relaxed);
+                    fds[0].events = 0;
+                    break;
+                }
+                _stalled = false;
+                continue;
+            } else {
+                if (count > RECV_RING_BURST) {
+                    count = RECV_RING_BURST;
+                }
+                struct mmsghdr* msgs = &_msgs[first & _mask];
+                for (uint32_t i = 0; i < count; i++) {
+                    msgs[i].msg_hdr.msg_controllen = _controlSize;
+                }
+                result = recvmmsg(_fd, msgs, count, MSG_DONTWAIT, nullptr);
+                if (result > 0) {
+                    // An empty message is the end of file of a socket pair
+                    int frames = 0;
+                    while (frames < result && msgs[frames].msg_len > 0) {
+                        frames++;
+                    }
+                    if (frames > 0) {
+                        produce(frames);
+                        uv_async_send(_async);
+                    }
+                    if (frames == result) {
+                        continue;
+                    }
+                    result = 0;
+                }
+            }
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                _error = result == 0 ? EPIPE : errno;
+                uv_async_send(_async);
+                return;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+// RecvRing.h
+
+#ifndef RECV_RING_H
+#define RECV_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <uv.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define RECV_RING_SLOTS_MIN 16
+#define RECV_RING_SLOTS_MAX 65536
+#define RECV_RING_BURST 64  // Frames read per recvmmsg() call
+
+// Single producer / single consumer ring of received frames.
+// A dedicated reader thread blocks on the socket and receives frames straight
+// into free slots, then wakes the event loop with uv_async_send(); the event loop
+// thread consumes whole runs of slots. Indices only grow, slot i lives at i & mask.
+// When the ring is full the reader stops reading until the event loop frees
+// slots (signalled through the eventfd), frames wait in the kernel receive queue
+// meanwhile. Such stalls are counted: frequent ones mean the ring is too small.
+class RecvRing {
+   public:
+    struct Counters {
+        uint64_t frames;     // Frames received into a slot
+        uint64_t stalls;  // Times the reader waited for the ring to have room
+        uint32_t highWater;  // Highest number of slots in use
+        uint32_t capacity;
+    };
+
+    RecvRing(int slots, int slotSize, int controlSize);
+    ~RecvRing();
+
+    int start(int fd, uv_async_t* async);
+    void stop();
+    int error();
+
+    // Consumer side
+    uint32_t readable(uint32_t* first) const;
+    void consume(uint32_t count);
+    char* data(uint32_t index);
+    int length(uint32_t index) const;
+    struct msghdr* header(uint32_t index);
+    uint32_t capacity() const;
+    Counters counters() const;
+
+   private:
+    uint32_t writable(uint32_t* first) const;
+    void produce(uint32_t count);
+    void readLoop();
+
+   private:
+    uint32_t _mask;
+    int _slotSize;
+    int _controlSize;
+    std::vector<char> _memory;
+    std::vector<char> _control;
+    std::vector<struct iovec> _iovs;
+    std::vector<struct mmsghdr> _msgs;  // One per slot, filled in place by the reader
+    int _fd;
+    int _wakeFd;  // eventfd stopping or resuming the reader thread
+    uv_async_t* _async;
+    std::thread _thread;
+    std::atomic<int> _error;  // Errno that stopped the reader thread, 0 if none
+    alignas(64) std::atomic<uint32_t> _head;  // Written by the reader thread
+    alignas(64) std::atomic<uint32_t> _tail;  // Written by the event loop thread
+    alignas(64) std::atomic<uint64_t> _frames;
+    std::atomic<uint64_t> _stalls;
+    std::atomic<uint32_t> _highWater;
+    std::atomic<bool> _stalled;  // Reader waiting for consume()
+    std::atomic<bool> _stopping;
+};
+
+#endif  // RECV_RING_H
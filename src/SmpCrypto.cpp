@@ -0,0 +1,318 @@
+// SmpCrypto.cpp
+
+// EC_KEY is deprecated by OpenSSL 3 but, unlike its replacements, available
+// in every OpenSSL a supported Node.js may be linked with
+#define OPENSSL_API_COMPAT 0x10100000L
+
+#include "SmpCrypto.h"
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdh.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <string.h>
+
+#define P256_COORDINATE_SIZE 32
+#define F5_MESSAGE_SIZE 53
+
+static const uint8_t F5_SALT[SMP_KEY_SIZE] = {0x6c, 0x88, 0x83, 0x91, 0xaa, 0xf5, 0xa5, 0x38, 0x60, 0x37, 0x0b, 0xdb, 0x5a, 0x60, 0x83, 0xbe};
+
+// Expanded AES-128 keys, least recently used evicted
+class AesKeyCache {
+   public:
+    AesKeyCache() : _entries(), _clock(0) {
+    }
+
+    ~AesKeyCache() {
+        for (auto& entry : _entries) {
+            if (entry.ctx != nullptr) {
+                EVP_CIPHER_CTX_free(entry.ctx);
+            }
+        }
+    }
+
+    EVP_CIPHER_CTX* get(const uint8_t* key) {
+        Entry* victim = &_entries[0];
+        for (auto& entry : _entries) {
+            if (entry.ctx != nullptr && memcmp(entry.key, key, SMP_KEY_SIZE) == 0) {
+                entry.used = ++_clock;
+                return entry.ctx;
+            }
+            if (entry.used < victim->used) {
+                victim = &entry;
+            }
+        }
+        if (victim->ctx == nullptr) {
+            victim->ctx = EVP_CIPHER_CTX_new();
+            if (victim->ctx == nullptr) {
+                return nullptr;
+            }
+        }
+        // ECB without padding keeps no state between blocks, a context is
+        // reused for as many blocks as needed
+        if (EVP_EncryptInit_ex(victim->ctx, EVP_aes_128_ecb(), nullptr, key, nullptr) != 1) {
+            victim->used = 0;
+            return nullptr;
+        }
+        EVP_CIPHER_CTX_set_padding(victim->ctx, 0);
+        memcpy(victim->key, key, SMP_KEY_SIZE);
+        victim->used = ++_clock;
+        return victim->ctx;
+    }
+
+   private:
+    struct Entry {
+        uint8_t key[SMP_KEY_SIZE];
+        EVP_CIPHER_CTX* ctx;
+        uint64_t used;
+    };
+    Entry _entries[SMP_AES_KEYS_MAX];
+    uint64_t _clock;
+};
+
+// OpenSSL contexts are not shared between worker threads
+static thread_local AesKeyCache aesKeys;
+
+// Copies length octets in reverse order (SMP PDU order <-> big endian)
+static inline void Swap(const uint8_t* in, size_t length, uint8_t* out) {
+    for (size_t i = 0; i < length; i++) {
+        out[i] = in[length - 1 - i];
+    }
+}
+
+static inline void Xor(uint8_t* data, const uint8_t* other) {
+    for (int i = 0; i < SMP_KEY_SIZE; i++) {
+        data[i] ^= other[i];
+    }
+}
+
+// AES-128 of one block, most significant octet first
+static bool Encrypt(const uint8_t* key, const uint8_t* in, uint8_t* out) {
+    EVP_CIPHER_CTX* ctx = aesKeys.get(key);
+    int length = 0;
+    return ctx != nullptr && EVP_EncryptUpdate(ctx, out, &length, in, SMP_KEY_SIZE) == 1 && length == SMP_KEY_SIZE;
+}
+
+static void CmacSubkey(const uint8_t* l, uint8_t* k) {
+    for (int i = 0; i < SMP_KEY_SIZE; i++) {
+        k[i] = (uint8_t)((l[i] << 1) | (i < SMP_KEY_SIZE - 1 ? l[i + 1] >> 7 : 0));
+    }
+    if (l[0] & 0x80) {
+        k[SMP_KEY_SIZE - 1] ^= 0x87;
+    }
+}
+
+bool SmpCrypto::e(const uint8_t* key, const uint8_t* data, uint8_t* out) {
+    uint8_t k[SMP_KEY_SIZE];
+    uint8_t in[SMP_KEY_SIZE];
+    uint8_t result[SMP_KEY_SIZE];
+    Swap(key, SMP_KEY_SIZE, k);
+    Swap(data, SMP_KEY_SIZE, in);
+    if (!Encrypt(k, in, result)) {
+        return false;
+    }
+    Swap(result, SMP_KEY_SIZE, out);
+    return true;
+}
+
+// Legacy pairing confirm value generation function c1
+// pres, preq: 7 octets pairing response / request PDUs, ia, ra: 6 octets addresses
+bool SmpCrypto::c1(const uint8_t* k, const uint8_t* r, const uint8_t* pres, const uint8_t* preq, uint8_t iat, const uint8_t* ia, uint8_t rat, const uint8_t* ra, uint8_t* out) {
+    // p1 = pres || preq || rat || iat, p2 = padding || ia || ra
+    uint8_t p1[SMP_KEY_SIZE];
+    uint8_t p2[SMP_KEY_SIZE] = {};
+    p1[0] = iat;
+    p1[1] = rat;
+    memcpy(&p1[2], preq, 7);
+    memcpy(&p1[9], pres, 7);
+    memcpy(&p2[0], ra, 6);
+    memcpy(&p2[6], ia, 6);
+
+    uint8_t block[SMP_KEY_SIZE];
+    memcpy(block, r, SMP_KEY_SIZE);
+    Xor(block, p1);
+    if (!e(k, block, block)) {
+        return false;
+    }
+    Xor(block, p2);
+    return e(k, block, out);
+}
+
+// Legacy pairing key generation function s1
+bool SmpCrypto::s1(const uint8_t* k, const uint8_t* r1, const uint8_t* r2, uint8_t* out) {
+    // r' = r1' || r2' (least significant 64 bits of each)
+    uint8_t block[SMP_KEY_SIZE];
+    memcpy(&block[0], r2, 8);
+    memcpy(&block[8], r1, 8);
+    return e(k, block, out);
+}
+
+bool SmpCrypto::aesCmac(const uint8_t* key, const uint8_t* message, size_t length, uint8_t* out) {
+    uint8_t l[SMP_KEY_SIZE] = {};
+    uint8_t k1[SMP_KEY_SIZE];
+    uint8_t k2[SMP_KEY_SIZE];
+    if (!Encrypt(key, l, l)) {
+        return false;
+    }
+    CmacSubkey(l, k1);
+    CmacSubkey(k1, k2);
+
+    size_t n = length > 0 ? (length + SMP_KEY_SIZE - 1) / SMP_KEY_SIZE : 1;
+    size_t lastLength = length - (n - 1) * SMP_KEY_SIZE;
+    uint8_t last[SMP_KEY_SIZE] = {};
+    memcpy(last, message + (n - 1) * SMP_KEY_SIZE, lastLength);
+    if (lastLength == SMP_KEY_SIZE) {
+        Xor(last, k1);
+    } else {
+        last[lastLength] = 0x80;
+        Xor(last, k2);
+    }
+
+    uint8_t x[SMP_KEY_SIZE] = {};
+    uint8_t y[SMP_KEY_SIZE];
+    for (size_t i = 0; i < n - 1; i++) {
+        memcpy(y, x, SMP_KEY_SIZE);
+        Xor(y, message + i * SMP_KEY_SIZE);
+        if (!Encrypt(key, y, x)) {
+            return false;
+        }
+    }
+    Xor(last, x);
+    return Encrypt(key, last, out);
+}
+
+// LE Secure Connections confirm value generation function f4
+// u, v: 32 octets public key X coordinates, x: 16 octets nonce
+bool SmpCrypto::f4(const uint8_t* u, const uint8_t* v, const uint8_t* x, uint8_t z, uint8_t* out) {
+    uint8_t key[SMP_KEY_SIZE];
+    uint8_t message[2 * P256_COORDINATE_SIZE + 1];
+    uint8_t result[SMP_KEY_SIZE];
+    Swap(x, SMP_KEY_SIZE, key);
+    Swap(u, P256_COORDINATE_SIZE, &message[0]);
+    Swap(v, P256_COORDINATE_SIZE, &message[P256_COORDINATE_SIZE]);
+    message[2 * P256_COORDINATE_SIZE] = z;
+    if (!aesCmac(key, message, sizeof(message), result)) {
+        return false;
+    }
+    Swap(result, SMP_KEY_SIZE, out);
+    return true;
+}
+
+// LE Secure Connections key generation function f5
+// w: 32 octets DHKey, n1, n2: 16 octets nonces, a1, a2: 7 octets addresses
+bool SmpCrypto::f5(const uint8_t* w, const uint8_t* n1, const uint8_t* n2, const uint8_t* a1, const uint8_t* a2, uint8_t* macKey, uint8_t* ltk) {
+    uint8_t dhKey[SMP_DHKEY_SIZE];
+    uint8_t t[SMP_KEY_SIZE];
+    Swap(w, SMP_DHKEY_SIZE, dhKey);
+    if (!aesCmac(F5_SALT, dhKey, sizeof(dhKey), t)) {
+        return false;
+    }
+
+    // Counter || keyID "btle" || N1 || N2 || A1 || A2 || Length (256)
+    uint8_t message[F5_MESSAGE_SIZE];
+    message[0] = 0;
+    memcpy(&message[1], "btle", 4);
+    Swap(n1, SMP_KEY_SIZE, &message[5]);
+    Swap(n2, SMP_KEY_SIZE, &message[21]);
+    Swap(a1, SMP_ADDRESS_SIZE, &message[37]);
+    Swap(a2, SMP_ADDRESS_SIZE, &message[44]);
+    message[51] = 0x01;
+    message[52] = 0x00;
+
+    uint8_t result[SMP_KEY_SIZE];
+    if (!aesCmac(t, message, sizeof(message), result)) {
+        return false;
+    }
+    Swap(result, SMP_KEY_SIZE, macKey);
+    message[0] = 1;
+    if (!aesCmac(t, message, sizeof(message), result)) {
+        return false;
+    }
+    Swap(result, SMP_KEY_SIZE, ltk);
+    return true;
+}
+
+// LE Secure Connections check value generation function f6
+// w: MacKey, n1, n2, r: 16 octets, ioCap: 3 octets, a1, a2: 7 octets addresses
+bool SmpCrypto::f6(const uint8_t* w, const uint8_t* n1, const uint8_t* n2, const uint8_t* r, const uint8_t* ioCap, const uint8_t* a1, const uint8_t* a2, uint8_t* out) {
+    uint8_t key[SMP_KEY_SIZE];
+    uint8_t message[3 * SMP_KEY_SIZE + SMP_IOCAP_SIZE + 2 * SMP_ADDRESS_SIZE];
+    uint8_t result[SMP_KEY_SIZE];
+    Swap(w, SMP_KEY_SIZE, key);
+    Swap(n1, SMP_KEY_SIZE, &message[0]);
+    Swap(n2, SMP_KEY_SIZE, &message[16]);
+    Swap(r, SMP_KEY_SIZE, &message[32]);
+    Swap(ioCap, SMP_IOCAP_SIZE, &message[48]);
+    Swap(a1, SMP_ADDRESS_SIZE, &message[51]);
+    Swap(a2, SMP_ADDRESS_SIZE, &message[58]);
+    if (!aesCmac(key, message, sizeof(message), result)) {
+        return false;
+    }
+    Swap(result, SMP_KEY_SIZE, out);
+    return true;
+}
+
+// LE Secure Connections numeric comparison value generation function g2
+// u, v: 32 octets public key X coordinates, x, y: 16 octets nonces
+// out: the six digit value to compare
+bool SmpCrypto::g2(const uint8_t* u, const uint8_t* v, const uint8_t* x, const uint8_t* y, uint32_t* out) {
+    uint8_t key[SMP_KEY_SIZE];
+    uint8_t message[2 * P256_COORDINATE_SIZE + SMP_KEY_SIZE];
+    uint8_t result[SMP_KEY_SIZE];
+    Swap(x, SMP_KEY_SIZE, key);
+    Swap(u, P256_COORDINATE_SIZE, &message[0]);
+    Swap(v, P256_COORDINATE_SIZE, &message[P256_COORDINATE_SIZE]);
+    Swap(y, SMP_KEY_SIZE, &message[2 * P256_COORDINATE_SIZE]);
+    if (!aesCmac(key, message, sizeof(message), result)) {
+        return false;
+    }
+    uint32_t value = ((uint32_t)result[12] << 24) | ((uint32_t)result[13] << 16) | ((uint32_t)result[14] << 8) | result[15];
+    *out = value % 1000000;
+    return true;
+}
+
+// privateKey: 32 octets scalar (opaque, big endian), publicKey: X || Y in SMP
+// PDU order, as carried by Pairing Public Key
+bool SmpCrypto::generateKeyPair(uint8_t* privateKey, uint8_t* publicKey) {
+    EC_KEY* key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    if (key == nullptr) {
+        return false;
+    }
+    // Uncompressed point: 0x04 || X || Y, big endian
+    uint8_t point[1 + 2 * P256_COORDINATE_SIZE];
+    bool ok = EC_KEY_generate_key(key) == 1 &&
+              BN_bn2binpad(EC_KEY_get0_private_key(key), privateKey, SMP_PRIVATE_KEY_SIZE) == SMP_PRIVATE_KEY_SIZE &&
+              EC_POINT_point2oct(EC_KEY_get0_group(key), EC_KEY_get0_public_key(key), POINT_CONVERSION_UNCOMPRESSED, point, sizeof(point), nullptr) == sizeof(point);
+    if (ok) {
+        Swap(&point[1], P256_COORDINATE_SIZE, &publicKey[0]);
+        Swap(&point[1 + P256_COORDINATE_SIZE], P256_COORDINATE_SIZE, &publicKey[P256_COORDINATE_SIZE]);
+    }
+    EC_KEY_free(key);
+    return ok;
+}
+
+// out: DHKey in SMP PDU order, as f5() takes it
+bool SmpCrypto::dhKey(const uint8_t* privateKey, const uint8_t* publicKey, uint8_t* out) {
+    uint8_t point[1 + 2 * P256_COORDINATE_SIZE];
+    point[0] = POINT_CONVERSION_UNCOMPRESSED;
+    Swap(&publicKey[0], P256_COORDINATE_SIZE, &point[1]);
+    Swap(&publicKey[P256_COORDINATE_SIZE], P256_COORDINATE_SIZE, &point[1 + P256_COORDINATE_SIZE]);
+
+    EC_KEY* key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    BIGNUM* scalar = BN_bin2bn(privateKey, SMP_PRIVATE_KEY_SIZE, nullptr);
+    EC_POINT* peer = key != nullptr ? EC_POINT_new(EC_KEY_get0_group(key)) : nullptr;
+    uint8_t secret[SMP_DHKEY_SIZE];
+    // oct2point rejects points off the curve (invalid curve attacks)
+    bool ok = peer != nullptr && scalar != nullptr &&
+              EC_KEY_set_private_key(key, scalar) == 1 &&
+              EC_POINT_oct2point(EC_KEY_get0_group(key), peer, point, sizeof(point), nullptr) == 1 &&
+              ECDH_compute_key(secret, sizeof(secret), peer, key, nullptr) == SMP_DHKEY_SIZE;
+    if (ok) {
+        Swap(secret, SMP_DHKEY_SIZE, out);
+    }
+    EC_POINT_free(peer);
+    BN_clear_free(scalar);
+    EC_KEY_free(key);
+    return ok;
+}
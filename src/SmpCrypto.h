@@ -0,0 +1,39 @@
+// SmpCrypto.h
+
+#ifndef SMP_CRYPTO_H
+#define SMP_CRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SMP_KEY_SIZE 16          // Keys, random numbers and results of the AES based functions
+#define SMP_ADDRESS_SIZE 7       // Address followed by its type
+#define SMP_IOCAP_SIZE 3         // IO capability, OOB data flag, AuthReq
+#define SMP_PRIVATE_KEY_SIZE 32  // P-256 private key
+#define SMP_PUBLIC_KEY_SIZE 64   // P-256 public key X and Y coordinates
+#define SMP_DHKEY_SIZE 32        // P-256 shared secret (X coordinate)
+#define SMP_AES_KEYS_MAX 8       // Key schedules kept per thread
+
+// Security Manager cryptographic toolbox (Core Vol 3 Part H, 2.2) on the
+// OpenSSL Node.js is linked with, so that AES-NI or the ARMv8 crypto extensions
+// are used where available. As in crypto.js every value is in SMP PDU order,
+// least significant octet first, except for aesCmac() which is most
+// significant octet first (RFC 4493). AES key schedules are cached per thread,
+// keys used in a row (TK in c1 and s1, the f5 salt, MacKey) are only expanded
+// once. Functions return false when OpenSSL fails.
+class SmpCrypto {
+   public:
+    static bool e(const uint8_t* key, const uint8_t* data, uint8_t* out);
+    static bool c1(const uint8_t* k, const uint8_t* r, const uint8_t* pres, const uint8_t* preq, uint8_t iat, const uint8_t* ia, uint8_t rat, const uint8_t* ra, uint8_t* out);
+    static bool s1(const uint8_t* k, const uint8_t* r1, const uint8_t* r2, uint8_t* out);
+    static bool aesCmac(const uint8_t* key, const uint8_t* message, size_t length, uint8_t* out);
+    static bool f4(const uint8_t* u, const uint8_t* v, const uint8_t* x, uint8_t z, uint8_t* out);
+    static bool f5(const uint8_t* w, const uint8_t* n1, const uint8_t* n2, const uint8_t* a1, const uint8_t* a2, uint8_t* macKey, uint8_t* ltk);
+    static bool f6(const uint8_t* w, const uint8_t* n1, const uint8_t* n2, const uint8_t* r, const uint8_t* ioCap, const uint8_t* a1, const uint8_t* a2, uint8_t* out);
+    static bool g2(const uint8_t* u, const uint8_t* v, const uint8_t* x, const uint8_t* y, uint32_t* out);
+    static bool generateKeyPair(uint8_t* privateKey, uint8_t* publicKey);
+    // Also false when publicKey is not a point of the curve
+    static bool dhKey(const uint8_t* privateKey, const uint8_t* publicKey, uint8_t* out);
+};
+
+#endif  // SMP_CRYPTO_H
@@ -0,0 +1,188 @@
+// SmpCryptoBinding.cpp
+
+#include "SmpCryptoBinding.h"
+
+#include <node_buffer.h>
+
+#include <initializer_list>
+
+using namespace v8;
+
+// Buffer arguments of the expected length, the usage error is thrown otherwise
+static bool GetArgs(const Nan::FunctionCallbackInfo<Value>& info, const char* usage, std::initializer_list<size_t> lengths, const uint8_t** args) {
+    int i = 0;
+    for (size_t length : lengths) {
+        if (info.Length() <= i || !node::Buffer::HasInstance(info[i]) || node::Buffer::Length(info[i]) < length) {
+            Nan::ThrowTypeError(usage);
+            return false;
+        }
+        args[i] = (const uint8_t*)node::Buffer::Data(info[i]);
+        i++;
+    }
+    return true;
+}
+
+static Local<Object> NewBuffer(const uint8_t* data, size_t length) {
+    return Nan::CopyBuffer((const char*)data, length).ToLocalChecked();
+}
+
+NAN_MODULE_INIT(SmpCryptoBinding::Init) {
+    Nan::HandleScope scope;
+
+    Local<Object> object = Nan::New<Object>();
+    Nan::SetMethod(object, "e", E);
+    Nan::SetMethod(object, "c1", C1);
+    Nan::SetMethod(object, "s1", S1);
+    Nan::SetMethod(object, "aesCmac", AesCmac);
+    Nan::SetMethod(object, "f4", F4);
+    Nan::SetMethod(object, "f5", F5);
+    Nan::SetMethod(object, "f6", F6);
+    Nan::SetMethod(object, "g2", G2);
+    Nan::SetMethod(object, "generateKeyPair", GenerateKeyPair);
+    Nan::SetMethod(object, "dhKey", DhKey);
+    Nan::Set(target, Nan::New("SmpCrypto").ToLocalChecked(), object);
+}
+
+NAN_METHOD(SmpCryptoBinding::E) {
+    Nan::HandleScope scope;
+    const uint8_t* args[2];
+    if (!GetArgs(info, "usage: e(key, data)", {SMP_KEY_SIZE, SMP_KEY_SIZE}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::e(args[0], args[1], out)) {
+        Nan::ThrowError("AES-128 failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::C1) {
+    Nan::HandleScope scope;
+    const uint8_t* args[8];
+    if (!GetArgs(info, "usage: c1(k, r, pres, preq, iat, ia, rat, ra)", {SMP_KEY_SIZE, SMP_KEY_SIZE, 7, 7, 1, 6, 1, 6}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::c1(args[0], args[1], args[2], args[3], args[4][0], args[5], args[6][0], args[7], out)) {
+        Nan::ThrowError("c1 failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::S1) {
+    Nan::HandleScope scope;
+    const uint8_t* args[3];
+    if (!GetArgs(info, "usage: s1(k, r1, r2)", {SMP_KEY_SIZE, 8, 8}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::s1(args[0], args[1], args[2], out)) {
+        Nan::ThrowError("s1 failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::AesCmac) {
+    Nan::HandleScope scope;
+    const uint8_t* args[2];
+    if (!GetArgs(info, "usage: aesCmac(key, message)", {SMP_KEY_SIZE, 0}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::aesCmac(args[0], args[1], node::Buffer::Length(info[1]), out)) {
+        Nan::ThrowError("AES-CMAC failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::F4) {
+    Nan::HandleScope scope;
+    const uint8_t* args[4];
+    if (!GetArgs(info, "usage: f4(u, v, x, z)", {SMP_DHKEY_SIZE, SMP_DHKEY_SIZE, SMP_KEY_SIZE, 1}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::f4(args[0], args[1], args[2], args[3][0], out)) {
+        Nan::ThrowError("f4 failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::F5) {
+    Nan::HandleScope scope;
+    const uint8_t* args[5];
+    if (!GetArgs(info, "usage: f5(w, n1, n2, a1, a2)", {SMP_DHKEY_SIZE, SMP_KEY_SIZE, SMP_KEY_SIZE, SMP_ADDRESS_SIZE, SMP_ADDRESS_SIZE}, args)) {
+        return;
+    }
+    uint8_t macKey[SMP_KEY_SIZE];
+    uint8_t ltk[SMP_KEY_SIZE];
+    if (!SmpCrypto::f5(args[0], args[1], args[2], args[3], args[4], macKey, ltk)) {
+        Nan::ThrowError("f5 failed");
+        return;
+    }
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("macKey").ToLocalChecked(), NewBuffer(macKey, sizeof(macKey)));
+    Nan::Set(object, Nan::New("ltk").ToLocalChecked(), NewBuffer(ltk, sizeof(ltk)));
+    info.GetReturnValue().Set(object);
+}
+
+NAN_METHOD(SmpCryptoBinding::F6) {
+    Nan::HandleScope scope;
+    const uint8_t* args[7];
+    if (!GetArgs(info, "usage: f6(w, n1, n2, r, ioCap, a1, a2)", {SMP_KEY_SIZE, SMP_KEY_SIZE, SMP_KEY_SIZE, SMP_KEY_SIZE, SMP_IOCAP_SIZE, SMP_ADDRESS_SIZE, SMP_ADDRESS_SIZE}, args)) {
+        return;
+    }
+    uint8_t out[SMP_KEY_SIZE];
+    if (!SmpCrypto::f6(args[0], args[1], args[2], args[3], args[4], args[5], args[6], out)) {
+        Nan::ThrowError("f6 failed");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
+
+NAN_METHOD(SmpCryptoBinding::G2) {
+    Nan::HandleScope scope;
+    const uint8_t* args[4];
+    if (!GetArgs(info, "usage: g2(u, v, x, y)", {SMP_DHKEY_SIZE, SMP_DHKEY_SIZE, SMP_KEY_SIZE, SMP_KEY_SIZE}, args)) {
+        return;
+    }
+    uint32_t value;
+    if (!SmpCrypto::g2(args[0], args[1], args[2], args[3], &value)) {
+        Nan::ThrowError("g2 failed");
+        return;
+    }
+    info.GetReturnValue().Set(Nan::New<Number>(value));
+}
+
+NAN_METHOD(SmpCryptoBinding::GenerateKeyPair) {
+    Nan::HandleScope scope;
+    uint8_t privateKey[SMP_PRIVATE_KEY_SIZE];
+    uint8_t publicKey[SMP_PUBLIC_KEY_SIZE];
+    if (!SmpCrypto::generateKeyPair(privateKey, publicKey)) {
+        Nan::ThrowError("P-256 key generation failed");
+        return;
+    }
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New("privateKey").ToLocalChecked(), NewBuffer(privateKey, sizeof(privateKey)));
+    Nan::Set(object, Nan::New("publicKey").ToLocalChecked(), NewBuffer(publicKey, sizeof(publicKey)));
+    info.GetReturnValue().Set(object);
+}
+
+NAN_METHOD(SmpCryptoBinding::DhKey) {
+    Nan::HandleScope scope;
+    const uint8_t* args[2];
+    if (!GetArgs(info, "usage: dhKey(privateKey, publicKey)", {SMP_PRIVATE_KEY_SIZE, SMP_PUBLIC_KEY_SIZE}, args)) {
+        return;
+    }
+    uint8_t out[SMP_DHKEY_SIZE];
+    if (!SmpCrypto::dhKey(args[0], args[1], out)) {
+        Nan::ThrowError("Invalid P-256 public key");
+        return;
+    }
+    info.GetReturnValue().Set(NewBuffer(out, sizeof(out)));
+}
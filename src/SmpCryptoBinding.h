@@ -0,0 +1,29 @@
+// SmpCryptoBinding.h
+
+#ifndef SMP_CRYPTO_BINDING_H
+#define SMP_CRYPTO_BINDING_H
+
+#include <nan.h>
+#include <node.h>
+
+#include "SmpCrypto.h"
+
+// SmpCrypto exported as plain functions, with the signatures of crypto.js
+class SmpCryptoBinding {
+   public:
+    static NAN_MODULE_INIT(Init);
+
+   private:
+    static NAN_METHOD(E);
+    static NAN_METHOD(C1);
+    static NAN_METHOD(S1);
+    static NAN_METHOD(AesCmac);
+    static NAN_METHOD(F4);
+    static NAN_METHOD(F5);
+    static NAN_METHOD(F6);
+    static NAN_METHOD(G2);
+    static NAN_METHOD(GenerateKeyPair);
+    static NAN_METHOD(DhKey);
+};
+
+#endif  // SMP_CRYPTO_BINDING_H
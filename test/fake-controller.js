@@ -0,0 +1,160 @@
+// fake-controller.js
+
+// Drives Central through the in-process fake controller: connection, a
+// notification split across ACL fragments and reassembled natively, and
+// connection parameters written to a debugfs stand-in directory.
+//
+// Usage: node test/fake-controller.js (npm test)
+
+const assert = require("node:assert");
+const { once } = require("node:events");
+const fs = require("node:fs");
+const os = require("node:os");
+const path = require("node:path");
+
+const Central = require("../central.js");
+
+const TEST_TIMEOUT = 5000;
+const PEER_ADDRESS = "c00000000002"; // Random static
+const PEER_ADDRESS_TYPE = 0x01; // Random
+const ATT_CID = 0x0004;
+const ATT_OP_HANDLE_NOTIFY = 0x1b;
+
+const CONN_PARAMS = {
+  conn_min_interval: 24,
+  conn_max_interval: 40,
+  conn_latency: 0,
+  supervision_timeout: 42,
+};
+
+// debugfs stand-in: <directory>/hci0/<parameter> holding the kernel defaults
+function makeDebugfs() {
+  const directory = fs.mkdtempSync(path.join(os.tmpdir(), "ble-hci-central-"));
+  fs.mkdirSync(path.join(directory, "hci0"));
+  for (const name in CONN_PARAMS) {
+    fs.writeFileSync(
+      path.join(directory, "hci0", name),
+      `${CONN_PARAMS[name]}\n`
+    );
+  }
+  return directory;
+}
+
+function readDebugfs(directory) {
+  const values = {};
+  for (const name in CONN_PARAMS) {
+    values[name] = parseInt(
+      fs.readFileSync(path.join(directory, "hci0", name), "utf8"),
+      10
+    );
+  }
+  return values;
+}
+
+// ACL fragment from the controller: pb 0x02 starts a PDU, 0x01 continues it
+function aclFragment(handle, pb, data) {
+  const packet = Buffer.alloc(5 + data.length);
+  packet.writeUInt8(0x02, 0); // HCI_ACLDATA_PKT
+  packet.writeUInt16LE(handle | (pb << 12), 1);
+  packet.writeUInt16LE(data.length, 3);
+  data.copy(packet, 5);
+  return packet;
+}
+
+function notificationPdu(handle, value) {
+  const pdu = Buffer.alloc(4 + 3 + value.length);
+  pdu.writeUInt16LE(3 + value.length, 0); // L2CAP length
+  pdu.writeUInt16LE(ATT_CID, 2);
+  pdu.writeUInt8(ATT_OP_HANDLE_NOTIFY, 4);
+  pdu.writeUInt16LE(handle, 5);
+  value.copy(pdu, 7);
+  return pdu;
+}
+
+function testConnectionParameters(central, debugfsPath) {
+  // Below the current max: min is written first
+  central.setConnectionParameters(6, 12, 0, 100);
+  assert.deepStrictEqual(readDebugfs(debugfsPath), {
+    conn_min_interval: 6,
+    conn_max_interval: 12,
+    conn_latency: 0,
+    supervision_timeout: 100,
+  });
+
+  // Above the current max: max first, the kernel refuses min > max
+  central.setConnectionParameters(80, 100, 4, 400);
+  assert.deepStrictEqual(readDebugfs(debugfsPath), {
+    conn_min_interval: 80,
+    conn_max_interval: 100,
+    conn_latency: 4,
+    supervision_timeout: 400,
+  });
+}
+
+async function testConnect(central) {
+  const connection = await central.connectAsync(
+    PEER_ADDRESS_TYPE,
+    PEER_ADDRESS
+  );
+  assert.strictEqual(connection.status, 0);
+  assert.strictEqual(connection.address, PEER_ADDRESS);
+  assert.strictEqual(central.connectionCount(), 1);
+  return connection.handle;
+}
+
+async function testNotification(central, connectionHandle) {
+  const value = Buffer.from("0123456789abcdef0123456789abcdef", "hex");
+  const pdu = notificationPdu(0x0010, value);
+  const notification = once(central, "notification");
+  central.inject(aclFragment(connectionHandle, 0x02, pdu.subarray(0, 9)));
+  central.inject(aclFragment(connectionHandle, 0x01, pdu.subarray(9)));
+  const [address, handle, data] = await notification;
+  assert.strictEqual(address, PEER_ADDRESS);
+  assert.strictEqual(handle, 0x0010);
+  assert.deepStrictEqual(data, value);
+}
+
+async function testDisconnect(central) {
+  const { address } = await central.disconnectAsync(PEER_ADDRESS);
+  assert.strictEqual(address, PEER_ADDRESS);
+  assert.strictEqual(central.connectionCount(), 0);
+}
+
+async function main() {
+  const debugfsPath = makeDebugfs();
+  const central = new Central({
+    transport: "fake",
+    fake: { advertisers: 0 },
+    debugfsPath,
+    aclReassembly: 512,
+  });
+  const timer = setTimeout(() => {
+    throw new Error("timed out");
+  }, TEST_TIMEOUT);
+  try {
+    const ready = once(central, "address");
+    central.start();
+    await ready;
+
+    testConnectionParameters(central, debugfsPath);
+    console.log("ok - connection parameters");
+    const handle = await testConnect(central);
+    console.log("ok - connect");
+    await testNotification(central, handle);
+    console.log("ok - notification reassembly");
+    await testDisconnect(central);
+    console.log("ok - disconnect");
+  } finally {
+    clearTimeout(timer);
+    central.stop();
+    fs.rmSync(debugfsPath, { recursive: true, force: true });
+  }
+}
+
+main().then(
+  () => process.exit(0),
+  (error) => {
+    console.error(error);
+    process.exit(1);
+  }
+);
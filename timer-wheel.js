@@ -0,0 +1,85 @@
+// timer-wheel.js
+
+const debug = require("debug")("ble-hci-central:timer-wheel");
+
+const { performance } = require("node:perf_hooks");
+
+// Hashed timer wheel: timers are hashed into slots by expiry tick and a single
+// interval, running only while timers are armed, advances the wheel. Arming
+// and cancelling are O(1) whatever the number of timers, expiry is rounded up
+// to the next tick. Timers further than one round of the wheel away stay in
+// their slot until their round comes.
+class TimerWheel {
+  constructor(tick, slots) {
+    this._tick = tick; // msec
+    this._mask = slots - 1; // slots must be a power of 2
+    this._slots = Array.from({ length: slots }, () => new Set());
+    this._current = 0; // Ticks elapsed since start
+    this._start = 0; // performance.now() at tick 0
+    this._count = 0;
+    this._interval = undefined;
+  }
+
+  // Returns a timer calling callback after delay msec, unless cancelled
+  schedule(callback, delay) {
+    if (this._interval === undefined) {
+      // Tick count resumes from where the wheel stopped
+      this._start = performance.now() - this._current * this._tick;
+      this._interval = setInterval(this._advance, this._tick);
+    }
+    const ticks = Math.max(1, Math.ceil(delay / this._tick));
+    const timer = { callback, expiry: this._current + ticks };
+    timer.slot = this._slots[timer.expiry & this._mask];
+    timer.slot.add(timer);
+    this._count++;
+    return timer;
+  }
+
+  cancel(timer) {
+    if (!timer.slot?.delete(timer)) return;
+    timer.slot = undefined;
+    this._count--;
+    if (this._count === 0) this._stop();
+  }
+
+  get size() {
+    return this._count;
+  }
+
+  _stop() {
+    clearInterval(this._interval);
+    this._interval = undefined;
+  }
+
+  _advance = () => {
+    // Catch up on the ticks a busy event loop delayed
+    const now = Math.floor((performance.now() - this._start) / this._tick);
+    let failure;
+    while (this._current < now && this._count > 0) {
+      this._current++;
+      const slot = this._slots[this._current & this._mask];
+      for (const timer of slot) {
+        if (timer.expiry > this._current) continue; // Later round
+        slot.delete(timer);
+        timer.slot = undefined;
+        this._count--;
+        try {
+          timer.callback();
+        } catch (error) {
+          debug("TimerWheel._advance: error %o", error);
+          if (failure === undefined) failure = { error };
+        }
+      }
+    }
+    if (this._count === 0) this._stop();
+    // The other timers due have run: the first error thrown by a callback
+    // surfaces as an uncaught exception, as it would from setTimeout()
+    if (failure !== undefined) {
+      process.nextTick(() => {
+        throw failure.error;
+      });
+    }
+  };
+}
+
+module.exports = TimerWheel;